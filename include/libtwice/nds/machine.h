@@ -13,6 +13,19 @@ namespace twice {
 
 struct nds_ctx;
 
+/**
+ * The policies for how long the ARM9 and ARM7 run before they are
+ * synchronized.
+ */
+enum class nds_timeslice_policy {
+	/* always use the shortest timeslice */
+	FIXED,
+	/* use longer timeslices while the CPUs are not communicating */
+	ADAPTIVE,
+	/* always use the longest timeslice */
+	MAX,
+};
+
 /**
  * The configuration to use when creating the NDS machine.
  */
@@ -24,6 +37,15 @@ struct nds_config {
 	std::filesystem::path image_path;
 	bool use_16_bit_audio{};
 	bool interpolate_audio{};
+	bool use_cached_interpreter{};
+	bool use_jit{};
+	bool skip_idle_loops{};
+	nds_timeslice_policy timeslice_policy{ nds_timeslice_policy::FIXED };
+	bool use_fastmem{};
+	int render_threads{};
+	bool async_render{};
+	bool threaded_geometry{};
+	bool threaded_2d{};
 };
 
 /**
@@ -227,6 +249,34 @@ struct nds_exec {
 	 * The emulated ARM9 / ARM7 DMA usage as a fraction from [0..1].
 	 */
 	std::pair<double, double> dma_usage{};
+
+	/**
+	 * The number of timeslices the CPUs were run for.
+	 */
+	u64 timeslices{};
+
+	/**
+	 * The number of 3D frames that were swapped to the renderer.
+	 */
+	u64 frames_3d{};
+
+	/**
+	 * The number of swapped 3D frames that kept the last rendered
+	 * frame, because their scene had not changed.
+	 */
+	u64 frames_3d_reused{};
+
+	/**
+	 * The number of lines started by the 2D engines, counting each
+	 * engine separately.
+	 */
+	u64 lines_2d{};
+
+	/**
+	 * The number of started 2D lines that kept the output of the last
+	 * frame, because nothing they are drawn from had changed.
+	 */
+	u64 lines_2d_reused{};
 };
 
 /**
@@ -533,6 +583,113 @@ struct nds_machine {
 	 */
 	void set_interpolate_audio(bool interpolate_audio);
 
+	/**
+	 * Set whether to use the cached interpreter.
+	 *
+	 * The cached interpreter decodes guest code into blocks once and
+	 * executes the decoded blocks, instead of decoding every
+	 * instruction as it is executed.
+	 *
+	 * \param use_cached_interpreter true to use the cached interpreter
+	 *                               false otherwise
+	 */
+	void set_use_cached_interpreter(bool use_cached_interpreter);
+
+	/**
+	 * Set whether to use the JIT.
+	 *
+	 * The JIT compiles the blocks of the cached interpreter to native
+	 * code. Instructions it cannot compile are run by the interpreter
+	 * from the native code. Only supported on Linux x86-64, elsewhere
+	 * the cached interpreter is used instead.
+	 *
+	 * \param use_jit true to use the JIT
+	 *                false otherwise
+	 */
+	void set_use_jit(bool use_jit);
+
+	/**
+	 * Set whether to skip idle loops.
+	 *
+	 * A cpu that is polling memory in a loop without side effects is
+	 * treated as halted until the next event, or until the memory can
+	 * have been changed by the other cpu. Only has an effect when the
+	 * cached interpreter is used.
+	 *
+	 * \param skip_idle_loops true to skip idle loops
+	 *                        false otherwise
+	 */
+	void set_skip_idle_loops(bool skip_idle_loops);
+
+	/**
+	 * Set the timeslice policy.
+	 *
+	 * Longer timeslices have less overhead, but the CPUs see each
+	 * other's writes later.
+	 *
+	 * \param policy the timeslice policy
+	 */
+	void set_timeslice_policy(nds_timeslice_policy policy);
+
+	/**
+	 * Set whether to use fastmem.
+	 *
+	 * Fastmem maps the guest address spaces into host memory, so that
+	 * most loads and stores do not have to look up the page tables.
+	 * Only supported on Linux, and takes effect the next time the
+	 * machine is booted.
+	 *
+	 * \param use_fastmem true to use fastmem
+	 *                    false otherwise
+	 */
+	void set_use_fastmem(bool use_fastmem);
+
+	/**
+	 * Set the number of threads used by the 3D renderer.
+	 *
+	 * The scanlines of a frame are split between the threads. The
+	 * rendered frames are the same for any number of threads.
+	 *
+	 * \param render_threads the number of threads, 0 or 1 to render
+	 *                       on one thread
+	 */
+	void set_render_threads(int render_threads);
+
+	/**
+	 * Set whether to render 3D frames in the background.
+	 *
+	 * A frame is rendered on its own thread while the emulator keeps
+	 * running, and is waited for when the 2D engine first reads it.
+	 *
+	 * \param async_render true to render in the background
+	 *                     false otherwise
+	 */
+	void set_async_render(bool async_render);
+
+	/**
+	 * Set whether to run 3D geometry commands on their own thread.
+	 *
+	 * Commands are executed in the background, and the emulator only
+	 * waits for them when it reads the results of the geometry engine.
+	 *
+	 * \param threaded_geometry true to use a geometry thread
+	 *                          false otherwise
+	 */
+	void set_threaded_geometry(bool threaded_geometry);
+
+	/**
+	 * Set whether to draw the 2D engines on their own threads.
+	 *
+	 * The registers of each line are saved as the line starts, and the
+	 * lines are drawn in batches while the emulator keeps running. The
+	 * emulator waits for them before VRAM, palette or OAM change, and
+	 * at VBLANK.
+	 *
+	 * \param threaded_2d true to draw on other threads
+	 *                    false otherwise
+	 */
+	void set_threaded_2d(bool threaded_2d);
+
 	/**
 	 * Dump the collected profiler data.
 	 */
@@ -0,0 +1,22 @@
+#include "common/cpu.h"
+
+namespace twice {
+
+#ifdef TWICE_HAVE_AVX2
+bool use_avx2 = cpu_has_avx2();
+
+bool
+cpu_has_avx2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+void
+set_use_avx2(bool enabled)
+{
+	use_avx2 = enabled && cpu_has_avx2();
+}
+#endif
+
+} // namespace twice
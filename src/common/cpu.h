@@ -0,0 +1,27 @@
+#ifndef TWICE_CPU_H
+#define TWICE_CPU_H
+
+#include "common/types.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  define TWICE_HAVE_AVX2
+#  include <immintrin.h>
+#endif
+
+namespace twice {
+
+#ifdef TWICE_HAVE_AVX2
+/*
+ * Code using avx2 is built with [[gnu::target("avx2")]] and only called when
+ * use_avx2 is true. It starts out as cpu_has_avx2(), and set_use_avx2 can
+ * turn it off to run the scalar code instead.
+ */
+extern bool use_avx2;
+
+bool cpu_has_avx2();
+void set_use_avx2(bool enabled);
+#endif
+
+} // namespace twice
+
+#endif
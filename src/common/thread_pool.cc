@@ -0,0 +1,120 @@
+#include "common/thread_pool.h"
+
+namespace twice {
+
+static void worker_main(thread_pool *pool);
+static bool run_next_task(
+		thread_pool *pool, std::unique_lock<std::mutex>& lock);
+
+thread_pool::~thread_pool()
+{
+	thread_pool_resize(this, 0);
+}
+
+void
+thread_pool_resize(thread_pool *pool, int num_threads)
+{
+	if (pool->threads.size() == (size_t)num_threads) {
+		return;
+	}
+
+	{
+		std::lock_guard lock(pool->mtx);
+		pool->quit = true;
+	}
+	pool->start_cv.notify_all();
+
+	for (auto& t : pool->threads) {
+		t.join();
+	}
+	pool->threads.clear();
+	pool->quit = false;
+
+	for (int i = 0; i < num_threads; i++) {
+		pool->threads.emplace_back(worker_main, pool);
+	}
+}
+
+/*
+ * Runs fn(data, i) for every i in [0, num_tasks) and returns when all of
+ * them have finished. Tasks may wait for each other, as long as there are
+ * no more tasks than threads that can run them.
+ */
+void
+thread_pool_run(thread_pool *pool, int num_tasks, thread_pool::task_fn fn,
+		void *data)
+{
+	thread_pool_start(pool, num_tasks, fn, data);
+	thread_pool_wait(pool);
+}
+
+/*
+ * Hands the tasks to the workers and returns without waiting for them.
+ * Every call must be followed by thread_pool_wait before the next job.
+ */
+void
+thread_pool_start(thread_pool *pool, int num_tasks, thread_pool::task_fn fn,
+		void *data)
+{
+	std::unique_lock lock(pool->mtx);
+	pool->fn = fn;
+	pool->data = data;
+	pool->num_tasks = num_tasks;
+	pool->next_task = 0;
+	pool->tasks_left = num_tasks;
+	lock.unlock();
+	pool->start_cv.notify_all();
+}
+
+/*
+ * Runs the tasks that no worker has picked up yet and returns when all
+ * tasks of the current job have finished.
+ */
+void
+thread_pool_wait(thread_pool *pool)
+{
+	std::unique_lock lock(pool->mtx);
+	while (run_next_task(pool, lock))
+		;
+
+	pool->done_cv.wait(lock, [=] { return pool->tasks_left == 0; });
+}
+
+static void
+worker_main(thread_pool *pool)
+{
+	std::unique_lock lock(pool->mtx);
+
+	while (true) {
+		pool->start_cv.wait(lock, [=] {
+			return pool->quit || pool->next_task < pool->num_tasks;
+		});
+
+		if (pool->quit) {
+			return;
+		}
+
+		run_next_task(pool, lock);
+	}
+}
+
+static bool
+run_next_task(thread_pool *pool, std::unique_lock<std::mutex>& lock)
+{
+	if (pool->next_task == pool->num_tasks) {
+		return false;
+	}
+
+	int task = pool->next_task++;
+	lock.unlock();
+	pool->fn(pool->data, task);
+	lock.lock();
+
+	if (--pool->tasks_left == 0) {
+		pool->done_cv.notify_all();
+	}
+
+	return true;
+}
+
+} // namespace twice
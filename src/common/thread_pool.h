@@ -0,0 +1,45 @@
+#ifndef TWICE_THREAD_POOL_H
+#define TWICE_THREAD_POOL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common/types.h"
+
+namespace twice {
+
+/*
+ * A set of worker threads that run the tasks of one job at a time. The
+ * thread that runs a job also works on its tasks, so a pool with n threads
+ * runs up to n + 1 tasks in parallel.
+ */
+struct thread_pool {
+	typedef void (*task_fn)(void *data, int task);
+
+	std::vector<std::thread> threads;
+	std::mutex mtx;
+	std::condition_variable start_cv;
+	std::condition_variable done_cv;
+
+	task_fn fn{};
+	void *data{};
+	int num_tasks{};
+	int next_task{};
+	int tasks_left{};
+	bool quit{};
+
+	~thread_pool();
+};
+
+void thread_pool_resize(thread_pool *pool, int num_threads);
+void thread_pool_run(thread_pool *pool, int num_tasks,
+		thread_pool::task_fn fn, void *data);
+void thread_pool_start(thread_pool *pool, int num_tasks,
+		thread_pool::task_fn fn, void *data);
+void thread_pool_wait(thread_pool *pool);
+
+} // namespace twice
+
+#endif
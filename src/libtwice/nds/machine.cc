@@ -738,6 +738,71 @@ nds_machine::set_interpolate_audio(bool interpolate_audio)
 	m->cfg.interpolate_audio = interpolate_audio;
 }
 
+void
+nds_machine::set_use_cached_interpreter(bool use_cached_interpreter)
+{
+	m->cfg.use_cached_interpreter = use_cached_interpreter;
+
+	/* fastmem stores are only used while no pages are tracked */
+	if (!use_cached_interpreter && !m->cfg.use_jit && m->curr.nds) {
+		invalidate_all_blocks(m->curr.nds.get(), 0);
+		invalidate_all_blocks(m->curr.nds.get(), 1);
+	}
+}
+
+void
+nds_machine::set_use_jit(bool use_jit)
+{
+	m->cfg.use_jit = use_jit;
+
+	if (!use_jit && !m->cfg.use_cached_interpreter && m->curr.nds) {
+		invalidate_all_blocks(m->curr.nds.get(), 0);
+		invalidate_all_blocks(m->curr.nds.get(), 1);
+	}
+}
+
+void
+nds_machine::set_skip_idle_loops(bool skip_idle_loops)
+{
+	m->cfg.skip_idle_loops = skip_idle_loops;
+}
+
+void
+nds_machine::set_timeslice_policy(nds_timeslice_policy policy)
+{
+	m->cfg.timeslice_policy = policy;
+}
+
+void
+nds_machine::set_use_fastmem(bool use_fastmem)
+{
+	m->cfg.use_fastmem = use_fastmem;
+}
+
+void
+nds_machine::set_render_threads(int render_threads)
+{
+	m->cfg.render_threads = render_threads;
+}
+
+void
+nds_machine::set_async_render(bool async_render)
+{
+	m->cfg.async_render = async_render;
+}
+
+void
+nds_machine::set_threaded_geometry(bool threaded_geometry)
+{
+	m->cfg.threaded_geometry = threaded_geometry;
+}
+
+void
+nds_machine::set_threaded_2d(bool threaded_2d)
+{
+	m->cfg.threaded_2d = threaded_2d;
+}
+
 void
 nds_machine::dump_profiler_report()
 {
@@ -30,8 +30,6 @@ const u16 arm_cond_table[16] = {
 
 static void swap_registers(arm_cpu *cpu, u32 old_mode, u32 new_mode);
 
-arm_cpu::~arm_cpu() = default;
-
 void
 arm_init(nds_ctx *nds, int cpuid)
 {
@@ -40,6 +38,21 @@ arm_init(nds_ctx *nds, int cpuid)
 	cpu->cpuid = cpuid;
 	cpu->cycles = &nds->arm_cycles[cpuid];
 	cpu->target_cycles = &nds->arm_target_cycles[cpuid];
+	arm_update_memory_ops(nds, cpuid);
+}
+
+void
+arm_update_memory_ops(nds_ctx *nds, int cpuid)
+{
+	if (cpuid == 0) {
+		auto *cpu = nds->arm9.get();
+		cpu->mem = cpu->fastmem.base ? &arm9_fastmem_ops
+		                             : &arm9_page_table_ops;
+	} else {
+		auto *cpu = nds->arm7.get();
+		cpu->mem = cpu->fastmem.base ? &arm7_fastmem_ops
+		                             : &arm7_page_table_ops;
+	}
 }
 
 void
@@ -62,6 +75,8 @@ arm_check_interrupt(arm_cpu *cpu)
 void
 arm_on_cpsr_write(arm_cpu *cpu)
 {
+	arm_set_flags(cpu, cpu->cpsr);
+
 	u32 new_mode;
 	switch (cpu->cpsr & 0x1F) {
 	case 0x1F:
@@ -93,22 +108,6 @@ arm_on_cpsr_write(arm_cpu *cpu)
 	arm_check_interrupt(cpu);
 }
 
-void
-arm_do_irq(arm_cpu *cpu)
-{
-	u32 old_cpsr = cpu->cpsr;
-	u32 ret_addr = cpu->pc() - (cpu->cpsr & 0x20 ? 2 : 4) + 4;
-
-	cpu->cpsr &= ~0xBF;
-	cpu->cpsr |= 0x92;
-	arm_switch_mode(cpu, arm_cpu::MODE_IRQ);
-	cpu->interrupt = false;
-
-	cpu->gpr[14] = ret_addr;
-	cpu->spsr() = old_cpsr;
-	cpu->arm_jump(cpu->exception_base + 0x18);
-}
-
 void
 halt_cpu(arm_cpu *cpu, u32 halt_bits)
 {
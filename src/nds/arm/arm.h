@@ -1,6 +1,8 @@
 #ifndef TWICE_ARM_H
 #define TWICE_ARM_H
 
+#include "nds/mem/fastmem.h"
+
 #include "common/types.h"
 #include "common/util.h"
 
@@ -8,9 +10,29 @@ namespace twice {
 
 struct nds_ctx;
 
-struct arm_cpu {
-	virtual ~arm_cpu();
+/*
+ * The single loads and stores of a cpu. One set goes through fastmem and
+ * one only through the page tables, and the set is chosen when fastmem is
+ * enabled or disabled, so the page table path has no fastmem checks.
+ */
+template <typename CPUT>
+struct arm_memory_ops {
+	u32 (*load32n)(CPUT *cpu, u32 addr);
+	u32 (*load32s)(CPUT *cpu, u32 addr);
+	u16 (*load16n)(CPUT *cpu, u32 addr);
+	u8 (*load8n)(CPUT *cpu, u32 addr);
+	void (*store32n)(CPUT *cpu, u32 addr, u32 value);
+	void (*store32s)(CPUT *cpu, u32 addr, u32 value);
+	void (*store16n)(CPUT *cpu, u32 addr, u16 value);
+	void (*store8n)(CPUT *cpu, u32 addr, u8 value);
+};
 
+/*
+ * State shared by both cpus. Memory accesses and the pipeline are
+ * implemented by arm9_cpu and arm7_cpu, and code that uses them is
+ * templated on the cpu type so that there are no virtual calls.
+ */
+struct arm_cpu {
 	enum cpu_mode {
 		MODE_SYS,
 		MODE_FIQ,
@@ -31,6 +53,16 @@ struct arm_cpu {
 	u32 bankedr[6][3]{};
 	u32 fiqr[5]{};
 	u32 cpsr{ 0x9F };
+	/*
+	 * The condition flags are kept outside of cpsr, so that setting them
+	 * does not have to read and repack cpsr. N is bit 31 of flag_n and Z
+	 * is set if flag_z is 0. The flag bits of cpsr itself are stale, so
+	 * use arm_get_cpsr to read the whole register.
+	 */
+	u32 flag_n{};
+	u32 flag_z{ 1 };
+	bool flag_c{};
+	bool flag_v{};
 	u32 opcode;
 	u32 pipeline[2]{};
 	u32 exception_base{};
@@ -41,6 +73,8 @@ struct arm_cpu {
 	u32 IE{};
 	bool interrupt{};
 	u32 halted{};
+	/* set if the cpu was halted or spun in an idle loop in its last run */
+	bool idling{};
 
 	nds_ctx *nds{};
 	int cpuid{};
@@ -51,6 +85,8 @@ struct arm_cpu {
 	u8 code_cycles{};
 	u8 data_cycles{};
 
+	fastmem_region fastmem;
+
 	u32& pc() { return gpr[15]; }
 
 	u32& spsr() { return bankedr[0][2]; }
@@ -63,47 +99,74 @@ struct arm_cpu {
 		*cycles += x;
 		cycles_executed += x;
 	}
-
-	virtual void add_ldr_cycles() = 0;
-	virtual void add_str_cycles(u32 extra = 0) = 0;
-	virtual void run() = 0;
-	virtual void step() = 0;
-	virtual void arm_jump(u32 addr) = 0;
-	virtual void thumb_jump(u32 addr) = 0;
-	virtual void jump_cpsr(u32 addr) = 0;
-	virtual u32 load32n(u32 addr) = 0;
-	virtual u32 load32s(u32 addr) = 0;
-	virtual u16 load16n(u32 addr) = 0;
-	virtual u8 load8n(u32 addr) = 0;
-	virtual void store32n(u32 addr, u32 value) = 0;
-	virtual void store32s(u32 addr, u32 value) = 0;
-	virtual void store16n(u32 addr, u16 value) = 0;
-	virtual void store8n(u32 addr, u8 value) = 0;
-	virtual void load_multiple(u32 addr, int count, u32 *values) = 0;
-	virtual void store_multiple(u32 addr, int count, u32 *values) = 0;
-	virtual u16 ldrh(u32 addr) = 0;
-	virtual s16 ldrsh(u32 addr) = 0;
-	virtual void ldm(u32 addr, u16 register_list, int count) = 0;
-	virtual void ldm_user(u32 addr, u16 register_list, int count) = 0;
-	virtual void ldm_cpsr(u32 addr, u16 register_list, int count) = 0;
-	virtual void stm(u32 addr, u16 register_list, int count) = 0;
-	virtual void stm_user(u32 addr, u16 register_list, int count) = 0;
-	virtual void thumb_ldm(u32 addr, u16 register_list, int count) = 0;
-	virtual void thumb_stm(u32 addr, u16 register_list, int count) = 0;
-	virtual bool check_halted() = 0;
 };
 
 void arm_init(nds_ctx *nds, int cpuid);
+void arm_update_memory_ops(nds_ctx *nds, int cpuid);
 void arm_switch_mode(arm_cpu *cpu, u32 new_mode);
 void arm_check_interrupt(arm_cpu *cpu);
 void arm_on_cpsr_write(arm_cpu *cpu);
-void arm_do_irq(arm_cpu *cpu);
 void halt_cpu(arm_cpu *cpu, u32 halt_bits);
 void unhalt_cpu(arm_cpu *cpu, u32 halt_bits);
 void request_interrupt(arm_cpu *cpu, int bit);
 
 extern const u16 arm_cond_table[16];
 
+inline u32
+arm_get_flags(arm_cpu *cpu)
+{
+	return (cpu->flag_n & 0x80000000) | (u32)(cpu->flag_z == 0) << 30 |
+	       (u32)cpu->flag_c << 29 | (u32)cpu->flag_v << 28;
+}
+
+inline u32
+arm_get_cpsr(arm_cpu *cpu)
+{
+	return (cpu->cpsr & ~0xF0000000) | arm_get_flags(cpu);
+}
+
+inline bool
+arm_check_cond(arm_cpu *cpu, u32 cond)
+{
+	/* the common conditions do not need the flags packed */
+	switch (cond) {
+	case 0x0:
+		return cpu->flag_z == 0;
+	case 0x1:
+		return cpu->flag_z != 0;
+	case 0xE:
+		return true;
+	default:
+		return arm_cond_table[cond] & BIT(arm_get_flags(cpu) >> 28);
+	}
+}
+
+inline void
+arm_set_flags(arm_cpu *cpu, u32 value)
+{
+	cpu->flag_n = value;
+	cpu->flag_z = ~value & BIT(30);
+	cpu->flag_c = value & BIT(29);
+	cpu->flag_v = value & BIT(28);
+}
+
+template <typename CPUT>
+void
+arm_do_irq(CPUT *cpu)
+{
+	u32 old_cpsr = arm_get_cpsr(cpu);
+	u32 ret_addr = cpu->pc() - (cpu->cpsr & 0x20 ? 2 : 4) + 4;
+
+	cpu->cpsr &= ~0xBF;
+	cpu->cpsr |= 0x92;
+	arm_switch_mode(cpu, arm_cpu::MODE_IRQ);
+	cpu->interrupt = false;
+
+	cpu->gpr[14] = ret_addr;
+	cpu->spsr() = old_cpsr;
+	cpu->arm_jump(cpu->exception_base + 0x18);
+}
+
 } // namespace twice
 
 #endif
@@ -14,11 +14,16 @@ const auto thumb7_inst_lut = arm::interpreter::gen::gen_array<
 		void (*)(arm7_cpu *), 1024>(
 		arm::interpreter::gen::gen_thumb_lut<arm7_cpu>);
 
+static void run_blocks(arm7_cpu *cpu);
+static bool is_idle_loop_iteration(arm7_cpu *cpu,
+		arm_block<arm7_cpu> *block, const u32 *gpr, u32 cpsr);
+
 void
 arm7_cpu::run()
 {
 	if (halted) {
 		*cycles = *target_cycles;
+		idling = true;
 		return;
 	}
 
@@ -26,6 +31,13 @@ arm7_cpu::run()
 		arm_do_irq(this);
 	}
 
+	idling = false;
+
+	if (nds->config->use_cached_interpreter || nds->config->use_jit) {
+		run_blocks(this);
+		return;
+	}
+
 	while (*cycles < *target_cycles) {
 		step();
 	}
@@ -47,8 +59,7 @@ arm7_cpu::step()
 		code_cycles = fetch32s(pc(), &pipeline[1]);
 
 		u32 cond = opcode >> 28;
-		if (cond == 0xE ||
-				arm_cond_table[cond] & (1 << (cpsr >> 28))) {
+		if (arm_check_cond(this, cond)) {
 			u32 op1 = opcode >> 20 & 0xFF;
 			u32 op2 = opcode >> 4 & 0xF;
 			arm7_inst_lut[op1 << 4 | op2](this);
@@ -105,10 +116,29 @@ fetch(arm7_cpu *cpu, u32 addr, u32 *result)
 	return cpu->code_tt[addr >> BUS_TIMING_SHIFT][Idx];
 }
 
-template <typename T>
+/*
+ * Main ram is where the cpus usually exchange data, so accesses to it from
+ * the arm7 keep the timeslices short.
+ */
+static void
+check_main_ram_access(arm7_cpu *cpu, u32 addr)
+{
+	if (addr >> 24 == 0x02) {
+		cpu->nds->sc.ipc_activity = true;
+	}
+}
+
+template <typename T, bool Fastmem>
 static T
 load(arm7_cpu *cpu, u32 addr)
 {
+	check_main_ram_access(cpu, addr);
+
+	T value;
+	if (Fastmem && fastmem_read(&cpu->fastmem, addr, &value)) {
+		return value;
+	}
+
 	u8 *p = cpu->read_pt[addr >> BUS7_PAGE_SHIFT];
 	if (p) {
 		return readarr<T>(p, addr & BUS7_PAGE_MASK);
@@ -117,13 +147,23 @@ load(arm7_cpu *cpu, u32 addr)
 	return bus7_read_slow<T>(cpu->nds, addr);
 }
 
-template <typename T>
+template <typename T, bool Fastmem>
 static void
 store(arm7_cpu *cpu, u32 addr, T value)
 {
+	check_main_ram_access(cpu, addr);
+
+	/* fastmem stores bypass the page tracker */
+	if (Fastmem && !cpu->nds->tracker.active &&
+			fastmem_write(&cpu->fastmem, addr, value)) {
+		return;
+	}
+
 	u8 *p = cpu->write_pt[addr >> BUS7_PAGE_SHIFT];
 	if (p) {
 		writearr<T>(p, addr & BUS7_PAGE_MASK, value);
+		track_page_write<BUS7_PAGE_SHIFT>(
+				&cpu->nds->tracker, cpu->tracked_pt, addr);
 		return;
 	}
 
@@ -136,9 +176,9 @@ load_multiple_from_page(
 {
 	u8 *p = cpu->read_pt[page];
 	if (p) {
-		for (; count--; addr += 4) {
-			*values++ = readarr<u32>(p, addr & BUS7_PAGE_MASK);
-		}
+		/* the range is contiguous in host memory */
+		std::memcpy(values, p + (addr & BUS7_PAGE_MASK), 4 * count);
+		values += count;
 	} else {
 		for (; count--; addr += 4) {
 			*values++ = bus7_read_slow<u32>(cpu->nds, addr);
@@ -154,9 +194,15 @@ store_multiple_to_page(
 {
 	u8 *p = cpu->write_pt[page];
 	if (p) {
-		for (; count--; addr += 4) {
-			writearr<u32>(p, addr & BUS7_PAGE_MASK, *values++);
-		}
+		std::memcpy(p + (addr & BUS7_PAGE_MASK), values, 4 * count);
+		values += count;
+
+		/* the stored range may span two code pages */
+		u32 last = addr + 4 * (count - 1);
+		track_page_write<BUS7_PAGE_SHIFT>(
+				&cpu->nds->tracker, cpu->tracked_pt, addr);
+		track_page_write<BUS7_PAGE_SHIFT>(
+				&cpu->nds->tracker, cpu->tracked_pt, last);
 	} else {
 		for (; count--; addr += 4) {
 			bus7_write_slow<u32>(cpu->nds, addr, *values++);
@@ -174,6 +220,8 @@ load_store_multiple(arm7_cpu *cpu, u32 addr, int count, u32 *values)
 		return 0;
 	}
 
+	check_main_ram_access(cpu, addr);
+
 	u32 start_page = addr >> BUS7_PAGE_SHIFT;
 	u32 end_page = (addr + 4 * (count - 1)) >> BUS7_PAGE_SHIFT;
 
@@ -235,61 +283,91 @@ arm7_cpu::fetch16s(u32 addr, u32 *result)
 	return fetch<u16, 3>(this, addr, result);
 }
 
-u32
-arm7_cpu::load32n(u32 addr)
+template <bool Fastmem>
+static u32
+load32n(arm7_cpu *cpu, u32 addr)
 {
-	data_cycles = data_tt[addr >> BUS_TIMING_SHIFT][0];
-	return load<u32>(this, addr);
+	cpu->data_cycles = cpu->data_tt[addr >> BUS_TIMING_SHIFT][0];
+	return load<u32, Fastmem>(cpu, addr);
 }
 
-u32
-arm7_cpu::load32s(u32 addr)
+template <bool Fastmem>
+static u32
+load32s(arm7_cpu *cpu, u32 addr)
 {
-	data_cycles += data_tt[addr >> BUS_TIMING_SHIFT][1];
-	return load<u32>(this, addr);
+	cpu->data_cycles += cpu->data_tt[addr >> BUS_TIMING_SHIFT][1];
+	return load<u32, Fastmem>(cpu, addr);
 }
 
-u16
-arm7_cpu::load16n(u32 addr)
+template <bool Fastmem>
+static u16
+load16n(arm7_cpu *cpu, u32 addr)
 {
-	data_cycles = data_tt[addr >> BUS_TIMING_SHIFT][2];
-	return load<u16>(this, addr);
+	cpu->data_cycles = cpu->data_tt[addr >> BUS_TIMING_SHIFT][2];
+	return load<u16, Fastmem>(cpu, addr);
 }
 
-u8
-arm7_cpu::load8n(u32 addr)
+template <bool Fastmem>
+static u8
+load8n(arm7_cpu *cpu, u32 addr)
 {
-	data_cycles = data_tt[addr >> BUS_TIMING_SHIFT][2];
-	return load<u8>(this, addr);
+	cpu->data_cycles = cpu->data_tt[addr >> BUS_TIMING_SHIFT][2];
+	return load<u8, Fastmem>(cpu, addr);
 }
 
-void
-arm7_cpu::store32n(u32 addr, u32 value)
+template <bool Fastmem>
+static void
+store32n(arm7_cpu *cpu, u32 addr, u32 value)
 {
-	data_cycles = data_tt[addr >> BUS_TIMING_SHIFT][0];
-	store<u32>(this, addr, value);
+	cpu->data_cycles = cpu->data_tt[addr >> BUS_TIMING_SHIFT][0];
+	store<u32, Fastmem>(cpu, addr, value);
 }
 
-void
-arm7_cpu::store32s(u32 addr, u32 value)
+template <bool Fastmem>
+static void
+store32s(arm7_cpu *cpu, u32 addr, u32 value)
 {
-	data_cycles += data_tt[addr >> BUS_TIMING_SHIFT][1];
-	store<u32>(this, addr, value);
+	cpu->data_cycles += cpu->data_tt[addr >> BUS_TIMING_SHIFT][1];
+	store<u32, Fastmem>(cpu, addr, value);
 }
 
-void
-arm7_cpu::store16n(u32 addr, u16 value)
+template <bool Fastmem>
+static void
+store16n(arm7_cpu *cpu, u32 addr, u16 value)
 {
-	data_cycles = data_tt[addr >> BUS_TIMING_SHIFT][2];
-	store<u16>(this, addr, value);
+	cpu->data_cycles = cpu->data_tt[addr >> BUS_TIMING_SHIFT][2];
+	store<u16, Fastmem>(cpu, addr, value);
 }
 
-void
-arm7_cpu::store8n(u32 addr, u8 value)
-{
-	data_cycles = data_tt[addr >> BUS_TIMING_SHIFT][2];
-	store<u8>(this, addr, value);
-}
+template <bool Fastmem>
+static void
+store8n(arm7_cpu *cpu, u32 addr, u8 value)
+{
+	cpu->data_cycles = cpu->data_tt[addr >> BUS_TIMING_SHIFT][2];
+	store<u8, Fastmem>(cpu, addr, value);
+}
+
+const arm_memory_ops<arm7_cpu> arm7_page_table_ops = {
+	load32n<false>,
+	load32s<false>,
+	load16n<false>,
+	load8n<false>,
+	store32n<false>,
+	store32s<false>,
+	store16n<false>,
+	store8n<false>,
+};
+
+const arm_memory_ops<arm7_cpu> arm7_fastmem_ops = {
+	load32n<true>,
+	load32s<true>,
+	load16n<true>,
+	load8n<true>,
+	store32n<true>,
+	store32s<true>,
+	store16n<true>,
+	store8n<true>,
+};
 
 void
 arm7_cpu::load_multiple(u32 addr, int count, u32 *values)
@@ -494,8 +572,284 @@ arm7_init_tables(arm7_cpu *cpu)
 {
 	cpu->read_pt = cpu->nds->bus7_read_pt;
 	cpu->write_pt = cpu->nds->bus7_write_pt;
+	cpu->tracked_pt = cpu->nds->bus7_tracked_pt;
 	cpu->code_tt = cpu->nds->arm7_code_timings;
 	cpu->data_tt = cpu->nds->arm7_data_timings;
 }
 
+static bool
+fetch_block_word(arm7_cpu *cpu, u32 addr, bool thumb, u32 *result,
+		arm_block<arm7_cpu> *block)
+{
+	u8 *p = cpu->read_pt[addr >> BUS7_PAGE_SHIFT];
+	if (!p) {
+		return false;
+	}
+
+	int code_page = get_tracked_page(
+			&cpu->nds->tracker, p + (addr & BUS7_PAGE_MASK));
+	if (code_page < 0) {
+		return false;
+	} else if (block->code_pages[0] == -1) {
+		block->code_pages[0] = code_page;
+	} else if (block->code_pages[0] != code_page) {
+		if (block->code_pages[1] == -1) {
+			block->code_pages[1] = code_page;
+		} else if (block->code_pages[1] != code_page) {
+			return false;
+		}
+	}
+
+	if (thumb) {
+		*result = readarr<u16>(p, addr & BUS7_PAGE_MASK);
+	} else {
+		*result = readarr<u32>(p, addr & BUS7_PAGE_MASK);
+	}
+
+	return true;
+}
+
+static arm_block<arm7_cpu> *
+decode_block(arm7_cpu *cpu, u32 addr, bool thumb)
+{
+	using arm::interpreter::arm_undefined;
+	using arm::interpreter::thumb_undefined;
+
+	arm_block<arm7_cpu> block;
+	u32 size = thumb ? 2 : 4;
+	u64 page_end = ((u64)addr | BUS7_PAGE_MASK) + 1;
+
+	u32 words[3];
+	if (!fetch_block_word(cpu, addr, thumb, &words[1], &block) ||
+			!fetch_block_word(cpu, addr + size, thumb, &words[2],
+					&block)) {
+		return nullptr;
+	}
+
+	for (u64 pc = addr; pc < page_end; pc += size) {
+		if (block.insts.size() == MAX_BLOCK_LENGTH) {
+			break;
+		}
+
+		words[0] = words[1];
+		words[1] = words[2];
+		if (!fetch_block_word(cpu, pc + 2 * size, thumb, &words[2],
+				    &block)) {
+			break;
+		}
+
+		u32 opcode = words[0];
+		arm_block<arm7_cpu>::inst inst{};
+		inst.opcode = opcode;
+		inst.pipeline[0] = words[1];
+		inst.pipeline[1] = words[2];
+
+		bool ends_block;
+		if (thumb) {
+			u32 fetch_addr = pc + 4;
+			inst.fn = thumb7_inst_lut[opcode >> 6 & 0x3FF];
+			inst.cond = 0xE;
+			inst.code_cycles = cpu->code_tt[fetch_addr >>
+			                                BUS_TIMING_SHIFT][3];
+			ends_block = thumb_inst_ends_block(opcode) ||
+			             inst.fn == thumb_undefined<arm7_cpu>;
+		} else {
+			u32 fetch_addr = pc + 8;
+			u32 op1 = opcode >> 20 & 0xFF;
+			u32 op2 = opcode >> 4 & 0xF;
+			inst.fn = arm7_inst_lut[op1 << 4 | op2];
+			inst.cond = opcode >> 28;
+			inst.code_cycles = cpu->code_tt[fetch_addr >>
+			                                BUS_TIMING_SHIFT][1];
+			ends_block = arm_inst_ends_block(opcode) ||
+			             inst.fn == arm_undefined<arm7_cpu>;
+		}
+
+		block.insts.push_back(inst);
+
+		if (ends_block) {
+			break;
+		}
+	}
+
+	if (block.insts.empty()) {
+		return nullptr;
+	}
+
+	find_idle_loop(block, addr, thumb);
+
+	return insert_block(&cpu->nds->tracker, cpu->blocks, addr, thumb,
+			std::move(block), 1);
+}
+
+static void
+run_arm_block(arm7_cpu *cpu, arm_block<arm7_cpu> *block)
+{
+	u64 generation = cpu->blocks.generation;
+	auto *inst = block->insts.data();
+	auto *end = inst + block->insts.size();
+
+	while (true) {
+		u32 pc = cpu->pc() += 4;
+		cpu->opcode = inst->opcode;
+		cpu->pipeline[0] = inst->pipeline[0];
+		cpu->pipeline[1] = inst->pipeline[1];
+		cpu->code_cycles = inst->code_cycles;
+
+		u32 cond = inst->cond;
+		if (arm_check_cond(cpu, cond)) {
+			inst->fn(cpu);
+		} else {
+			cpu->add_code_cycles();
+		}
+
+		if (cpu->interrupt) {
+			arm_do_irq(cpu);
+			return;
+		}
+
+		/*
+		 * exceptions can be raised by instructions that do not end
+		 * the block, and the block may have been freed by a write to
+		 * its code
+		 */
+		if (cpu->pc() != pc || cpu->blocks.generation != generation ||
+				++inst == end ||
+				*cpu->cycles >= *cpu->target_cycles) {
+			return;
+		}
+	}
+}
+
+static void
+run_thumb_block(arm7_cpu *cpu, arm_block<arm7_cpu> *block)
+{
+	u64 generation = cpu->blocks.generation;
+	auto *inst = block->insts.data();
+	auto *end = inst + block->insts.size();
+
+	while (true) {
+		u32 pc = cpu->pc() += 2;
+		cpu->opcode = inst->opcode;
+		cpu->pipeline[0] = inst->pipeline[0];
+		cpu->pipeline[1] = inst->pipeline[1];
+		cpu->code_cycles = inst->code_cycles;
+		inst->fn(cpu);
+
+		if (cpu->interrupt) {
+			arm_do_irq(cpu);
+			return;
+		}
+
+		if (cpu->pc() != pc || cpu->blocks.generation != generation ||
+				++inst == end ||
+				*cpu->cycles >= *cpu->target_cycles) {
+			return;
+		}
+	}
+}
+
+static void
+run_blocks(arm7_cpu *cpu)
+{
+	arm_block<arm7_cpu> *prev = nullptr;
+	u64 prev_generation = 0;
+	bool busy = false;
+
+	while (*cpu->cycles < *cpu->target_cycles) {
+		bool thumb = cpu->cpsr & 0x20;
+		u32 addr = cpu->pc() - (thumb ? 2 : 4);
+
+		if (prev && cpu->blocks.generation != prev_generation) {
+			prev = nullptr;
+		}
+
+		auto *block = prev ? follow_link(cpu->blocks, prev, addr, thumb)
+		                   : nullptr;
+		if (!block) {
+			block = lookup_block(cpu->blocks, addr, thumb);
+			if (!block) {
+				block = decode_block(cpu, addr, thumb);
+			}
+
+			if (block && prev &&
+					cpu->blocks.generation ==
+							prev_generation) {
+				link_block(cpu->blocks, prev, addr, thumb,
+						block);
+			}
+		}
+
+		/*
+		 * code that was already prefetched may have been overwritten
+		 * since, in which case the pipeline has to be drained first
+		 */
+		if (block && (block->insts[0].opcode != cpu->pipeline[0] ||
+				block->insts[0].pipeline[0] !=
+						cpu->pipeline[1])) {
+			block = nullptr;
+		}
+
+		bool use_jit = cpu->nds->config->use_jit;
+		if (block && !block->code && use_jit &&
+				!jit_compile_block(cpu, block, addr, thumb)) {
+			/* the code cache was full and has been cleared */
+			prev = nullptr;
+			continue;
+		}
+
+		prev = block;
+		prev_generation = cpu->blocks.generation;
+
+		bool idle_loop = block && block->idle_loop &&
+		                 cpu->nds->config->skip_idle_loops;
+		u32 gpr[16];
+		u32 cpsr = arm_get_cpsr(cpu);
+		if (idle_loop) {
+			std::copy_n(cpu->gpr, 16, gpr);
+		}
+
+		if (!block) {
+			cpu->step();
+		} else if (block->code && use_jit) {
+			jit_run_block(cpu, block, addr, thumb);
+		} else if (thumb) {
+			run_thumb_block(cpu, block);
+		} else {
+			run_arm_block(cpu, block);
+		}
+
+		if (idle_loop && cpu->blocks.generation == prev_generation &&
+				is_idle_loop_iteration(cpu, block, gpr, cpsr)) {
+			skip_idle_loop(cpu, addr, thumb);
+			cpu->idling = !busy;
+			return;
+		}
+
+		busy = true;
+	}
+}
+
+static bool
+is_idle_loop_iteration(arm7_cpu *cpu, arm_block<arm7_cpu> *block,
+		const u32 *gpr, u32 cpsr)
+{
+	if (arm_get_cpsr(cpu) != cpsr ||
+			!std::equal(gpr, gpr + 16, cpu->gpr)) {
+		return false;
+	}
+
+	/* only plain memory and a few io registers can be polled */
+	for (u32 i = 0; i < block->idle_info.num_loads; i++) {
+		u32 addr = get_idle_loop_load_addr(
+				cpu, block->idle_info.loads[i]);
+		if (!cpu->read_pt[addr >> BUS7_PAGE_SHIFT] &&
+				!is_idle_loop_io_addr(addr)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
 } // namespace twice
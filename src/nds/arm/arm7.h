@@ -2,23 +2,28 @@
 #define TWICE_ARM7_H
 
 #include "nds/arm/arm.h"
+#include "nds/arm/block_cache.h"
 
 namespace twice {
 
 struct arm7_cpu final : arm_cpu {
 	u8 **read_pt{};
 	u8 **write_pt{};
+	s16 *tracked_pt{};
 	std::array<u8, 4> *code_tt{};
 	std::array<u8, 4> *data_tt{};
 
-	void add_ldr_cycles() override
+	arm_block_cache<arm7_cpu> blocks;
+	const arm_memory_ops<arm7_cpu> *mem{};
+
+	void add_ldr_cycles()
 	{
 		u32 x = code_cycles + data_cycles + 1;
 		*cycles += x;
 		cycles_executed += x;
 	}
 
-	void add_str_cycles(u32 extra = 0) override
+	void add_str_cycles(u32 extra = 0)
 	{
 		/* TODO: should be 2N */
 		u32 x = code_cycles + data_cycles + extra;
@@ -26,36 +31,50 @@ struct arm7_cpu final : arm_cpu {
 		cycles_executed += x;
 	}
 
-	void run() override;
-	void step() override;
-	void arm_jump(u32 addr) override;
-	void thumb_jump(u32 addr) override;
-	void jump_cpsr(u32 addr) override;
+	void run();
+	void step();
+	void arm_jump(u32 addr);
+	void thumb_jump(u32 addr);
+	void jump_cpsr(u32 addr);
 	u8 fetch32n(u32 addr, u32 *result);
 	u8 fetch32s(u32 addr, u32 *result);
 	u8 fetch16n(u32 addr, u32 *result);
 	u8 fetch16s(u32 addr, u32 *result);
-	u32 load32n(u32 addr) override;
-	u32 load32s(u32 addr) override;
-	u16 load16n(u32 addr) override;
-	u8 load8n(u32 addr) override;
-	void store32n(u32 addr, u32 value) override;
-	void store32s(u32 addr, u32 value) override;
-	void store16n(u32 addr, u16 value) override;
-	void store8n(u32 addr, u8 value) override;
-	void load_multiple(u32 addr, int count, u32 *values) override;
-	void store_multiple(u32 addr, int count, u32 *values) override;
-	u16 ldrh(u32 addr) override;
-	s16 ldrsh(u32 addr) override;
-	void ldm(u32 addr, u16 register_list, int count) override;
-	void ldm_user(u32 addr, u16 register_list, int count) override;
-	void ldm_cpsr(u32 addr, u16 register_list, int count) override;
-	void stm(u32 addr, u16 register_list, int count) override;
-	void stm_user(u32 addr, u16 register_list, int count) override;
-	void thumb_ldm(u32 addr, u16 register_list, int count) override;
-	void thumb_stm(u32 addr, u16 register_list, int count) override;
-
-	bool check_halted() override
+	u32 load32n(u32 addr) { return mem->load32n(this, addr); }
+	u32 load32s(u32 addr) { return mem->load32s(this, addr); }
+	u16 load16n(u32 addr) { return mem->load16n(this, addr); }
+	u8 load8n(u32 addr) { return mem->load8n(this, addr); }
+
+	void store32n(u32 addr, u32 value)
+	{
+		mem->store32n(this, addr, value);
+	}
+
+	void store32s(u32 addr, u32 value)
+	{
+		mem->store32s(this, addr, value);
+	}
+
+	void store16n(u32 addr, u16 value)
+	{
+		mem->store16n(this, addr, value);
+	}
+
+	void store8n(u32 addr, u8 value) { mem->store8n(this, addr, value); }
+
+	void load_multiple(u32 addr, int count, u32 *values);
+	void store_multiple(u32 addr, int count, u32 *values);
+	u16 ldrh(u32 addr);
+	s16 ldrsh(u32 addr);
+	void ldm(u32 addr, u16 register_list, int count);
+	void ldm_user(u32 addr, u16 register_list, int count);
+	void ldm_cpsr(u32 addr, u16 register_list, int count);
+	void stm(u32 addr, u16 register_list, int count);
+	void stm_user(u32 addr, u16 register_list, int count);
+	void thumb_ldm(u32 addr, u16 register_list, int count);
+	void thumb_stm(u32 addr, u16 register_list, int count);
+
+	bool check_halted()
 	{
 		if (IE & IF) {
 			halted &= ~CPU_HALT;
@@ -65,6 +84,9 @@ struct arm7_cpu final : arm_cpu {
 	}
 };
 
+extern const arm_memory_ops<arm7_cpu> arm7_page_table_ops;
+extern const arm_memory_ops<arm7_cpu> arm7_fastmem_ops;
+
 void arm7_direct_boot(arm7_cpu *cpu, u32 entry_addr);
 void arm7_init_tables(arm7_cpu *cpu);
 
@@ -25,12 +25,17 @@ static void remap_store_pt(arm9_cpu *cpu, u64 unmap_start, u64 unmap_end);
 static void unmap_tcm_pages(arm9_cpu *cpu, int table, u64 start, u64 end);
 static void map_dtcm_pages(arm9_cpu *cpu, int table);
 static void map_itcm_pages(arm9_cpu *cpu, int table);
+static void map_tracked_tcm_pages(arm9_cpu *cpu, u64 start, u64 end);
+static void run_blocks(arm9_cpu *cpu);
+static bool is_idle_loop_iteration(arm9_cpu *cpu,
+		arm_block<arm9_cpu> *block, const u32 *gpr, u32 cpsr);
 
 void
 arm9_cpu::run()
 {
 	if (halted) {
 		*cycles = *target_cycles;
+		idling = true;
 		return;
 	}
 
@@ -38,6 +43,13 @@ arm9_cpu::run()
 		arm_do_irq(this);
 	}
 
+	idling = false;
+
+	if (nds->config->use_cached_interpreter || nds->config->use_jit) {
+		run_blocks(this);
+		return;
+	}
+
 	while (*cycles < *target_cycles) {
 		step();
 	}
@@ -64,8 +76,7 @@ arm9_cpu::step()
 		code_cycles = fetch32n(pc(), &pipeline[1]);
 
 		u32 cond = opcode >> 28;
-		if (cond == 0xE ||
-				arm_cond_table[cond] & (1 << (cpsr >> 28))) {
+		if (arm_check_cond(this, cond)) {
 			u32 op1 = opcode >> 20 & 0xFF;
 			u32 op2 = opcode >> 4 & 0xF;
 			arm9_inst_lut[op1 << 4 | op2](this);
@@ -146,10 +157,15 @@ fetch(arm9_cpu *cpu, u32 addr, T *result)
 	return cpu->timings[arm9_cpu::FETCH][addr >> BUS9_PAGE_SHIFT][0];
 }
 
-template <typename T>
+template <typename T, bool Fastmem>
 static T
 load(arm9_cpu *cpu, u32 addr)
 {
+	T value;
+	if (Fastmem && fastmem_read(&cpu->fastmem, addr, &value)) {
+		return value;
+	}
+
 	u8 *p = cpu->pages[arm9_cpu::LOAD][addr >> BUS9_PAGE_SHIFT];
 	if (p) {
 		return readarr<T>(p, addr & BUS9_PAGE_MASK);
@@ -158,13 +174,21 @@ load(arm9_cpu *cpu, u32 addr)
 	return bus9_read_slow<T>(cpu->nds, addr);
 }
 
-template <typename T>
+template <typename T, bool Fastmem>
 static void
 store(arm9_cpu *cpu, u32 addr, T value)
 {
+	/* fastmem stores bypass the page tracker */
+	if (Fastmem && !cpu->nds->tracker.active &&
+			fastmem_write(&cpu->fastmem, addr, value)) {
+		return;
+	}
+
 	u8 *p = cpu->pages[arm9_cpu::STORE][addr >> BUS9_PAGE_SHIFT];
 	if (p) {
 		writearr<T>(p, addr & BUS9_PAGE_MASK, value);
+		track_page_write<BUS9_PAGE_SHIFT>(
+				&cpu->nds->tracker, cpu->tracked_pt, addr);
 		return;
 	}
 
@@ -177,9 +201,9 @@ load_multiple_from_page(
 {
 	u8 *p = cpu->pages[arm9_cpu::LOAD][page];
 	if (p) {
-		for (; count--; addr += 4) {
-			*values++ = readarr<u32>(p, addr & BUS9_PAGE_MASK);
-		}
+		/* the range is contiguous in host memory */
+		std::memcpy(values, p + (addr & BUS9_PAGE_MASK), 4 * count);
+		values += count;
 	} else {
 		for (; count--; addr += 4) {
 			*values++ = bus9_read_slow<u32>(cpu->nds, addr);
@@ -195,9 +219,10 @@ store_multiple_to_page(
 {
 	u8 *p = cpu->pages[arm9_cpu::STORE][page];
 	if (p) {
-		for (; count--; addr += 4) {
-			writearr<u32>(p, addr & BUS9_PAGE_MASK, *values++);
-		}
+		std::memcpy(p + (addr & BUS9_PAGE_MASK), values, 4 * count);
+		values += count;
+		track_page_write<BUS9_PAGE_SHIFT>(
+				&cpu->nds->tracker, cpu->tracked_pt, addr);
 	} else {
 		for (; count--; addr += 4) {
 			bus9_write_slow<u32>(cpu->nds, addr, *values++);
@@ -257,62 +282,100 @@ arm9_cpu::fetch32n(u32 addr, u32 *result)
 	return fetch<u32>(this, addr, result);
 }
 
-u32
-arm9_cpu::load32n(u32 addr)
+template <bool Fastmem>
+static u32
+load32n(arm9_cpu *cpu, u32 addr)
 {
-	data_cycles = timings[LOAD][addr >> BUS9_PAGE_SHIFT][0];
-	return load<u32>(this, addr);
+	auto& t = cpu->timings[arm9_cpu::LOAD][addr >> BUS9_PAGE_SHIFT];
+	cpu->data_cycles = t[0];
+	return load<u32, Fastmem>(cpu, addr);
 }
 
-u32
-arm9_cpu::load32s(u32 addr)
+template <bool Fastmem>
+static u32
+load32s(arm9_cpu *cpu, u32 addr)
 {
-	data_cycles += timings[LOAD][addr >> BUS9_PAGE_SHIFT][1];
-	return load<u32>(this, addr);
+	auto& t = cpu->timings[arm9_cpu::LOAD][addr >> BUS9_PAGE_SHIFT];
+	cpu->data_cycles += t[1];
+	return load<u32, Fastmem>(cpu, addr);
 }
 
-u16
-arm9_cpu::load16n(u32 addr)
+template <bool Fastmem>
+static u16
+load16n(arm9_cpu *cpu, u32 addr)
 {
-	data_cycles = timings[LOAD][addr >> BUS9_PAGE_SHIFT][2];
-	return load<u16>(this, addr);
+	auto& t = cpu->timings[arm9_cpu::LOAD][addr >> BUS9_PAGE_SHIFT];
+	cpu->data_cycles = t[2];
+	return load<u16, Fastmem>(cpu, addr);
 }
 
-u8
-arm9_cpu::load8n(u32 addr)
+template <bool Fastmem>
+static u8
+load8n(arm9_cpu *cpu, u32 addr)
 {
-	data_cycles = timings[LOAD][addr >> BUS9_PAGE_SHIFT][2];
-	return load<u8>(this, addr);
+	auto& t = cpu->timings[arm9_cpu::LOAD][addr >> BUS9_PAGE_SHIFT];
+	cpu->data_cycles = t[2];
+	return load<u8, Fastmem>(cpu, addr);
 }
 
-void
-arm9_cpu::store32n(u32 addr, u32 value)
+template <bool Fastmem>
+static void
+store32n(arm9_cpu *cpu, u32 addr, u32 value)
 {
-	data_cycles = timings[STORE][addr >> BUS9_PAGE_SHIFT][0];
-	store<u32>(this, addr, value);
+	auto& t = cpu->timings[arm9_cpu::STORE][addr >> BUS9_PAGE_SHIFT];
+	cpu->data_cycles = t[0];
+	store<u32, Fastmem>(cpu, addr, value);
 }
 
-void
-arm9_cpu::store32s(u32 addr, u32 value)
+template <bool Fastmem>
+static void
+store32s(arm9_cpu *cpu, u32 addr, u32 value)
 {
-	data_cycles = timings[STORE][addr >> BUS9_PAGE_SHIFT][1];
-	store<u32>(this, addr, value);
+	auto& t = cpu->timings[arm9_cpu::STORE][addr >> BUS9_PAGE_SHIFT];
+	cpu->data_cycles = t[1];
+	store<u32, Fastmem>(cpu, addr, value);
 }
 
-void
-arm9_cpu::store16n(u32 addr, u16 value)
+template <bool Fastmem>
+static void
+store16n(arm9_cpu *cpu, u32 addr, u16 value)
 {
-	data_cycles = timings[STORE][addr >> BUS9_PAGE_SHIFT][2];
-	store<u16>(this, addr, value);
+	auto& t = cpu->timings[arm9_cpu::STORE][addr >> BUS9_PAGE_SHIFT];
+	cpu->data_cycles = t[2];
+	store<u16, Fastmem>(cpu, addr, value);
 }
 
-void
-arm9_cpu::store8n(u32 addr, u8 value)
+template <bool Fastmem>
+static void
+store8n(arm9_cpu *cpu, u32 addr, u8 value)
 {
-	data_cycles = timings[STORE][addr >> BUS9_PAGE_SHIFT][2];
-	store<u8>(this, addr, value);
+	auto& t = cpu->timings[arm9_cpu::STORE][addr >> BUS9_PAGE_SHIFT];
+	cpu->data_cycles = t[2];
+	store<u8, Fastmem>(cpu, addr, value);
 }
 
+const arm_memory_ops<arm9_cpu> arm9_page_table_ops = {
+	load32n<false>,
+	load32s<false>,
+	load16n<false>,
+	load8n<false>,
+	store32n<false>,
+	store32s<false>,
+	store16n<false>,
+	store8n<false>,
+};
+
+const arm_memory_ops<arm9_cpu> arm9_fastmem_ops = {
+	load32n<true>,
+	load32s<true>,
+	load16n<true>,
+	load8n<true>,
+	store32n<true>,
+	store32s<true>,
+	store16n<true>,
+	store8n<true>,
+};
+
 void
 arm9_cpu::load_multiple(u32 addr, int count, u32 *values)
 {
@@ -595,6 +658,7 @@ update_arm9_page_tables(arm9_cpu *cpu, u64 start, u64 end)
 	remap_fetch_pt(cpu, start, end);
 	remap_load_pt(cpu, start, end);
 	remap_store_pt(cpu, start, end);
+	fastmem_map_pages(cpu->nds, 0, start, end);
 }
 
 static void
@@ -646,6 +710,9 @@ set_dtcm_params(arm9_cpu *cpu, u32 dtcm_base, u32 mask)
 	if (cpu->write_dtcm) {
 		remap_store_pt(cpu, old_dtcm_base, old_dtcm_end);
 	}
+
+	fastmem_map_pages(cpu->nds, 0, old_dtcm_base, old_dtcm_end);
+	fastmem_map_pages(cpu->nds, 0, cpu->dtcm_base, cpu->dtcm_end);
 }
 
 static void
@@ -663,11 +730,17 @@ set_itcm_params(arm9_cpu *cpu, u32 mask)
 	if (cpu->write_itcm) {
 		remap_store_pt(cpu, 0, old_itcm_end);
 	}
+
+	fastmem_map_pages(cpu->nds, 0, 0,
+			std::max<u64>(old_itcm_end, cpu->itcm_end));
 }
 
 static void
 remap_fetch_pt(arm9_cpu *cpu, u64 unmap_start, u64 unmap_end)
 {
+	/* code timings and mappings are baked into the decoded blocks */
+	invalidate_all_blocks(cpu->nds, 0);
+
 	unmap_tcm_pages(cpu, arm9_cpu::FETCH, unmap_start, unmap_end);
 
 	if (cpu->read_itcm) {
@@ -718,6 +791,9 @@ unmap_tcm_pages(arm9_cpu *cpu, int table, u64 start, u64 end)
 		u32 tt_src_page = addr >> BUS_TIMING_SHIFT;
 		pt[page] = pt_src[page];
 		tt[page] = tt_src[tt_src_page];
+		if (table == arm9_cpu::STORE) {
+			cpu->tracked_pt[page] = cpu->nds->bus9_tracked_pt[page];
+		}
 	}
 }
 
@@ -733,6 +809,10 @@ map_dtcm_pages(arm9_cpu *cpu, int table)
 		pt[page] = &cpu->dtcm[addr & cpu->dtcm_array_mask];
 		tt[page] = { 1, 1, 1, 1 };
 	}
+
+	if (table == arm9_cpu::STORE) {
+		map_tracked_tcm_pages(cpu, cpu->dtcm_base, cpu->dtcm_end);
+	}
 }
 
 static void
@@ -746,6 +826,309 @@ map_itcm_pages(arm9_cpu *cpu, int table)
 		pt[page] = &cpu->itcm[addr & cpu->itcm_array_mask];
 		tt[page] = { 1, 1, 1, 1 };
 	}
+
+	if (table == arm9_cpu::STORE) {
+		map_tracked_tcm_pages(cpu, 0, cpu->itcm_end);
+	}
+}
+
+static void
+map_tracked_tcm_pages(arm9_cpu *cpu, u64 start, u64 end)
+{
+	auto& pt = cpu->pages[arm9_cpu::STORE];
+
+	for (u64 addr = start; addr < end; addr += BUS9_PAGE_SIZE) {
+		u32 page = addr >> BUS9_PAGE_SHIFT;
+		cpu->tracked_pt[page] =
+				get_tracked_page(&cpu->nds->tracker, pt[page]);
+	}
+}
+
+static bool
+fetch_block_word(arm9_cpu *cpu, u32 addr, bool thumb, u32 *result,
+		arm_block<arm9_cpu> *block)
+{
+	u8 *p = cpu->pages[arm9_cpu::FETCH][addr >> BUS9_PAGE_SHIFT];
+	if (!p) {
+		return false;
+	}
+
+	/* the bios is read only, so it never needs to be invalidated */
+	int code_page = get_tracked_page(
+			&cpu->nds->tracker, p + (addr & BUS9_PAGE_MASK));
+	if (code_page < 0) {
+		u8 *bios = cpu->nds->arm9_bios;
+		if ((uintptr_t)p - (uintptr_t)bios >= ARM9_BIOS_SIZE) {
+			return false;
+		}
+	} else if (block->code_pages[0] == -1) {
+		block->code_pages[0] = code_page;
+	} else if (block->code_pages[0] != code_page) {
+		if (block->code_pages[1] == -1) {
+			block->code_pages[1] = code_page;
+		} else if (block->code_pages[1] != code_page) {
+			return false;
+		}
+	}
+
+	/* thumb code is fetched a word at a time, like in step */
+	if (thumb && (addr & 2)) {
+		*result = readarr<u16>(p, addr & BUS9_PAGE_MASK);
+	} else {
+		*result = readarr<u32>(p, addr & BUS9_PAGE_MASK);
+	}
+
+	return true;
+}
+
+static arm_block<arm9_cpu> *
+decode_block(arm9_cpu *cpu, u32 addr, bool thumb)
+{
+	using arm::interpreter::arm_undefined;
+	using arm::interpreter::thumb_undefined;
+
+	arm_block<arm9_cpu> block;
+	u32 size = thumb ? 2 : 4;
+	u64 page_end = ((u64)addr | BUS9_PAGE_MASK) + 1;
+
+	u32 words[3];
+	if (!fetch_block_word(cpu, addr, thumb, &words[1], &block) ||
+			!fetch_block_word(cpu, addr + size, thumb, &words[2],
+					&block)) {
+		return nullptr;
+	}
+
+	for (u64 pc = addr; pc < page_end; pc += size) {
+		if (block.insts.size() == MAX_BLOCK_LENGTH) {
+			break;
+		}
+
+		words[0] = words[1];
+		words[1] = words[2];
+		if (!fetch_block_word(cpu, pc + 2 * size, thumb, &words[2],
+				    &block)) {
+			break;
+		}
+
+		u32 opcode = words[0];
+		arm_block<arm9_cpu>::inst inst{};
+		inst.opcode = opcode;
+		inst.pipeline[0] = words[1];
+		inst.pipeline[1] = words[2];
+
+		bool ends_block;
+		if (thumb) {
+			u32 fetch_addr = pc + 4;
+			auto& t = cpu->timings[arm9_cpu::FETCH]
+			                      [fetch_addr >> BUS9_PAGE_SHIFT];
+			inst.fn = thumb9_inst_lut[opcode >> 6 & 0x3FF];
+			inst.cond = 0xE;
+			inst.code_cycles = fetch_addr & 2 ? 0 : t[0];
+			ends_block = thumb_inst_ends_block(opcode) ||
+			             inst.fn == thumb_undefined<arm9_cpu>;
+		} else {
+			u32 fetch_addr = pc + 8;
+			auto& t = cpu->timings[arm9_cpu::FETCH]
+			                      [fetch_addr >> BUS9_PAGE_SHIFT];
+			u32 op1 = opcode >> 20 & 0xFF;
+			u32 op2 = opcode >> 4 & 0xF;
+			inst.fn = arm9_inst_lut[op1 << 4 | op2];
+			inst.cond = opcode >> 28;
+			inst.code_cycles = t[0];
+			ends_block = arm_inst_ends_block(opcode) ||
+			             inst.fn == arm_undefined<arm9_cpu>;
+
+			/* handled by step */
+			if (inst.cond == 0xF) {
+				break;
+			}
+		}
+
+		block.insts.push_back(inst);
+
+		if (ends_block) {
+			break;
+		}
+	}
+
+	if (block.insts.empty()) {
+		return nullptr;
+	}
+
+	find_idle_loop(block, addr, thumb);
+
+	return insert_block(&cpu->nds->tracker, cpu->blocks, addr, thumb,
+			std::move(block), 0);
+}
+
+static void
+run_arm_block(arm9_cpu *cpu, arm_block<arm9_cpu> *block)
+{
+	u64 generation = cpu->blocks.generation;
+	auto *inst = block->insts.data();
+	auto *end = inst + block->insts.size();
+
+	while (true) {
+		u32 pc = cpu->pc() += 4;
+		cpu->opcode = inst->opcode;
+		cpu->pipeline[0] = inst->pipeline[0];
+		cpu->pipeline[1] = inst->pipeline[1];
+		cpu->code_cycles = inst->code_cycles;
+
+		u32 cond = inst->cond;
+		if (arm_check_cond(cpu, cond)) {
+			inst->fn(cpu);
+		} else {
+			cpu->add_code_cycles();
+		}
+
+		if (cpu->interrupt) {
+			arm_do_irq(cpu);
+			return;
+		}
+
+		/*
+		 * exceptions can be raised by instructions that do not end
+		 * the block, and the block may have been freed by a write to
+		 * its code
+		 */
+		if (cpu->pc() != pc || cpu->blocks.generation != generation ||
+				++inst == end ||
+				*cpu->cycles >= *cpu->target_cycles) {
+			return;
+		}
+	}
+}
+
+static void
+run_thumb_block(arm9_cpu *cpu, arm_block<arm9_cpu> *block)
+{
+	u64 generation = cpu->blocks.generation;
+	auto *inst = block->insts.data();
+	auto *end = inst + block->insts.size();
+
+	while (true) {
+		u32 pc = cpu->pc() += 2;
+		cpu->opcode = inst->opcode;
+		cpu->pipeline[0] = inst->pipeline[0];
+		cpu->pipeline[1] = inst->pipeline[1];
+		cpu->code_cycles = inst->code_cycles;
+		inst->fn(cpu);
+
+		if (cpu->interrupt) {
+			arm_do_irq(cpu);
+			return;
+		}
+
+		if (cpu->pc() != pc || cpu->blocks.generation != generation ||
+				++inst == end ||
+				*cpu->cycles >= *cpu->target_cycles) {
+			return;
+		}
+	}
+}
+
+static void
+run_blocks(arm9_cpu *cpu)
+{
+	arm_block<arm9_cpu> *prev = nullptr;
+	u64 prev_generation = 0;
+	bool busy = false;
+
+	while (*cpu->cycles < *cpu->target_cycles) {
+		bool thumb = cpu->cpsr & 0x20;
+		u32 addr = cpu->pc() - (thumb ? 2 : 4);
+
+		if (prev && cpu->blocks.generation != prev_generation) {
+			prev = nullptr;
+		}
+
+		auto *block = prev ? follow_link(cpu->blocks, prev, addr, thumb)
+		                   : nullptr;
+		if (!block) {
+			block = lookup_block(cpu->blocks, addr, thumb);
+			if (!block) {
+				block = decode_block(cpu, addr, thumb);
+			}
+
+			if (block && prev &&
+					cpu->blocks.generation ==
+							prev_generation) {
+				link_block(cpu->blocks, prev, addr, thumb,
+						block);
+			}
+		}
+
+		/*
+		 * code that was already prefetched may have been overwritten
+		 * since, in which case the pipeline has to be drained first
+		 */
+		if (block && (block->insts[0].opcode != cpu->pipeline[0] ||
+				block->insts[0].pipeline[0] !=
+						cpu->pipeline[1])) {
+			block = nullptr;
+		}
+
+		bool use_jit = cpu->nds->config->use_jit;
+		if (block && !block->code && use_jit &&
+				!jit_compile_block(cpu, block, addr, thumb)) {
+			/* the code cache was full and has been cleared */
+			prev = nullptr;
+			continue;
+		}
+
+		prev = block;
+		prev_generation = cpu->blocks.generation;
+
+		bool idle_loop = block && block->idle_loop &&
+		                 cpu->nds->config->skip_idle_loops;
+		u32 gpr[16];
+		u32 cpsr = arm_get_cpsr(cpu);
+		if (idle_loop) {
+			std::copy_n(cpu->gpr, 16, gpr);
+		}
+
+		if (!block) {
+			cpu->step();
+		} else if (block->code && use_jit) {
+			jit_run_block(cpu, block, addr, thumb);
+		} else if (thumb) {
+			run_thumb_block(cpu, block);
+		} else {
+			run_arm_block(cpu, block);
+		}
+
+		if (idle_loop && cpu->blocks.generation == prev_generation &&
+				is_idle_loop_iteration(cpu, block, gpr, cpsr)) {
+			skip_idle_loop(cpu, addr, thumb);
+			cpu->idling = !busy;
+			return;
+		}
+
+		busy = true;
+	}
+}
+
+static bool
+is_idle_loop_iteration(arm9_cpu *cpu, arm_block<arm9_cpu> *block,
+		const u32 *gpr, u32 cpsr)
+{
+	if (arm_get_cpsr(cpu) != cpsr ||
+			!std::equal(gpr, gpr + 16, cpu->gpr)) {
+		return false;
+	}
+
+	/* only plain memory and a few io registers can be polled */
+	for (u32 i = 0; i < block->idle_info.num_loads; i++) {
+		u32 addr = get_idle_loop_load_addr(
+				cpu, block->idle_info.loads[i]);
+		if (!cpu->pages[arm9_cpu::LOAD][addr >> BUS9_PAGE_SHIFT] &&
+				!is_idle_loop_io_addr(addr)) {
+			return false;
+		}
+	}
+
+	return true;
 }
 
 } // namespace twice
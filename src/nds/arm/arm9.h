@@ -2,6 +2,7 @@
 #define TWICE_ARM9_H
 
 #include "nds/arm/arm.h"
+#include "nds/arm/block_cache.h"
 #include "nds/mem/bus.h"
 
 namespace twice {
@@ -15,6 +16,8 @@ struct arm9_cpu final : arm_cpu {
 
 	u8 *pages[3][BUS9_PAGE_TABLE_SIZE]{};
 	std::array<u8, 4> timings[3][BUS9_PAGE_TABLE_SIZE]{};
+	/* the tracked pages of the store table */
+	s16 tracked_pt[BUS9_PAGE_TABLE_SIZE]{};
 
 	enum {
 		ITCM_SIZE = 32_KiB,
@@ -23,8 +26,8 @@ struct arm9_cpu final : arm_cpu {
 		DTCM_MASK = 16_KiB - 1,
 	};
 
-	u8 itcm[ITCM_SIZE]{};
-	u8 dtcm[DTCM_SIZE]{};
+	alignas(4_KiB) u8 itcm[ITCM_SIZE]{};
+	alignas(4_KiB) u8 dtcm[DTCM_SIZE]{};
 
 	u64 itcm_end{};
 	u32 itcm_array_mask{};
@@ -41,7 +44,10 @@ struct arm9_cpu final : arm_cpu {
 	u32 dtcm_reg{};
 	u32 itcm_reg{};
 
-	void add_ldr_cycles() override
+	arm_block_cache<arm9_cpu> blocks;
+	const arm_memory_ops<arm9_cpu> *mem{};
+
+	void add_ldr_cycles()
 	{
 		/* TODO: handle properly */
 		u32 x = (std::max(code_cycles, data_cycles) + 1) & ~1;
@@ -49,7 +55,7 @@ struct arm9_cpu final : arm_cpu {
 		cycles_executed += x;
 	}
 
-	void add_str_cycles(u32 extra = 0) override
+	void add_str_cycles(u32 extra = 0)
 	{
 		/* TODO: handle properly */
 
@@ -59,33 +65,47 @@ struct arm9_cpu final : arm_cpu {
 		cycles_executed += x;
 	}
 
-	void run() override;
-	void step() override;
-	void arm_jump(u32 addr) override;
-	void thumb_jump(u32 addr) override;
-	void jump_cpsr(u32 addr) override;
+	void run();
+	void step();
+	void arm_jump(u32 addr);
+	void thumb_jump(u32 addr);
+	void jump_cpsr(u32 addr);
 	u8 fetch32n(u32 addr, u32 *result);
-	u32 load32n(u32 addr) override;
-	u32 load32s(u32 addr) override;
-	u16 load16n(u32 addr) override;
-	u8 load8n(u32 addr) override;
-	void store32n(u32 addr, u32 value) override;
-	void store32s(u32 addr, u32 value) override;
-	void store16n(u32 addr, u16 value) override;
-	void store8n(u32 addr, u8 value) override;
-	void load_multiple(u32 addr, int count, u32 *values) override;
-	void store_multiple(u32 addr, int count, u32 *values) override;
-	u16 ldrh(u32 addr) override;
-	s16 ldrsh(u32 addr) override;
-	void ldm(u32 addr, u16 register_list, int count) override;
-	void ldm_user(u32 addr, u16 register_list, int count) override;
-	void ldm_cpsr(u32 addr, u16 register_list, int count) override;
-	void stm(u32 addr, u16 register_list, int count) override;
-	void stm_user(u32 addr, u16 register_list, int count) override;
-	void thumb_ldm(u32 addr, u16 register_list, int count) override;
-	void thumb_stm(u32 addr, u16 register_list, int count) override;
-
-	bool check_halted() override
+	u32 load32n(u32 addr) { return mem->load32n(this, addr); }
+	u32 load32s(u32 addr) { return mem->load32s(this, addr); }
+	u16 load16n(u32 addr) { return mem->load16n(this, addr); }
+	u8 load8n(u32 addr) { return mem->load8n(this, addr); }
+
+	void store32n(u32 addr, u32 value)
+	{
+		mem->store32n(this, addr, value);
+	}
+
+	void store32s(u32 addr, u32 value)
+	{
+		mem->store32s(this, addr, value);
+	}
+
+	void store16n(u32 addr, u16 value)
+	{
+		mem->store16n(this, addr, value);
+	}
+
+	void store8n(u32 addr, u8 value) { mem->store8n(this, addr, value); }
+
+	void load_multiple(u32 addr, int count, u32 *values);
+	void store_multiple(u32 addr, int count, u32 *values);
+	u16 ldrh(u32 addr);
+	s16 ldrsh(u32 addr);
+	void ldm(u32 addr, u16 register_list, int count);
+	void ldm_user(u32 addr, u16 register_list, int count);
+	void ldm_cpsr(u32 addr, u16 register_list, int count);
+	void stm(u32 addr, u16 register_list, int count);
+	void stm_user(u32 addr, u16 register_list, int count);
+	void thumb_ldm(u32 addr, u16 register_list, int count);
+	void thumb_stm(u32 addr, u16 register_list, int count);
+
+	bool check_halted()
 	{
 		if ((IE & IF) && (IME & 1)) {
 			halted &= ~CPU_HALT;
@@ -95,6 +115,9 @@ struct arm9_cpu final : arm_cpu {
 	}
 };
 
+extern const arm_memory_ops<arm9_cpu> arm9_page_table_ops;
+extern const arm_memory_ops<arm9_cpu> arm9_fastmem_ops;
+
 void arm9_direct_boot(arm9_cpu *gpu, u32 entry_addr);
 u32 cp15_read(arm9_cpu *cpu, u32 reg);
 void cp15_write(arm9_cpu *cpu, u32 reg, u32 value);
@@ -0,0 +1,341 @@
+#include "nds/arm/block_cache.h"
+#include "nds/arm/arm7.h"
+#include "nds/arm/arm9.h"
+#include "nds/nds.h"
+
+#include "common/logger.h"
+
+namespace twice {
+
+static bool add_idle_loop_load(
+		idle_loop_info *info, u32 rn, u32 offset, u32 written);
+static void log_idle_loop_stats(
+		const char *name, const std::map<u32, idle_loop_stats>& stats);
+
+void
+invalidate_code_page(page_tracker *t, int page)
+{
+	if (t->flags[page] & PAGE_ARM9_CODE) {
+		invalidate_blocks_in_page(t->nds->arm9->blocks, page);
+	}
+
+	if (t->flags[page] & PAGE_ARM7_CODE) {
+		invalidate_blocks_in_page(t->nds->arm7->blocks, page);
+	}
+
+	t->flags[page] &= ~(PAGE_ARM9_CODE | PAGE_ARM7_CODE);
+}
+
+void
+invalidate_all_blocks(nds_ctx *nds, int cpuid)
+{
+	auto& t = nds->tracker;
+	u8 code_flag = PAGE_ARM9_CODE << cpuid;
+
+	if (cpuid == 0) {
+		clear_block_cache(nds->arm9->blocks);
+	} else {
+		clear_block_cache(nds->arm7->blocks);
+	}
+
+	for (u32 i = 0; i < NUM_TRACKED_PAGES; i++) {
+		t.flags[i] &= ~code_flag;
+	}
+	t.active &= ~code_flag;
+}
+
+bool
+arm_inst_ends_block(u32 opcode)
+{
+	u32 rd = opcode >> 12 & 0xF;
+
+	switch (opcode >> 25 & 7) {
+	case 0:
+		/* bx, blx, or anything that might write to the pc */
+		return (opcode & 0x0FFFFFD0) == 0x012FFF10 || rd == 15;
+	case 1:
+		return rd == 15;
+	case 2:
+	case 3:
+		return (opcode & BIT(20)) && rd == 15;
+	case 4:
+		/* an empty register list loads the pc on the arm7 */
+		return (opcode & BIT(20)) &&
+		       ((opcode & BIT(15)) || (opcode & 0xFFFF) == 0);
+	default:
+		/* branches, coprocessor instructions, swi */
+		return true;
+	}
+}
+
+bool
+thumb_inst_ends_block(u32 opcode)
+{
+	switch (opcode >> 11 & 0x1F) {
+	case 0x08:
+		/* bx, blx, hi register operations with rd = pc */
+		return (opcode & 0xFF00) == 0x4700 ||
+		       ((opcode & 0xFC00) == 0x4400 && (opcode & 0x87) == 0x87);
+	case 0x17:
+		/* pop with pc, bkpt */
+		return (opcode & 0xFF00) == 0xBD00 ||
+		       (opcode & 0xFF00) == 0xBE00;
+	case 0x19:
+		/* an empty register list loads the pc on the arm7 */
+		return (opcode & 0xFF) == 0;
+	case 0x1A:
+	case 0x1B:
+	case 0x1C:
+	case 0x1D:
+	case 0x1F:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool
+arm_find_idle_loop(
+		u32 addr, const u32 *opcodes, u32 count, idle_loop_info *info)
+{
+	u32 written = 0;
+	info->num_loads = 0;
+
+	for (u32 i = 0; i < count; i++) {
+		u32 op = opcodes[i];
+		u32 pc = addr + 4 * i + 8;
+		u32 rn = op >> 16 & 0xF;
+		u32 rd = op >> 12 & 0xF;
+
+		if (i == count - 1) {
+			/* b back to the start of the loop */
+			u32 offset = (u32)((s32)(op << 8) >> 6);
+			return (op & 0x0F000000) == 0x0A000000 &&
+			       op >> 28 != 0xF && pc + offset == addr;
+		}
+
+		if ((op & 0x0E000090) == 0x00000090 && (op & 0x60)) {
+			/* ldrh, ldrsb, ldrsh with an immediate offset */
+			if ((op & 0x01700000) != 0x01500000 || rd == 15) {
+				return false;
+			}
+
+			u32 offset = (op >> 4 & 0xF0) | (op & 0xF);
+			if (!(op & BIT(23))) {
+				offset = -offset;
+			}
+
+			if (rn == 15) {
+				rn = IDLE_LOOP_ABSOLUTE_ADDR;
+				offset += pc;
+			}
+
+			if (!add_idle_loop_load(info, rn, offset, written)) {
+				return false;
+			}
+			written |= BIT(rd);
+		} else if ((op & 0x0E000000) == 0x04000000) {
+			/* ldr, ldrb with an immediate offset */
+			if ((op & 0x01300000) != 0x01100000 || rd == 15) {
+				return false;
+			}
+
+			u32 offset = op & 0xFFF;
+			if (!(op & BIT(23))) {
+				offset = -offset;
+			}
+
+			if (rn == 15) {
+				rn = IDLE_LOOP_ABSOLUTE_ADDR;
+				offset += pc;
+			}
+
+			if (!add_idle_loop_load(info, rn, offset, written)) {
+				return false;
+			}
+			written |= BIT(rd);
+		} else if ((op & 0x0C000000) == 0) {
+			/* data processing, excluding multiplies and misc */
+			if ((op & 0x02000090) == 0x90 ||
+					(op & 0x01900000) == 0x01000000) {
+				return false;
+			}
+
+			u32 opc = op >> 21 & 0xF;
+			if (opc < 8 || opc > 11) {
+				if (rd == 15) {
+					return false;
+				}
+				written |= BIT(rd);
+			}
+		} else {
+			return false;
+		}
+	}
+
+	return false;
+}
+
+bool
+thumb_find_idle_loop(
+		u32 addr, const u32 *opcodes, u32 count, idle_loop_info *info)
+{
+	u32 written = 0;
+	info->num_loads = 0;
+
+	for (u32 i = 0; i < count; i++) {
+		u32 op = opcodes[i] & 0xFFFF;
+		u32 pc = addr + 2 * i + 4;
+
+		if (i == count - 1) {
+			/* b or b<cond> back to the start of the loop */
+			u32 offset;
+			if ((op & 0xF000) == 0xD000 && (op & 0xF00) < 0xE00) {
+				offset = (u32)((s32)(op << 24) >> 23);
+			} else if ((op & 0xF800) == 0xE000) {
+				offset = (u32)((s32)(op << 21) >> 20);
+			} else {
+				return false;
+			}
+
+			return pc + offset == addr;
+		}
+
+		u32 rd = op & 7;
+		u32 rn = op >> 3 & 7;
+		u32 offset = op >> 6 & 0x1F;
+
+		switch (op >> 11) {
+		case 0x00:
+		case 0x01:
+		case 0x02:
+		case 0x03:
+			/* shifts, add, sub */
+			written |= BIT(rd);
+			break;
+		case 0x04:
+		case 0x06:
+		case 0x07:
+		case 0x14:
+		case 0x15:
+			/* mov, add, sub immediate, add pc / sp */
+			written |= BIT(op >> 8 & 7);
+			break;
+		case 0x05:
+			/* cmp immediate */
+			break;
+		case 0x08:
+			if (op & 0x400) {
+				/* hi register operations */
+				u32 hi_rd = (op & 7) | (op >> 4 & 8);
+				if ((op & 0x300) == 0x300) {
+					return false;
+				}
+				if ((op & 0x300) != 0x100) {
+					if (hi_rd == 15) {
+						return false;
+					}
+					written |= BIT(hi_rd);
+				}
+			} else {
+				/* alu operations, except tst, cmp, cmn */
+				u32 opc = op >> 6 & 0xF;
+				if (opc != 8 && opc != 10 && opc != 11) {
+					written |= BIT(rd);
+				}
+			}
+			break;
+		case 0x09:
+			/* ldr pc relative */
+			if (!add_idle_loop_load(info, IDLE_LOOP_ABSOLUTE_ADDR,
+					    (pc & ~3) + (op & 0xFF) * 4,
+					    written)) {
+				return false;
+			}
+			written |= BIT(op >> 8 & 7);
+			break;
+		case 0x0D:
+		case 0x0F:
+		case 0x11:
+			/* ldr, ldrb, ldrh with an immediate offset */
+			if (op >> 11 == 0x0D) {
+				offset *= 4;
+			} else if (op >> 11 == 0x11) {
+				offset *= 2;
+			}
+
+			if (!add_idle_loop_load(info, rn, offset, written)) {
+				return false;
+			}
+			written |= BIT(rd);
+			break;
+		case 0x13:
+			/* ldr sp relative */
+			if (!add_idle_loop_load(info, 13, (op & 0xFF) * 4,
+					    written)) {
+				return false;
+			}
+			written |= BIT(op >> 8 & 7);
+			break;
+		default:
+			return false;
+		}
+	}
+
+	return false;
+}
+
+bool
+is_idle_loop_io_addr(u32 addr)
+{
+	/* registers that only change on events or writes from the cpus */
+	switch (addr & ~3) {
+	case 0x04000004: /* DISPSTAT, VCOUNT */
+	case 0x04000130: /* KEYINPUT */
+	case 0x04000134: /* EXTKEYIN */
+	case 0x04000180: /* IPCSYNC */
+	case 0x04000184: /* IPCFIFOCNT */
+	case 0x04000208: /* IME */
+	case 0x04000210: /* IE */
+	case 0x04000214: /* IF */
+		return true;
+	default:
+		return false;
+	}
+}
+
+void
+dump_idle_loop_stats(nds_ctx *nds)
+{
+	log_idle_loop_stats("arm9", nds->arm9->blocks.idle_stats);
+	log_idle_loop_stats("arm7", nds->arm7->blocks.idle_stats);
+}
+
+static void
+log_idle_loop_stats(
+		const char *name, const std::map<u32, idle_loop_stats>& stats)
+{
+	for (const auto& [key, s] : stats) {
+		LOG("%s idle loop %08X%s: %lu hits, %lu cycles skipped\n",
+				name, key & ~1, key & 1 ? " (thumb)" : "",
+				s.hits, s.cycles_skipped);
+	}
+}
+
+static bool
+add_idle_loop_load(idle_loop_info *info, u32 rn, u32 offset, u32 written)
+{
+	/* the base register has to hold the same value as on loop entry */
+	if (info->num_loads == MAX_IDLE_LOOP_LOADS) {
+		return false;
+	}
+
+	if (rn != IDLE_LOOP_ABSOLUTE_ADDR && (written & BIT(rn))) {
+		return false;
+	}
+
+	info->loads[info->num_loads++] = { rn, offset };
+	return true;
+}
+
+} // namespace twice
@@ -0,0 +1,244 @@
+#ifndef TWICE_ARM_BLOCK_CACHE_H
+#define TWICE_ARM_BLOCK_CACHE_H
+
+#include "nds/arm/jit/jit.h"
+#include "nds/mem/page_tracker.h"
+
+#include "common/types.h"
+#include "common/util.h"
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace twice {
+
+struct nds_ctx;
+
+enum : u32 {
+	MAX_BLOCK_LENGTH = 64,
+	MAX_CACHED_INSTS = 256_KiB,
+
+	MAX_IDLE_LOOP_LENGTH = 8,
+	MAX_IDLE_LOOP_LOADS = 4,
+	IDLE_LOOP_ABSOLUTE_ADDR = 16,
+};
+
+/*
+ * A block that branches back to its start, and only loads from memory and
+ * modifies registers on the way. If an iteration leaves the registers
+ * unchanged, the loop cannot make progress until the memory it reads
+ * changes.
+ */
+struct idle_loop_info {
+	struct load {
+		/* base register, or IDLE_LOOP_ABSOLUTE_ADDR */
+		u32 rn;
+		u32 offset;
+	} loads[MAX_IDLE_LOOP_LOADS];
+	u32 num_loads{};
+};
+
+struct idle_loop_stats {
+	u64 hits{};
+	u64 cycles_skipped{};
+};
+
+template <typename CPUT>
+struct arm_block {
+	struct inst {
+		void (*fn)(CPUT *cpu);
+		u32 opcode;
+		u32 pipeline[2];
+		u8 cond;
+		u8 code_cycles;
+	};
+
+	/*
+	 * Links to the blocks that were executed after this one. A link is
+	 * only valid while the generation of the cache is unchanged, since
+	 * the linked block may have been freed otherwise.
+	 */
+	struct link {
+		arm_block *block{};
+		u32 key{};
+		u64 generation{};
+	};
+
+	std::vector<inst> insts;
+	int code_pages[2]{ -1, -1 };
+	link links[2];
+	bool idle_loop{};
+	idle_loop_info idle_info;
+
+	/* native code, or null if the block is interpreted */
+	u8 *code{};
+	/* the jumps from other blocks that were linked to this one */
+	std::vector<jit_link> jit_links;
+};
+
+template <typename CPUT>
+struct arm_block_cache {
+	std::unordered_map<u32, arm_block<CPUT>> blocks;
+	/* the blocks in each page of the page tracker */
+	std::vector<u32> page_blocks[NUM_TRACKED_PAGES];
+	u64 generation{};
+	u32 num_insts{};
+	std::map<u32, idle_loop_stats> idle_stats;
+	jit_code_cache jit;
+};
+
+void invalidate_code_page(page_tracker *t, int page);
+void invalidate_all_blocks(nds_ctx *nds, int cpuid);
+bool arm_inst_ends_block(u32 opcode);
+bool thumb_inst_ends_block(u32 opcode);
+bool arm_find_idle_loop(
+		u32 addr, const u32 *opcodes, u32 count, idle_loop_info *info);
+bool thumb_find_idle_loop(
+		u32 addr, const u32 *opcodes, u32 count, idle_loop_info *info);
+bool is_idle_loop_io_addr(u32 addr);
+void dump_idle_loop_stats(nds_ctx *nds);
+
+template <typename CPUT>
+arm_block<CPUT> *
+lookup_block(arm_block_cache<CPUT>& cache, u32 addr, bool thumb)
+{
+	auto it = cache.blocks.find(addr | thumb);
+	return it == cache.blocks.end() ? nullptr : &it->second;
+}
+
+template <typename CPUT>
+arm_block<CPUT> *
+insert_block(page_tracker *t, arm_block_cache<CPUT>& cache, u32 addr,
+		bool thumb, arm_block<CPUT>&& block, int cpuid)
+{
+	u32 key = addr | thumb;
+	u8 code_flag = PAGE_ARM9_CODE << cpuid;
+
+	if (cache.num_insts + block.insts.size() > MAX_CACHED_INSTS) {
+		invalidate_all_blocks(t->nds, cpuid);
+	}
+	cache.num_insts += block.insts.size();
+
+	for (int page : block.code_pages) {
+		if (page < 0) {
+			continue;
+		}
+
+		auto& keys = cache.page_blocks[page];
+		if (std::find(keys.begin(), keys.end(), key) == keys.end()) {
+			keys.push_back(key);
+		}
+		t->flags[page] |= code_flag;
+		t->active |= code_flag;
+	}
+
+	return &(cache.blocks[key] = std::move(block));
+}
+
+template <typename CPUT>
+void
+find_idle_loop(arm_block<CPUT>& block, u32 addr, bool thumb)
+{
+	u32 count = block.insts.size();
+	if (count > MAX_IDLE_LOOP_LENGTH) {
+		return;
+	}
+
+	u32 opcodes[MAX_IDLE_LOOP_LENGTH];
+	for (u32 i = 0; i < count; i++) {
+		opcodes[i] = block.insts[i].opcode;
+	}
+
+	if (thumb) {
+		block.idle_loop = thumb_find_idle_loop(
+				addr, opcodes, count, &block.idle_info);
+	} else {
+		block.idle_loop = arm_find_idle_loop(
+				addr, opcodes, count, &block.idle_info);
+	}
+}
+
+template <typename CPUT>
+u32
+get_idle_loop_load_addr(CPUT *cpu, const idle_loop_info::load& load)
+{
+	if (load.rn == IDLE_LOOP_ABSOLUTE_ADDR) {
+		return load.offset;
+	}
+
+	return cpu->gpr[load.rn] + load.offset;
+}
+
+template <typename CPUT>
+void
+skip_idle_loop(CPUT *cpu, u32 addr, bool thumb)
+{
+	auto& stats = cpu->blocks.idle_stats[addr | thumb];
+	stats.hits++;
+
+	if (*cpu->cycles < *cpu->target_cycles) {
+		stats.cycles_skipped += *cpu->target_cycles - *cpu->cycles;
+		*cpu->cycles = *cpu->target_cycles;
+	}
+}
+
+template <typename CPUT>
+void
+invalidate_blocks_in_page(arm_block_cache<CPUT>& cache, int page)
+{
+	for (u32 key : cache.page_blocks[page]) {
+		auto it = cache.blocks.find(key);
+		if (it != cache.blocks.end()) {
+			cache.num_insts -= it->second.insts.size();
+			jit_unlink_block(it->second.jit_links);
+			cache.blocks.erase(it);
+		}
+	}
+	cache.page_blocks[page].clear();
+	cache.generation++;
+}
+
+template <typename CPUT>
+void
+clear_block_cache(arm_block_cache<CPUT>& cache)
+{
+	cache.blocks.clear();
+	for (auto& keys : cache.page_blocks) {
+		keys.clear();
+	}
+	cache.num_insts = 0;
+	jit_reset_code_cache(&cache.jit);
+	cache.generation++;
+}
+
+template <typename CPUT>
+arm_block<CPUT> *
+follow_link(arm_block_cache<CPUT>& cache, arm_block<CPUT> *block, u32 addr,
+		bool thumb)
+{
+	u32 key = addr | thumb;
+
+	for (auto& link : block->links) {
+		if (link.block && link.key == key &&
+				link.generation == cache.generation) {
+			return link.block;
+		}
+	}
+
+	return nullptr;
+}
+
+template <typename CPUT>
+void
+link_block(arm_block_cache<CPUT>& cache, arm_block<CPUT> *block, u32 addr,
+		bool thumb, arm_block<CPUT> *next)
+{
+	block->links[1] = block->links[0];
+	block->links[0] = { next, addr | thumb, cache.generation };
+}
+
+} // namespace twice
+
+#endif
@@ -253,9 +253,9 @@ arm_alu(CPUT *cpu)
 		if (OP == AND || OP == EOR || OP == TST || OP == TEQ ||
 				OP == ORR || OP == MOV || OP == BIC ||
 				OP == MVN) {
-			set_nzc(cpu, r >> 31, r == 0, carry);
+			set_nzc(cpu, r, carry);
 		} else {
-			set_nzcv(cpu, r >> 31, r == 0, carry, overflow);
+			set_nzcv(cpu, r, carry, overflow);
 		}
 	}
 }
@@ -69,8 +69,7 @@ arm_cop_reg(CPUT *cpu)
 		}
 
 		if (rd == 15) {
-			u32 mask = 0xF0000000;
-			cpu->cpsr = (cpu->cpsr & ~mask) | (value & mask);
+			arm_set_flags(cpu, value);
 		} else {
 			cpu->gpr[rd] = value;
 		}
@@ -16,7 +16,7 @@ template <typename CPUT>
 void
 arm_undefined(CPUT *cpu)
 {
-	u32 old_cpsr = cpu->cpsr;
+	u32 old_cpsr = arm_get_cpsr(cpu);
 	cpu->cpsr &= ~0xBF;
 	cpu->cpsr |= 0x9B;
 	arm_switch_mode(cpu, arm_cpu::MODE_UND);
@@ -32,7 +32,7 @@ template <typename CPUT>
 void
 arm_swi(CPUT *cpu)
 {
-	u32 old_cpsr = cpu->cpsr;
+	u32 old_cpsr = arm_get_cpsr(cpu);
 	cpu->cpsr &= ~0xBF;
 	cpu->cpsr |= 0x93;
 	arm_switch_mode(cpu, arm_cpu::MODE_SVC);
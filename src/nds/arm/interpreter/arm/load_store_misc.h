@@ -87,8 +87,10 @@ arm_misc_dt(CPUT *cpu)
 				rd &= ~1;
 			}
 
-			cpu->gpr[rd] = cpu->load32n(address & ~3);
-			u32 value = cpu->load32s((address & ~3) + 4);
+			u32 values[2];
+			cpu->load_multiple(address & ~3, 2, values);
+			cpu->gpr[rd] = values[0];
+			u32 value = values[1];
 
 			cpu->add_ldr_cycles();
 
@@ -23,7 +23,7 @@ arm_multiply(CPUT *cpu)
 	cpu->gpr[rd] = r;
 
 	if (S) {
-		set_nz(cpu, r >> 31, r == 0);
+		set_nz(cpu, r);
 	}
 
 	u32 icycles = 0;
@@ -62,7 +62,7 @@ arm_multiply_long(CPUT *cpu)
 	cpu->gpr[rdlo] = r;
 
 	if (S) {
-		set_nz(cpu, r >> 63, r == 0);
+		set_nz64(cpu, r);
 	}
 
 	u32 icycles = 0;
@@ -14,7 +14,7 @@ arm_mrs(CPUT *cpu)
 	if (R) {
 		cpu->gpr[rd] = cpu->spsr();
 	} else {
-		cpu->gpr[rd] = cpu->cpsr;
+		cpu->gpr[rd] = arm_get_cpsr(cpu);
 	}
 
 	cpu->add_code_cycles();
@@ -49,7 +49,8 @@ arm_msr(CPUT *cpu)
 			write_mask |= 0xFF << 24;
 		}
 
-		cpu->cpsr = (cpu->cpsr & ~write_mask) | (operand & write_mask);
+		cpu->cpsr = (arm_get_cpsr(cpu) & ~write_mask) |
+		            (operand & write_mask);
 		arm_on_cpsr_write(cpu);
 
 		if (operand & write_mask & BIT(5)) {
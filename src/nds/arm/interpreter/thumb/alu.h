@@ -32,7 +32,7 @@ thumb_alu1_2(CPUT *cpu)
 	}
 
 	cpu->gpr[rd] = r;
-	set_nzcv(cpu, r >> 31, r == 0, carry, overflow);
+	set_nzcv(cpu, r, carry, overflow);
 
 	cpu->add_code_cycles();
 }
@@ -62,9 +62,9 @@ thumb_alu3(CPUT *cpu)
 	}
 
 	if (OP == 0) {
-		set_nz(cpu, r >> 31, r == 0);
+		set_nz(cpu, r);
 	} else {
-		set_nzcv(cpu, r >> 31, r == 0, carry, overflow);
+		set_nzcv(cpu, r, carry, overflow);
 	}
 
 	cpu->add_code_cycles();
@@ -84,10 +84,10 @@ thumb_alu4(CPUT *cpu)
 	case 0:
 		if (IMM == 0) {
 			r = rm;
-			set_nz(cpu, r >> 31, r == 0);
+			set_nz(cpu, r);
 		} else {
 			r = rm << IMM;
-			set_nzc(cpu, r >> 31, r == 0, rm & BIT(32 - IMM));
+			set_nzc(cpu, r, rm & BIT(32 - IMM));
 		}
 		break;
 	case 1:
@@ -98,7 +98,7 @@ thumb_alu4(CPUT *cpu)
 			r = rm >> IMM;
 			carry = rm & BIT(IMM - 1);
 		}
-		set_nzc(cpu, r >> 31, r == 0, carry);
+		set_nzc(cpu, r, carry);
 		break;
 	case 2:
 		if (IMM == 0) {
@@ -112,7 +112,7 @@ thumb_alu4(CPUT *cpu)
 			r = (s32)rm >> IMM;
 			carry = rm & BIT(IMM - 1);
 		}
-		set_nzc(cpu, r >> 31, r == 0, carry);
+		set_nzc(cpu, r, carry);
 		break;
 	}
 
@@ -154,59 +154,59 @@ thumb_alu5(CPUT *cpu)
 	switch (OP) {
 	case AND:
 		r = cpu->gpr[rd] = operand & rm;
-		set_nz(cpu, r >> 31, r == 0);
+		set_nz(cpu, r);
 		break;
 	case EOR:
 		r = cpu->gpr[rd] = operand ^ rm;
-		set_nz(cpu, r >> 31, r == 0);
+		set_nz(cpu, r);
 		break;
 	case LSL:
 		rm &= 0xFF;
 		if (rm == 0) {
 			r = operand;
-			set_nz(cpu, r >> 31, r == 0);
+			set_nz(cpu, r);
 		} else if (rm < 32) {
 			carry = operand & BIT(32 - rm);
 			r = cpu->gpr[rd] = operand << rm;
-			set_nzc(cpu, r >> 31, r == 0, carry);
+			set_nzc(cpu, r, carry);
 		} else if (rm == 32) {
 			carry = operand & 1;
 			r = cpu->gpr[rd] = 0;
-			set_nzc(cpu, r >> 31, r == 0, carry);
+			set_nzc(cpu, r, carry);
 		} else {
 			carry = 0;
 			r = cpu->gpr[rd] = 0;
-			set_nzc(cpu, r >> 31, r == 0, carry);
+			set_nzc(cpu, r, carry);
 		}
 		break;
 	case LSR:
 		rm &= 0xFF;
 		if (rm == 0) {
 			r = operand;
-			set_nz(cpu, r >> 31, r == 0);
+			set_nz(cpu, r);
 		} else if (rm < 32) {
 			carry = operand & BIT(rm - 1);
 			r = cpu->gpr[rd] = operand >> rm;
-			set_nzc(cpu, r >> 31, r == 0, carry);
+			set_nzc(cpu, r, carry);
 		} else if (rm == 32) {
 			carry = operand >> 31;
 			r = cpu->gpr[rd] = 0;
-			set_nzc(cpu, r >> 31, r == 0, carry);
+			set_nzc(cpu, r, carry);
 		} else {
 			carry = 0;
 			r = cpu->gpr[rd] = 0;
-			set_nzc(cpu, r >> 31, r == 0, carry);
+			set_nzc(cpu, r, carry);
 		}
 		break;
 	case ASR:
 		rm &= 0xFF;
 		if (rm == 0) {
 			r = operand;
-			set_nz(cpu, r >> 31, r == 0);
+			set_nz(cpu, r);
 		} else if (rm < 32) {
 			carry = operand & BIT(rm - 1);
 			r = cpu->gpr[rd] = (s32)operand >> rm;
-			set_nzc(cpu, r >> 31, r == 0, carry);
+			set_nzc(cpu, r, carry);
 		} else {
 			carry = operand >> 31;
 			if (operand >> 31 == 0) {
@@ -214,7 +214,7 @@ thumb_alu5(CPUT *cpu)
 			} else {
 				r = cpu->gpr[rd] = 0xFFFFFFFF;
 			}
-			set_nzc(cpu, r >> 31, r == 0, carry);
+			set_nzc(cpu, r, carry);
 		}
 		break;
 	case ADC:
@@ -222,7 +222,7 @@ thumb_alu5(CPUT *cpu)
 		u64 r64 = (u64)operand + rm + get_c(cpu);
 		r = cpu->gpr[rd] = r64;
 		std::tie(carry, overflow) = set_adc_flags(operand, rm, r, r64);
-		set_nzcv(cpu, r >> 31, r == 0, carry, overflow);
+		set_nzcv(cpu, r, carry, overflow);
 		break;
 	}
 	case SBC:
@@ -230,58 +230,58 @@ thumb_alu5(CPUT *cpu)
 		s64 r64 = (s64)operand - rm - !get_c(cpu);
 		r = cpu->gpr[rd] = r64;
 		std::tie(carry, overflow) = set_sbc_flags(operand, rm, r, r64);
-		set_nzcv(cpu, r >> 31, r == 0, carry, overflow);
+		set_nzcv(cpu, r, carry, overflow);
 		break;
 	}
 	case ROR:
 		rm &= 0xFF;
 		if (rm == 0) {
 			r = operand;
-			set_nz(cpu, r >> 31, r == 0);
+			set_nz(cpu, r);
 		} else if ((rm & 0x1F) == 0) {
 			carry = operand >> 31;
 			r = operand;
-			set_nzc(cpu, r >> 31, r == 0, carry);
+			set_nzc(cpu, r, carry);
 		} else {
 			carry = operand & BIT((rm & 0x1F) - 1);
 			r = cpu->gpr[rd] = std::rotr(operand, rm & 0x1F);
-			set_nzc(cpu, r >> 31, r == 0, carry);
+			set_nzc(cpu, r, carry);
 		}
 		break;
 	case TST:
 		r = operand & rm;
-		set_nz(cpu, r >> 31, r == 0);
+		set_nz(cpu, r);
 		break;
 	case NEG:
 		r = cpu->gpr[rd] = -rm;
 		std::tie(carry, overflow) = set_sub_flags(0, rm, r);
-		set_nzcv(cpu, r >> 31, r == 0, carry, overflow);
+		set_nzcv(cpu, r, carry, overflow);
 		break;
 	case CMP:
 		r = operand - rm;
 		std::tie(carry, overflow) = set_sub_flags(operand, rm, r);
-		set_nzcv(cpu, r >> 31, r == 0, carry, overflow);
+		set_nzcv(cpu, r, carry, overflow);
 		break;
 	case CMN:
 		r = operand + rm;
 		std::tie(carry, overflow) = set_add_flags(operand, rm, r);
-		set_nzcv(cpu, r >> 31, r == 0, carry, overflow);
+		set_nzcv(cpu, r, carry, overflow);
 		break;
 	case ORR:
 		r = cpu->gpr[rd] = operand | rm;
-		set_nz(cpu, r >> 31, r == 0);
+		set_nz(cpu, r);
 		break;
 	case MUL:
 		r = cpu->gpr[rd] = operand * rm;
-		set_nz(cpu, r >> 31, r == 0);
+		set_nz(cpu, r);
 		break;
 	case BIC:
 		r = cpu->gpr[rd] = operand & ~rm;
-		set_nz(cpu, r >> 31, r == 0);
+		set_nz(cpu, r);
 		break;
 	case MVN:
 		r = cpu->gpr[rd] = ~rm;
-		set_nz(cpu, r >> 31, r == 0);
+		set_nz(cpu, r);
 	}
 
 	u32 icycles = 0;
@@ -357,7 +357,7 @@ thumb_alu8(CPUT *cpu)
 		bool carry;
 		bool overflow;
 		std::tie(carry, overflow) = set_sub_flags(rn, rm, r);
-		set_nzcv(cpu, r >> 31, r == 0, carry, overflow);
+		set_nzcv(cpu, r, carry, overflow);
 	} else {
 		if (rd == 15) {
 			cpu->thumb_jump(rm & ~1);
@@ -10,10 +10,10 @@ template <typename CPUT, int COND>
 void
 thumb_b1(CPUT *cpu)
 {
-	bool N = cpu->cpsr & BIT(31);
-	bool Z = cpu->cpsr & BIT(30);
-	bool C = cpu->cpsr & BIT(29);
-	bool V = cpu->cpsr & BIT(28);
+	bool N = cpu->flag_n >> 31;
+	bool Z = cpu->flag_z == 0;
+	bool C = cpu->flag_c;
+	bool V = cpu->flag_v;
 
 	bool jump;
 
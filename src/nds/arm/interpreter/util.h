@@ -37,7 +37,7 @@ current_mode_has_spsr(arm_cpu *cpu)
 inline bool
 get_c(arm_cpu *cpu)
 {
-	return cpu->cpsr & BIT(29);
+	return cpu->flag_c;
 }
 
 inline void
@@ -46,31 +46,34 @@ set_q(arm_cpu *cpu, bool q)
 	cpu->cpsr = (cpu->cpsr & ~BIT(27)) | (q << 27);
 }
 
+/* N and Z are both taken from the result r */
 inline void
-set_nz(arm_cpu *cpu, bool n, bool z)
+set_nz(arm_cpu *cpu, u32 r)
 {
-	cpu->cpsr &= ~0xC0000000;
-	cpu->cpsr |= n << 31;
-	cpu->cpsr |= z << 30;
+	cpu->flag_n = r;
+	cpu->flag_z = r;
 }
 
 inline void
-set_nzc(arm_cpu *cpu, bool n, bool z, bool c)
+set_nz64(arm_cpu *cpu, u64 r)
 {
-	cpu->cpsr &= ~0xE0000000;
-	cpu->cpsr |= n << 31;
-	cpu->cpsr |= z << 30;
-	cpu->cpsr |= c << 29;
+	cpu->flag_n = r >> 32;
+	cpu->flag_z = r >> 32 | (u32)r;
 }
 
 inline void
-set_nzcv(arm_cpu *cpu, bool n, bool z, bool c, bool v)
+set_nzc(arm_cpu *cpu, u32 r, bool c)
 {
-	cpu->cpsr &= ~0xF0000000;
-	cpu->cpsr |= n << 31;
-	cpu->cpsr |= z << 30;
-	cpu->cpsr |= c << 29;
-	cpu->cpsr |= v << 28;
+	set_nz(cpu, r);
+	cpu->flag_c = c;
+}
+
+inline void
+set_nzcv(arm_cpu *cpu, u32 r, bool c, bool v)
+{
+	set_nz(cpu, r);
+	cpu->flag_c = c;
+	cpu->flag_v = v;
 }
 
 template <typename CPUT>
@@ -95,8 +98,9 @@ is_arm9(CPUT *)
 	}
 }
 
-inline void
-arm_do_bx(arm_cpu *cpu, u32 addr)
+template <typename CPUT>
+void
+arm_do_bx(CPUT *cpu, u32 addr)
 {
 	if (addr & 1) {
 		cpu->cpsr |= 0x20;
@@ -106,8 +110,9 @@ arm_do_bx(arm_cpu *cpu, u32 addr)
 	}
 }
 
-inline void
-thumb_do_bx(arm_cpu *cpu, u32 addr)
+template <typename CPUT>
+void
+thumb_do_bx(CPUT *cpu, u32 addr)
 {
 	if (!(addr & 1)) {
 		cpu->cpsr &= ~0x20;
@@ -117,38 +122,44 @@ thumb_do_bx(arm_cpu *cpu, u32 addr)
 	}
 }
 
-inline u32
-arm_do_ldr(arm_cpu *cpu, u32 addr)
+template <typename CPUT>
+u32
+arm_do_ldr(CPUT *cpu, u32 addr)
 {
 	return std::rotr(cpu->load32n(addr & ~3), (addr & 3) << 3);
 }
 
-inline void
-arm_do_str(arm_cpu *cpu, u32 addr, u32 value)
+template <typename CPUT>
+void
+arm_do_str(CPUT *cpu, u32 addr, u32 value)
 {
 	cpu->store32n(addr & ~3, value);
 }
 
-inline void
-arm_do_strh(arm_cpu *cpu, u32 addr, u16 value)
+template <typename CPUT>
+void
+arm_do_strh(CPUT *cpu, u32 addr, u16 value)
 {
 	cpu->store16n(addr & ~1, value);
 }
 
-inline u8
-arm_do_ldrb(arm_cpu *cpu, u32 addr)
+template <typename CPUT>
+u8
+arm_do_ldrb(CPUT *cpu, u32 addr)
 {
 	return cpu->load8n(addr);
 }
 
-inline void
-arm_do_strb(arm_cpu *cpu, u32 addr, u8 value)
+template <typename CPUT>
+void
+arm_do_strb(CPUT *cpu, u32 addr, u8 value)
 {
 	cpu->store8n(addr, value);
 }
 
-inline s8
-arm_do_ldrsb(arm_cpu *cpu, u32 addr)
+template <typename CPUT>
+s8
+arm_do_ldrsb(CPUT *cpu, u32 addr)
 {
 	return cpu->load8n(addr);
 }
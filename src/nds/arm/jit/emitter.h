@@ -0,0 +1,478 @@
+#ifndef TWICE_ARM_JIT_EMITTER_H
+#define TWICE_ARM_JIT_EMITTER_H
+
+#include "common/types.h"
+
+#include <vector>
+
+namespace twice::arm::jit {
+
+enum x64_reg : u8 {
+	RAX,
+	RCX,
+	RDX,
+	RBX,
+	RSP,
+	RBP,
+	RSI,
+	RDI,
+	R8,
+	R9,
+	R10,
+	R11,
+	R12,
+	R13,
+	R14,
+	R15,
+	NO_REG = 0xFF,
+};
+
+enum x64_cond : u8 {
+	CC_O,
+	CC_NO,
+	CC_B,
+	CC_AE,
+	CC_E,
+	CC_NE,
+	CC_BE,
+	CC_A,
+	CC_S,
+	CC_NS,
+	CC_P,
+	CC_NP,
+	CC_L,
+	CC_GE,
+	CC_LE,
+	CC_G,
+};
+
+/* the /digit of the group 1 instructions */
+enum x64_alu_op : u8 {
+	ALU_ADD,
+	ALU_OR,
+	ALU_ADC,
+	ALU_SBB,
+	ALU_AND,
+	ALU_SUB,
+	ALU_XOR,
+	ALU_CMP,
+};
+
+/* the /digit of the group 2 instructions */
+enum x64_shift_op : u8 {
+	SHIFT_ROL,
+	SHIFT_ROR,
+	SHIFT_RCL,
+	SHIFT_RCR,
+	SHIFT_SHL,
+	SHIFT_SHR,
+	SHIFT_SAR = 7,
+};
+
+/* the /digit of the group 3 instructions */
+enum x64_unary_op : u8 {
+	UNARY_NOT = 2,
+	UNARY_NEG,
+	UNARY_MUL,
+	UNARY_IMUL,
+};
+
+/* [base + index * (1 << scale) + disp], index RSP means no index */
+struct x64_mem {
+	x64_reg base;
+	x64_reg index;
+	u8 scale;
+	s32 disp;
+};
+
+inline x64_mem
+mem(x64_reg base, s32 disp = 0)
+{
+	return { base, RSP, 0, disp };
+}
+
+inline x64_mem
+mem(x64_reg base, x64_reg index, u8 scale, s32 disp = 0)
+{
+	return { base, index, scale, disp };
+}
+
+/*
+ * Emits x86-64 code into a fixed buffer. Nothing is written past the end of
+ * the buffer, and overflow is set instead, so the caller only has to check
+ * once after emitting a whole block.
+ *
+ * Operand sizes are given in bytes. Labels are bound once and can be jumped
+ * to before or after they are bound.
+ */
+struct x64_emitter {
+	u8 *p{};
+	u8 *end{};
+	bool overflow{};
+
+	struct label {
+		u8 *pos{};
+		std::vector<u8 *> refs;
+	};
+
+	std::vector<label> labels;
+
+	void byte(u32 b)
+	{
+		if (p < end) {
+			*p++ = b;
+		} else {
+			overflow = true;
+		}
+	}
+
+	void dword(u32 v)
+	{
+		for (int i = 0; i < 4; i++) {
+			byte(v >> 8 * i);
+		}
+	}
+
+	void qword(u64 v)
+	{
+		dword(v);
+		dword(v >> 32);
+	}
+
+	void opcode(u32 op)
+	{
+		if (op > 0xFFFF) {
+			byte(op >> 16);
+		}
+		if (op > 0xFF) {
+			byte(op >> 8);
+		}
+		byte(op);
+	}
+
+	/*
+	 * The low byte of rsp, rbp, rsi and rdi can only be accessed with a
+	 * rex prefix.
+	 */
+	void prefix(int w, u8 reg, u8 index, u8 base, bool byte_regs)
+	{
+		if (w == 2) {
+			byte(0x66);
+		}
+
+		u8 rex = 0x40 | (w == 8) << 3 | (reg >> 3 & 1) << 2 |
+		         (index >> 3 & 1) << 1 | (base >> 3 & 1);
+		if (rex != 0x40 || byte_regs) {
+			byte(rex);
+		}
+	}
+
+	static bool is_byte_reg_hi(u8 r) { return r >= 4 && r < 8; }
+
+	void op_rr(int w, u32 op, u8 reg, u8 rm, bool byte_rm = false)
+	{
+		bool force = (w == 1 && (is_byte_reg_hi(reg) ||
+						is_byte_reg_hi(rm))) ||
+		             (byte_rm && is_byte_reg_hi(rm));
+		prefix(w, reg, 0, rm, force);
+		opcode(op);
+		byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+	}
+
+	void op_rm(int w, u32 op, u8 reg, x64_mem m)
+	{
+		prefix(w, reg, m.index, m.base, w == 1 && is_byte_reg_hi(reg));
+		opcode(op);
+
+		u8 r = reg & 7;
+		u8 b = m.base & 7;
+		bool sib = m.index != RSP || b == 4;
+		int mod;
+		if (m.disp == 0 && b != 5) {
+			mod = 0;
+		} else if (m.disp >= -128 && m.disp <= 127) {
+			mod = 1;
+		} else {
+			mod = 2;
+		}
+
+		byte(mod << 6 | r << 3 | (sib ? 4 : b));
+		if (sib) {
+			byte(m.scale << 6 | (m.index & 7) << 3 | b);
+		}
+		if (mod == 1) {
+			byte(m.disp);
+		} else if (mod == 2) {
+			dword(m.disp);
+		}
+	}
+
+	void mov(int w, x64_reg dst, x64_reg src)
+	{
+		op_rr(w, w == 1 ? 0x88 : 0x89, src, dst);
+	}
+
+	void mov(int w, x64_reg dst, x64_mem src)
+	{
+		op_rm(w, w == 1 ? 0x8A : 0x8B, dst, src);
+	}
+
+	void mov(int w, x64_mem dst, x64_reg src)
+	{
+		op_rm(w, w == 1 ? 0x88 : 0x89, src, dst);
+	}
+
+	/* a 32 bit immediate is sign extended for 8 byte stores */
+	void mov_imm(int w, x64_mem dst, u32 imm)
+	{
+		op_rm(w, w == 1 ? 0xC6 : 0xC7, 0, dst);
+		if (w == 1) {
+			byte(imm);
+		} else if (w == 2) {
+			byte(imm);
+			byte(imm >> 8);
+		} else {
+			dword(imm);
+		}
+	}
+
+	/* does not change the flags */
+	void mov_imm(x64_reg dst, u32 imm)
+	{
+		prefix(4, 0, 0, dst, false);
+		byte(0xB8 + (dst & 7));
+		dword(imm);
+	}
+
+	void mov_imm64(x64_reg dst, u64 imm)
+	{
+		prefix(8, 0, 0, dst, false);
+		byte(0xB8 + (dst & 7));
+		qword(imm);
+	}
+
+	void mov_ptr(x64_reg dst, const void *ptr)
+	{
+		mov_imm64(dst, (uintptr_t)ptr);
+	}
+
+	void alu(int w, x64_alu_op op, x64_reg dst, x64_reg src)
+	{
+		op_rr(w, op << 3 | (w == 1 ? 0 : 1), src, dst);
+	}
+
+	void alu(int w, x64_alu_op op, x64_reg dst, x64_mem src)
+	{
+		op_rm(w, op << 3 | (w == 1 ? 2 : 3), dst, src);
+	}
+
+	void alu(int w, x64_alu_op op, x64_mem dst, x64_reg src)
+	{
+		op_rm(w, op << 3 | (w == 1 ? 0 : 1), src, dst);
+	}
+
+	void alu_imm(int w, x64_alu_op op, x64_reg dst, s32 imm)
+	{
+		if (w == 1) {
+			op_rr(w, 0x80, op, dst);
+			byte(imm);
+		} else if (imm >= -128 && imm <= 127) {
+			op_rr(w, 0x83, op, dst);
+			byte(imm);
+		} else {
+			op_rr(w, 0x81, op, dst);
+			dword(imm);
+		}
+	}
+
+	void alu_imm(int w, x64_alu_op op, x64_mem dst, s32 imm)
+	{
+		if (w == 1) {
+			op_rm(w, 0x80, op, dst);
+			byte(imm);
+		} else if (imm >= -128 && imm <= 127) {
+			op_rm(w, 0x83, op, dst);
+			byte(imm);
+		} else {
+			op_rm(w, 0x81, op, dst);
+			dword(imm);
+		}
+	}
+
+	void test(int w, x64_reg a, x64_reg b)
+	{
+		op_rr(w, w == 1 ? 0x84 : 0x85, b, a);
+	}
+
+	void test_imm(int w, x64_reg dst, u32 imm)
+	{
+		op_rr(w, w == 1 ? 0xF6 : 0xF7, 0, dst);
+		if (w == 1) {
+			byte(imm);
+		} else {
+			dword(imm);
+		}
+	}
+
+	void shift(int w, x64_shift_op op, x64_reg dst, u8 n)
+	{
+		if (n == 1) {
+			op_rr(w, w == 1 ? 0xD0 : 0xD1, op, dst);
+		} else {
+			op_rr(w, w == 1 ? 0xC0 : 0xC1, op, dst);
+			byte(n);
+		}
+	}
+
+	/* shifts by cl */
+	void shift_cl(int w, x64_shift_op op, x64_reg dst)
+	{
+		op_rr(w, w == 1 ? 0xD2 : 0xD3, op, dst);
+	}
+
+	void unary(int w, x64_unary_op op, x64_reg dst)
+	{
+		op_rr(w, w == 1 ? 0xF6 : 0xF7, op, dst);
+	}
+
+	void imul(int w, x64_reg dst, x64_reg src)
+	{
+		op_rr(w, 0x0FAF, dst, src);
+	}
+
+	void movzx8(x64_reg dst, x64_reg src)
+	{
+		op_rr(4, 0x0FB6, dst, src, true);
+	}
+
+	void movzx8(x64_reg dst, x64_mem src) { op_rm(4, 0x0FB6, dst, src); }
+
+	void movzx16(x64_reg dst, x64_reg src)
+	{
+		op_rr(4, 0x0FB7, dst, src);
+	}
+
+	void movzx16(x64_reg dst, x64_mem src) { op_rm(4, 0x0FB7, dst, src); }
+
+	void movsx8(x64_reg dst, x64_reg src)
+	{
+		op_rr(4, 0x0FBE, dst, src, true);
+	}
+
+	void movsx8(x64_reg dst, x64_mem src) { op_rm(4, 0x0FBE, dst, src); }
+
+	void movsx16(x64_reg dst, x64_reg src)
+	{
+		op_rr(4, 0x0FBF, dst, src);
+	}
+
+	void movsx16(x64_reg dst, x64_mem src) { op_rm(4, 0x0FBF, dst, src); }
+
+	void setcc(x64_cond cc, x64_reg dst)
+	{
+		op_rr(1, 0x0F90 | cc, 0, dst, true);
+	}
+
+	void setcc(x64_cond cc, x64_mem dst) { op_rm(1, 0x0F90 | cc, 0, dst); }
+
+	void cmov(int w, x64_cond cc, x64_reg dst, x64_reg src)
+	{
+		op_rr(w, 0x0F40 | cc, dst, src);
+	}
+
+	void lea(int w, x64_reg dst, x64_mem src) { op_rm(w, 0x8D, dst, src); }
+
+	void cmc() { byte(0xF5); }
+
+	void ret() { byte(0xC3); }
+
+	void push(x64_reg r)
+	{
+		prefix(4, 0, 0, r, false);
+		byte(0x50 + (r & 7));
+	}
+
+	void pop(x64_reg r)
+	{
+		prefix(4, 0, 0, r, false);
+		byte(0x58 + (r & 7));
+	}
+
+	void call(x64_reg r) { op_rr(4, 0xFF, 2, r); }
+
+	void call(const void *fn)
+	{
+		mov_ptr(RAX, fn);
+		call(RAX);
+	}
+
+	/* returns the location of the rel32 operand */
+	u8 *jmp(const u8 *target)
+	{
+		byte(0xE9);
+		return rel32(target);
+	}
+
+	u8 *jcc(x64_cond cc, const u8 *target)
+	{
+		byte(0x0F);
+		byte(0x80 | cc);
+		return rel32(target);
+	}
+
+	u8 *rel32(const u8 *target)
+	{
+		u8 *site = p;
+		dword(target - (p + 4));
+		return overflow ? nullptr : site;
+	}
+
+	int new_label()
+	{
+		labels.emplace_back();
+		return labels.size() - 1;
+	}
+
+	void bind(int l)
+	{
+		labels[l].pos = p;
+		for (u8 *ref : labels[l].refs) {
+			patch_rel32(ref, p);
+		}
+		labels[l].refs.clear();
+	}
+
+	u8 *jmp(int l)
+	{
+		u8 *site = jmp(p);
+		link_label(l, site);
+		return site;
+	}
+
+	void jcc(x64_cond cc, int l) { link_label(l, jcc(cc, p)); }
+
+	void link_label(int l, u8 *site)
+	{
+		if (!site) {
+			return;
+		}
+
+		if (labels[l].pos) {
+			patch_rel32(site, labels[l].pos);
+		} else {
+			labels[l].refs.push_back(site);
+		}
+	}
+
+	static void patch_rel32(u8 *site, const u8 *target)
+	{
+		s32 rel = target - (site + 4);
+		for (int i = 0; i < 4; i++) {
+			site[i] = (u32)rel >> 8 * i;
+		}
+	}
+};
+
+} // namespace twice::arm::jit
+
+#endif
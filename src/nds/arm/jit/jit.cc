@@ -0,0 +1,2145 @@
+#include "nds/arm/jit/jit.h"
+#include "nds/arm/arm7.h"
+#include "nds/arm/arm9.h"
+#include "nds/nds.h"
+
+#include "common/logger.h"
+
+#ifdef TWICE_HAVE_JIT
+
+#include "nds/arm/interpreter/util.h"
+#include "nds/arm/jit/emitter.h"
+
+#include <functional>
+#include <type_traits>
+
+#include <sys/mman.h>
+
+namespace twice {
+
+using namespace arm::jit;
+
+/*
+ * Native code runs with the cpu in r15, a pointer to its cycle counter in
+ * r14 and the counter itself in rbx. r13d counts the cycles that go to
+ * cycles_executed. Both counters are written back by the exit code.
+ *
+ * The guest registers a block uses most are kept in the allocatable host
+ * registers for the whole block. They are written back before anything
+ * that can look at the cpu, so the interpreter always sees them in gpr.
+ */
+constexpr x64_reg CPU_REG = R15;
+constexpr x64_reg CYCLES_PTR_REG = R14;
+constexpr x64_reg EXECUTED_REG = R13;
+constexpr x64_reg CYCLES_REG = RBX;
+
+constexpr x64_reg alloc_regs[] = { RBP, R12, R8, R9, R10, R11 };
+
+/* [rsp] holds the cache generation when the block was entered */
+constexpr s32 GENERATION_SLOT = 0;
+constexpr s32 TEMP_SLOT = 8;
+constexpr s32 STACK_SIZE = 24;
+
+enum : uintptr_t {
+	EXIT_NORMAL,
+	EXIT_IRQ,
+};
+
+enum {
+	OP_AND,
+	OP_EOR,
+	OP_SUB,
+	OP_RSB,
+	OP_ADD,
+	OP_ADC,
+	OP_SBC,
+	OP_RSC,
+	OP_TST,
+	OP_TEQ,
+	OP_CMP,
+	OP_CMN,
+	OP_ORR,
+	OP_MOV,
+	OP_BIC,
+	OP_MVN,
+};
+
+/* where the shifter carry out is after the second operand is computed */
+enum carry_out {
+	CARRY_UNCHANGED,
+	CARRY_CLEAR,
+	CARRY_SET,
+	CARRY_IN_DL,
+};
+
+template <typename CPUT>
+struct jit_compiler {
+	CPUT *cpu{};
+	arm_block<CPUT> *block{};
+	jit_code_cache *jit{};
+	x64_emitter e;
+	u32 addr{};
+	bool thumb{};
+	u32 size{};
+
+	x64_reg regs[16];
+	std::vector<x64_reg> volatile_regs;
+
+	/* code that is only reached on slow paths, emitted after the block */
+	std::vector<std::function<void()>> cold;
+
+	const typename arm_block<CPUT>::inst *inst{};
+	u32 inst_addr{};
+	int exit_label{ -1 };
+	int irq_label{ -1 };
+	int plain_exit_label{ -1 };
+	int plain_irq_label{ -1 };
+
+	/* the instruction ends with a jump that does not return */
+	bool block_done{};
+
+	/* lr is known if the previous instruction was a thumb bl prefix */
+	bool lr_known{};
+	bool lr_known_next{};
+	u32 lr_value{};
+	u32 lr_value_next{};
+};
+
+template <typename CPUT>
+static void
+save_exception(CPUT *cpu)
+{
+	cpu->blocks.jit.exception = std::current_exception();
+	cpu->blocks.jit.threw = true;
+}
+
+template <typename CPUT>
+static void
+jit_interpret(CPUT *cpu, void (*fn)(CPUT *))
+{
+	try {
+		fn(cpu);
+	} catch (...) {
+		save_exception(cpu);
+	}
+}
+
+template <typename CPUT, typename T>
+static u32
+jit_load(CPUT *cpu, u32 addr)
+{
+	try {
+		if constexpr (sizeof(T) == 4) {
+			return cpu->load32n(addr);
+		} else if constexpr (sizeof(T) == 2) {
+			return (T)cpu->load16n(addr);
+		} else {
+			return (T)cpu->load8n(addr);
+		}
+	} catch (...) {
+		save_exception(cpu);
+		return 0;
+	}
+}
+
+template <typename CPUT, typename T>
+static void
+jit_store(CPUT *cpu, u32 addr, u32 value)
+{
+	try {
+		if constexpr (sizeof(T) == 4) {
+			cpu->store32n(addr, value);
+		} else if constexpr (sizeof(T) == 2) {
+			cpu->store16n(addr, value);
+		} else {
+			cpu->store8n(addr, value);
+		}
+	} catch (...) {
+		save_exception(cpu);
+	}
+}
+
+/* the cycles of the fetches were already counted by the block */
+template <typename CPUT>
+static void
+jit_refill_pipeline(CPUT *cpu, u32 addr, bool thumb)
+{
+	timestamp cycles = *cpu->cycles;
+
+	try {
+		if (thumb) {
+			cpu->thumb_jump(addr);
+		} else {
+			cpu->arm_jump(addr);
+		}
+	} catch (...) {
+		save_exception(cpu);
+	}
+
+	*cpu->cycles = cycles;
+}
+
+template <typename CPUT>
+static u32
+get_jump_cycles(CPUT *cpu, u32 addr, bool thumb)
+{
+	if constexpr (std::is_same_v<CPUT, arm9_cpu>) {
+		auto t = [=](u32 a) {
+			return cpu->timings[arm9_cpu::FETCH]
+			                   [a >> BUS9_PAGE_SHIFT][0];
+		};
+
+		if (!thumb) {
+			return t(addr) + t(addr + 4);
+		} else if (addr & 2) {
+			return t(addr - 2) + t(addr + 2);
+		} else {
+			return t(addr);
+		}
+	} else {
+		auto t = [=](u32 a, int idx) {
+			return cpu->code_tt[a >> BUS_TIMING_SHIFT][idx];
+		};
+
+		if (!thumb) {
+			return t(addr, 0) + t(addr + 4, 1);
+		} else {
+			return t(addr, 2) + t(addr + 2, 3);
+		}
+	}
+}
+
+template <typename CPUT>
+static x64_mem
+field(jit_compiler<CPUT> *c, const void *p)
+{
+	return mem(CPU_REG, (const u8 *)p - (const u8 *)c->cpu);
+}
+
+template <typename CPUT>
+static x64_mem
+gpr_mem(jit_compiler<CPUT> *c, u32 r)
+{
+	return field(c, &c->cpu->gpr[r]);
+}
+
+/* the value of pc while the current instruction executes */
+template <typename CPUT>
+static u32
+get_pc(jit_compiler<CPUT> *c)
+{
+	return c->inst_addr + 2 * c->size;
+}
+
+template <typename CPUT>
+static void
+load_reg(jit_compiler<CPUT> *c, x64_reg dst, u32 r)
+{
+	if (r == 15) {
+		c->e.mov_imm(dst, get_pc(c));
+	} else if (c->regs[r] != NO_REG) {
+		c->e.mov(4, dst, c->regs[r]);
+	} else {
+		c->e.mov(4, dst, gpr_mem(c, r));
+	}
+}
+
+template <typename CPUT>
+static void
+store_reg(jit_compiler<CPUT> *c, u32 r, x64_reg src)
+{
+	if (c->regs[r] != NO_REG) {
+		c->e.mov(4, c->regs[r], src);
+	} else {
+		c->e.mov(4, gpr_mem(c, r), src);
+	}
+}
+
+template <typename CPUT>
+static void
+flush_regs(jit_compiler<CPUT> *c)
+{
+	for (u32 r = 0; r < 15; r++) {
+		if (c->regs[r] != NO_REG) {
+			c->e.mov(4, gpr_mem(c, r), c->regs[r]);
+		}
+	}
+}
+
+template <typename CPUT>
+static void
+reload_regs(jit_compiler<CPUT> *c)
+{
+	for (u32 r = 0; r < 15; r++) {
+		if (c->regs[r] != NO_REG) {
+			c->e.mov(4, c->regs[r], gpr_mem(c, r));
+		}
+	}
+}
+
+template <typename CPUT>
+static void
+add_cycles(jit_compiler<CPUT> *c, u32 cycles)
+{
+	if (cycles) {
+		c->e.alu_imm(8, ALU_ADD, CYCLES_REG, cycles);
+		c->e.alu_imm(4, ALU_ADD, EXECUTED_REG, cycles);
+	}
+}
+
+/* the cycles in rcx */
+template <typename CPUT>
+static void
+add_cycles_rcx(jit_compiler<CPUT> *c)
+{
+	c->e.alu(8, ALU_ADD, CYCLES_REG, RCX);
+	c->e.alu(4, ALU_ADD, EXECUTED_REG, RCX);
+}
+
+template <typename CPUT>
+static void
+emit_cycles_check(jit_compiler<CPUT> *c, int label)
+{
+	s32 target = (u8 *)c->cpu->target_cycles - (u8 *)c->cpu->cycles;
+	c->e.alu(8, ALU_CMP, CYCLES_REG, mem(CYCLES_PTR_REG, target));
+	c->e.jcc(CC_AE, label);
+}
+
+template <typename CPUT>
+static void
+emit_generation_check(jit_compiler<CPUT> *c, int label)
+{
+	c->e.mov(8, RCX, field(c, &c->cpu->blocks.generation));
+	c->e.alu(8, ALU_CMP, RCX, mem(RSP, GENERATION_SLOT));
+	c->e.jcc(CC_NE, label);
+}
+
+template <typename CPUT>
+static void
+emit_interrupt_check(jit_compiler<CPUT> *c, int label)
+{
+	c->e.alu_imm(1, ALU_CMP, field(c, &c->cpu->interrupt), 0);
+	c->e.jcc(CC_NE, label);
+}
+
+template <typename CPUT>
+static void
+emit_exception_check(jit_compiler<CPUT> *c, int label)
+{
+	c->e.alu_imm(1, ALU_CMP, field(c, &c->cpu->blocks.jit.threw), 0);
+	c->e.jcc(CC_NE, label);
+}
+
+/* leaves the cpu as the interpreter would after the current instruction */
+template <typename CPUT>
+static void
+store_exit_state(jit_compiler<CPUT> *c, u32 pc, const u32 *pipeline)
+{
+	auto& e = c->e;
+	e.mov_imm(4, gpr_mem(c, 15), pc);
+	e.mov_imm(4, field(c, &c->cpu->pipeline[0]), pipeline[0]);
+	e.mov_imm(4, field(c, &c->cpu->pipeline[1]), pipeline[1]);
+}
+
+template <typename CPUT>
+static int
+get_exit_stub(jit_compiler<CPUT> *c, int *label, uintptr_t ret)
+{
+	if (*label >= 0) {
+		return *label;
+	}
+
+	int l = *label = c->e.new_label();
+	u32 pc = get_pc(c);
+	const u32 *pipeline = c->inst->pipeline;
+	c->cold.push_back([=] {
+		c->e.bind(l);
+		flush_regs(c);
+		store_exit_state(c, pc, pipeline);
+		c->e.mov_imm(RAX, ret);
+		c->e.jmp(c->jit->exit);
+	});
+
+	return l;
+}
+
+/* returns after the current instruction */
+template <typename CPUT>
+static int
+get_exit_label(jit_compiler<CPUT> *c)
+{
+	return get_exit_stub(c, &c->exit_label, EXIT_NORMAL);
+}
+
+/* handles an interrupt after the current instruction */
+template <typename CPUT>
+static int
+get_irq_label(jit_compiler<CPUT> *c)
+{
+	return get_exit_stub(c, &c->irq_label, EXIT_IRQ);
+}
+
+/* for when the registers and pc are already in the cpu */
+template <typename CPUT>
+static int
+get_plain_exit_label(jit_compiler<CPUT> *c, bool irq)
+{
+	int *label = irq ? &c->plain_irq_label : &c->plain_exit_label;
+	if (*label >= 0) {
+		return *label;
+	}
+
+	int l = *label = c->e.new_label();
+	c->cold.push_back([=] {
+		c->e.bind(l);
+		c->e.mov_imm(RAX, irq ? EXIT_IRQ : EXIT_NORMAL);
+		c->e.jmp(c->jit->exit);
+	});
+
+	return l;
+}
+
+/*
+ * Calls a C++ function with the guest registers in caller saved host
+ * registers preserved, and keep unless it is NO_REG. args sets up the
+ * arguments after the registers are pushed.
+ */
+template <typename CPUT>
+static void
+emit_call(jit_compiler<CPUT> *c, const void *fn, x64_reg keep,
+		const std::function<void()>& args)
+{
+	auto& e = c->e;
+
+	std::vector<x64_reg> saved = c->volatile_regs;
+	if (keep != NO_REG) {
+		saved.push_back(keep);
+	}
+
+	bool pad = saved.size() & 1;
+	for (x64_reg r : saved) {
+		e.push(r);
+	}
+	if (pad) {
+		e.alu_imm(8, ALU_SUB, RSP, 8);
+	}
+
+	args();
+	e.mov(8, mem(CYCLES_PTR_REG), CYCLES_REG);
+	e.call(fn);
+
+	if (pad) {
+		e.alu_imm(8, ALU_ADD, RSP, 8);
+	}
+	for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+		e.pop(*it);
+	}
+	e.mov(8, CYCLES_REG, mem(CYCLES_PTR_REG));
+}
+
+/* jumps to skip if the condition does not hold, clobbers eax */
+template <typename CPUT>
+static void
+emit_cond_check(jit_compiler<CPUT> *c, u32 cond, int skip)
+{
+	auto& e = c->e;
+	x64_mem n = field(c, &c->cpu->flag_n);
+	x64_mem z = field(c, &c->cpu->flag_z);
+	x64_mem cf = field(c, &c->cpu->flag_c);
+	x64_mem v = field(c, &c->cpu->flag_v);
+
+	/* sets ZF if N == V */
+	auto n_eq_v = [&] {
+		e.mov(4, RAX, n);
+		e.shift(4, SHIFT_SHR, RAX, 31);
+		e.alu(1, ALU_CMP, RAX, v);
+	};
+
+	int exec = e.new_label();
+
+	switch (cond) {
+	case 0x0:
+		e.alu_imm(4, ALU_CMP, z, 0);
+		e.jcc(CC_NE, skip);
+		break;
+	case 0x1:
+		e.alu_imm(4, ALU_CMP, z, 0);
+		e.jcc(CC_E, skip);
+		break;
+	case 0x2:
+		e.alu_imm(1, ALU_CMP, cf, 0);
+		e.jcc(CC_E, skip);
+		break;
+	case 0x3:
+		e.alu_imm(1, ALU_CMP, cf, 0);
+		e.jcc(CC_NE, skip);
+		break;
+	case 0x4:
+		e.alu_imm(4, ALU_CMP, n, 0);
+		e.jcc(CC_NS, skip);
+		break;
+	case 0x5:
+		e.alu_imm(4, ALU_CMP, n, 0);
+		e.jcc(CC_S, skip);
+		break;
+	case 0x6:
+		e.alu_imm(1, ALU_CMP, v, 0);
+		e.jcc(CC_E, skip);
+		break;
+	case 0x7:
+		e.alu_imm(1, ALU_CMP, v, 0);
+		e.jcc(CC_NE, skip);
+		break;
+	case 0x8:
+		e.alu_imm(1, ALU_CMP, cf, 0);
+		e.jcc(CC_E, skip);
+		e.alu_imm(4, ALU_CMP, z, 0);
+		e.jcc(CC_E, skip);
+		break;
+	case 0x9:
+		e.alu_imm(1, ALU_CMP, cf, 0);
+		e.jcc(CC_E, exec);
+		e.alu_imm(4, ALU_CMP, z, 0);
+		e.jcc(CC_NE, skip);
+		break;
+	case 0xA:
+		n_eq_v();
+		e.jcc(CC_NE, skip);
+		break;
+	case 0xB:
+		n_eq_v();
+		e.jcc(CC_E, skip);
+		break;
+	case 0xC:
+		e.alu_imm(4, ALU_CMP, z, 0);
+		e.jcc(CC_E, skip);
+		n_eq_v();
+		e.jcc(CC_NE, skip);
+		break;
+	case 0xD:
+		e.alu_imm(4, ALU_CMP, z, 0);
+		e.jcc(CC_E, exec);
+		n_eq_v();
+		e.jcc(CC_E, skip);
+		break;
+	case 0xE:
+		break;
+	default:
+		e.jmp(skip);
+	}
+
+	e.bind(exec);
+}
+
+/* sets CF to the carry flag */
+template <typename CPUT>
+static void
+load_carry(jit_compiler<CPUT> *c)
+{
+	c->e.alu_imm(1, ALU_CMP, field(c, &c->cpu->flag_c), 1);
+	c->e.cmc();
+}
+
+/* sets CF to the inverse of the carry flag, for sbb */
+template <typename CPUT>
+static void
+load_borrow(jit_compiler<CPUT> *c)
+{
+	c->e.alu_imm(1, ALU_CMP, field(c, &c->cpu->flag_c), 1);
+}
+
+template <typename CPUT>
+static void
+emit_set_nz(jit_compiler<CPUT> *c, x64_reg r)
+{
+	c->e.mov(4, field(c, &c->cpu->flag_n), r);
+	c->e.mov(4, field(c, &c->cpu->flag_z), r);
+}
+
+static bool
+is_logical_op(u32 op)
+{
+	switch (op) {
+	case OP_AND:
+	case OP_EOR:
+	case OP_TST:
+	case OP_TEQ:
+	case OP_ORR:
+	case OP_MOV:
+	case OP_BIC:
+	case OP_MVN:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool
+is_compare_op(u32 op)
+{
+	return op >= OP_TST && op <= OP_CMN;
+}
+
+/* the first operand is in eax, the second in ecx, the result goes to eax */
+template <typename CPUT>
+static void
+emit_alu_op(jit_compiler<CPUT> *c, u32 op, bool set_flags, carry_out carry)
+{
+	auto& e = c->e;
+
+	switch (op) {
+	case OP_AND:
+	case OP_TST:
+		e.alu(4, ALU_AND, RAX, RCX);
+		break;
+	case OP_EOR:
+	case OP_TEQ:
+		e.alu(4, ALU_XOR, RAX, RCX);
+		break;
+	case OP_SUB:
+	case OP_CMP:
+		e.alu(4, ALU_SUB, RAX, RCX);
+		break;
+	case OP_RSB:
+		e.alu(4, ALU_SUB, RCX, RAX);
+		e.mov(4, RAX, RCX);
+		break;
+	case OP_ADD:
+	case OP_CMN:
+		e.alu(4, ALU_ADD, RAX, RCX);
+		break;
+	case OP_ADC:
+		load_carry(c);
+		e.alu(4, ALU_ADC, RAX, RCX);
+		break;
+	case OP_SBC:
+		load_borrow(c);
+		e.alu(4, ALU_SBB, RAX, RCX);
+		break;
+	case OP_RSC:
+		load_borrow(c);
+		e.alu(4, ALU_SBB, RCX, RAX);
+		e.mov(4, RAX, RCX);
+		break;
+	case OP_ORR:
+		e.alu(4, ALU_OR, RAX, RCX);
+		break;
+	case OP_MOV:
+		e.mov(4, RAX, RCX);
+		break;
+	case OP_BIC:
+		e.unary(4, UNARY_NOT, RCX);
+		e.alu(4, ALU_AND, RAX, RCX);
+		break;
+	case OP_MVN:
+		e.mov(4, RAX, RCX);
+		e.unary(4, UNARY_NOT, RAX);
+	}
+
+	if (!set_flags) {
+		return;
+	}
+
+	if (!is_logical_op(op)) {
+		/* x86 sets CF on a borrow, arm clears C */
+		bool add = op == OP_ADD || op == OP_ADC || op == OP_CMN;
+		e.setcc(add ? CC_B : CC_AE, field(c, &c->cpu->flag_c));
+		e.setcc(CC_O, field(c, &c->cpu->flag_v));
+	} else if (carry == CARRY_CLEAR || carry == CARRY_SET) {
+		e.mov_imm(1, field(c, &c->cpu->flag_c), carry == CARRY_SET);
+	} else if (carry == CARRY_IN_DL) {
+		e.mov(1, field(c, &c->cpu->flag_c), RDX);
+	}
+
+	emit_set_nz(c, RAX);
+}
+
+/* shifts ecx by an immediate, the carry out goes to dl if needed */
+template <typename CPUT>
+static carry_out
+emit_shift_imm(jit_compiler<CPUT> *c, u32 type, u32 n, bool need_carry)
+{
+	auto& e = c->e;
+
+	switch (type) {
+	case 0:
+		if (n == 0) {
+			return CARRY_UNCHANGED;
+		}
+		e.shift(4, SHIFT_SHL, RCX, n);
+		break;
+	case 1:
+		if (n == 0) {
+			/* lsr #32 */
+			if (need_carry) {
+				e.mov(4, RDX, RCX);
+				e.shift(4, SHIFT_SHR, RDX, 31);
+			}
+			e.alu(4, ALU_XOR, RCX, RCX);
+			return CARRY_IN_DL;
+		}
+		e.shift(4, SHIFT_SHR, RCX, n);
+		break;
+	case 2:
+		if (n == 0) {
+			/* asr #32 */
+			e.shift(4, SHIFT_SAR, RCX, 31);
+			if (need_carry) {
+				e.mov(4, RDX, RCX);
+				e.alu_imm(4, ALU_AND, RDX, 1);
+			}
+			return CARRY_IN_DL;
+		}
+		e.shift(4, SHIFT_SAR, RCX, n);
+		break;
+	default:
+		if (n == 0) {
+			/* rrx */
+			load_carry(c);
+			e.shift(4, SHIFT_RCR, RCX, 1);
+		} else {
+			e.shift(4, SHIFT_ROR, RCX, n);
+		}
+	}
+
+	if (need_carry) {
+		e.setcc(CC_B, RDX);
+	}
+
+	return CARRY_IN_DL;
+}
+
+/* leaves a shifter operand without a register shift in ecx */
+template <typename CPUT>
+static carry_out
+emit_arm_operand(jit_compiler<CPUT> *c, u32 opcode, bool need_carry)
+{
+	if (opcode & BIT(25)) {
+		u32 rot = (opcode >> 8 & 0xF) << 1;
+		u32 value = std::rotr(opcode & 0xFF, rot);
+		c->e.mov_imm(RCX, value);
+		if (rot == 0) {
+			return CARRY_UNCHANGED;
+		}
+		return value >> 31 ? CARRY_SET : CARRY_CLEAR;
+	}
+
+	load_reg(c, RCX, opcode & 0xF);
+	return emit_shift_imm(
+			c, opcode >> 5 & 3, opcode >> 7 & 0x1F, need_carry);
+}
+
+template <typename CPUT>
+static bool
+compile_arm_alu(jit_compiler<CPUT> *c, u32 opcode)
+{
+	u32 op = opcode >> 21 & 0xF;
+	bool S = opcode & BIT(20);
+	u32 rn = opcode >> 16 & 0xF;
+	u32 rd = opcode >> 12 & 0xF;
+
+	/* writes to pc and shifts by a register are left to the interpreter */
+	if (rd == 15 || (!(opcode & BIT(25)) && (opcode & BIT(4)))) {
+		return false;
+	}
+
+	if (is_compare_op(op) && !S) {
+		add_cycles(c, c->inst->code_cycles);
+		return true;
+	}
+
+	carry_out carry = emit_arm_operand(c, opcode, S && is_logical_op(op));
+	if (op != OP_MOV && op != OP_MVN) {
+		load_reg(c, RAX, rn);
+	}
+	emit_alu_op(c, op, S, carry);
+	if (!is_compare_op(op)) {
+		store_reg(c, rd, RAX);
+	}
+	add_cycles(c, c->inst->code_cycles);
+
+	return true;
+}
+
+template <typename CPUT>
+static bool
+compile_arm_multiply(jit_compiler<CPUT> *c, u32 opcode)
+{
+	auto& e = c->e;
+	bool A = opcode & BIT(21);
+	bool S = opcode & BIT(20);
+	u32 rd = opcode >> 16 & 0xF;
+	u32 rn = opcode >> 12 & 0xF;
+	u32 rs = opcode >> 8 & 0xF;
+	u32 rm = opcode & 0xF;
+
+	/* the arm7 timings depend on the operand */
+	if (!std::is_same_v<CPUT, arm9_cpu> || rd == 15 || rs == 15 ||
+			rm == 15 || (A && rn == 15)) {
+		return false;
+	}
+
+	load_reg(c, RAX, rm);
+	load_reg(c, RCX, rs);
+	e.imul(4, RAX, RCX);
+	if (A) {
+		load_reg(c, RCX, rn);
+		e.alu(4, ALU_ADD, RAX, RCX);
+	}
+	store_reg(c, rd, RAX);
+	if (S) {
+		emit_set_nz(c, RAX);
+	}
+	add_cycles(c, c->inst->code_cycles + (S ? 3 : 1));
+
+	return true;
+}
+
+template <typename CPUT>
+static bool
+compile_arm_multiply_long(jit_compiler<CPUT> *c, u32 opcode)
+{
+	auto& e = c->e;
+	bool U = opcode & BIT(22);
+	bool A = opcode & BIT(21);
+	bool S = opcode & BIT(20);
+	u32 rdhi = opcode >> 16 & 0xF;
+	u32 rdlo = opcode >> 12 & 0xF;
+	u32 rs = opcode >> 8 & 0xF;
+	u32 rm = opcode & 0xF;
+
+	if (!std::is_same_v<CPUT, arm9_cpu> || rdhi == 15 || rdlo == 15 ||
+			rs == 15 || rm == 15) {
+		return false;
+	}
+
+	load_reg(c, RAX, rm);
+	load_reg(c, RCX, rs);
+	e.unary(4, U ? UNARY_IMUL : UNARY_MUL, RCX);
+	if (A) {
+		load_reg(c, RCX, rdlo);
+		e.alu(4, ALU_ADD, RAX, RCX);
+		load_reg(c, RCX, rdhi);
+		e.alu(4, ALU_ADC, RDX, RCX);
+	}
+	store_reg(c, rdhi, RDX);
+	store_reg(c, rdlo, RAX);
+	if (S) {
+		e.mov(4, field(c, &c->cpu->flag_n), RDX);
+		e.alu(4, ALU_OR, RDX, RAX);
+		e.mov(4, field(c, &c->cpu->flag_z), RDX);
+	}
+	add_cycles(c, c->inst->code_cycles + (S ? 4 : 2));
+
+	return true;
+}
+
+/*
+ * Does what track_page_write does for the store to the address in esi.
+ * Leaves the tracked page in edx and the offset in it in eax, or jumps to
+ * none if the page is not tracked or has no flags set. Clobbers ecx.
+ */
+template <typename CPUT>
+static void
+emit_find_tracked_page(jit_compiler<CPUT> *c, int none)
+{
+	auto& e = c->e;
+	auto *cpu = c->cpu;
+
+	e.mov(4, RCX, RSI);
+	if constexpr (std::is_same_v<CPUT, arm9_cpu>) {
+		e.shift(4, SHIFT_SHR, RCX, BUS9_PAGE_SHIFT);
+		s32 tracked_pt = field(c, &cpu->tracked_pt[0]).disp;
+		e.movsx16(RDX, mem(CPU_REG, RCX, 1, tracked_pt));
+	} else {
+		e.shift(4, SHIFT_SHR, RCX, BUS7_PAGE_SHIFT);
+		e.mov(8, RAX, field(c, &cpu->tracked_pt));
+		e.movsx16(RDX, mem(RAX, RCX, 1));
+	}
+	e.test(4, RDX, RDX);
+	e.jcc(CC_S, none);
+
+	/* a bus page can cover several tracked pages */
+	u32 bus_page_mask = std::is_same_v<CPUT, arm9_cpu> ? BUS9_PAGE_MASK
+	                                                   : BUS7_PAGE_MASK;
+	e.mov(4, RAX, RSI);
+	e.alu_imm(4, ALU_AND, RAX, bus_page_mask);
+	e.mov(4, RCX, RAX);
+	e.shift(4, SHIFT_SHR, RCX, TRACKED_PAGE_SHIFT);
+	e.alu(4, ALU_ADD, RDX, RCX);
+	e.alu_imm(4, ALU_AND, RAX, TRACKED_PAGE_MASK);
+
+	e.mov_ptr(RCX, cpu->nds->tracker.flags);
+	e.alu_imm(1, ALU_CMP, mem(RCX, RDX, 0), 0);
+	e.jcc(CC_E, none);
+}
+
+/*
+ * Emits a load or store of the address in esi. Loads leave the value in
+ * eax, stores take it from edx, and both leave the data cycles in edi.
+ *
+ * The rest of the instruction is emitted by tail, once on the fast path and
+ * again on every slow path, so that the slow paths can check for anything
+ * the access changed after the instruction is done, and the fast path does
+ * not have to.
+ */
+template <typename CPUT>
+static void
+emit_memory_access(jit_compiler<CPUT> *c, int size, bool sign, bool store,
+		const std::function<void()>& tail)
+{
+	auto& e = c->e;
+	auto *cpu = c->cpu;
+	u32 align = ~(u32)(size - 1);
+	int timing = size == 4 ? 0 : 2;
+
+	int slow = e.new_label();
+	int join = e.new_label();
+	int exit = get_exit_label(c);
+	int irq = get_irq_label(c);
+
+	if (store && size != 1) {
+		e.alu_imm(4, ALU_AND, RSI, align);
+	}
+
+	if constexpr (std::is_same_v<CPUT, arm9_cpu>) {
+		int table = store ? arm9_cpu::STORE : arm9_cpu::LOAD;
+		s32 pages = field(c, &cpu->pages[table][0]).disp;
+		s32 timings = field(c, &cpu->timings[table][0][timing]).disp;
+		e.mov(4, RCX, RSI);
+		e.shift(4, SHIFT_SHR, RCX, BUS9_PAGE_SHIFT);
+		e.mov(8, RAX, mem(CPU_REG, RCX, 3, pages));
+		e.movzx8(RDI, mem(CPU_REG, RCX, 2, timings));
+		e.test(8, RAX, RAX);
+		e.jcc(CC_E, slow);
+		e.mov(4, RCX, RSI);
+		e.alu_imm(4, ALU_AND, RCX, BUS9_PAGE_MASK & align);
+	} else {
+		/* main ram accesses end the timeslice early */
+		int not_main_ram = e.new_label();
+		e.mov(4, RCX, RSI);
+		e.shift(4, SHIFT_SHR, RCX, BUS_TIMING_SHIFT);
+		e.alu_imm(4, ALU_CMP, RCX, 2);
+		e.jcc(CC_NE, not_main_ram);
+		e.mov_ptr(RAX, &cpu->nds->sc.ipc_activity);
+		e.mov_imm(1, mem(RAX), 1);
+		e.bind(not_main_ram);
+
+		e.mov(8, RAX, field(c, &cpu->data_tt));
+		e.movzx8(RDI, mem(RAX, RCX, 2, timing));
+		e.mov(4, RCX, RSI);
+		e.shift(4, SHIFT_SHR, RCX, BUS7_PAGE_SHIFT);
+		e.mov(8, RAX, field(c, store ? &cpu->write_pt : &cpu->read_pt));
+		e.mov(8, RAX, mem(RAX, RCX, 3));
+		e.test(8, RAX, RAX);
+		e.jcc(CC_E, slow);
+		e.mov(4, RCX, RSI);
+		e.alu_imm(4, ALU_AND, RCX, BUS7_PAGE_MASK & align);
+	}
+
+	if (store) {
+		int track = e.new_label();
+		int resume = e.new_label();
+
+		e.alu(8, ALU_ADD, RAX, RCX);
+		e.mov(size, mem(RAX), RDX);
+		e.mov_ptr(RCX, &cpu->nds->tracker.active);
+		e.alu_imm(1, ALU_CMP, mem(RCX), 0);
+		e.jcc(CC_NE, track);
+		e.bind(resume);
+		tail();
+		e.bind(join);
+
+		c->cold.push_back([=] {
+			auto& e = c->e;
+			auto *tracker = &c->cpu->nds->tracker;
+
+			e.bind(track);
+			emit_find_tracked_page(c, resume);
+			emit_call(c, (void *)on_tracked_page_write, RDI, [=] {
+				c->e.mov_ptr(RDI, tracker);
+				c->e.mov(4, RSI, RDX);
+				c->e.mov(4, RDX, RAX);
+			});
+			tail();
+			emit_generation_check(c, exit);
+			e.jmp(join);
+		});
+	} else {
+		x64_mem m = mem(RAX, RCX, 0);
+		if (size == 4) {
+			e.mov(4, RAX, m);
+		} else if (size == 2) {
+			sign ? e.movsx16(RAX, m) : e.movzx16(RAX, m);
+		} else {
+			sign ? e.movsx8(RAX, m) : e.movzx8(RAX, m);
+		}
+		tail();
+		e.bind(join);
+	}
+
+	const void *helper;
+	if (store) {
+		helper = size == 4   ? (void *)jit_store<CPUT, u32>
+		         : size == 2 ? (void *)jit_store<CPUT, u16>
+		                     : (void *)jit_store<CPUT, u8>;
+	} else if (size == 4) {
+		helper = (void *)jit_load<CPUT, u32>;
+	} else if (size == 2) {
+		helper = sign ? (void *)jit_load<CPUT, s16>
+		              : (void *)jit_load<CPUT, u16>;
+	} else {
+		helper = sign ? (void *)jit_load<CPUT, s8>
+		              : (void *)jit_load<CPUT, u8>;
+	}
+
+	c->cold.push_back([=] {
+		auto& e = c->e;
+
+		e.bind(slow);
+		emit_call(c, helper, store ? NO_REG : RSI, [=] {
+			c->e.mov(8, RDI, CPU_REG);
+			if (!store && size != 1) {
+				c->e.alu_imm(4, ALU_AND, RSI, align);
+			}
+		});
+		emit_exception_check(c, exit);
+		e.movzx8(RDI, field(c, &c->cpu->data_cycles));
+		tail();
+		emit_interrupt_check(c, irq);
+		emit_generation_check(c, exit);
+		e.jmp(join);
+	});
+}
+
+/* the data cycles are in edi */
+template <typename CPUT>
+static void
+add_data_cycles(jit_compiler<CPUT> *c, bool load)
+{
+	auto& e = c->e;
+	u32 code_cycles = c->inst->code_cycles;
+
+	if constexpr (std::is_same_v<CPUT, arm9_cpu>) {
+		e.mov_imm(RCX, code_cycles);
+		e.alu(4, ALU_CMP, RCX, RDI);
+		e.cmov(4, CC_B, RCX, RDI);
+		e.alu_imm(4, ALU_ADD, RCX, 1);
+		e.alu_imm(4, ALU_AND, RCX, ~1);
+	} else {
+		e.lea(4, RCX, mem(RDI, code_cycles + load));
+	}
+	add_cycles_rcx(c);
+}
+
+enum load_kind {
+	LOAD_WORD,
+	LOAD_WORD_ALIGNED,
+	LOAD_BYTE,
+	LOAD_SBYTE,
+	LOAD_HALF,
+	LOAD_SHALF,
+};
+
+/* loads from the address in esi into rd */
+template <typename CPUT>
+static void
+emit_load(jit_compiler<CPUT> *c, load_kind kind, u32 rd)
+{
+	auto& e = c->e;
+	constexpr bool arm9 = std::is_same_v<CPUT, arm9_cpu>;
+
+	auto finish = [=] {
+		store_reg(c, rd, RAX);
+		add_data_cycles(c, true);
+	};
+
+	switch (kind) {
+	case LOAD_WORD:
+		emit_memory_access(c, 4, false, false, [=] {
+			c->e.mov(4, RCX, RSI);
+			c->e.alu_imm(4, ALU_AND, RCX, 3);
+			c->e.shift(4, SHIFT_SHL, RCX, 3);
+			c->e.shift_cl(4, SHIFT_ROR, RAX);
+			finish();
+		});
+		break;
+	case LOAD_WORD_ALIGNED:
+		emit_memory_access(c, 4, false, false, finish);
+		break;
+	case LOAD_BYTE:
+	case LOAD_SBYTE:
+		emit_memory_access(c, 1, kind == LOAD_SBYTE, false, finish);
+		break;
+	case LOAD_HALF:
+		if (arm9) {
+			emit_memory_access(c, 2, false, false, finish);
+			break;
+		}
+
+		/* the arm7 rotates misaligned halfwords */
+		emit_memory_access(c, 2, false, false, [=] {
+			int aligned = c->e.new_label();
+			c->e.test_imm(4, RSI, 1);
+			c->e.jcc(CC_E, aligned);
+			c->e.shift(2, SHIFT_ROR, RAX, 8);
+			c->e.bind(aligned);
+			finish();
+		});
+		break;
+	case LOAD_SHALF:
+		if (arm9) {
+			emit_memory_access(c, 2, true, false, finish);
+			break;
+		}
+
+		/* and loads a signed byte from odd addresses */
+		int odd = e.new_label();
+		int done = e.new_label();
+		e.test_imm(4, RSI, 1);
+		e.jcc(CC_NE, odd);
+		emit_memory_access(c, 2, true, false, finish);
+		e.jmp(done);
+		e.bind(odd);
+		emit_memory_access(c, 1, true, false, finish);
+		e.bind(done);
+	}
+}
+
+/* stores edx to the address in esi, tail runs after the store */
+template <typename CPUT>
+static void
+emit_store(jit_compiler<CPUT> *c, int size,
+		const std::function<void()>& tail = {})
+{
+	emit_memory_access(c, size, false, true, [=] {
+		if (tail) {
+			tail();
+		}
+		add_data_cycles(c, false);
+	});
+}
+
+/* the offset of an arm load or store goes to ecx */
+template <typename CPUT>
+static void
+emit_arm_sdt_offset(jit_compiler<CPUT> *c, u32 opcode)
+{
+	bool U = opcode & BIT(23);
+
+	if (!(opcode & BIT(25))) {
+		u32 offset = opcode & 0xFFF;
+		c->e.mov_imm(RCX, U ? offset : -offset);
+		return;
+	}
+
+	u32 type = opcode >> 5 & 3;
+	u32 n = opcode >> 7 & 0x1F;
+	load_reg(c, RCX, opcode & 0xF);
+	if (type == 0 && n == 0) {
+		/* lsl #0 */
+	} else {
+		emit_shift_imm(c, type, n, false);
+	}
+	if (!U) {
+		c->e.unary(4, UNARY_NEG, RCX);
+	}
+}
+
+/*
+ * Computes the address of a load or store with the offset in ecx, and
+ * writes back the base of loads. Stores write back after the access, so
+ * their new base waits on the stack.
+ */
+template <typename CPUT>
+static void
+emit_address(jit_compiler<CPUT> *c, u32 opcode, bool load)
+{
+	auto& e = c->e;
+	bool P = opcode & BIT(24);
+	bool W = opcode & BIT(21);
+	u32 rn = opcode >> 16 & 0xF;
+
+	load_reg(c, RAX, rn);
+	if (P) {
+		e.lea(4, RSI, mem(RAX, RCX, 0));
+	} else {
+		e.mov(4, RSI, RAX);
+	}
+
+	if (W || !P) {
+		e.lea(4, RAX, mem(RAX, RCX, 0));
+		if (load) {
+			store_reg(c, rn, RAX);
+		} else {
+			e.mov(4, mem(RSP, TEMP_SLOT), RAX);
+		}
+	}
+}
+
+template <typename CPUT>
+static std::function<void()>
+get_writeback_tail(jit_compiler<CPUT> *c, u32 opcode)
+{
+	bool P = opcode & BIT(24);
+	bool W = opcode & BIT(21);
+	u32 rn = opcode >> 16 & 0xF;
+
+	if (!W && P) {
+		return {};
+	}
+
+	return [=] {
+		c->e.mov(4, RAX, mem(RSP, TEMP_SLOT));
+		store_reg(c, rn, RAX);
+	};
+}
+
+template <typename CPUT>
+static bool
+compile_arm_sdt(jit_compiler<CPUT> *c, u32 opcode)
+{
+	bool P = opcode & BIT(24);
+	bool B = opcode & BIT(22);
+	bool W = opcode & BIT(21);
+	bool L = opcode & BIT(20);
+	u32 rn = opcode >> 16 & 0xF;
+	u32 rd = opcode >> 12 & 0xF;
+
+	if (((W || !P) && rn == 15) || (L && rd == 15)) {
+		return false;
+	}
+
+	emit_arm_sdt_offset(c, opcode);
+	if (L) {
+		emit_address(c, opcode, true);
+		emit_load(c, B ? LOAD_BYTE : LOAD_WORD, rd);
+	} else {
+		if (rd == 15) {
+			c->e.mov_imm(RDX, get_pc(c) + 4);
+		} else {
+			load_reg(c, RDX, rd);
+		}
+		emit_address(c, opcode, false);
+		emit_store(c, B ? 1 : 4, get_writeback_tail(c, opcode));
+	}
+
+	return true;
+}
+
+template <typename CPUT>
+static bool
+compile_arm_misc_dt(jit_compiler<CPUT> *c, u32 opcode)
+{
+	bool P = opcode & BIT(24);
+	bool U = opcode & BIT(23);
+	bool I = opcode & BIT(22);
+	bool W = opcode & BIT(21);
+	bool L = opcode & BIT(20);
+	bool S = opcode & BIT(6);
+	bool H = opcode & BIT(5);
+	u32 rn = opcode >> 16 & 0xF;
+	u32 rd = opcode >> 12 & 0xF;
+
+	/* ldrd and strd */
+	if (!L && S) {
+		return false;
+	}
+
+	if (((W || !P) && rn == 15) || (L && rd == 15)) {
+		return false;
+	}
+
+	if (I) {
+		u32 offset = (opcode >> 4 & 0xF0) | (opcode & 0xF);
+		c->e.mov_imm(RCX, U ? offset : -offset);
+	} else {
+		load_reg(c, RCX, opcode & 0xF);
+		if (!U) {
+			c->e.unary(4, UNARY_NEG, RCX);
+		}
+	}
+
+	if (L) {
+		emit_address(c, opcode, true);
+		if (!S) {
+			emit_load(c, LOAD_HALF, rd);
+		} else {
+			emit_load(c, H ? LOAD_SHALF : LOAD_SBYTE, rd);
+		}
+	} else {
+		if (rd == 15) {
+			c->e.mov_imm(RDX, get_pc(c) + 4);
+		} else {
+			load_reg(c, RDX, rd);
+		}
+		emit_address(c, opcode, false);
+		emit_store(c, 2, get_writeback_tail(c, opcode));
+	}
+
+	return true;
+}
+
+/*
+ * Leaves the block for the jump target. The jump to the link stub can be
+ * replaced by a jump to the next block, so the registers are written back
+ * before it. The exit taken when the timeslice is over is never replaced.
+ */
+template <typename CPUT>
+static void
+emit_jump_stub(jit_compiler<CPUT> *c, u32 target, bool thumb, u8 *site)
+{
+	auto& e = c->e;
+
+	e.mov(8, mem(CYCLES_PTR_REG), CYCLES_REG);
+	e.mov(8, RDI, CPU_REG);
+	e.mov_imm(RSI, target);
+	e.mov_imm(RDX, thumb);
+	e.call((void *)jit_refill_pipeline<CPUT>);
+	if (site) {
+		e.mov_ptr(RAX, site);
+	} else {
+		e.mov_imm(RAX, EXIT_NORMAL);
+	}
+	e.jmp(c->jit->exit);
+}
+
+template <typename CPUT>
+static void
+emit_jump(jit_compiler<CPUT> *c, u32 target, bool thumb)
+{
+	auto& e = c->e;
+
+	/* the fetches only count towards the timestamp */
+	u32 fetch_cycles = get_jump_cycles(c->cpu, target, thumb);
+	if (fetch_cycles) {
+		e.alu_imm(8, ALU_ADD, CYCLES_REG, fetch_cycles);
+	}
+
+	int exit = e.new_label();
+	int stub = e.new_label();
+	emit_cycles_check(c, exit);
+	flush_regs(c);
+	u8 *site = e.jmp(stub);
+
+	c->cold.push_back([=] {
+		c->e.bind(exit);
+		flush_regs(c);
+		emit_jump_stub(c, target, thumb, nullptr);
+		c->e.bind(stub);
+		emit_jump_stub(c, target, thumb, site);
+	});
+}
+
+template <typename CPUT>
+static bool
+compile_arm_b(jit_compiler<CPUT> *c, u32 opcode)
+{
+	u32 pc = get_pc(c);
+
+	if (opcode & BIT(24)) {
+		c->e.mov_imm(RAX, pc - 4);
+		store_reg(c, 14, RAX);
+	}
+	add_cycles(c, c->inst->code_cycles);
+	emit_jump(c, pc + ((s32)(opcode << 8) >> 6), false);
+	c->block_done = true;
+
+	return true;
+}
+
+template <typename CPUT>
+static bool
+compile_arm_inst(jit_compiler<CPUT> *c, u32 opcode)
+{
+	u32 i = (opcode >> 16 & 0xFF0) | (opcode >> 4 & 0xF);
+
+	/* in the order of the interpreter lookup table */
+	if ((i & 0xFB0) == 0x300 || (i & 0xE01) == 0x601) {
+		return false;
+	}
+	if ((i & 0xE00) == 0xA00) {
+		return compile_arm_b(c, opcode);
+	}
+	if (i == 0x123 || i == 0x121) {
+		return false;
+	}
+	if ((i & 0xFCF) == 0x009) {
+		return compile_arm_multiply(c, opcode);
+	}
+	if ((i & 0xF8F) == 0x089) {
+		return compile_arm_multiply_long(c, opcode);
+	}
+	/* clz, psr transfers, swi, bkpt, dsp math and swp */
+	if (i == 0x161 || (i & 0xFBF) == 0x100 || (i & 0xFB0) == 0x320 ||
+			(i & 0xFBF) == 0x120 || (i & 0xF00) == 0xF00 ||
+			i == 0x127 || (i & 0xF9F) == 0x105 ||
+			(i & 0xF99) == 0x108 || (i & 0xFBF) == 0x109) {
+		return false;
+	}
+	if ((i & 0xE09) == 0x009 && (i & 0xF) != 0x9) {
+		return compile_arm_misc_dt(c, opcode);
+	}
+	if (i >> 10 == 1) {
+		return compile_arm_sdt(c, opcode);
+	}
+	/* block transfers and coprocessor instructions */
+	if (i >= 0x800) {
+		return false;
+	}
+	if ((i & 0xE00) == 0x200 || (i & 0xE01) == 0x000) {
+		return compile_arm_alu(c, opcode);
+	}
+
+	return false;
+}
+
+template <typename CPUT>
+static void
+compile_thumb_shift_reg(jit_compiler<CPUT> *c, u32 op, u32 rd)
+{
+	auto& e = c->e;
+	x64_mem cf = field(c, &c->cpu->flag_c);
+	int done = e.new_label();
+	int big = e.new_label();
+
+	/* the operand is in eax, the shift amount in cl */
+	e.movzx8(RCX, RCX);
+	e.test(4, RCX, RCX);
+	e.jcc(CC_E, done);
+
+	if (op == 7) {
+		e.test_imm(1, RCX, 0x1F);
+		e.jcc(CC_E, big);
+		e.shift_cl(4, SHIFT_ROR, RAX);
+		e.setcc(CC_B, cf);
+	} else {
+		x64_shift_op shift = op == 2   ? SHIFT_SHL
+		                     : op == 3 ? SHIFT_SHR
+		                               : SHIFT_SAR;
+		e.alu_imm(4, ALU_CMP, RCX, 32);
+		e.jcc(CC_AE, big);
+		e.shift_cl(4, shift, RAX);
+		e.setcc(CC_B, cf);
+	}
+	e.bind(done);
+	store_reg(c, rd, RAX);
+	emit_set_nz(c, RAX);
+
+	c->cold.push_back([=] {
+		auto& e = c->e;
+
+		e.bind(big);
+		switch (op) {
+		case 2:
+		case 3:
+		{
+			/* by 32 the carry is the last bit out, beyond it 0 */
+			int over = e.new_label();
+			e.jcc(CC_A, over);
+			if (op == 2) {
+				e.alu_imm(4, ALU_AND, RAX, 1);
+			} else {
+				e.shift(4, SHIFT_SHR, RAX, 31);
+			}
+			e.mov(1, cf, RAX);
+			e.alu(4, ALU_XOR, RAX, RAX);
+			e.jmp(done);
+			e.bind(over);
+			e.mov_imm(1, cf, 0);
+			e.alu(4, ALU_XOR, RAX, RAX);
+			e.jmp(done);
+			break;
+		}
+		case 4:
+			e.shift(4, SHIFT_SAR, RAX, 31);
+			e.mov(4, RDX, RAX);
+			e.alu_imm(4, ALU_AND, RDX, 1);
+			e.mov(1, cf, RDX);
+			e.jmp(done);
+			break;
+		default:
+			/* a multiple of 32 only sets the carry */
+			e.mov(4, RDX, RAX);
+			e.shift(4, SHIFT_SHR, RDX, 31);
+			e.mov(1, cf, RDX);
+			e.jmp(done);
+		}
+	});
+}
+
+template <typename CPUT>
+static bool
+compile_thumb_alu5(jit_compiler<CPUT> *c, u32 opcode)
+{
+	auto& e = c->e;
+	u32 op = opcode >> 6 & 0xF;
+	u32 rm = opcode >> 3 & 0x7;
+	u32 rd = opcode & 0x7;
+	u32 code_cycles = c->inst->code_cycles;
+
+	/* the arm data processing op each one works like */
+	static const u8 arm_ops[16] = {
+		OP_AND, OP_EOR, 0, 0, 0, OP_ADC, OP_SBC, 0, OP_TST, OP_SUB,
+		OP_CMP, OP_CMN, OP_ORR, 0, OP_BIC, OP_MVN,
+	};
+
+	load_reg(c, RAX, rd);
+	load_reg(c, RCX, rm);
+
+	switch (op) {
+	case 0x2:
+	case 0x3:
+	case 0x4:
+	case 0x7:
+		compile_thumb_shift_reg(c, op, rd);
+		add_cycles(c, code_cycles + 1);
+		return true;
+	case 0xD:
+		if constexpr (std::is_same_v<CPUT, arm9_cpu>) {
+			add_cycles(c, code_cycles + 3);
+		} else {
+			/* the cycles depend on the significant bytes of rd */
+			e.mov(4, RDX, RAX);
+			e.shift(4, SHIFT_SAR, RDX, 31);
+			e.alu(4, ALU_XOR, RDX, RAX);
+			e.mov_imm(RDI, code_cycles + 1);
+			for (u32 limit : { 0x100, 0x10000, 0x1000000 }) {
+				e.alu_imm(4, ALU_CMP, RDX, limit);
+				e.alu_imm(4, ALU_SBB, RDI, -1);
+			}
+			e.alu(8, ALU_ADD, CYCLES_REG, RDI);
+			e.alu(4, ALU_ADD, EXECUTED_REG, RDI);
+		}
+		e.imul(4, RAX, RCX);
+		store_reg(c, rd, RAX);
+		emit_set_nz(c, RAX);
+		return true;
+	case 0x9:
+		e.alu(4, ALU_XOR, RAX, RAX);
+		break;
+	}
+
+	u32 arm_op = arm_ops[op];
+	emit_alu_op(c, arm_op, true, CARRY_UNCHANGED);
+	if (!is_compare_op(arm_op)) {
+		store_reg(c, rd, RAX);
+	}
+	add_cycles(c, code_cycles);
+
+	return true;
+}
+
+template <typename CPUT>
+static bool
+compile_thumb_alu(jit_compiler<CPUT> *c, u32 opcode, u32 i)
+{
+	auto& e = c->e;
+	u32 code_cycles = c->inst->code_cycles;
+
+	if (i >> 5 == 0x3) {
+		/* add and sub with three operands */
+		u32 op = opcode >> 9 & 3;
+		u32 field3 = opcode >> 6 & 7;
+		load_reg(c, RAX, opcode >> 3 & 7);
+		if (op & 2) {
+			e.mov_imm(RCX, field3);
+		} else {
+			load_reg(c, RCX, field3);
+		}
+		emit_alu_op(c, op & 1 ? OP_SUB : OP_ADD, true,
+				CARRY_UNCHANGED);
+		store_reg(c, opcode & 7, RAX);
+	} else if (i >> 7 == 1) {
+		/* mov, cmp, add and sub with an 8 bit immediate */
+		static const u8 ops[4] = { OP_MOV, OP_CMP, OP_ADD, OP_SUB };
+		u32 op = ops[opcode >> 11 & 3];
+		u32 rd = opcode >> 8 & 7;
+		if (op != OP_MOV) {
+			load_reg(c, RAX, rd);
+		}
+		e.mov_imm(RCX, opcode & 0xFF);
+		emit_alu_op(c, op, true, CARRY_UNCHANGED);
+		if (op != OP_CMP) {
+			store_reg(c, rd, RAX);
+		}
+	} else if (i >> 7 == 0) {
+		/* shifts by an immediate */
+		load_reg(c, RCX, opcode >> 3 & 7);
+		carry_out carry = emit_shift_imm(
+				c, opcode >> 11 & 3, opcode >> 6 & 0x1F, true);
+		emit_alu_op(c, OP_MOV, true, carry);
+		store_reg(c, opcode & 7, RAX);
+	} else if (i >> 4 == 0x10) {
+		return compile_thumb_alu5(c, opcode);
+	} else if (i >> 6 == 0xA) {
+		/* add to pc or sp */
+		u32 offset = (opcode & 0xFF) << 2;
+		if (opcode & BIT(11)) {
+			load_reg(c, RAX, 13);
+			e.alu_imm(4, ALU_ADD, RAX, offset);
+		} else {
+			e.mov_imm(RAX, (get_pc(c) & ~3) + offset);
+		}
+		store_reg(c, opcode >> 8 & 7, RAX);
+	} else if (i >> 2 == 0xB0) {
+		/* adjust sp */
+		u32 offset = (opcode & 0x7F) << 2;
+		load_reg(c, RAX, 13);
+		e.alu_imm(4, opcode & BIT(7) ? ALU_SUB : ALU_ADD, RAX, offset);
+		store_reg(c, 13, RAX);
+	} else {
+		/* high register add, cmp and mov */
+		u32 op = opcode >> 8 & 3;
+		u32 rm = opcode >> 3 & 0xF;
+		u32 rd = (opcode >> 4 & 8) | (opcode & 7);
+		if (op != 1 && rd == 15) {
+			return false;
+		}
+
+		load_reg(c, RCX, rm);
+		if (op == 2) {
+			store_reg(c, rd, RCX);
+		} else {
+			load_reg(c, RAX, rd);
+			emit_alu_op(c, op ? OP_CMP : OP_ADD, op == 1,
+					CARRY_UNCHANGED);
+			if (op == 0) {
+				store_reg(c, rd, RAX);
+			}
+		}
+	}
+
+	add_cycles(c, code_cycles);
+	return true;
+}
+
+template <typename CPUT>
+static bool
+compile_thumb_load_store(jit_compiler<CPUT> *c, u32 opcode, u32 i)
+{
+	auto& e = c->e;
+	u32 rd = opcode & 7;
+
+	if (i >> 5 == 0x9) {
+		/* pc relative loads are always aligned */
+		rd = opcode >> 8 & 7;
+		e.mov_imm(RSI, (get_pc(c) & ~3) + ((opcode & 0xFF) << 2));
+		emit_load(c, LOAD_WORD_ALIGNED, rd);
+		return true;
+	}
+
+	int size;
+	bool load;
+	load_kind kind = LOAD_WORD;
+
+	if (i >> 6 == 0x9) {
+		/* sp relative */
+		rd = opcode >> 8 & 7;
+		load_reg(c, RSI, 13);
+		e.alu_imm(4, ALU_ADD, RSI, (opcode & 0xFF) << 2);
+		size = 4;
+		load = opcode & BIT(11);
+	} else if (i >> 6 == 0x5) {
+		/* register offset */
+		static const u8 sizes[8] = { 4, 2, 1, 1, 4, 2, 1, 2 };
+		static const u8 kinds[8] = { 0, 0, 0, LOAD_SBYTE, LOAD_WORD,
+			LOAD_HALF, LOAD_BYTE, LOAD_SHALF };
+		u32 op = opcode >> 9 & 7;
+		load_reg(c, RSI, opcode >> 3 & 7);
+		load_reg(c, RCX, opcode >> 6 & 7);
+		e.alu(4, ALU_ADD, RSI, RCX);
+		size = sizes[op];
+		load = op >= 3;
+		kind = (load_kind)kinds[op];
+	} else {
+		/* immediate offset, in units of the access size */
+		u32 op = opcode >> 11;
+		size = op >= 0x10 ? 2 : op >= 0xE ? 1 : 4;
+		load = op & 1;
+		kind = size == 4 ? LOAD_WORD : size == 2 ? LOAD_HALF
+		                                         : LOAD_BYTE;
+		load_reg(c, RSI, opcode >> 3 & 7);
+		e.alu_imm(4, ALU_ADD, RSI, (opcode >> 6 & 0x1F) * size);
+	}
+
+	if (load) {
+		emit_load(c, kind, rd);
+	} else {
+		load_reg(c, RDX, rd);
+		emit_store(c, size);
+	}
+
+	return true;
+}
+
+template <typename CPUT>
+static bool
+compile_thumb_branch(jit_compiler<CPUT> *c, u32 opcode, u32 i)
+{
+	auto& e = c->e;
+	u32 pc = get_pc(c);
+
+	add_cycles(c, c->inst->code_cycles);
+
+	if (i >> 6 == 0xD) {
+		u32 cond = opcode >> 8 & 0xF;
+		u32 target = pc + ((s16)(opcode << 8) >> 7);
+		if (cond == 0xE) {
+			emit_jump(c, target, true);
+			c->block_done = true;
+		} else {
+			int skip = e.new_label();
+			emit_cond_check(c, cond, skip);
+			emit_jump(c, target, true);
+			e.bind(skip);
+		}
+	} else if (i >> 5 == 0x1C) {
+		emit_jump(c, pc + ((s16)(opcode << 5) >> 4), true);
+		c->block_done = true;
+	} else {
+		u32 H = opcode >> 11 & 3;
+		u32 offset = (opcode & 0x7FF) << 1;
+		if (H == 2) {
+			c->lr_value_next = pc + ((s32)(opcode << 21) >> 9);
+			c->lr_known_next = true;
+			e.mov_imm(RAX, c->lr_value_next);
+			store_reg(c, 14, RAX);
+			return true;
+		}
+
+		e.mov_imm(RAX, (pc - 2) | 1);
+		store_reg(c, 14, RAX);
+		if (H == 3) {
+			emit_jump(c, (c->lr_value + offset) & ~1, true);
+		} else {
+			e.alu_imm(4, ALU_AND, field(c, &c->cpu->cpsr), ~0x20);
+			emit_jump(c, (c->lr_value + offset) & ~3, false);
+		}
+		c->block_done = true;
+	}
+
+	return true;
+}
+
+template <typename CPUT>
+static bool
+compile_thumb_inst(jit_compiler<CPUT> *c, u32 opcode)
+{
+	u32 i = opcode >> 6 & 0x3FF;
+
+	/* in the order of the interpreter lookup table */
+	if (i >> 2 == 0xDE || i >> 2 == 0xDF || i >> 2 == 0xBE) {
+		return false;
+	}
+	if (i >> 6 == 0xD || i >> 5 == 0x1C) {
+		return compile_thumb_branch(c, opcode, i);
+	}
+	if (i >> 7 == 0x7) {
+		u32 H = opcode >> 11 & 3;
+		bool arm9 = std::is_same_v<CPUT, arm9_cpu>;
+		if (H == 2 || (c->lr_known && (H == 3 || (H == 1 && arm9)))) {
+			return compile_thumb_branch(c, opcode, i);
+		}
+		return false;
+	}
+	if (i >> 1 == 0x8E || i >> 1 == 0x8F) {
+		return false;
+	}
+	if (i >> 5 == 0x3 || i >> 7 == 0x1 || i >> 7 == 0x0 ||
+			i >> 4 == 0x10 || i >> 6 == 0xA || i >> 2 == 0xB0 ||
+			i >> 4 == 0x11) {
+		return compile_thumb_alu(c, opcode, i);
+	}
+	if (i >> 7 == 0x3 || i >> 6 == 0x8 || i >> 6 == 0x5 ||
+			i >> 5 == 0x9 || i >> 6 == 0x9) {
+		return compile_thumb_load_store(c, opcode, i);
+	}
+
+	return false;
+}
+
+/* runs an instruction with the interpreter */
+template <typename CPUT>
+static void
+emit_interpreter_call(jit_compiler<CPUT> *c)
+{
+	auto& e = c->e;
+	auto *cpu = c->cpu;
+	auto *inst = c->inst;
+	u32 pc = get_pc(c);
+
+	flush_regs(c);
+	store_exit_state(c, pc, inst->pipeline);
+	e.mov_imm(4, field(c, &cpu->opcode), inst->opcode);
+	e.mov_imm(1, field(c, &cpu->code_cycles), inst->code_cycles);
+	e.mov(8, mem(CYCLES_PTR_REG), CYCLES_REG);
+	e.mov(8, RDI, CPU_REG);
+	e.mov_ptr(RSI, (const void *)inst->fn);
+	e.call((void *)jit_interpret<CPUT>);
+	e.mov(8, CYCLES_REG, mem(CYCLES_PTR_REG));
+
+	emit_exception_check(c, get_plain_exit_label(c, false));
+	reload_regs(c);
+	emit_interrupt_check(c, get_plain_exit_label(c, true));
+	e.alu_imm(4, ALU_CMP, gpr_mem(c, 15), pc);
+	e.jcc(CC_NE, get_plain_exit_label(c, false));
+	emit_generation_check(c, get_plain_exit_label(c, false));
+}
+
+template <typename CPUT>
+static void
+compile_inst(jit_compiler<CPUT> *c)
+{
+	auto& e = c->e;
+	u32 opcode = c->inst->opcode;
+	u32 cond = c->inst->cond;
+
+	c->exit_label = -1;
+	c->irq_label = -1;
+	c->block_done = false;
+	c->lr_known = c->lr_known_next;
+	c->lr_value = c->lr_value_next;
+	c->lr_known_next = false;
+
+	if (cond == 0xF) {
+		add_cycles(c, c->inst->code_cycles);
+		emit_cycles_check(c, get_exit_label(c));
+		return;
+	}
+
+	int skip = -1;
+	if (cond != 0xE) {
+		skip = e.new_label();
+		emit_cond_check(c, cond, skip);
+	}
+
+	/* thumb opcodes have the next halfword in the upper bits */
+	bool native = c->thumb ? compile_thumb_inst(c, opcode & 0xFFFF)
+	                       : compile_arm_inst(c, opcode);
+	if (!native) {
+		emit_interpreter_call(c);
+	}
+
+	if (skip >= 0) {
+		int done = e.new_label();
+		if (!c->block_done) {
+			e.jmp(done);
+		}
+		e.bind(skip);
+		add_cycles(c, c->inst->code_cycles);
+		e.bind(done);
+		c->block_done = false;
+	}
+
+	if (!c->block_done) {
+		emit_cycles_check(c, get_exit_label(c));
+	}
+}
+
+/* the guest registers the block uses most get host registers */
+template <typename CPUT>
+static void
+allocate_regs(jit_compiler<CPUT> *c)
+{
+	u32 uses[16]{};
+
+	for (auto& inst : c->block->insts) {
+		u32 op = inst.opcode;
+		if (c->thumb) {
+			op &= 0xFFFF;
+			uses[op & 7]++;
+			uses[op >> 3 & 7]++;
+			if (op >> 12 >= 0x9 && op >> 12 <= 0xB) {
+				uses[op >> 8 & 7]++;
+				uses[13]++;
+			} else if (op >> 11 >= 0x4 && op >> 11 <= 0x7) {
+				uses[op >> 8 & 7]++;
+			} else if (op >> 13 == 0x7) {
+				uses[14]++;
+			}
+		} else if ((op >> 26 & 3) <= 1) {
+			uses[op & 0xF]++;
+			uses[op >> 12 & 0xF]++;
+			uses[op >> 16 & 0xF]++;
+		}
+	}
+	uses[15] = 0;
+
+	std::fill(std::begin(c->regs), std::end(c->regs), NO_REG);
+	for (x64_reg host : alloc_regs) {
+		u32 best = 15;
+		for (u32 r = 0; r < 15; r++) {
+			if (c->regs[r] == NO_REG && uses[r] >= 2 &&
+					uses[r] > uses[best]) {
+				best = r;
+			}
+		}
+		if (best == 15) {
+			break;
+		}
+
+		c->regs[best] = host;
+		uses[best] = 0;
+		if (host >= R8 && host <= R11) {
+			c->volatile_regs.push_back(host);
+		}
+	}
+}
+
+template <typename CPUT>
+static u8 *
+compile_block(jit_compiler<CPUT> *c)
+{
+	auto& e = c->e;
+	auto& insts = c->block->insts;
+	u8 *code = e.p;
+
+	allocate_regs(c);
+
+	e.mov(8, RAX, field(c, &c->cpu->blocks.generation));
+	e.mov(8, mem(RSP, GENERATION_SLOT), RAX);
+	reload_regs(c);
+
+	for (size_t i = 0; i < insts.size(); i++) {
+		c->inst = &insts[i];
+		c->inst_addr = c->addr + i * c->size;
+		compile_inst(c);
+		if (c->block_done) {
+			break;
+		}
+	}
+
+	if (!c->block_done) {
+		/* falls through to the next block */
+		int stub = e.new_label();
+		flush_regs(c);
+		u8 *site = e.jmp(stub);
+		e.bind(stub);
+		store_exit_state(c, get_pc(c), c->inst->pipeline);
+		e.mov_ptr(RAX, site);
+		e.jmp(c->jit->exit);
+	}
+
+	/* the list can grow while it is emitted */
+	for (size_t i = 0; i < c->cold.size(); i++) {
+		auto fn = std::move(c->cold[i]);
+		fn();
+	}
+
+	return code;
+}
+
+template <typename CPUT>
+static bool
+init_code_cache(CPUT *cpu)
+{
+	auto& jit = cpu->blocks.jit;
+
+	void *p = mmap(nullptr, JIT_CODE_CACHE_SIZE,
+			PROT_READ | PROT_WRITE | PROT_EXEC,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		return false;
+	}
+
+	jit.base = (u8 *)p;
+	jit.end = jit.base + JIT_CODE_CACHE_SIZE;
+
+	x64_emitter e;
+	e.p = jit.base;
+	e.end = jit.end;
+	s32 cycles = (u8 *)&cpu->cycles - (u8 *)cpu;
+	s32 executed = (u8 *)&cpu->cycles_executed - (u8 *)cpu;
+
+	/* u64 enter(cpu, code) */
+	jit.enter = e.p;
+	for (x64_reg r : { RBX, RBP, R12, R13, R14, R15 }) {
+		e.push(r);
+	}
+	e.alu_imm(8, ALU_SUB, RSP, STACK_SIZE);
+	e.mov(8, CPU_REG, RDI);
+	e.mov(8, CYCLES_PTR_REG, mem(CPU_REG, cycles));
+	e.mov(8, CYCLES_REG, mem(CYCLES_PTR_REG));
+	e.alu(4, ALU_XOR, EXECUTED_REG, EXECUTED_REG);
+	e.op_rr(4, 0xFF, 4, RSI);
+
+	/* blocks jump here with the return value in rax */
+	jit.exit = e.p;
+	e.mov(8, mem(CYCLES_PTR_REG), CYCLES_REG);
+	e.alu(4, ALU_ADD, mem(CPU_REG, executed), EXECUTED_REG);
+	e.alu_imm(8, ALU_ADD, RSP, STACK_SIZE);
+	for (x64_reg r : { R15, R14, R13, R12, RBP, RBX }) {
+		e.pop(r);
+	}
+	e.ret();
+
+	jit.blocks_start = e.p;
+	jit.free = e.p;
+
+	return true;
+}
+
+template <typename CPUT>
+bool
+jit_compile_block(CPUT *cpu, arm_block<CPUT> *block, u32 addr, bool thumb)
+{
+	auto& jit = cpu->blocks.jit;
+
+	if (jit.unavailable) {
+		return true;
+	}
+
+	if (!jit.base && !init_code_cache(cpu)) {
+		LOG("jit: could not allocate the code cache\n");
+		jit.unavailable = true;
+		return true;
+	}
+
+	jit_compiler<CPUT> c;
+	c.cpu = cpu;
+	c.block = block;
+	c.jit = &jit;
+	c.addr = addr;
+	c.thumb = thumb;
+	c.size = thumb ? 2 : 4;
+	c.e.p = jit.free;
+	c.e.end = jit.end;
+
+	u8 *code = compile_block(&c);
+	if (c.e.overflow) {
+		/* start over with an empty cache */
+		invalidate_all_blocks(cpu->nds, cpu->cpuid);
+		return false;
+	}
+
+	block->code = code;
+	jit.free = (u8 *)(((uintptr_t)c.e.p + 15) & ~(uintptr_t)15);
+
+	return true;
+}
+
+template <typename CPUT>
+void
+jit_run_block(CPUT *cpu, arm_block<CPUT> *block, u32 addr, bool thumb)
+{
+	auto& cache = cpu->blocks;
+	auto& jit = cache.jit;
+
+	/*
+	 * The previous block left through a link stub to this one, so the
+	 * stub can be replaced with a jump. Idle loops are not linked to, so
+	 * that the dispatcher sees every iteration.
+	 */
+	if (jit.pending_jump && jit.pending_key == (addr | thumb) &&
+			jit.pending_generation == cache.generation &&
+			!block->idle_loop) {
+		u8 *stub = jit.pending_jump + 4 +
+		           (s32)readarr<u32>(jit.pending_jump, 0);
+		block->jit_links.push_back({ jit.pending_jump, stub });
+		x64_emitter::patch_rel32(jit.pending_jump, block->code);
+	}
+	jit.pending_jump = nullptr;
+
+	auto enter = (uintptr_t(*)(CPUT *, u8 *))jit.enter;
+	uintptr_t ret = enter(cpu, block->code);
+
+	if (jit.threw) {
+		jit.threw = false;
+		std::rethrow_exception(std::exchange(jit.exception, nullptr));
+	}
+
+	if (ret == EXIT_IRQ) {
+		arm_do_irq(cpu);
+	} else if (ret != EXIT_NORMAL && !block->idle_loop) {
+		bool next_thumb = cpu->cpsr & 0x20;
+		jit.pending_jump = (u8 *)ret;
+		jit.pending_key = (cpu->pc() - (next_thumb ? 2 : 4)) |
+		                  next_thumb;
+		jit.pending_generation = cache.generation;
+	}
+}
+
+void
+jit_unlink_block(const std::vector<jit_link>& links)
+{
+	for (auto& link : links) {
+		x64_emitter::patch_rel32(link.jump, link.stub);
+	}
+}
+
+void
+jit_reset_code_cache(jit_code_cache *jit)
+{
+	jit->free = jit->blocks_start;
+	jit->pending_jump = nullptr;
+}
+
+void
+jit_destroy(nds_ctx *nds)
+{
+	auto destroy = [](jit_code_cache *jit) {
+		if (jit->base) {
+			munmap(jit->base, JIT_CODE_CACHE_SIZE);
+			*jit = {};
+		}
+	};
+
+	if (nds->arm9) {
+		destroy(&nds->arm9->blocks.jit);
+	}
+	if (nds->arm7) {
+		destroy(&nds->arm7->blocks.jit);
+	}
+}
+
+} // namespace twice
+
+#else
+
+namespace twice {
+
+template <typename CPUT>
+bool
+jit_compile_block(CPUT *, arm_block<CPUT> *, u32, bool)
+{
+	return true;
+}
+
+template <typename CPUT>
+void
+jit_run_block(CPUT *, arm_block<CPUT> *, u32, bool)
+{
+}
+
+void
+jit_unlink_block(const std::vector<jit_link>&)
+{
+}
+
+void
+jit_reset_code_cache(jit_code_cache *)
+{
+}
+
+void
+jit_destroy(nds_ctx *)
+{
+}
+
+} // namespace twice
+
+#endif
+
+namespace twice {
+
+template bool jit_compile_block(arm9_cpu *cpu, arm_block<arm9_cpu> *block,
+		u32 addr, bool thumb);
+template bool jit_compile_block(arm7_cpu *cpu, arm_block<arm7_cpu> *block,
+		u32 addr, bool thumb);
+template void jit_run_block(arm9_cpu *cpu, arm_block<arm9_cpu> *block,
+		u32 addr, bool thumb);
+template void jit_run_block(arm7_cpu *cpu, arm_block<arm7_cpu> *block,
+		u32 addr, bool thumb);
+
+} // namespace twice
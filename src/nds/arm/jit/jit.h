@@ -0,0 +1,72 @@
+#ifndef TWICE_ARM_JIT_H
+#define TWICE_ARM_JIT_H
+
+#include "common/types.h"
+#include "common/util.h"
+
+#include <exception>
+#include <vector>
+
+#if defined(__linux__) && defined(__x86_64__)
+#define TWICE_HAVE_JIT 1
+#endif
+
+namespace twice {
+
+struct nds_ctx;
+
+template <typename CPUT>
+struct arm_block;
+
+enum : u32 {
+	JIT_CODE_CACHE_SIZE = 32_MiB,
+};
+
+/*
+ * A jump at the end of a block that was patched to go to the next block
+ * directly instead of returning to the dispatcher. stub is where it went
+ * before, and where it goes again when the next block is invalidated.
+ */
+struct jit_link {
+	u8 *jump;
+	u8 *stub;
+};
+
+/*
+ * The native code of the blocks of one cpu. The code of a block is only
+ * overwritten after the whole cache is cleared, so a block that invalidates
+ * itself can still run to the end of the instruction that did it.
+ */
+struct jit_code_cache {
+	u8 *base{};
+	u8 *free{};
+	u8 *end{};
+
+	/* the code shared by all blocks, at the start of the cache */
+	u8 *enter{};
+	u8 *exit{};
+	u8 *blocks_start{};
+
+	/* the last block returned through a link stub */
+	u8 *pending_jump{};
+	u32 pending_key{};
+	u64 pending_generation{};
+
+	/* raised by the interpreter, and rethrown once the block returns */
+	std::exception_ptr exception;
+	bool threw{};
+	bool unavailable{};
+};
+
+template <typename CPUT>
+bool jit_compile_block(
+		CPUT *cpu, arm_block<CPUT> *block, u32 addr, bool thumb);
+template <typename CPUT>
+void jit_run_block(CPUT *cpu, arm_block<CPUT> *block, u32 addr, bool thumb);
+void jit_unlink_block(const std::vector<jit_link>& links);
+void jit_reset_code_cache(jit_code_cache *jit);
+void jit_destroy(nds_ctx *nds);
+
+} // namespace twice
+
+#endif
@@ -7,6 +7,10 @@
 namespace twice {
 
 static void check_window_y_bounds(gpu_2d_engine *gpu, u32 y);
+static void save_scanline(nds_ctx *nds, u32 y);
+static void start_line_batch(nds_ctx *nds);
+static void wait_for_line_batch(gpu_2d_render_queue *q);
+static void draw_line_batch(void *data, int engineid);
 
 void
 gpu2d_init(nds_ctx *nds)
@@ -21,6 +25,14 @@ gpu2d_init(nds_ctx *nds)
 	gpu_b->nds = nds;
 	gpu_b->engineid = 1;
 	gpu_b->palette_offset = 0x400;
+
+	for (int i = 0; i < 2; i++) {
+		gpu_2d_engine *copy = &nds->gpu2d_queue.engines[i];
+		copy->nds = nds;
+		copy->engineid = i;
+		copy->palette_offset = nds->gpu2d[i].palette_offset;
+		tile_cache_init(&nds->gpu2d_tiles[i], i);
+	}
 }
 
 u8
@@ -337,8 +349,18 @@ gpu_on_scanline_start(nds_ctx *nds)
 	}
 
 	if (y < 192) {
-		render_scanline(gpu_a, y);
-		render_scanline(gpu_b, y);
+		if (nds->config->threaded_2d) {
+			save_scanline(nds, y);
+		} else {
+			/* threaded_2d may have been turned off mid frame */
+			gpu2d_wait_for_lines(nds);
+			render_scanline(gpu_a, y);
+			render_scanline(gpu_b, y);
+		}
+	}
+
+	if (y == 192) {
+		gpu2d_wait_for_lines(nds);
 	}
 
 	if (y == 192 && gpu_a->display_capture) {
@@ -366,4 +388,105 @@ check_window_y_bounds(gpu_2d_engine *gpu, u32 y)
 	}
 }
 
+static void
+save_scanline(nds_ctx *nds, u32 y)
+{
+	auto& q = nds->gpu2d_queue;
+
+	/* the lines before were drawn, or threaded_2d was just turned on */
+	if (!q.busy) {
+		q.num_started = y;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		q.line_unchanged[i][y] = save_scanline_registers(
+				&nds->gpu2d[i], y, &q.line_regs[i][y]);
+	}
+	q.num_saved = y + 1;
+	q.busy = true;
+
+	if (q.num_saved - q.num_started == GPU2D_LINES_PER_BATCH ||
+			y == 191) {
+		start_line_batch(nds);
+	}
+}
+
+/*
+ * Draws the lines saved so far and waits for them. Must be called before
+ * changing VRAM, palette or OAM, or the mapping of VRAM.
+ */
+void
+gpu2d_wait_for_lines(nds_ctx *nds)
+{
+	auto& q = nds->gpu2d_queue;
+	if (!q.busy) {
+		return;
+	}
+
+	start_line_batch(nds);
+	wait_for_line_batch(&q);
+	q.busy = false;
+}
+
+static void
+start_line_batch(nds_ctx *nds)
+{
+	auto& q = nds->gpu2d_queue;
+	wait_for_line_batch(&q);
+
+	if (q.num_started == q.num_saved) {
+		return;
+	}
+
+	/* the render threads must not wait for the 3D engine themselves */
+	re_wait_for_frame(&nds->gpu3d.re);
+
+	q.batch_start = q.num_started;
+	q.batch_end = q.num_saved;
+	q.num_started = q.num_saved;
+	thread_pool_resize(&q.pool, 2);
+	thread_pool_start(&q.pool, 2, draw_line_batch, nds);
+	q.pending = true;
+}
+
+static void
+wait_for_line_batch(gpu_2d_render_queue *q)
+{
+	if (!q->pending) {
+		return;
+	}
+
+	thread_pool_wait(&q->pool);
+	q->pending = false;
+
+	for (auto& e : q->errors) {
+		if (e) {
+			std::exception_ptr error = e;
+			e = nullptr;
+			std::rethrow_exception(error);
+		}
+	}
+}
+
+static void
+draw_line_batch(void *data, int engineid)
+{
+	nds_ctx *nds = (nds_ctx *)data;
+	auto& q = nds->gpu2d_queue;
+	gpu_2d_engine *gpu = &q.engines[engineid];
+
+	try {
+		for (u32 y = q.batch_start; y < q.batch_end; y++) {
+			if (q.line_unchanged[engineid][y])
+				continue;
+
+			gpu_2d_registers& regs = *gpu;
+			regs = q.line_regs[engineid][y];
+			draw_scanline(gpu, y);
+		}
+	} catch (...) {
+		q.errors[engineid] = std::current_exception();
+	}
+}
+
 } // namespace twice
@@ -1,6 +1,9 @@
 #ifndef TWICE_GPU2D_H
 #define TWICE_GPU2D_H
 
+#include <exception>
+
+#include "common/thread_pool.h"
 #include "common/types.h"
 #include "common/util.h"
 
@@ -10,7 +13,8 @@ namespace twice {
 
 struct nds_ctx;
 
-struct gpu_2d_engine {
+/* the state of a 2D engine that can change from one line to the next */
+struct gpu_2d_registers {
 	u32 dispcnt{};
 	u16 bg_cnt[4]{};
 	u16 bg_hofs[4]{};
@@ -43,6 +47,13 @@ struct gpu_2d_engine {
 	bool display_capture{};
 	u32 dispcapcnt{};
 	bool window_y_in_range[2]{};
+	u32 *fb{};
+	bool enabled{};
+
+	bool operator==(const gpu_2d_registers&) const = default;
+};
+
+struct gpu_2d_engine : gpu_2d_registers {
 	bool window_enabled[3]{};
 	bool window_any_enabled{};
 	u8 window_bits[4]{};
@@ -73,12 +84,78 @@ struct gpu_2d_engine {
 	std::array<u32, 256> obj_attr{};
 	u32 palette_offset{};
 
-	u32 *fb{};
-	bool enabled{};
 	nds_ctx *nds{};
 	int engineid{};
 };
 
+/*
+ * The sprites of an engine that are on each visible line, one bit per
+ * sprite. The bins are rebuilt from OAM before drawing a line after the
+ * emulator writes OAM, which it only does once the 2D lines are drawn.
+ */
+struct gpu_2d_sprite_bins {
+	u64 lines[192][2]{};
+	bool dirty{ true };
+};
+
+/* what the output of a line is drawn from */
+struct gpu_2d_line_key {
+	gpu_2d_registers regs;
+	u64 vram_gen[2]{};
+	u64 palette_gen[2]{};
+	u64 oam_gen{};
+	u64 frame_3d{};
+
+	bool operator==(const gpu_2d_line_key&) const = default;
+};
+
+/*
+ * The inputs each line of an engine was last drawn from. When a line has
+ * the same inputs in the next frame, it is not drawn again, since its
+ * output is still in the framebuffer. The generations count writes to the
+ * BG and OBJ parts of the VRAM and palette of the engine, and to its OAM.
+ * Lines that are captured or not drawn from the 2D layers are always
+ * drawn.
+ */
+struct gpu_2d_line_memo {
+	std::array<gpu_2d_line_key, 192> keys{};
+	std::array<bool, 192> valid{};
+	u64 vram_gen[2]{};
+	u64 palette_gen[2]{};
+	u64 oam_gen{};
+	/* lines started, and those that kept the last output */
+	u64 lines{};
+	u64 lines_reused{};
+};
+
+enum : u32 {
+	/* lines saved before they are handed to the render threads */
+	GPU2D_LINES_PER_BATCH = 32,
+};
+
+/*
+ * With threaded_2d, the registers of both engines are saved as each line
+ * starts, and batches of lines are drawn by a thread pool on copies of the
+ * engines, one task per engine. The emulation thread waits for the lines
+ * saved so far before it changes memory that the renderer reads.
+ */
+struct gpu_2d_render_queue {
+	std::array<gpu_2d_registers, 192> line_regs[2];
+	/* the saved lines that kept the last output and are not drawn */
+	std::array<bool, 192> line_unchanged[2];
+	gpu_2d_engine engines[2];
+	std::exception_ptr errors[2];
+	u32 num_saved{};
+	u32 num_started{};
+	/* the lines the thread pool is drawing */
+	u32 batch_start{};
+	u32 batch_end{};
+	bool pending{};
+	/* set while there are saved lines that are not drawn yet */
+	bool busy{};
+	thread_pool pool;
+};
+
 void gpu2d_init(nds_ctx *nds);
 u8 gpu_2d_read8(gpu_2d_engine *gpu, u8 offset);
 u16 gpu_2d_read16(gpu_2d_engine *gpu, u8 offset);
@@ -87,6 +164,7 @@ void gpu_2d_write8(gpu_2d_engine *gpu, u8 offset, u8 value);
 void gpu_2d_write16(gpu_2d_engine *gpu, u8 offset, u16 value);
 void gpu_2d_write32(gpu_2d_engine *gpu, u8 offset, u32 value);
 void gpu_on_scanline_start(nds_ctx *nds);
+void gpu2d_wait_for_lines(nds_ctx *nds);
 
 } // namespace twice
 
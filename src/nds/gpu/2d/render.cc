@@ -1,15 +1,21 @@
 #include "nds/nds.h"
 
+#include "common/cpu.h"
 #include "nds/gpu/2d/render.h"
 #include "nds/mem/vram.h"
 
 namespace twice {
 
 static void check_internal_regs(gpu_2d_engine *gpu, u32 y);
+static bool check_line_memo(gpu_2d_engine *gpu, u32 y);
 static void update_internal_regs(gpu_2d_engine *gpu);
 static void render_output_line(gpu_2d_engine *gpu, u32 y);
 static void render_vram_line(gpu_2d_engine *gpu, u32 y);
 static void capture_display(gpu_2d_engine *gpu, u32 y);
+static void write_fb_line(gpu_2d_engine *gpu, u32 y);
+#ifdef TWICE_HAVE_AVX2
+static void write_fb_line_avx2(gpu_2d_engine *gpu, u32 y);
+#endif
 static void apply_master_brightness(gpu_2d_engine *gpu);
 static u8 *get_lcdc_pointer_checked(nds_ctx *nds, int bank);
 static u8 *get_lcdc_pointer_unchecked(nds_ctx *nds, int bank);
@@ -18,18 +24,39 @@ void
 render_scanline(gpu_2d_engine *gpu, u32 y)
 {
 	check_internal_regs(gpu, y);
+	if (!check_line_memo(gpu, y)) {
+		draw_scanline(gpu, y);
+	}
+	update_internal_regs(gpu);
+}
+
+/*
+ * Does what render_scanline does to the registers of the engine, and saves
+ * them for drawing the line later. Returns true if the line kept the
+ * output of the last frame and does not need to be drawn.
+ */
+bool
+save_scanline_registers(gpu_2d_engine *gpu, u32 y, gpu_2d_registers *regs)
+{
+	check_internal_regs(gpu, y);
+	*regs = *gpu;
+	bool unchanged = check_line_memo(gpu, y);
+	update_internal_regs(gpu);
 
+	return unchanged;
+}
+
+void
+draw_scanline(gpu_2d_engine *gpu, u32 y)
+{
 	if (gpu->enabled) {
+		tile_cache_sync(gpu);
 		render_output_line(gpu, y);
-		std::transform(gpu->output_line.begin(),
-				gpu->output_line.end(), gpu->fb + 256 * y,
-				pack_to_bgr888);
+		write_fb_line(gpu, y);
 	} else {
 		std::fill(gpu->fb + 256 * y, gpu->fb + 256 * (y + 1),
 				0xFFFFFFFF);
 	}
-
-	update_internal_regs(gpu);
 }
 
 static void
@@ -72,6 +99,46 @@ check_internal_regs(gpu_2d_engine *gpu, u32 y)
 	}
 }
 
+/*
+ * Returns true if the line has the same inputs as when it was last drawn,
+ * in which case its output is still in the framebuffer. Both engines draw
+ * every line, and the screens they draw to only swap for both at once,
+ * so nothing else writes the line in between.
+ */
+static bool
+check_line_memo(gpu_2d_engine *gpu, u32 y)
+{
+	nds_ctx *nds = gpu->nds;
+	auto& memo = nds->gpu2d_memo[gpu->engineid];
+	memo.lines++;
+
+	u32 display_mode = gpu->dispcnt >> 16 & 3;
+	if (!gpu->enabled || display_mode > 1 || gpu->display_capture) {
+		memo.valid[y] = false;
+		return false;
+	}
+
+	gpu_2d_line_key key;
+	key.regs = *gpu;
+	key.vram_gen[0] = memo.vram_gen[0];
+	key.vram_gen[1] = memo.vram_gen[1];
+	key.palette_gen[0] = memo.palette_gen[0];
+	key.palette_gen[1] = memo.palette_gen[1];
+	key.oam_gen = memo.oam_gen;
+	if (gpu->engineid == 0 && (gpu->dispcnt & 0x108) == 0x108) {
+		key.frame_3d = nds->gpu3d.re.frame_id;
+	}
+
+	if (memo.valid[y] && memo.keys[y] == key) {
+		memo.lines_reused++;
+		return true;
+	}
+
+	memo.keys[y] = key;
+	memo.valid[y] = true;
+	return false;
+}
+
 static void
 update_internal_regs(gpu_2d_engine *gpu)
 {
@@ -115,8 +182,6 @@ render_output_line(gpu_2d_engine *gpu, u32 y)
 	if (gpu->display_capture) {
 		capture_display(gpu, y);
 	}
-
-	apply_master_brightness(gpu);
 }
 
 static void
@@ -147,10 +212,16 @@ capture_display(gpu_2d_engine *gpu, u32 y)
 		return;
 
 	u32 capture_src = gpu->dispcapcnt >> 29 & 3;
-	color4 *src_a = gpu->dispcapcnt & BIT(24)
-	                                ? gpu->nds->gpu3d.re.color_buf[0][y]
-	                                                  .data()
-	                                : gpu->gfx_line.data();
+	color4 *src_a = gpu->gfx_line.data();
+	color4 line_3d[256];
+	if (gpu->dispcapcnt & BIT(24)) {
+		re_wait_for_frame(&gpu->nds->gpu3d.re);
+		auto& pixels = gpu->nds->gpu3d.re.pixels[y];
+		for (u32 i = 0; i < 256; i++) {
+			line_3d[i] = pixels[i].color[0];
+		}
+		src_a = line_3d;
+	}
 	u16 src_b[256]{};
 
 	if (capture_src != 0) {
@@ -219,6 +290,73 @@ capture_display(gpu_2d_engine *gpu, u32 y)
 	}
 }
 
+/* applies master brightness to the output line and packs it to fb */
+static void
+write_fb_line(gpu_2d_engine *gpu, u32 y)
+{
+#ifdef TWICE_HAVE_AVX2
+	if (use_avx2) {
+		write_fb_line_avx2(gpu, y);
+		return;
+	}
+#endif
+	apply_master_brightness(gpu);
+	std::transform(gpu->output_line.begin(), gpu->output_line.end(),
+			gpu->fb + 256 * y, pack_to_bgr888);
+}
+
+#ifdef TWICE_HAVE_AVX2
+[[gnu::target("avx2")]] static __m256i
+master_brightness_channels(__m256i c, u32 mode, __m256i k)
+{
+	switch (mode) {
+	case 1:
+	{
+		__m256i d = _mm256_sub_epi16(_mm256_set1_epi16(0x3F), c);
+		d = _mm256_srli_epi16(_mm256_mullo_epi16(d, k), 4);
+		return _mm256_add_epi16(c, d);
+	}
+	case 2:
+	{
+		__m256i d = _mm256_srli_epi16(_mm256_mullo_epi16(c, k), 4);
+		return _mm256_sub_epi16(c, d);
+	}
+	default:
+		return c;
+	}
+}
+
+/* (c * 259 + 33) >> 6 as in pack_to_bgr888 */
+[[gnu::target("avx2")]] static __m256i
+expand_channels(__m256i c)
+{
+	c = _mm256_mullo_epi16(c, _mm256_set1_epi16(259));
+	c = _mm256_add_epi16(c, _mm256_set1_epi16(33));
+	return _mm256_srli_epi16(c, 6);
+}
+
+[[gnu::target("avx2")]] static void
+write_fb_line_avx2(gpu_2d_engine *gpu, u32 y)
+{
+	u32 mode = gpu->master_bright >> 14 & 3;
+	__m256i k = _mm256_set1_epi16(std::min(gpu->master_bright & 0x1F, 16));
+	__m256i zero = _mm256_setzero_si256();
+	__m256i alpha = _mm256_set1_epi32(0xFF000000);
+	u32 *fb = gpu->fb + 256 * y;
+
+	for (u32 x = 0; x < 256; x += 8) {
+		__m256i c = _mm256_loadu_si256(
+				(__m256i *)&gpu->output_line[x]);
+		__m256i lo = _mm256_unpacklo_epi8(c, zero);
+		__m256i hi = _mm256_unpackhi_epi8(c, zero);
+		lo = expand_channels(master_brightness_channels(lo, mode, k));
+		hi = expand_channels(master_brightness_channels(hi, mode, k));
+		c = _mm256_or_si256(_mm256_packus_epi16(lo, hi), alpha);
+		_mm256_storeu_si256((__m256i *)(fb + x), c);
+	}
+}
+#endif
+
 static void
 apply_master_brightness(gpu_2d_engine *gpu)
 {
@@ -7,6 +7,9 @@
 namespace twice {
 
 void render_scanline(gpu_2d_engine *gpu, u32 y);
+bool save_scanline_registers(
+		gpu_2d_engine *gpu, u32 y, gpu_2d_registers *regs);
+void draw_scanline(gpu_2d_engine *gpu, u32 y);
 void render_gfx_line(gpu_2d_engine *gpu, u32 y);
 void render_obj_line(gpu_2d_engine *gpu, u32 y);
 void render_text_bg_line(gpu_2d_engine *gpu, int bg_id, u32 y);
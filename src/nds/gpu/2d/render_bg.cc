@@ -51,8 +51,8 @@ FORCE_INLINE static void render_text_bg_256_mosaic(
 FORCE_INLINE static void render_text_bg_16_mosaic(
 		gpu_2d_engine *, background&);
 FORCE_INLINE static void render_text_bg_loop_step(background&);
-template <typename T>
-FORCE_INLINE static std::pair<T, u32> fetch_text_bg_tile(
+template <bool color_256>
+FORCE_INLINE static std::pair<u64, u32> fetch_text_bg_tile(
 		gpu_2d_engine *, background&);
 
 /* affine bg */
@@ -227,6 +227,7 @@ render_3d_line(gpu_2d_engine *gpu, u32 y)
 	u32 priority = gpu->bg_cnt[0] & 3;
 	u32 attr = priority << 28 | (u32)4 << 24 | (gpu->bldcnt & 0x101) | 0x6;
 	s32 offset = SEXT<9>(gpu->bg_hofs[0]);
+	re_wait_for_frame(&gpu->nds->gpu3d.re);
 
 	u32 x, start, end;
 	if (offset < 0) {
@@ -243,7 +244,7 @@ render_3d_line(gpu_2d_engine *gpu, u32 y)
 		if (!layer_in_window(gpu, 0, x))
 			continue;
 
-		color4 color = gpu->nds->gpu3d.re.color_buf[0][y][x];
+		color4 color = gpu->nds->gpu3d.re.pixels[y][x].color[0];
 		if (color.a == 0)
 			continue;
 
@@ -293,7 +294,7 @@ render_text_bg_256(gpu_2d_engine *gpu, background& bg)
 {
 	for (u32 x = 0, px = bg.x & 7; x < 256;) {
 		auto [char_row, palette_num] =
-				fetch_text_bg_tile<u64>(gpu, bg);
+				fetch_text_bg_tile<true>(gpu, bg);
 		char_row >>= px << 3;
 
 		for (; px < 8 && x < 256; px++, x++, char_row >>= 8) {
@@ -325,10 +326,10 @@ render_text_bg_16(gpu_2d_engine *gpu, background& bg)
 {
 	for (u32 x = 0, px = bg.x & 7; x < 256;) {
 		auto [char_row, palette_num] =
-				fetch_text_bg_tile<u32>(gpu, bg);
-		char_row >>= px << 2;
+				fetch_text_bg_tile<false>(gpu, bg);
+		char_row >>= px << 3;
 
-		for (; px < 8 && x < 256; px++, x++, char_row >>= 4) {
+		for (; px < 8 && x < 256; px++, x++, char_row >>= 8) {
 			if (!layer_in_window(gpu, bg.id, x))
 				continue;
 
@@ -351,7 +352,7 @@ static void
 render_text_bg_256_mosaic(gpu_2d_engine *gpu, background& bg)
 {
 	u32 mosaic_w = bg.mosaic_h + 1;
-	auto [char_row, palette_num] = fetch_text_bg_tile<u64>(gpu, bg);
+	auto [char_row, palette_num] = fetch_text_bg_tile<true>(gpu, bg);
 
 	for (u32 x = 0, px = 0, k = bg.x & 7; x < 256;) {
 		u32 num_tiles = ((px + k) >> 3) - (px >> 3);
@@ -363,7 +364,7 @@ render_text_bg_256_mosaic(gpu_2d_engine *gpu, background& bg)
 
 		if (num_tiles != 0) {
 			std::tie(char_row, palette_num) =
-					fetch_text_bg_tile<u64>(gpu, bg);
+					fetch_text_bg_tile<true>(gpu, bg);
 			char_row >>= px << 3;
 		} else {
 			char_row >>= k << 3;
@@ -397,7 +398,7 @@ static void
 render_text_bg_16_mosaic(gpu_2d_engine *gpu, background& bg)
 {
 	u32 mosaic_w = bg.mosaic_h + 1;
-	auto [char_row, palette_num] = fetch_text_bg_tile<u32>(gpu, bg);
+	auto [char_row, palette_num] = fetch_text_bg_tile<false>(gpu, bg);
 
 	for (u32 x = 0, px = 0, k = bg.x & 7; x < 256;) {
 		u32 num_tiles = ((px + k) >> 3) - (px >> 3);
@@ -409,10 +410,10 @@ render_text_bg_16_mosaic(gpu_2d_engine *gpu, background& bg)
 
 		if (num_tiles != 0) {
 			std::tie(char_row, palette_num) =
-					fetch_text_bg_tile<u32>(gpu, bg);
-			char_row >>= px << 2;
+					fetch_text_bg_tile<false>(gpu, bg);
+			char_row >>= px << 3;
 		} else {
-			char_row >>= k << 2;
+			char_row >>= k << 3;
 		}
 
 		u32 color_num = char_row & 0xF;
@@ -445,8 +446,12 @@ render_text_bg_loop_step(background& bg)
 	}
 }
 
-template <typename T>
-static std::pair<T, u32>
+/*
+ * Returns the row of the tile under the screen entry with one byte per
+ * pixel, flipped as the screen entry says, and the palette number.
+ */
+template <bool color_256>
+static std::pair<u64, u32>
 fetch_text_bg_tile(gpu_2d_engine *gpu, background& bg)
 {
 	u32 se_offset = bg.screen_base + (bg.screen << 11) + (bg.se_y << 6) +
@@ -455,26 +460,21 @@ fetch_text_bg_tile(gpu_2d_engine *gpu, background& bg)
 	u32 py = se & BIT(11) ? 7 - (bg.y & 7) : bg.y & 7;
 	u32 char_idx = se & 0x3FF;
 
-	if constexpr (sizeof(T) == 8) {
-		u64 char_row = read_bg_data<u64>(gpu,
+	u64 char_row;
+	if (color_256) {
+		char_row = read_bg_data<u64>(gpu,
 				bg.char_base + (char_idx << 6) + (py << 3));
-		if (se & BIT(10)) {
-			char_row = byteswap64(char_row);
-		}
-
-		return { char_row, se >> 12 };
 	} else {
-
-		u32 char_row = read_bg_data<u32>(gpu,
+		auto *r = &gpu->nds->gpu2d_tiles[gpu->engineid].bg;
+		char_row = tile_cache_get_row(gpu, r, false,
 				bg.char_base + (char_idx << 5) + (py << 2));
-		if (se & BIT(10)) {
-			char_row = byteswap32(char_row);
-			char_row = (char_row & 0x0F0F0F0F) << 4 |
-			           (char_row & 0xF0F0F0F0) >> 4;
-		}
+	}
 
-		return { char_row, se >> 12 };
+	if (se & BIT(10)) {
+		char_row = byteswap64(char_row);
 	}
+
+	return { char_row, se >> 12 };
 }
 
 static void
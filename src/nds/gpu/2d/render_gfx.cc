@@ -1,5 +1,6 @@
 #include "nds/gpu/2d/render.h"
 
+#include "common/cpu.h"
 #include "nds/nds.h"
 
 namespace twice {
@@ -10,6 +11,9 @@ static void clear_bg_buffers(gpu_2d_engine *gpu);
 static void apply_window_to_obj_line(gpu_2d_engine *gpu);
 static void set_active_window(gpu_2d_engine *gpu);
 static void merge_lines(gpu_2d_engine *gpu, u32 y);
+#ifdef TWICE_HAVE_AVX2
+static void merge_lines_avx2(gpu_2d_engine *gpu);
+#endif
 static color4 alpha_blend(color4 c1, color4 c2, u8 k1, u8 k2, u8 shift);
 static color4 increase_brightness(color4 c, u8 k);
 static color4 decrease_brightness(color4 c, u8 k);
@@ -218,6 +222,12 @@ clear_bg_buffers(gpu_2d_engine *gpu)
 static void
 merge_lines(gpu_2d_engine *gpu, u32)
 {
+#ifdef TWICE_HAVE_AVX2
+	if (use_avx2) {
+		merge_lines_avx2(gpu);
+		return;
+	}
+#endif
 	u16 backdrop_color = bg_get_color(gpu, 0);
 	u32 backdrop_attr = (u32)0x40 << 24 | (gpu->bldcnt >> 5 & 0x101);
 	u32 obj_blend_attr = gpu->bldcnt >> 4 & 0x101;
@@ -315,6 +325,224 @@ merge_lines(gpu_2d_engine *gpu, u32)
 	}
 }
 
+#ifdef TWICE_HAVE_AVX2
+[[gnu::target("avx2")]] static __m256i
+test_bits(__m256i v, u32 bits)
+{
+	__m256i b = _mm256_set1_epi32(bits);
+	return _mm256_cmpeq_epi32(_mm256_and_si256(v, b), b);
+}
+
+/* colors of layers not from 3d are still bgr555 */
+[[gnu::target("avx2")]] static __m256i
+unpack_layer_colors(__m256i color, __m256i attr)
+{
+	__m256i r = _mm256_and_si256(_mm256_slli_epi32(color, 1),
+			_mm256_set1_epi32(0x3E));
+	__m256i g = _mm256_and_si256(_mm256_slli_epi32(color, 4),
+			_mm256_set1_epi32(0x3E00));
+	__m256i b = _mm256_and_si256(_mm256_slli_epi32(color, 7),
+			_mm256_set1_epi32(0x3E0000));
+	__m256i c = _mm256_or_si256(_mm256_or_si256(r, g),
+			_mm256_or_si256(b, _mm256_set1_epi32(0x1F000000)));
+
+	return _mm256_blendv_epi8(c, color, test_bits(attr, BIT(2)));
+}
+
+/* c1 * k1 + c2 * k2 on 16 bit channels */
+[[gnu::target("avx2")]] static __m256i
+weigh_channels(__m256i c1, __m256i c2, __m256i k1, __m256i k2)
+{
+	return _mm256_add_epi16(_mm256_mullo_epi16(c1, k1),
+			_mm256_mullo_epi16(c2, k2));
+}
+
+/*
+ * Blends with a pair of weights per pixel and a shift of 5. Weights meant
+ * for a shift of 4 are doubled by the caller, which gives the same result.
+ */
+[[gnu::target("avx2")]] static __m256i
+alpha_blend_avx2(__m256i c1, __m256i c2, __m256i k1, __m256i k2)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i half = _mm256_set1_epi16(16);
+	__m256i max = _mm256_set1_epi16(0x3F);
+
+	/* spread the weight of each pixel to its four channels */
+	k1 = _mm256_mullo_epi32(k1, _mm256_set1_epi32(0x01010101));
+	k2 = _mm256_mullo_epi32(k2, _mm256_set1_epi32(0x01010101));
+
+	__m256i lo = weigh_channels(_mm256_unpacklo_epi8(c1, zero),
+			_mm256_unpacklo_epi8(c2, zero),
+			_mm256_unpacklo_epi8(k1, zero),
+			_mm256_unpacklo_epi8(k2, zero));
+	__m256i hi = weigh_channels(_mm256_unpackhi_epi8(c1, zero),
+			_mm256_unpackhi_epi8(c2, zero),
+			_mm256_unpackhi_epi8(k1, zero),
+			_mm256_unpackhi_epi8(k2, zero));
+	lo = _mm256_srli_epi16(_mm256_add_epi16(lo, half), 5);
+	hi = _mm256_srli_epi16(_mm256_add_epi16(hi, half), 5);
+
+	return _mm256_packus_epi16(_mm256_min_epu16(lo, max),
+			_mm256_min_epu16(hi, max));
+}
+
+[[gnu::target("avx2")]] static __m256i
+increase_channels(__m256i c, __m256i k)
+{
+	__m256i d = _mm256_sub_epi16(_mm256_set1_epi16(0x3F), c);
+	d = _mm256_add_epi16(_mm256_mullo_epi16(d, k), _mm256_set1_epi16(8));
+	return _mm256_add_epi16(c, _mm256_srli_epi16(d, 4));
+}
+
+[[gnu::target("avx2")]] static __m256i
+decrease_channels(__m256i c, __m256i k)
+{
+	__m256i d = _mm256_mullo_epi16(c, k);
+	d = _mm256_add_epi16(d, _mm256_set1_epi16(7));
+	return _mm256_sub_epi16(c, _mm256_srli_epi16(d, 4));
+}
+
+[[gnu::target("avx2")]] static __m256i
+change_brightness_avx2(__m256i c, u8 effect, u8 k)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i vk = _mm256_set1_epi16(k);
+	__m256i lo = _mm256_unpacklo_epi8(c, zero);
+	__m256i hi = _mm256_unpackhi_epi8(c, zero);
+
+	if (effect == 2) {
+		lo = increase_channels(lo, vk);
+		hi = increase_channels(hi, vk);
+	} else {
+		lo = decrease_channels(lo, vk);
+		hi = decrease_channels(hi, vk);
+	}
+
+	return _mm256_packus_epi16(lo, hi);
+}
+
+/*
+ * Does what merge_lines does for 8 pixels at a time. Attributes are
+ * compared with their top bit flipped, so signed compares order them as
+ * unsigned.
+ */
+[[gnu::target("avx2")]] static void
+merge_lines_avx2(gpu_2d_engine *gpu)
+{
+	__m256i sign = _mm256_set1_epi32((s32)BIT(31));
+	__m256i backdrop_color = _mm256_set1_epi32(bg_get_color(gpu, 0));
+	__m256i backdrop_attr = _mm256_set1_epi32(((u32)0x40 << 24 ^ BIT(31)) |
+			(gpu->bldcnt >> 5 & 0x101));
+	__m256i obj_blend_attr = _mm256_set1_epi32(gpu->bldcnt >> 4 & 0x101);
+
+	u8 effect = gpu->bldcnt >> 6 & 3;
+	u8 eva = std::min(gpu->bldalpha & 0x1F, 16);
+	u8 evb = std::min(gpu->bldalpha >> 8 & 0x1F, 16);
+	u8 evy = std::min(gpu->bldy & 0x1F, 16);
+	__m256i eva2 = _mm256_set1_epi32(eva * 2);
+	__m256i evb2 = _mm256_set1_epi32(evb * 2);
+	__m256i k_max = _mm256_set1_epi32(32);
+	__m256i one = _mm256_set1_epi32(1);
+	__m256i alpha_mask = _mm256_set1_epi32(0xFF000000);
+	__m256i alpha = _mm256_set1_epi32(0x1F000000);
+
+	for (u32 x = 0; x < 256; x += 8) {
+		__m256i color0 = backdrop_color;
+		__m256i attr0 = backdrop_attr;
+		__m256i color1 = backdrop_color;
+		__m256i attr1 = backdrop_attr;
+
+		__m256i obj_attr = _mm256_loadu_si256(
+				(__m256i *)&gpu->obj_attr[x]);
+		__m256i obj_color = _mm256_loadu_si256(
+				(__m256i *)&gpu->obj_line[x]);
+		obj_attr = _mm256_xor_si256(obj_attr, sign);
+		__m256i m = _mm256_cmpgt_epi32(attr0, obj_attr);
+		attr0 = _mm256_blendv_epi8(attr0,
+				_mm256_or_si256(obj_attr, obj_blend_attr), m);
+		color0 = _mm256_blendv_epi8(color0, obj_color, m);
+
+		for (u32 bg = 0; bg < 4; bg++) {
+			__m256i bg_attr = _mm256_loadu_si256(
+					(__m256i *)&gpu->bg_attr[bg][x]);
+			__m256i bg_color = _mm256_loadu_si256(
+					(__m256i *)&gpu->bg_line[bg][x]);
+			bg_attr = _mm256_xor_si256(bg_attr, sign);
+			__m256i top = _mm256_cmpgt_epi32(attr0, bg_attr);
+			__m256i bottom = _mm256_andnot_si256(top,
+					_mm256_cmpgt_epi32(attr1, bg_attr));
+
+			attr1 = _mm256_blendv_epi8(attr1, attr0, top);
+			color1 = _mm256_blendv_epi8(color1, color0, top);
+			attr0 = _mm256_blendv_epi8(attr0, bg_attr, top);
+			color0 = _mm256_blendv_epi8(color0, bg_color, top);
+			attr1 = _mm256_blendv_epi8(attr1, bg_attr, bottom);
+			color1 = _mm256_blendv_epi8(color1, bg_color, bottom);
+		}
+
+		color0 = unpack_layer_colors(color0, attr0);
+		color1 = unpack_layer_colors(color1, attr1);
+
+		__m256i window = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+				(__m128i *)&gpu->window_bits_line[x]));
+		__m256i window_fx = test_bits(window, BIT(5));
+		__m256i top_fx = _mm256_and_si256(
+				test_bits(attr0, BIT(0)), window_fx);
+		__m256i bottom_fx = _mm256_and_si256(
+				test_bits(attr1, BIT(8)), window_fx);
+		__m256i force = _mm256_and_si256(
+				test_bits(attr0, BIT(1)), bottom_fx);
+
+		/* weights for forced blending, doubled for a shift of 4 */
+		__m256i obj_alpha = _mm256_and_si256(
+				_mm256_srli_epi32(attr0, 12),
+				_mm256_set1_epi32(0xF));
+		__m256i has_obj_alpha = _mm256_andnot_si256(
+				_mm256_cmpeq_epi32(obj_alpha,
+						_mm256_setzero_si256()),
+				force);
+		__m256i is_3d = _mm256_and_si256(
+				test_bits(attr0, BIT(2)), force);
+		__m256i k1_obj = _mm256_slli_epi32(
+				_mm256_add_epi32(obj_alpha, one), 1);
+		__m256i k1 = _mm256_blendv_epi8(eva2, k1_obj, has_obj_alpha);
+		__m256i k2 = _mm256_blendv_epi8(evb2,
+				_mm256_sub_epi32(k_max, k1_obj), has_obj_alpha);
+		__m256i k1_3d = _mm256_add_epi32(
+				_mm256_srli_epi32(color0, 24), one);
+		k1 = _mm256_blendv_epi8(k1, k1_3d, is_3d);
+		k2 = _mm256_blendv_epi8(
+				k2, _mm256_sub_epi32(k_max, k1_3d), is_3d);
+
+		__m256i blend = force;
+		if (effect == 1) {
+			blend = _mm256_or_si256(blend,
+					_mm256_and_si256(top_fx, bottom_fx));
+		}
+
+		__m256i result = color0;
+		if (!_mm256_testz_si256(blend, blend)) {
+			result = _mm256_blendv_epi8(result,
+					alpha_blend_avx2(color0, color1, k1,
+							k2),
+					blend);
+		}
+
+		if (effect >= 2 && !_mm256_testz_si256(top_fx, top_fx)) {
+			result = _mm256_blendv_epi8(result,
+					change_brightness_avx2(
+							color0, effect, evy),
+					top_fx);
+		}
+
+		result = _mm256_or_si256(
+				_mm256_andnot_si256(alpha_mask, result), alpha);
+		_mm256_storeu_si256((__m256i *)&gpu->gfx_line[x], result);
+	}
+}
+#endif
+
 static color4
 alpha_blend(color4 c1, color4 c2, u8 k1, u8 k2, u8 shift)
 {
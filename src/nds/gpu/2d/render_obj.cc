@@ -42,6 +42,8 @@ static const u32 obj_heights[4][4] = {
 	{ 0, 0, 0, 0 },
 };
 
+static void build_sprite_bins(
+		gpu_2d_engine *gpu, gpu_2d_sprite_bins *bins);
 static void apply_obj_mosaic(gpu_2d_engine *gpu);
 
 /* setup functions */
@@ -60,7 +62,7 @@ FORCE_INLINE static void render_normal_sprite_256(
 FORCE_INLINE static void render_normal_sprite_16(
 		gpu_2d_engine *, sprite&, u32 px);
 template <typename T>
-FORCE_INLINE static T fetch_obj_tile(gpu_2d_engine *, sprite&);
+FORCE_INLINE static u64 fetch_obj_tile(gpu_2d_engine *, sprite&);
 FORCE_INLINE static void render_bitmap_sprite(gpu_2d_engine *, sprite&, u32 y);
 
 /* affine sprites */
@@ -91,9 +93,21 @@ FORCE_INLINE static void write_mosaic_attr(gpu_2d_engine *, u32 x, u32 attr);
 void
 render_obj_line(gpu_2d_engine *gpu, u32 y)
 {
-	u32 oam_offset = gpu->palette_offset;
+	auto *bins = &gpu->nds->gpu2d_sprites[gpu->engineid];
+	if (bins->dirty) {
+		build_sprite_bins(gpu, bins);
+		bins->dirty = false;
+	}
 
-	for (u32 id = 0; id < 128; id++, oam_offset += 8) {
+	for (u32 id = 0; id < 128; id++) {
+		u64 rest = bins->lines[y][id >> 6] >> (id & 63);
+		if (rest == 0) {
+			id |= 63;
+			continue;
+		}
+		id += std::countr_zero(rest);
+
+		u32 oam_offset = gpu->palette_offset + 8 * id;
 		sprite obj;
 		obj.id = id;
 		obj.attrs[0] = readarr<u16>(gpu->nds->oam, oam_offset);
@@ -101,9 +115,6 @@ render_obj_line(gpu_2d_engine *gpu, u32 y)
 		obj.attrs[2] = readarr<u16>(gpu->nds->oam, oam_offset + 4);
 		obj.mode = obj.attrs[0] >> 10 & 3;
 
-		if ((obj.attrs[0] >> 8 & 3) == 2)
-			continue;
-
 		bool affine = obj.attrs[0] & BIT(8);
 		bool bitmap = obj.mode == 3;
 		obj.map_1d = gpu->dispcnt & BIT(bitmap ? 6 : 4);
@@ -122,6 +133,39 @@ render_obj_line(gpu_2d_engine *gpu, u32 y)
 	apply_obj_mosaic(gpu);
 }
 
+/* sets the bit of each shown sprite on the lines its box covers */
+static void
+build_sprite_bins(gpu_2d_engine *gpu, gpu_2d_sprite_bins *bins)
+{
+	u32 oam_offset = gpu->palette_offset;
+
+	for (auto& line : bins->lines) {
+		line[0] = 0;
+		line[1] = 0;
+	}
+
+	for (u32 id = 0; id < 128; id++, oam_offset += 8) {
+		u32 attr0 = readarr<u16>(gpu->nds->oam, oam_offset);
+		u32 attr1 = readarr<u16>(gpu->nds->oam, oam_offset + 2);
+
+		if ((attr0 >> 8 & 3) == 2)
+			continue;
+
+		u32 box_h = obj_heights[attr0 >> 14 & 3][attr1 >> 14 & 3];
+		if ((attr0 >> 8 & 3) == 3) {
+			box_h <<= 1;
+		}
+
+		u32 ycoord = attr0 & 0xFF;
+		for (u32 i = 0; i < box_h; i++) {
+			u32 y = (ycoord + i) & 0xFF;
+			if (y < 192) {
+				bins->lines[y][id >> 6] |= BIT(id & 63);
+			}
+		}
+	}
+}
+
 static void
 apply_obj_mosaic(gpu_2d_engine *gpu)
 {
@@ -323,10 +367,10 @@ static void
 render_normal_sprite_16(gpu_2d_engine *gpu, sprite& obj, u32 px)
 {
 	for (u32 x = obj.x_start, end = obj.x_end; x != end;) {
-		u32 char_row = fetch_obj_tile<u32>(gpu, obj);
-		char_row >>= px << 2;
+		u64 char_row = fetch_obj_tile<u32>(gpu, obj);
+		char_row >>= px << 3;
 
-		for (; px < 8 && x != end; px++, x++, char_row >>= 4) {
+		for (; px < 8 && x != end; px++, x++, char_row >>= 8) {
 			u32 color_num = char_row & 0xF;
 			if (color_num == 0) {
 				if (obj.mode != 2) {
@@ -350,31 +394,31 @@ render_normal_sprite_16(gpu_2d_engine *gpu, sprite& obj, u32 px)
 	}
 }
 
+/*
+ * Returns the row of the tile with one byte per pixel, T being the size of
+ * a row in VRAM.
+ */
 template <typename T>
-static T
+static u64
 fetch_obj_tile(gpu_2d_engine *gpu, sprite& obj)
 {
 	u32 py = obj.y & 7;
 
+	u64 char_row;
 	if constexpr (sizeof(T) == 8) {
-		u64 char_row = read_obj_data<u64>(
+		char_row = read_obj_data<u64>(
 				gpu, obj.tile_offset + (py << 3));
-		if (obj.hflip) {
-			char_row = byteswap64(char_row);
-		}
-
-		return char_row;
 	} else {
-		u32 char_row = read_obj_data<u32>(
-				gpu, obj.tile_offset + (py << 2));
-		if (obj.hflip) {
-			char_row = byteswap32(char_row);
-			char_row = (char_row & 0x0F0F0F0F) << 4 |
-			           (char_row & 0xF0F0F0F0) >> 4;
-		}
+		auto *r = &gpu->nds->gpu2d_tiles[gpu->engineid].obj;
+		char_row = tile_cache_get_row(
+				gpu, r, true, obj.tile_offset + (py << 2));
+	}
 
-		return char_row;
+	if (obj.hflip) {
+		char_row = byteswap64(char_row);
 	}
+
+	return char_row;
 }
 
 static void
@@ -0,0 +1,119 @@
+#include "nds/gpu/2d/tile_cache.h"
+
+#include "nds/mem/vram.h"
+#include "nds/nds.h"
+
+namespace twice {
+
+static void init_region(tile_cache_region *r, u32 size);
+static void sync_region(tile_cache_region *r, u8 *const *pt, u32 num_slots,
+		nds_ctx *nds, int engineid);
+static u64 decode_row(u32 row);
+
+void
+tile_cache_init(tile_cache *tc, int engineid)
+{
+	if (engineid == 0) {
+		init_region(&tc->bg, 512_KiB);
+		init_region(&tc->obj, 256_KiB);
+	} else {
+		init_region(&tc->bg, 128_KiB);
+		init_region(&tc->obj, 128_KiB);
+	}
+}
+
+static void
+init_region(tile_cache_region *r, u32 size)
+{
+	r->rows.assign(size >> 5 << 3, 0);
+	r->valid.assign(size >> VRAM_2D_PAGE_SHIFT, 0);
+	r->tile_mask = (size >> 5) - 1;
+}
+
+/*
+ * Drops the tiles read from pages written since the last call. Must be
+ * called before drawing a line.
+ */
+void
+tile_cache_sync(gpu_2d_engine *gpu)
+{
+	nds_ctx *nds = gpu->nds;
+	int engineid = gpu->engineid;
+	tile_cache *tc = &nds->gpu2d_tiles[engineid];
+
+	if (nds->vram.dirty_2d[engineid].none())
+		return;
+
+	if (engineid == 0) {
+		sync_region(&tc->bg, nds->vram.abg_pt, 32, nds, 0);
+		sync_region(&tc->obj, nds->vram.aobj_pt, 16, nds, 0);
+	} else {
+		sync_region(&tc->bg, nds->vram.bbg_pt, 8, nds, 1);
+		sync_region(&tc->obj, nds->vram.bobj_pt, 8, nds, 1);
+	}
+
+	nds->vram.dirty_2d[engineid].reset();
+}
+
+static void
+sync_region(tile_cache_region *r, u8 *const *pt, u32 num_slots,
+		nds_ctx *nds, int engineid)
+{
+	auto& dirty = nds->vram.dirty_2d[engineid];
+	u32 pages_per_slot = 16_KiB >> VRAM_2D_PAGE_SHIFT;
+
+	for (u32 i = 0; i < num_slots; i++) {
+		u32 *valid = &r->valid[i * pages_per_slot];
+
+		/* slots with several or no banks are not worth tracking */
+		if (!pt[i]) {
+			std::fill(valid, valid + pages_per_slot, 0);
+			continue;
+		}
+
+		uintptr_t offset = (uintptr_t)pt[i] -
+		                   (uintptr_t)nds->vram.vram_a;
+		u32 page = offset >> VRAM_2D_PAGE_SHIFT;
+		for (u32 j = 0; j < pages_per_slot; j++) {
+			if (dirty.test(page + j)) {
+				valid[j] = 0;
+			}
+		}
+	}
+}
+
+void
+tile_cache_decode(gpu_2d_engine *gpu, bool obj, u32 tile)
+{
+	nds_ctx *nds = gpu->nds;
+	tile_cache *tc = &nds->gpu2d_tiles[gpu->engineid];
+	tile_cache_region *r = obj ? &tc->obj : &tc->bg;
+
+	for (u32 py = 0; py < 8; py++) {
+		u32 offset = tile << 5 | py << 2;
+		u32 row;
+		if (gpu->engineid == 0) {
+			row = obj ? vram_read_aobj<u32>(nds, offset)
+			          : vram_read_abg<u32>(nds, offset);
+		} else {
+			row = obj ? vram_read_bobj<u32>(nds, offset)
+			          : vram_read_bbg<u32>(nds, offset);
+		}
+		r->rows[tile << 3 | py] = decode_row(row);
+	}
+
+	r->valid[tile >> 5] |= BIT(tile & 31);
+}
+
+/* spreads the 8 nibbles of a row to the low nibbles of 8 bytes */
+static u64
+decode_row(u32 row)
+{
+	u64 x = row;
+	x = (x | x << 16) & 0x0000FFFF0000FFFF;
+	x = (x | x << 8) & 0x00FF00FF00FF00FF;
+	x = (x | x << 4) & 0x0F0F0F0F0F0F0F0F;
+	return x;
+}
+
+} // namespace twice
@@ -0,0 +1,56 @@
+#ifndef TWICE_GPU2D_TILE_CACHE_H
+#define TWICE_GPU2D_TILE_CACHE_H
+
+#include <vector>
+
+#include "common/types.h"
+#include "common/util.h"
+
+namespace twice {
+
+struct gpu_2d_engine;
+
+/* the 4 bit tiles of a BG or OBJ region decoded to one byte per pixel */
+struct tile_cache_region {
+	/* 8 rows of 8 color numbers per tile */
+	std::vector<u64> rows;
+	/* one bit per tile, one word per page of VRAM */
+	std::vector<u32> valid;
+	u32 tile_mask{};
+};
+
+/*
+ * Decoded tiles of a 2D engine, keyed by their offset in the engine's BG
+ * and OBJ regions. Tiles are decoded the first time they are drawn, and
+ * dropped when a page they were read from changes, which the vram code
+ * reports through dirty_2d.
+ *
+ * Only the thread drawing the engine touches the cache. The emulator waits
+ * for the 2D lines before it writes VRAM, so the dirty bits do not change
+ * while a line is drawn.
+ */
+struct tile_cache {
+	tile_cache_region bg;
+	tile_cache_region obj;
+};
+
+void tile_cache_init(tile_cache *tc, int engineid);
+void tile_cache_sync(gpu_2d_engine *gpu);
+void tile_cache_decode(gpu_2d_engine *gpu, bool obj, u32 tile);
+
+/* returns the row of the 4 bit tile at offset, starting at pixel 0 */
+inline u64
+tile_cache_get_row(
+		gpu_2d_engine *gpu, tile_cache_region *r, bool obj, u32 offset)
+{
+	u32 tile = offset >> 5 & r->tile_mask;
+	if (!(r->valid[tile >> 5] & BIT(tile & 31))) {
+		tile_cache_decode(gpu, obj, tile);
+	}
+
+	return r->rows[tile << 3 | (offset >> 2 & 7)];
+}
+
+} // namespace twice
+
+#endif
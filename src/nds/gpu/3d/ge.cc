@@ -1,5 +1,6 @@
 #include "nds/gpu/3d/ge.h"
 
+#include "common/cpu.h"
 #include "libtwice/util/matrix.h"
 #include "nds/nds.h"
 
@@ -64,16 +65,35 @@ static void mtx_mult_4x3(ge_matrix r, ge_params t);
 static void mtx_mult_3x3(ge_matrix r, ge_params t);
 static void mtx_scale(ge_matrix r, ge_params t);
 static void mtx_trans(ge_matrix r, ge_params t);
+#ifdef TWICE_HAVE_AVX2
+static void mtx_mult_rows_avx2(
+		s32 *r, const s32 *s, const s32 *t, u32 num_rows);
+#endif
 
 /* clipping */
-static std::vector<vertex> clip_polygon(std::span<vertex *>, u32 num_vertices,
-		bool render_clipped_far);
-static void clip_polygon_plane(std::list<vertex>& in, int plane, int positive,
-		bool render_clipped);
-static vertex create_clipped_vertex(std::list<vertex>::iterator v0,
-		std::list<vertex>::iterator v1, int plane, int positive);
+enum : u32 {
+	/*
+	 * each plane adds at most one vertex per two edges crossing it, so a
+	 * quad grows to at most 4, 6, 9, 13, 19, 28, 42 vertices
+	 */
+	MAX_CLIPPED_VTXS = 42,
+	CLIP_FAR = BIT(4),
+};
+static u32 get_clip_outcode(const vertex *v);
+static u32 clip_polygon(std::span<vertex *> in, u32 num_vertices,
+		bool render_clipped_far, vertex *out);
+static u32 clip_polygon_plane(const vertex *in, u32 num_vertices,
+		vertex *out, int plane, int positive);
+static bool clip_inside(const vertex *v, int plane, int positive);
+static vertex create_clipped_vertex(
+		const vertex *v0, const vertex *v1, int plane, int positive);
 static s32 clip_lerp(s32 y0, s32 y1, interpolator *i, int positive);
 
+/* lighting */
+#ifdef TWICE_HAVE_AVX2
+static void light_vertex_avx2(geometry_engine *ge, const s32 *normal);
+#endif
+
 /* polygon */
 static void add_vertex(geometry_engine *ge);
 static void add_polygon(geometry_engine *ge);
@@ -534,6 +554,14 @@ cmd_normal(geometry_engine *ge)
 	s32 normal[3];
 	mtx_mult_vec3(normal, ge->vector_mtx, nx, ny, nz);
 
+#ifdef TWICE_HAVE_AVX2
+	/* all lights are done at once, which only pays off for three or more */
+	if (use_avx2 && std::popcount(ge->poly_attr & 0xF) >= 3) {
+		light_vertex_avx2(ge, normal);
+		return;
+	}
+#endif
+
 	s32 color[3]{};
 	color[0] = ge->emission_color[0] << 14;
 	color[1] = ge->emission_color[1] << 14;
@@ -554,8 +582,7 @@ cmd_normal(geometry_engine *ge)
 			spe_dot = (0x400 - (spe_dot - 0x400)) & 0x3FF;
 		}
 
-		s32 spe_recip = ((s32)1 << 18) /
-		                (-ge->light_vec[i][2] + (1 << 9));
+		s32 spe_recip = ge->spe_recip[i];
 		s32 spe_level = (spe_dot * spe_dot >> 10) * spe_recip >> 8;
 		spe_level -= (1 << 9);
 
@@ -730,6 +757,9 @@ cmd_light_vector(geometry_engine *ge)
 	ge->half_vec[l][0] = ge->light_vec[l][0];
 	ge->half_vec[l][1] = ge->light_vec[l][1];
 	ge->half_vec[l][2] = (ge->light_vec[l][2] - (1 << 9));
+
+	s32 spe_div = -ge->half_vec[l][2];
+	ge->spe_recip[l] = spe_div == 0 ? 0 : ((s32)1 << 18) / spe_div;
 }
 
 static void
@@ -804,27 +834,56 @@ cmd_box_test(geometry_engine *ge)
 		{ x, y + dy, z + dz, 1 << 12 },
 	};
 
+	/*
+	 * A corner inside the view volume is kept by clipping, and a face
+	 * with all corners outside the same plane clips to nothing, so only
+	 * faces crossing the edge of the view volume have to be clipped.
+	 */
+	u32 outcodes[8];
+	u32 all_out = 0x3F;
 	for (u32 i = 0; i < 8; i++) {
 		mtx_mult_vec(vs[i].pos, ge->clip_mtx, positions[i]);
+		outcodes[i] = get_clip_outcode(&vs[i]);
+		if (outcodes[i] == 0) {
+			ge->gpu->gxstat |= BIT(1);
+			return;
+		}
+		all_out &= outcodes[i];
+	}
+
+	if (all_out) {
+		ge->gpu->gxstat &= ~(u32)BIT(1);
+		return;
 	}
 
-	vertex *faces[6][4] = {
-		{ &vs[0], &vs[1], &vs[2], &vs[3] },
-		{ &vs[1], &vs[5], &vs[6], &vs[2] },
-		{ &vs[5], &vs[4], &vs[7], &vs[6] },
-		{ &vs[4], &vs[0], &vs[3], &vs[7] },
-		{ &vs[7], &vs[6], &vs[2], &vs[3] },
-		{ &vs[4], &vs[5], &vs[1], &vs[0] },
+	static const u8 faces[6][4] = {
+		{ 0, 1, 2, 3 },
+		{ 1, 5, 6, 2 },
+		{ 5, 4, 7, 6 },
+		{ 4, 0, 3, 7 },
+		{ 7, 6, 2, 3 },
+		{ 4, 5, 1, 0 },
 	};
 
 	for (u32 i = 0; i < 6; i++) {
-		if (clip_polygon(faces[i], 4, true).size() > 0) {
+		u32 face_out = 0x3F;
+		vertex *face[4];
+		for (u32 j = 0; j < 4; j++) {
+			face_out &= outcodes[faces[i][j]];
+			face[j] = &vs[faces[i][j]];
+		}
+		if (face_out) {
+			continue;
+		}
+
+		vertex clipped[MAX_CLIPPED_VTXS];
+		if (clip_polygon(face, 4, true, clipped) > 0) {
 			ge->gpu->gxstat |= BIT(1);
 			return;
 		}
 	}
 
-	ge->gpu->gxstat &= ~BIT(1);
+	ge->gpu->gxstat &= ~(u32)BIT(1);
 }
 
 static void
@@ -858,6 +917,12 @@ cmd_vec_test(geometry_engine *ge)
 static void
 mtx_mult_mtx(ge_matrix r, const_ge_matrix s, const_ge_matrix t)
 {
+#ifdef TWICE_HAVE_AVX2
+	if (use_avx2) {
+		mtx_mult_rows_avx2(r.data(), s.data(), t.data(), 4);
+		return;
+	}
+#endif
 	for (u32 i = 0; i < 4; i++) {
 		for (u32 j = 0; j < 4; j++) {
 			s64 sum = 0;
@@ -872,6 +937,12 @@ mtx_mult_mtx(ge_matrix r, const_ge_matrix s, const_ge_matrix t)
 static void
 mtx_mult_vec(ge_vector r, const_ge_matrix s, const_ge_vector t)
 {
+#ifdef TWICE_HAVE_AVX2
+	if (use_avx2) {
+		mtx_mult_rows_avx2(r.data(), s.data(), t.data(), 1);
+		return;
+	}
+#endif
 	for (u32 j = 0; j < 4; j++) {
 		s64 sum = 0;
 		for (u32 k = 0; k < 4; k++) {
@@ -925,6 +996,13 @@ mtx_load_4x3(ge_matrix r, ge_params ts)
 static void
 mtx_mult_4x4(ge_matrix r, ge_params t)
 {
+#ifdef TWICE_HAVE_AVX2
+	if (use_avx2) {
+		mtx_mult_rows_avx2(
+				r.data(), r.data(), (const s32 *)t.data(), 4);
+		return;
+	}
+#endif
 	std::array<s32, r.size()> s;
 	std::ranges::copy(r, s.begin());
 
@@ -942,6 +1020,18 @@ mtx_mult_4x4(ge_matrix r, ge_params t)
 static void
 mtx_mult_4x3(ge_matrix r, ge_params t)
 {
+#ifdef TWICE_HAVE_AVX2
+	if (use_avx2) {
+		s32 m[16] = {
+			(s32)t[0], (s32)t[1], (s32)t[2], 0,
+			(s32)t[3], (s32)t[4], (s32)t[5], 0,
+			(s32)t[6], (s32)t[7], (s32)t[8], 0,
+			(s32)t[9], (s32)t[10], (s32)t[11], 1 << 12,
+		};
+		mtx_mult_rows_avx2(r.data(), r.data(), m, 4);
+		return;
+	}
+#endif
 	std::array<s32, r.size()> s;
 	std::ranges::copy(r, s.begin());
 
@@ -968,6 +1058,17 @@ mtx_mult_4x3(ge_matrix r, ge_params t)
 static void
 mtx_mult_3x3(ge_matrix r, ge_params t)
 {
+#ifdef TWICE_HAVE_AVX2
+	if (use_avx2) {
+		s32 m[12] = {
+			(s32)t[0], (s32)t[1], (s32)t[2], 0,
+			(s32)t[3], (s32)t[4], (s32)t[5], 0,
+			(s32)t[6], (s32)t[7], (s32)t[8], 0,
+		};
+		mtx_mult_rows_avx2(r.data(), r.data(), m, 3);
+		return;
+	}
+#endif
 	std::array<s32, r.size()> s;
 	std::ranges::copy(r, s.begin());
 
@@ -989,6 +1090,17 @@ mtx_mult_3x3(ge_matrix r, ge_params t)
 static void
 mtx_scale(ge_matrix r, ge_params t)
 {
+#ifdef TWICE_HAVE_AVX2
+	if (use_avx2) {
+		s32 m[12] = {
+			(s32)t[0], 0, 0, 0,
+			0, (s32)t[1], 0, 0,
+			0, 0, (s32)t[2], 0,
+		};
+		mtx_mult_rows_avx2(r.data(), r.data(), m, 3);
+		return;
+	}
+#endif
 	for (u32 i = 0; i < 3; i++) {
 		for (u32 j = 0; j < 4; j++) {
 			r[i * 4 + j] = (s64)r[i * 4 + j] * (s32)t[i] >> 12;
@@ -999,6 +1111,13 @@ mtx_scale(ge_matrix r, ge_params t)
 static void
 mtx_trans(ge_matrix r, ge_params t)
 {
+#ifdef TWICE_HAVE_AVX2
+	if (use_avx2) {
+		s32 m[4] = { (s32)t[0], (s32)t[1], (s32)t[2], 1 << 12 };
+		mtx_mult_rows_avx2(&r[12], r.data(), m, 1);
+		return;
+	}
+#endif
 	for (u32 j = 0; j < 4; j++) {
 		s64 sum = 0;
 		for (u32 k = 0; k < 3; k++) {
@@ -1009,70 +1128,131 @@ mtx_trans(ge_matrix r, ge_params t)
 	}
 }
 
-static std::vector<vertex>
-clip_polygon(std::span<vertex *> in, u32 num_vertices, bool render_clipped_far)
+#ifdef TWICE_HAVE_AVX2
+/*
+ * Sets row i of r to the rows of the 4x4 matrix s weighted by row i of the
+ * Nx4 matrix t, for the first num_rows rows. r may be s or part of it.
+ */
+[[gnu::target("avx2")]] static void
+mtx_mult_rows_avx2(s32 *r, const s32 *s, const s32 *t, u32 num_rows)
 {
-	std::list<vertex> out;
-	for (u32 i = 0; i < num_vertices; i++) {
-		out.push_back(*in[i]);
+	/* each row of s sign extended to 64 bits */
+	__m256i src[4];
+	for (u32 k = 0; k < 4; k++) {
+		src[k] = _mm256_cvtepi32_epi64(
+				_mm_loadu_si128((const __m128i *)&s[k * 4]));
 	}
 
-	clip_polygon_plane(out, 2, 1, render_clipped_far);
-	clip_polygon_plane(out, 2, 0, true);
-	clip_polygon_plane(out, 1, 1, true);
-	clip_polygon_plane(out, 1, 0, true);
-	clip_polygon_plane(out, 0, 1, true);
-	clip_polygon_plane(out, 0, 0, true);
+	for (u32 i = 0; i < num_rows; i++) {
+		__m256i sum = _mm256_setzero_si256();
+		for (u32 k = 0; k < 4; k++) {
+			__m256i f = _mm256_set1_epi64x(t[i * 4 + k]);
+			f = _mm256_mul_epi32(src[k], f);
+			sum = _mm256_add_epi64(sum, f);
+		}
 
-	return { out.begin(), out.end() };
+		/* only the low 32 bits of the shifted sums are kept */
+		sum = _mm256_srli_epi64(sum, 12);
+		sum = _mm256_permutevar8x32_epi32(
+				sum, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6));
+		_mm_storeu_si128((__m128i *)&r[i * 4],
+				_mm256_castsi256_si128(sum));
+	}
 }
+#endif
 
-static void
-clip_polygon_plane(std::list<vertex>& in, int plane, int positive,
-		bool render_clipped)
+static u32
+get_clip_outcode(const vertex *v)
 {
-	if (in.empty())
-		return;
+	u32 code = 0;
+	for (int plane = 0; plane < 3; plane++) {
+		if (!clip_inside(v, plane, 1)) {
+			code |= BIT(2 * plane);
+		}
+		if (!clip_inside(v, plane, 0)) {
+			code |= BIT(2 * plane + 1);
+		}
+	}
 
-	in.push_back(in.front());
-	auto end = --in.end();
+	return code;
+}
 
-	for (auto curr = in.begin(); curr != end;) {
-		auto next = std::next(curr);
-		bool curr_inside =
-				positive ? curr->pos[plane] <= curr->pos[3]
-					 : curr->pos[plane] >= -curr->pos[3];
-		bool next_inside =
-				positive ? next->pos[plane] <= next->pos[3]
-					 : next->pos[plane] >= -next->pos[3];
+/*
+ * Clips the polygon against the view volume into out, which must have room
+ * for MAX_CLIPPED_VTXS vertices, and returns the number of vertices left.
+ */
+static u32
+clip_polygon(std::span<vertex *> in, u32 num_vertices, bool render_clipped_far,
+		vertex *out)
+{
+	u32 all_out = 0x3F;
+	u32 any_out = 0;
+	for (u32 i = 0; i < num_vertices; i++) {
+		u32 code = get_clip_outcode(in[i]);
+		all_out &= code;
+		any_out |= code;
+		out[i] = *in[i];
+	}
 
-		if (!(curr_inside && next_inside) && !render_clipped) {
-			in.clear();
-			return;
+	if (all_out) {
+		return 0;
+	}
+
+	if (!any_out) {
+		return num_vertices;
+	}
+
+	if ((any_out & CLIP_FAR) && !render_clipped_far) {
+		return 0;
+	}
+
+	vertex tmp[MAX_CLIPPED_VTXS];
+	u32 n = num_vertices;
+	n = clip_polygon_plane(out, n, tmp, 2, 1);
+	n = clip_polygon_plane(tmp, n, out, 2, 0);
+	n = clip_polygon_plane(out, n, tmp, 1, 1);
+	n = clip_polygon_plane(tmp, n, out, 1, 0);
+	n = clip_polygon_plane(out, n, tmp, 0, 1);
+	n = clip_polygon_plane(tmp, n, out, 0, 0);
+
+	return n;
+}
+
+static u32
+clip_polygon_plane(const vertex *in, u32 num_vertices, vertex *out,
+		int plane, int positive)
+{
+	u32 count = 0;
+
+	for (u32 i = 0; i < num_vertices; i++) {
+		const vertex *curr = &in[i];
+		const vertex *next = &in[i + 1 == num_vertices ? 0 : i + 1];
+		bool curr_inside = clip_inside(curr, plane, positive);
+		bool next_inside = clip_inside(next, plane, positive);
+
+		if (curr_inside) {
+			out[count++] = *curr;
 		}
 
-		if (curr_inside && next_inside) {
-			curr = next;
-		} else if (curr_inside) {
-			in.insert(next, create_clipped_vertex(curr, next,
-							plane, positive));
-			curr = next;
-		} else if (next_inside) {
-			in.insert(next, create_clipped_vertex(curr, next,
-							plane, positive));
-			in.erase(curr);
-			curr = next;
-		} else {
-			curr = in.erase(curr);
+		if (curr_inside != next_inside) {
+			out[count++] = create_clipped_vertex(
+					curr, next, plane, positive);
 		}
 	}
 
-	in.erase(end);
+	return count;
+}
+
+static bool
+clip_inside(const vertex *v, int plane, int positive)
+{
+	return positive ? v->pos[plane] <= v->pos[3]
+	                : v->pos[plane] >= -v->pos[3];
 }
 
 static vertex
-create_clipped_vertex(std::list<vertex>::iterator v0,
-		std::list<vertex>::iterator v1, int plane, int positive)
+create_clipped_vertex(
+		const vertex *v0, const vertex *v1, int plane, int positive)
 {
 	vertex r;
 	interpolator i;
@@ -1132,6 +1312,113 @@ clip_lerp(s32 y0, s32 y1, interpolator *i, int positive)
 	}
 }
 
+#ifdef TWICE_HAVE_AVX2
+/*
+ * Lights all four lights at once, one per lane, and adds up the lanes of
+ * the enabled lights.
+ */
+[[gnu::target("avx2")]] static void
+light_vertex_avx2(geometry_engine *ge, const s32 *normal)
+{
+	alignas(16) s32 light_vec[3][4];
+	alignas(16) s32 light_color[3][4];
+	for (u32 i = 0; i < 4; i++) {
+		for (u32 j = 0; j < 3; j++) {
+			light_vec[j][i] = ge->light_vec[i][j];
+			light_color[j][i] = ge->light_color[i][j];
+		}
+	}
+
+	__m128i zero = _mm_setzero_si128();
+	__m128i dif_dot = zero;
+	for (u32 j = 0; j < 3; j++) {
+		__m128i v = _mm_load_si128((__m128i *)light_vec[j]);
+		v = _mm_mullo_epi32(_mm_sub_epi32(zero, v),
+				_mm_set1_epi32(normal[j]));
+		dif_dot = _mm_add_epi32(dif_dot, _mm_srai_epi32(v, 9));
+	}
+	__m128i dif_level = dif_dot;
+
+	__m128i spe_dot = _mm_add_epi32(dif_dot, _mm_set1_epi32(normal[2]));
+	__m128i spe_dot_high = _mm_sub_epi32(_mm_set1_epi32(0x800), spe_dot);
+	spe_dot_high = _mm_and_si128(spe_dot_high, _mm_set1_epi32(0x3FF));
+	spe_dot = _mm_blendv_epi8(spe_dot, spe_dot_high,
+			_mm_cmpgt_epi32(spe_dot, _mm_set1_epi32(0x3FF)));
+
+	__m128i spe_recip = _mm_loadu_si128((__m128i *)ge->spe_recip.data());
+	__m128i spe_level = _mm_mullo_epi32(spe_dot, spe_dot);
+	spe_level = _mm_srai_epi32(spe_level, 10);
+	spe_level = _mm_mullo_epi32(spe_level, spe_recip);
+	spe_level = _mm_srai_epi32(spe_level, 8);
+	spe_level = _mm_sub_epi32(spe_level, _mm_set1_epi32(1 << 9));
+	spe_level = _mm_srai_epi32(_mm_slli_epi32(spe_level, 18), 18);
+	spe_level = _mm_min_epi32(spe_level, _mm_set1_epi32(511));
+
+	if (ge->shiny_table_enabled) {
+		alignas(16) s32 level[4];
+		__m128i idx = _mm_srai_epi32(spe_level, 2);
+		idx = _mm_min_epi32(_mm_max_epi32(idx, zero),
+				_mm_set1_epi32(127));
+		_mm_store_si128((__m128i *)level, idx);
+		for (u32 i = 0; i < 4; i++) {
+			level[i] = ge->shiny_table[level[i]] << 1;
+		}
+		spe_level = _mm_load_si128((__m128i *)level);
+	}
+
+	__m128i no_dif = _mm_cmpgt_epi32(zero, dif_level);
+	__m128i no_spe = _mm_or_si128(
+			_mm_cmpgt_epi32(_mm_set1_epi32(1), dif_dot),
+			_mm_cmpgt_epi32(zero, spe_level));
+	__m128i dif_high = _mm_cmpgt_epi32(dif_level, _mm_set1_epi32(1023));
+	__m128i enabled = _mm_cmpeq_epi32(
+			_mm_and_si128(_mm_set1_epi32(ge->poly_attr),
+					_mm_setr_epi32(1, 2, 4, 8)),
+			zero);
+	enabled = _mm_xor_si128(enabled, _mm_set1_epi32(-1));
+
+	s32 color[3];
+	for (u32 j = 0; j < 3; j++) {
+		__m128i l = _mm_load_si128((__m128i *)light_color[j]);
+
+		__m128i dif_l = _mm_mullo_epi32(
+				_mm_set1_epi32(ge->diffuse_color[j]), l);
+		__m128i dif = _mm_mullo_epi32(dif_l, dif_level);
+		__m128i dif_over = _mm_sub_epi32(
+				_mm_set1_epi32(1024), dif_l);
+		dif_over = _mm_add_epi32(_mm_slli_epi32(dif_over, 10),
+				_mm_mullo_epi32(dif_l, _mm_sub_epi32(dif_level,
+						_mm_set1_epi32(1024))));
+		dif = _mm_blendv_epi8(dif, dif_over, dif_high);
+		dif = _mm_max_epi32(dif, zero);
+		dif = _mm_min_epi32(dif, _mm_set1_epi32((s32)31 << 14));
+		dif = _mm_andnot_si128(_mm_or_si128(no_dif,
+				_mm_cmpeq_epi32(dif_l, zero)), dif);
+
+		__m128i spe_l = _mm_mullo_epi32(
+				_mm_set1_epi32(ge->specular_color[j]), l);
+		__m128i spe = _mm_mullo_epi32(spe_l, spe_level);
+		spe = _mm_andnot_si128(_mm_or_si128(no_spe,
+				_mm_cmpeq_epi32(spe_l, zero)), spe);
+
+		__m128i amb = _mm_mullo_epi32(
+				_mm_set1_epi32(ge->ambient_color[j]), l);
+		amb = _mm_slli_epi32(amb, 9);
+
+		__m128i sum = _mm_add_epi32(_mm_add_epi32(dif, spe), amb);
+		sum = _mm_and_si128(sum, enabled);
+		sum = _mm_hadd_epi32(sum, sum);
+		sum = _mm_hadd_epi32(sum, sum);
+		color[j] = (ge->emission_color[j] << 14) +
+		           _mm_cvtsi128_si32(sum);
+	}
+
+	ge->vtx_color[0] = std::clamp<s32>(color[0] >> 14, 0, 31);
+	ge->vtx_color[1] = std::clamp<s32>(color[1] >> 14, 0, 31);
+	ge->vtx_color[2] = std::clamp<s32>(color[2] >> 14, 0, 31);
+}
+#endif
+
 static void
 add_vertex(geometry_engine *ge)
 {
@@ -1297,13 +1584,18 @@ add_polygon(geometry_engine *ge)
 		}
 	}
 
-	std::vector<vertex> clipped_vertices = clip_polygon(
-			vertices, num_vtxs, ge->poly_attr & BIT(12));
-	if (clipped_vertices.empty()) {
+	vertex clipped_vertices[MAX_CLIPPED_VTXS];
+	num_vtxs = clip_polygon(vertices, num_vtxs, ge->poly_attr & BIT(12),
+			clipped_vertices);
+	if (num_vtxs == 0) {
+		return;
+	}
+
+	if (num_vtxs > 10) {
+		LOG("too many clipped vertices\n");
 		return;
 	}
 
-	num_vtxs = clipped_vertices.size();
 	if (vr->count + num_vtxs > 6144) {
 		LOG("vertex ram full\n");
 		return;
@@ -32,6 +32,8 @@ struct geometry_engine {
 	std::array<u8, 3> light_color[4]{};
 	std::array<s32, 3> light_vec[4]{};
 	std::array<s32, 3> half_vec[4]{};
+	/* (1 << 18) / -half_vec[i][2], used for the specular level */
+	std::array<s32, 4> spe_recip{ 512, 512, 512, 512 };
 	std::array<s32, 3> normal_vec{};
 	std::array<s32, 2> texcoord{};
 	std::array<s32, 2> vtx_texcoord{};
@@ -47,8 +47,21 @@ static void gxfifo_write(gpu_3d_engine *gpu, u32 value);
 static void unpack_gxfifo_to_fifo(gpu_3d_engine *gpu);
 static void fifo_pipe_push(gpu_3d_engine *gpu, u8 cmd, u32 param);
 static void fifo_pipe_process_commands(gpu_3d_engine *gpu);
+static void run_ge_command(
+		gpu_3d_engine *gpu, u8 cmd, const u32 *params, u32 num_params);
 static void execute_swap_buffers(gpu_3d_engine *gpu);
+static u64 hash_scene(rendering_engine *re);
 static bool valid_ge_command(u8 command);
+static void ge_thread_push(
+		gpu_3d_engine *gpu, u8 cmd, const u32 *params, u32 num_params);
+static void ge_thread_wait(gpu_3d_engine *gpu);
+static void ge_thread_wait_for(gpu_3d_engine *gpu, u32 idx);
+static void ge_thread_main(gpu_3d_engine *gpu);
+
+enum : u32 {
+	/* tells the geometry thread to return */
+	GE_THREAD_QUIT = 0xFF,
+};
 
 void
 gpu3d_init(nds_ctx *nds)
@@ -83,6 +96,10 @@ gpu_3d_read8(gpu_3d_engine *gpu, u16 offset)
 u16
 gpu_3d_read16(gpu_3d_engine *gpu, u16 offset)
 {
+	if (offset != 0x600 && offset != 0x602) {
+		ge_thread_wait(gpu);
+	}
+
 	switch (offset) {
 	case 0x320:
 		return 46;
@@ -108,6 +125,10 @@ gpu_3d_read16(gpu_3d_engine *gpu, u16 offset)
 u32
 gpu_3d_read32(gpu_3d_engine *gpu, u16 offset)
 {
+	if (offset != 0x600) {
+		ge_thread_wait(gpu);
+	}
+
 	if (0x640 <= offset && offset < 0x680) {
 		u32 idx = offset >> 2 & 0xF;
 		return gpu->ge.clip_mtx[idx];
@@ -193,6 +214,7 @@ gpu_3d_write16(gpu_3d_engine *gpu, u16 offset, u16 value)
 		return;
 	case 0x610:
 		/* NO SEXT */
+		ge_thread_wait(gpu);
 		gpu->ge.disp_1dot_depth = (s32)(value & 0x7FFF) << 9;
 		return;
 	}
@@ -266,14 +288,18 @@ gpu_3d_write32(gpu_3d_engine *gpu, u16 offset, u32 value)
 void
 gpu3d_on_vblank(gpu_3d_engine *gpu)
 {
+	re_wait_for_frame(&gpu->re);
+	ge_thread_wait(gpu);
+
 	if (!gpu->ge.enabled)
 		return;
 
+	bool swapped = false;
 	bool render_frame = false;
 
 	if (gpu->halted) {
 		execute_swap_buffers(gpu);
-		render_frame = true;
+		swapped = true;
 	}
 
 	if (gpu->re.enabled) {
@@ -284,8 +310,24 @@ gpu3d_on_vblank(gpu_3d_engine *gpu)
 			render_frame = true;
 		}
 
+		/*
+		 * Many games submit the same display list every frame, in
+		 * which case the output of the last frame can be kept.
+		 */
+		if (gpu->scene_hash != gpu->rendered_scene_hash) {
+			render_frame = true;
+		}
+
+		if (swapped) {
+			gpu->frames_swapped++;
+			if (!render_frame) {
+				gpu->frames_reused++;
+			}
+		}
+
 		gpu->re.manual_sort = gpu->ge.swap_bits & 1;
 		gpu->re.r = gpu->re.r_s;
+		gpu->rendered_scene_hash = gpu->scene_hash;
 
 		gpu->render_frame = render_frame;
 	}
@@ -326,6 +368,8 @@ gxfifo_check_irq(gpu_3d_engine *gpu)
 static u32
 gxstat_read(gpu_3d_engine *gpu)
 {
+	ge_thread_wait_for(gpu, gpu->ge_thread.gxstat_idx);
+
 	/* TODO: unhandled bits when gpu timings added */
 	u32 fifo_size = gpu->fifo.buffer.size();
 	if (fifo_size > 256) {
@@ -343,11 +387,13 @@ gxstat_read(gpu_3d_engine *gpu)
 static void
 gxstat_write(gpu_3d_engine *gpu, u32 value)
 {
+	ge_thread_wait(gpu);
+
 	gpu->gxstat = (gpu->gxstat & ~0xC0000000) | (value & 0xC0000000);
 
 	if (value & BIT(15)) {
-		gpu->gxstat &= ~BIT(15);
-		gpu->gxstat &= ~BIT(13);
+		gpu->gxstat &= ~(u32)BIT(15);
+		gpu->gxstat &= ~(u32)BIT(13);
 		gpu->ge.proj_sp = 0;
 		gpu->ge.texture_sp = 0;
 	}
@@ -358,6 +404,8 @@ gxstat_write(gpu_3d_engine *gpu, u32 value)
 static void
 gxstat_write_byte_3(gpu_3d_engine *gpu, u8 value)
 {
+	ge_thread_wait(gpu);
+
 	gpu->gxstat = (gpu->gxstat & ~0xC0000000) |
 	              ((u32)(value << 24) & 0xC0000000);
 	gxfifo_check_irq(gpu);
@@ -384,10 +432,10 @@ gxfifo_write(gpu_3d_engine *gpu, u32 value)
 			unpack_gxfifo_to_fifo(gpu);
 		}
 
-		gxfifo.params.clear();
+		gxfifo.num_params = 0;
 	} else {
 		gxfifo.params_left--;
-		gxfifo.params.push_back(value);
+		gxfifo.params[gxfifo.num_params++] = value;
 
 		if (gxfifo.params_left == 0) {
 			unpack_gxfifo_to_fifo(gpu);
@@ -447,16 +495,16 @@ fifo_pipe_process_commands(gpu_3d_engine *gpu)
 	while (!fifo.buffer.empty()) {
 		auto entry = fifo.buffer.front();
 		u32 num_params = ge_cmd_num_params[entry.cmd];
+		u32 params[32];
 
 		if (num_params == 0) {
 			fifo.buffer.pop();
-			ge_execute_command(&gpu->ge, entry.cmd);
+			run_ge_command(gpu, entry.cmd, params, 0);
 		} else if (fifo.buffer.size() >= num_params) {
 			for (u32 i = 0; i < num_params; i++) {
-				gpu->ge.cmd_params[i] =
-						fifo.buffer.pop().param;
+				params[i] = fifo.buffer.pop().param;
 			}
-			ge_execute_command(&gpu->ge, entry.cmd);
+			run_ge_command(gpu, entry.cmd, params, num_params);
 		} else {
 			break;
 		}
@@ -473,6 +521,20 @@ fifo_pipe_process_commands(gpu_3d_engine *gpu)
 	}
 }
 
+static void
+run_ge_command(gpu_3d_engine *gpu, u8 cmd, const u32 *params, u32 num_params)
+{
+	/* SWAP_BUFFERS halts the FIFO, so it has to take effect right away */
+	if (gpu->nds->config->threaded_geometry && cmd != 0x50) {
+		ge_thread_push(gpu, cmd, params, num_params);
+		return;
+	}
+
+	ge_thread_wait(gpu);
+	std::copy(params, params + num_params, gpu->ge.cmd_params);
+	ge_execute_command(&gpu->ge, cmd);
+}
+
 static void
 execute_swap_buffers(gpu_3d_engine *gpu)
 {
@@ -481,6 +543,62 @@ execute_swap_buffers(gpu_3d_engine *gpu)
 	gpu->ge.vtx_ram->count = 0;
 	gpu->ge.poly_ram->count = 0;
 	gpu->halted = false;
+	gpu->scene_hash = hash_scene(&gpu->re);
+}
+
+/* the finalizer of MurmurHash3, every input bit affects every output bit */
+static u64
+mix64(u64 x)
+{
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCD;
+	x ^= x >> 33;
+	x *= 0xC4CEB9FE1A85EC53;
+	x ^= x >> 33;
+	return x;
+}
+
+static u64
+hash_combine(u64 h, u64 v)
+{
+	return mix64(h ^ mix64(v));
+}
+
+/*
+ * Hashes the parts of polygon and vertex RAM that the renderer reads.
+ * Vertices are hashed by their index, since the two copies of vertex RAM
+ * are at different addresses.
+ */
+static u64
+hash_scene(rendering_engine *re)
+{
+	vertex_ram *vr = re->vtx_ram;
+	polygon_ram *pr = re->poly_ram;
+	u64 h = hash_combine(0xCBF29CE484222325,
+			(u64)vr->count << 32 | pr->count);
+
+	for (u32 i = 0; i < vr->count; i++) {
+		const vertex& v = vr->vtxs[i];
+		h = hash_combine(h, (u64)(u32)v.sx << 32 | (u32)v.sy);
+		h = hash_combine(h, (u64)(u32)v.attr[0] << 32 | (u32)v.attr[1]);
+		h = hash_combine(h, (u64)(u32)v.attr[2] << 32 | (u32)v.attr[3]);
+		h = hash_combine(h, (u32)v.attr[4]);
+	}
+
+	for (u32 i = 0; i < pr->count; i++) {
+		const polygon& p = pr->polys[i];
+		h = hash_combine(h, (u64)p.attr << 32 | p.num_vtxs);
+		h = hash_combine(h, (u64)p.tx_param << 32 | p.pltt_base);
+		h = hash_combine(h, p.wbuffering | p.translucent << 1 |
+		                            p.backface << 2);
+		for (u32 j = 0; j < p.num_vtxs; j++) {
+			u64 idx = p.vtxs[j] - vr->vtxs.data();
+			h = hash_combine(h, idx << 32 | (u32)p.w[j]);
+			h = hash_combine(h, (u32)p.z[j]);
+		}
+	}
+
+	return h;
 }
 
 static bool
@@ -489,4 +607,115 @@ valid_ge_command(u8 command)
 	return ge_cmd_num_params[command] != -1;
 }
 
+gpu_3d_engine::geometry_thread::~geometry_thread()
+{
+	if (!thread.joinable()) {
+		return;
+	}
+
+	u32 idx = write_idx.load(std::memory_order_relaxed);
+	u32 r;
+	while ((r = read_idx.load(std::memory_order_acquire)) != idx) {
+		read_idx.wait(r, std::memory_order_acquire);
+	}
+
+	queue[idx % QUEUE_SIZE] = GE_THREAD_QUIT;
+	write_idx.store(idx + 1, std::memory_order_release);
+	write_idx.notify_one();
+	thread.join();
+}
+
+static void
+ge_thread_push(gpu_3d_engine *gpu, u8 cmd, const u32 *params, u32 num_params)
+{
+	auto& t = gpu->ge_thread;
+	constexpr u32 size = gpu_3d_engine::geometry_thread::QUEUE_SIZE;
+
+	if (!t.thread.joinable()) {
+		t.thread = std::thread(ge_thread_main, gpu);
+	}
+
+	u32 idx = t.write_idx.load(std::memory_order_relaxed);
+	u32 end = idx + 1 + num_params;
+	while (true) {
+		u32 read_idx = t.read_idx.load(std::memory_order_acquire);
+		if (end - read_idx <= size) {
+			break;
+		}
+		t.read_idx.wait(read_idx, std::memory_order_acquire);
+	}
+
+	t.queue[idx++ % size] = cmd | num_params << 8;
+	for (u32 i = 0; i < num_params; i++) {
+		t.queue[idx++ % size] = params[i];
+	}
+	t.write_idx.store(idx, std::memory_order_release);
+	t.write_idx.notify_one();
+
+	/* MTX_PUSH, MTX_POP, MTX_STORE, MTX_RESTORE and BOX_TEST */
+	if ((0x11 <= cmd && cmd <= 0x14) || cmd == 0x70) {
+		t.gxstat_idx = idx;
+	}
+}
+
+/*
+ * Waits for the geometry thread to run every queued command, after which
+ * the emulation thread may touch the geometry engine.
+ */
+static void
+ge_thread_wait(gpu_3d_engine *gpu)
+{
+	auto& t = gpu->ge_thread;
+	ge_thread_wait_for(gpu, t.write_idx.load(std::memory_order_relaxed));
+}
+
+static void
+ge_thread_wait_for(gpu_3d_engine *gpu, u32 idx)
+{
+	auto& t = gpu->ge_thread;
+
+	while (true) {
+		u32 read_idx = t.read_idx.load(std::memory_order_acquire);
+		if ((s32)(idx - read_idx) <= 0) {
+			break;
+		}
+		t.read_idx.wait(read_idx, std::memory_order_acquire);
+	}
+}
+
+static void
+ge_thread_main(gpu_3d_engine *gpu)
+{
+	auto& t = gpu->ge_thread;
+	constexpr u32 size = gpu_3d_engine::geometry_thread::QUEUE_SIZE;
+	u32 idx = t.read_idx.load(std::memory_order_relaxed);
+
+	while (true) {
+		u32 write_idx = t.write_idx.load(std::memory_order_acquire);
+		if (idx == write_idx) {
+			t.write_idx.wait(write_idx, std::memory_order_acquire);
+			continue;
+		}
+
+		/* run everything queued so far before reporting progress */
+		while (idx != write_idx) {
+			u32 word = t.queue[idx++ % size];
+			u8 cmd = word;
+			u32 num_params = word >> 8;
+
+			if (cmd == GE_THREAD_QUIT) {
+				return;
+			}
+
+			for (u32 i = 0; i < num_params; i++) {
+				gpu->ge.cmd_params[i] = t.queue[idx++ % size];
+			}
+			ge_execute_command(&gpu->ge, cmd);
+		}
+
+		t.read_idx.store(idx, std::memory_order_release);
+		t.read_idx.notify_all();
+	}
+}
+
 } // namespace twice
@@ -1,6 +1,9 @@
 #ifndef TWICE_GPU3D_H
 #define TWICE_GPU3D_H
 
+#include <atomic>
+#include <thread>
+
 #include "common/ringbuf.h"
 #include "common/types.h"
 #include "nds/gpu/3d/ge.h"
@@ -12,9 +15,17 @@ namespace twice {
 struct nds_ctx;
 
 struct gpu_3d_engine {
-	u32 gxstat{};
+	/* also written by the geometry thread */
+	std::atomic<u32> gxstat{};
 	bool halted{};
 	bool render_frame{};
+	/* hash of the scene swapped to the renderer, see hash_scene */
+	u64 scene_hash{};
+	/* hash of the scene in the output buffers of the renderer */
+	u64 rendered_scene_hash{};
+	/* swapped 3D frames, and those that reused the last output */
+	u64 frames_swapped{};
+	u64 frames_reused{};
 
 	geometry_engine ge;
 	rendering_engine re;
@@ -34,12 +45,34 @@ struct gpu_3d_engine {
 	struct gxfifo {
 		u8 cmd[4]{};
 		int params_left{};
-		std::vector<u32> params{};
+		/* up to 32 parameters for each of the 4 packed commands */
+		std::array<u32, 128> params{};
+		u32 num_params{};
 	} gxfifo;
 
 	vertex_ram vtx_ram[2]{};
 	polygon_ram poly_ram[2]{};
 
+	/*
+	 * With threaded_geometry, commands leaving the FIFO are queued here
+	 * and executed by the geometry thread. Each command is a word with the
+	 * command and its number of parameters, followed by the parameters.
+	 * The indices only increase, and the emulation thread waits for
+	 * read_idx to catch up before it looks at the geometry engine.
+	 */
+	struct geometry_thread {
+		static constexpr u32 QUEUE_SIZE = 16384;
+
+		std::array<u32, QUEUE_SIZE> queue{};
+		std::atomic<u32> read_idx{};
+		std::atomic<u32> write_idx{};
+		/* write_idx after the last command that changes GXSTAT */
+		u32 gxstat_idx{};
+		std::thread thread;
+
+		~geometry_thread();
+	} ge_thread;
+
 	nds_ctx *nds{};
 };
 
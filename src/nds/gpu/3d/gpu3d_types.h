@@ -8,6 +8,7 @@ namespace twice {
 struct rendering_engine;
 struct geometry_engine;
 struct gpu_3d_engine;
+struct texture_cache_entry;
 
 struct vertex {
 	std::array<s32, 4> pos{};  /* x, y, z, w */
@@ -100,6 +101,7 @@ struct re_polygon {
 	u32 id{};
 	bool shadow{};
 	bool horizontal_line{};
+	texture_cache_entry *texture{};
 };
 
 struct vertex_ram {
@@ -1,5 +1,6 @@
 #include "nds/gpu/3d/re.h"
 
+#include "common/cpu.h"
 #include "common/macros.h"
 #include "nds/mem/vram.h"
 #include "nds/nds.h"
@@ -36,7 +37,13 @@ struct poly_render_data {
 
 /* setup */
 static void clear_buffers(rendering_engine *re);
+static void fill_pixels(rendering_engine *re, const re_pixel& px);
+#ifdef TWICE_HAVE_AVX2
+static void fill_pixels_avx2(rendering_engine *re, const re_pixel& px);
+#endif
 static void setup_polygons(rendering_engine *re);
+static void setup_line_polygon_lists(rendering_engine *re);
+static void setup_polygon_textures(rendering_engine *re);
 static void find_polygon_start_end_sortkey(polygon *p, bool manual_sort);
 static void setup_polygon(rendering_engine *re, re_polygon *p);
 static void setup_polygon_scanline(rendering_engine *re, re_polygon *p, s32 y);
@@ -49,22 +56,36 @@ static std::pair<bool, bool> setup_poly_fill_rules(rendering_engine *re,
 static void get_slope_x_cov(slope *s, s32& x_start, s32& x_end, s32& cov_start,
 		s32& cov_end, s32 y);
 
+/* threads */
+static void render_frame_task(void *data, int);
+static void render_frame(rendering_engine *re);
+static void render_frame_threaded(rendering_engine *re, int num_threads);
+static bool get_band_shadow_mask_state(rendering_engine *re, s32 y0);
+static void render_band(void *data, int i);
+static void setup_band_polygons(rendering_engine *re, re_band *b);
+
 /* rendering */
-static void render_scanline(rendering_engine *re, s32 y);
+static void render_scanline(rendering_engine *re, re_band *b, s32 y);
+static void advance_polygon_edges(rendering_engine *re, re_polygon *p, s32 y);
 static void render_polygon_scanline(
-		rendering_engine *re, re_polygon *p, s32 y);
+		rendering_engine *re, re_band *b, re_polygon *p, s32 y);
 static void render_shadow_mask_polygon_pixel(rendering_engine *re,
 		poly_render_data& r_data, interpolator *span, u32 x, s32 y,
 		u32 attr);
+static void render_normal_polygon_span(rendering_engine *re,
+		poly_render_data& r_data, interpolator *span, u32 start,
+		u32 end, s32 y, u32 attr);
 static void render_normal_polygon_pixel(rendering_engine *re,
 		poly_render_data& r_data, interpolator *span, u32 x, s32 y,
 		u32 attr);
+static void draw_polygon_pixel(rendering_engine *re,
+		poly_render_data& r_data, interpolator *span, u32 x, s32 y,
+		s32 z, bool layer, u32 attr);
 static bool depth_test(rendering_engine *re, s32 z, u32 x, u32 y, bool layer,
 		u32 attr, bool wbuffering);
-static color4 get_pixel_color(rendering_engine *re, polygon *p, u8 rv, u8 gv,
-		u8 bv, u8 av, s32 s, s32 t);
-static color4 get_texture_color(
-		rendering_engine *re, polygon *p, s32 s, s32 t);
+static color4 get_pixel_color(rendering_engine *re, re_polygon *p, u8 rv,
+		u8 gv, u8 bv, u8 av, s32 s, s32 t);
+static color4 get_texture_color(re_polygon *p, s32 s, s32 t);
 static s32 clamp_or_repeat_texcoords(s32 s, s32 size, bool clamp, bool flip);
 static void draw_opaque_pixel(rendering_engine *re, poly_render_data& r_data,
 		color4 color, u32 x, u32 y, s32 z, bool layer, u32 attr);
@@ -73,10 +94,13 @@ static void draw_translucent_pixel(rendering_engine *re,
 		bool layer, bool shadow, u32 attr);
 
 /* effects */
-static void apply_effects_scanline(rendering_engine *re, s32 y);
-static void apply_edge_marking(rendering_engine *re, s32 y);
-static void get_surrounding_id_depth(rendering_engine *re, s32 y, s32 x,
-		u32 *id_out, s32 *depth_out);
+static void apply_effects_scanline(
+		rendering_engine *re, const re_band *b, s32 y);
+static void save_band_edges(rendering_engine *re, re_band *b);
+static void apply_edge_marking(
+		rendering_engine *re, const re_band *b, s32 y);
+static void get_surrounding_id_depth(rendering_engine *re, const re_band *b,
+		s32 y, s32 x, u32 *id_out, s32 *depth_out);
 static void apply_fog(rendering_engine *re, s32 y);
 static u8 calculate_fog_density(
 		u8 *fog_table, s32 fog_offset, s32 fog_step, s32 z);
@@ -102,16 +126,169 @@ re_render_frame(rendering_engine *re)
 	if (!re->enabled)
 		return;
 
-	setup_fast_texture_vram(re->gpu->nds);
+	nds_ctx *nds = re->gpu->nds;
+	re_wait_for_frame(re);
+	re->frame_id++;
+
+	/*
+	 * The renderer only reads the latched registers and the texture
+	 * copies made here, which the emulator leaves alone until the next
+	 * vblank, so the frame can be rendered while emulation goes on.
+	 */
+	setup_fast_texture_vram(nds);
+
+	if (nds->config->async_render) {
+		thread_pool_resize(&re->render_thread, 1);
+		thread_pool_start(&re->render_thread, 1, render_frame_task, re);
+		re->render_pending = true;
+	} else {
+		render_frame(re);
+	}
+}
+
+/*
+ * Waits for a frame started by re_render_frame to be done. Must be called
+ * before reading the output buffers or changing the renderer state.
+ */
+void
+re_wait_for_frame(rendering_engine *re)
+{
+	if (re->render_pending) {
+		thread_pool_wait(&re->render_thread);
+		re->render_pending = false;
+	}
+}
+
+static void
+render_frame_task(void *data, int)
+{
+	render_frame((rendering_engine *)data);
+}
+
+static void
+render_frame(rendering_engine *re)
+{
+	nds_ctx *nds = re->gpu->nds;
 	clear_buffers(re);
 	setup_polygons(re);
 
+	int num_threads = std::clamp(
+			nds->config->render_threads, 1, +MAX_RENDER_THREADS);
+	if (num_threads > 1) {
+		render_frame_threaded(re, num_threads);
+		return;
+	}
+
+	re_band *b = &re->bands[0];
+	b->y0 = 0;
+	b->y1 = 192;
+	b->polys = re->polys.data();
+	b->last_poly_is_shadow_mask = re->last_poly_is_shadow_mask;
+
 	for (s32 i = 0; i < 192; i++) {
-		render_scanline(re, i);
+		render_scanline(re, b, i);
 	}
+	re->last_poly_is_shadow_mask = b->last_poly_is_shadow_mask;
 
 	for (s32 i = 0; i < 192; i++) {
-		apply_effects_scanline(re, i);
+		apply_effects_scanline(re, b, i);
+	}
+}
+
+/*
+ * Splits the screen into one band of scanlines per thread. Every band
+ * walks the polygon edges on its own copy of the polygons, so the output
+ * is the same as when rendering on one thread.
+ */
+static void
+render_frame_threaded(rendering_engine *re, int num_threads)
+{
+	thread_pool_resize(&re->pool, num_threads - 1);
+	re->num_bands = num_threads;
+
+	for (int i = 0; i < num_threads; i++) {
+		re_band *b = &re->bands[i];
+		b->y0 = 192 * i / num_threads;
+		b->y1 = 192 * (i + 1) / num_threads;
+		b->last_poly_is_shadow_mask =
+				get_band_shadow_mask_state(re, b->y0);
+		b->rasterized = false;
+	}
+
+	thread_pool_run(&re->pool, num_threads, render_band, re);
+	re->last_poly_is_shadow_mask =
+			re->bands[num_threads - 1].last_poly_is_shadow_mask;
+}
+
+/*
+ * last_poly_is_shadow_mask is carried over from one scanline to the next,
+ * so a band starts with the value left by the last polygon drawn on the
+ * closest line above it.
+ */
+static bool
+get_band_shadow_mask_state(rendering_engine *re, s32 y0)
+{
+	for (s32 y = y0; y--;) {
+		u32 end = re->line_start[y + 1];
+		if (re->line_start[y] != end) {
+			re_polygon *p = &re->polys[re->line_polys[end - 1]];
+			return p->shadow && p->id == 0;
+		}
+	}
+
+	return re->last_poly_is_shadow_mask;
+}
+
+static void
+render_band(void *data, int i)
+{
+	auto *re = (rendering_engine *)data;
+	re_band *b = &re->bands[i];
+
+	setup_band_polygons(re, b);
+	for (s32 y = b->y0; y < b->y1; y++) {
+		render_scanline(re, b, y);
+	}
+
+	/* edge marking looks at the lines next to the band */
+	if (re->r.disp3dcnt & BIT(5)) {
+		save_band_edges(re, b);
+	}
+
+	b->rasterized = true;
+	b->rasterized.notify_all();
+
+	if (re->r.disp3dcnt & BIT(5)) {
+		if (i != 0) {
+			re->bands[i - 1].rasterized.wait(false);
+		}
+		if (i != re->num_bands - 1) {
+			re->bands[i + 1].rasterized.wait(false);
+		}
+	}
+
+	for (s32 y = b->y0; y < b->y1; y++) {
+		apply_effects_scanline(re, b, y);
+	}
+}
+
+static void
+setup_band_polygons(rendering_engine *re, re_band *b)
+{
+	u32 num_polys = re->poly_ram->count;
+	b->poly_state.resize(re->polys.size());
+	b->polys = b->poly_state.data();
+
+	for (u32 i = 0; i < num_polys; i++) {
+		re_polygon *p = &re->polys[i];
+		if (p->end_y <= b->y0 || p->start_y >= b->y1)
+			continue;
+
+		/* walk the edges down to the first line of the band */
+		b->polys[i] = *p;
+		for (s32 y = std::max(p->start_y, 0); y < b->y0; y++) {
+			advance_polygon_edges(re, &b->polys[i], y);
+		}
 	}
 }
 
@@ -128,14 +305,17 @@ clear_buffers(rendering_engine *re)
 		u32 rear_attr = re->r.clear_color & 0x3F000000;
 
 		for (u32 y = 0; y < 192; y++) {
+			/* the rear color and depth rows are contiguous */
+			u32 row = ((y_offset + y) & 0xFF) << 9;
+			const u8 *colors = nds->vram.texture_fast + 0x40000 +
+			                   row;
+			const u8 *depths = nds->vram.texture_fast + 0x60000 +
+			                   row;
+
 			for (u32 x = 0; x < 256; x++) {
-				u32 bmp_x = (x_offset + x) & 0xFF;
-				u32 bmp_y = (y_offset + y) & 0xFF;
-				u32 offset = (bmp_y << 9) + (bmp_x << 1);
-				u16 rear_color = vram_read_texture<u16>(
-						nds, 0x40000 + offset);
-				u32 rear_depth = vram_read_texture<u16>(
-						nds, 0x60000 + offset);
+				u32 offset = ((x_offset + x) & 0xFF) << 1;
+				u16 rear_color = readarr<u16>(colors, offset);
+				u32 rear_depth = readarr<u16>(depths, offset);
 				color4 color = unpack_abgr1555_3d(rear_color);
 				s32 depth = 0x200 * (rear_depth & 0x7FFF) +
 				            0x1FF;
@@ -149,40 +329,63 @@ clear_buffers(rendering_engine *re)
 				}
 				attr |= rear_depth & 0x8000;
 
+				re_pixel px;
 				for (u32 l = 0; l < 2; l++) {
-					re->color_buf[l][y][x] = color;
-					re->depth_buf[l][y][x] = depth;
-					re->attr_buf[l][y][x] = attr;
+					px.color[l] = color;
+					px.depth[l] = depth;
+					px.attr[l] = attr;
 				}
+				re->pixels[y][x] = px;
 			}
 		}
-
-		for (auto& line : re->stencil_buf)
-			line.fill(0);
-
 	} else {
 		color4 color = unpack_bgr555_3d(re->r.clear_color);
 		color.a = re->r.clear_color >> 16 & 0x1F;
 
+		re_pixel px;
 		for (u32 l = 0; l < 2; l++) {
-			for (auto& line : re->color_buf[l])
-				line.fill(color);
-
-			for (auto& line : re->depth_buf[l])
-				line.fill(default_depth);
-
-			for (auto& line : re->attr_buf[l])
-				line.fill(default_attr);
+			px.color[l] = color;
+			px.depth[l] = default_depth;
+			px.attr[l] = default_attr;
 		}
-
-		for (auto& line : re->stencil_buf)
-			line.fill(0);
+		fill_pixels(re, px);
 	}
 
+	for (auto& line : re->stencil_buf)
+		line.fill(0);
+
 	re->outside_opaque_id_attr = default_attr & 0x3F000000;
 	re->outside_depth = default_depth;
 }
 
+static void
+fill_pixels(rendering_engine *re, const re_pixel& px)
+{
+#ifdef TWICE_HAVE_AVX2
+	if (use_avx2) {
+		fill_pixels_avx2(re, px);
+		return;
+	}
+#endif
+	for (auto& line : re->pixels) {
+		line.fill(px);
+	}
+}
+
+#ifdef TWICE_HAVE_AVX2
+/* a pixel is one 32 byte store */
+[[gnu::target("avx2")]] static void
+fill_pixels_avx2(rendering_engine *re, const re_pixel& px)
+{
+	__m256i v = _mm256_load_si256((const __m256i *)&px);
+	for (auto& line : re->pixels) {
+		for (auto& dst : line) {
+			_mm256_store_si256((__m256i *)&dst, v);
+		}
+	}
+}
+#endif
+
 static void
 setup_polygons(rendering_engine *re)
 {
@@ -203,6 +406,68 @@ setup_polygons(rendering_engine *re)
 	for (u32 i = 0; i < num_polys; i++) {
 		setup_polygon(re, &re->polys[i]);
 	}
+
+	setup_line_polygon_lists(re);
+	setup_polygon_textures(re);
+}
+
+static void
+setup_line_polygon_lists(rendering_engine *re)
+{
+	u32 num_polys = re->poly_ram->count;
+	auto& start = re->line_start;
+
+	start.fill(0);
+	for (u32 i = 0; i < num_polys; i++) {
+		re_polygon *p = &re->polys[i];
+		s32 y0 = std::max(p->start_y, 0);
+		s32 y1 = std::min(p->end_y, 192);
+		for (s32 y = y0; y < y1; y++) {
+			start[y + 1]++;
+		}
+	}
+
+	for (u32 y = 0; y < 192; y++) {
+		start[y + 1] += start[y];
+	}
+	re->line_polys.resize(start[192]);
+
+	/* filled in polygon order, so every line keeps the sort order */
+	std::array<u32, 192> next;
+	std::copy(start.begin(), start.end() - 1, next.begin());
+	for (u32 i = 0; i < num_polys; i++) {
+		re_polygon *p = &re->polys[i];
+		s32 y0 = std::max(p->start_y, 0);
+		s32 y1 = std::min(p->end_y, 192);
+		for (s32 y = y0; y < y1; y++) {
+			re->line_polys[next[y]++] = i;
+		}
+	}
+}
+
+/* looks up the decoded textures before any thread samples them */
+static void
+setup_polygon_textures(rendering_engine *re)
+{
+	nds_ctx *nds = re->gpu->nds;
+	texture_cache *tc = &re->tex_cache;
+	u32 num_polys = re->poly_ram->count;
+
+	texture_cache_begin_frame(tc, nds);
+
+	for (u32 i = 0; i < num_polys; i++) {
+		re_polygon *p = &re->polys[i];
+		polygon *pp = p->p;
+
+		p->texture = nullptr;
+		if ((pp->tx_param >> 26 & 7) == 0 || !(re->r.disp3dcnt & 1))
+			continue;
+
+		p->texture = texture_cache_get(
+				tc, nds, pp->tx_param, pp->pltt_base);
+	}
+
+	texture_cache_end_frame(tc);
 }
 
 static void
@@ -591,33 +856,41 @@ get_slope_x_cov(slope *s, s32& x_start, s32& x_end, s32& cov_start,
 }
 
 static void
-render_scanline(rendering_engine *re, s32 y)
+render_scanline(rendering_engine *re, re_band *b, s32 y)
 {
-	u32 num_polys = re->poly_ram->count;
-
-	for (u32 i = 0; i < num_polys; i++) {
-		re_polygon *p = &re->polys[i];
-		if (y < p->start_y || y >= p->end_y)
-			continue;
+	u32 end = re->line_start[y + 1];
 
-		render_polygon_scanline(re, p, y);
+	for (u32 j = re->line_start[y]; j < end; j++) {
+		u32 i = re->line_polys[j];
+		render_polygon_scanline(re, b, &b->polys[i], y);
 	}
 }
 
 static void
-render_polygon_scanline(rendering_engine *re, re_polygon *p, s32 y)
+advance_polygon_edges(rendering_engine *re, re_polygon *p, s32 y)
+{
+	setup_polygon_scanline(re, p, y);
+
+	u32 k_start = p->shadow && p->id == 0 ? 5 : 0;
+	interp_update_or_set_z_attrs(&p->sl.i, y, k_start, 6);
+	interp_update_or_set_z_attrs(&p->sr.i, y, k_start, 6);
+}
+
+static void
+render_polygon_scanline(
+		rendering_engine *re, re_band *b, re_polygon *p, s32 y)
 {
 	poly_slope_data s_data;
 	poly_render_data r_data;
 	polygon *pp = p->p;
 
-	setup_polygon_scanline(re, p, y);
+	advance_polygon_edges(re, p, y);
 
 	bool shadow_mask = p->shadow && p->id == 0;
-	if (shadow_mask && !re->last_poly_is_shadow_mask) {
+	if (shadow_mask && !b->last_poly_is_shadow_mask) {
 		re->stencil_buf[y].fill(0);
 	}
-	re->last_poly_is_shadow_mask = shadow_mask;
+	b->last_poly_is_shadow_mask = shadow_mask;
 
 	setup_poly_slope_data(re, p, y, s_data);
 	slope *sl = s_data.sl;
@@ -639,8 +912,6 @@ render_polygon_scanline(rendering_engine *re, re_polygon *p, s32 y)
 	auto [fill_left, fill_right] =
 			setup_poly_fill_rules(re, s_data, r_data, y);
 
-	interp_update_or_set_z_attrs(&sl->i, y, shadow_mask ? 5 : 0, 6);
-	interp_update_or_set_z_attrs(&sr->i, y, shadow_mask ? 5 : 0, 6);
 	interpolator span;
 	interp_setup(&span, s_data.i_x0, s_data.i_x1, sl->i.attrs[5].y,
 			sr->i.attrs[5].y, false, pp->wbuffering);
@@ -672,10 +943,8 @@ render_polygon_scanline(rendering_engine *re, re_polygon *p, s32 y)
 				r_data.cov_x1 = s_data.x_l_end - 1;
 			}
 
-			for (u32 x = start; x < end; x++) {
-				render_normal_polygon_pixel(
-						re, r_data, &span, x, y, attr);
-			}
+			render_normal_polygon_span(
+					re, r_data, &span, start, end, y, attr);
 		}
 	}
 
@@ -697,10 +966,8 @@ render_polygon_scanline(rendering_engine *re, re_polygon *p, s32 y)
 				r_data.cov_x1 = 0;
 			}
 
-			for (u32 x = start; x < end; x++) {
-				render_normal_polygon_pixel(
-						re, r_data, &span, x, y, attr);
-			}
+			render_normal_polygon_span(
+					re, r_data, &span, start, end, y, attr);
 		}
 	}
 
@@ -722,10 +989,8 @@ render_polygon_scanline(rendering_engine *re, re_polygon *p, s32 y)
 				r_data.cov_x1 = s_data.x_r_end - 1;
 			}
 
-			for (u32 x = start; x < end; x++) {
-				render_normal_polygon_pixel(
-						re, r_data, &span, x, y, attr);
-			}
+			render_normal_polygon_span(
+					re, r_data, &span, start, end, y, attr);
 		}
 	}
 }
@@ -747,13 +1012,270 @@ render_shadow_mask_polygon_pixel(rendering_engine *re,
 		re->stencil_buf[y][x] = 1;
 	}
 
-	if (re->attr_buf[0][y][x] & 1) {
+	if (re->pixels[y][x].attr[0] & 1) {
 		if (!depth_test(re, z, x, y, 1, attr, wbuffering)) {
 			re->stencil_buf[y][x] |= 2;
 		}
 	}
 }
 
+#ifdef TWICE_HAVE_AVX2
+static void render_normal_polygon_span_avx2(rendering_engine *re,
+		poly_render_data& r_data, interpolator *span, u32 start,
+		u32 end, s32 y, u32 attr);
+#endif
+
+static void
+render_normal_polygon_span(rendering_engine *re, poly_render_data& r_data,
+		interpolator *span, u32 start, u32 end, s32 y, u32 attr)
+{
+#ifdef TWICE_HAVE_AVX2
+	if (use_avx2 && !r_data.p->shadow) {
+		render_normal_polygon_span_avx2(
+				re, r_data, span, start, end, y, attr);
+		return;
+	}
+#endif
+
+	for (u32 x = start; x < end; x++) {
+		render_normal_polygon_pixel(re, r_data, span, x, y, attr);
+	}
+}
+
+#ifdef TWICE_HAVE_AVX2
+/*
+ * Computes the perspective factors of 8 pixels like interp_set_x does,
+ * using doubles. The numerator fits in 36 bits and the denominator in 27,
+ * so the truncated double quotient is the exact integer quotient. Lanes
+ * whose quotient does not fit in an s32 are redone with integers.
+ */
+[[gnu::target("avx2")]] static __m256i
+get_perspective_factors_avx2(interpolator *i, __m256i xs, u32 n)
+{
+	__m256i dx0 = _mm256_sub_epi32(xs, _mm256_set1_epi32(i->x0));
+	__m256i dx1 = _mm256_sub_epi32(_mm256_set1_epi32(i->x1), xs);
+	__m256d w0_n = _mm256_set1_pd((double)((s64)i->w0_n << i->precision));
+	__m256d w0_d = _mm256_set1_pd(i->w0_d);
+	__m256d w1_d = _mm256_set1_pd(i->w1_d);
+	__m256d zero = _mm256_setzero_pd();
+	__m256d limit = _mm256_set1_pd(0x7FFFFFFF);
+	__m128i q[2];
+	u32 bad = 0;
+
+	for (int h = 0; h < 2; h++) {
+		__m128i dx0_h = h ? _mm256_extracti128_si256(dx0, 1)
+		                  : _mm256_castsi256_si128(dx0);
+		__m128i dx1_h = h ? _mm256_extracti128_si256(dx1, 1)
+		                  : _mm256_castsi256_si128(dx1);
+		__m256d a = _mm256_cvtepi32_pd(dx0_h);
+		__m256d b = _mm256_cvtepi32_pd(dx1_h);
+		__m256d numer = _mm256_mul_pd(w0_n, a);
+		__m256d denom = _mm256_add_pd(_mm256_mul_pd(w1_d, b),
+				_mm256_mul_pd(w0_d, a));
+		__m256d nonzero = _mm256_cmp_pd(denom, zero, _CMP_NEQ_OQ);
+		__m256d quot = _mm256_and_pd(
+				_mm256_div_pd(numer, denom), nonzero);
+		__m256d mag = _mm256_andnot_pd(_mm256_set1_pd(-0.0), quot);
+		__m256d big = _mm256_cmp_pd(mag, limit, _CMP_GT_OQ);
+		bad |= _mm256_movemask_pd(big) << 4 * h;
+		q[h] = _mm256_cvttpd_epi32(quot);
+	}
+
+	__m256i pfactor = _mm256_set_m128i(q[1], q[0]);
+	if (!(bad & ((1 << n) - 1)))
+		return pfactor;
+
+	alignas(32) s32 x[8];
+	alignas(32) u32 pf[8];
+	_mm256_store_si256((__m256i *)x, xs);
+	_mm256_store_si256((__m256i *)pf, pfactor);
+	for (u32 j = 0; j < n; j++) {
+		i->numer = ((s64)i->w0_n << i->precision) * (x[j] - i->x0);
+		i->denom = ((s64)i->w1_d * (i->x1 - x[j])) +
+		           ((s64)i->w0_d * (x[j] - i->x0));
+		interp_update_perspective_factor(i);
+		pf[j] = i->pfactor;
+	}
+
+	return _mm256_load_si256((__m256i *)pf);
+}
+
+/* interp_set_attr_perspective for 8 pixels */
+[[gnu::target("avx2")]] static __m256i
+interp_attr_perspective_avx2(
+		interpolator *i, u32 k, __m256i pfactor, __m256i pfactor_r)
+{
+	auto& attr = i->attrs[k];
+	__m128i shift = _mm_cvtsi32_si128(i->precision);
+	__m256i y_len = _mm256_set1_epi32(attr.y_len);
+	__m256i f = attr.positive ? pfactor : pfactor_r;
+	s32 base = attr.positive ? attr.y0 : attr.y1;
+
+	__m256i d = _mm256_srl_epi32(_mm256_mullo_epi32(y_len, f), shift);
+	return _mm256_add_epi32(_mm256_set1_epi32(base), d);
+}
+
+/*
+ * interp_set_attr_linear for 8 pixels. The product wraps around like the
+ * s32 product does, and the s32 quotient is exact as a double.
+ */
+[[gnu::target("avx2")]] static __m256i
+interp_attr_linear_avx2(interpolator *i, u32 k, __m256i xs)
+{
+	auto& attr = i->attrs[k];
+	if (i->x_len == 0)
+		return _mm256_set1_epi32(attr.y0);
+
+	__m256i dx = attr.positive
+	                     ? _mm256_sub_epi32(xs, _mm256_set1_epi32(i->x0))
+	                     : _mm256_sub_epi32(_mm256_set1_epi32(i->x1), xs);
+	__m256i prod = _mm256_mullo_epi32(_mm256_set1_epi32(attr.y_len), dx);
+	__m256d x_len = _mm256_set1_pd(i->x_len);
+	__m128i lo = _mm256_cvttpd_epi32(_mm256_div_pd(
+			_mm256_cvtepi32_pd(_mm256_castsi256_si128(prod)),
+			x_len));
+	__m128i hi = _mm256_cvttpd_epi32(_mm256_div_pd(
+			_mm256_cvtepi32_pd(_mm256_extracti128_si256(prod, 1)),
+			x_len));
+	s32 base = attr.positive ? attr.y0 : attr.y1;
+
+	return _mm256_add_epi32(_mm256_set1_epi32(base),
+			_mm256_set_m128i(hi, lo));
+}
+
+/* depth_test for layer 0 of 8 pixels, returns the lanes that pass */
+[[gnu::target("avx2")]] static __m256i
+depth_test_avx2(__m256i z, __m256i z_dest, __m256i attr_dest, u32 attr,
+		bool wbuffering)
+{
+	if (attr & BIT(14)) {
+		s32 margin = wbuffering ? 0xFF : 0x200;
+		__m256i max_z = _mm256_add_epi32(
+				z_dest, _mm256_set1_epi32(margin));
+		return _mm256_or_si256(_mm256_cmpgt_epi32(max_z, z),
+				_mm256_cmpeq_epi32(max_z, z));
+	}
+
+	__m256i pass = _mm256_cmpgt_epi32(z_dest, z);
+	if (!(attr & BIT(7))) {
+		__m256i bits = _mm256_set1_epi32(BIT(1) | BIT(7));
+		__m256i le = _mm256_cmpeq_epi32(
+				_mm256_and_si256(attr_dest, bits), bits);
+		pass = _mm256_or_si256(pass, _mm256_and_si256(le,
+				_mm256_cmpeq_epi32(z_dest, z)));
+	}
+
+	return pass;
+}
+
+/*
+ * Does what render_normal_polygon_pixel does for every pixel of the span,
+ * 8 pixels at a time. The interpolated values and the layer 0 depth test
+ * are computed for the whole block, and only the pixels that can be drawn
+ * are shaded one by one. The scalar path sets the linear attributes at
+ * every pixel, so the blocks do the same, while z is stepped pixel by
+ * pixel like interp_update_or_set_z_attrs steps it.
+ */
+[[gnu::target("avx2")]] static void
+render_normal_polygon_span_avx2(rendering_engine *re, poly_render_data& r_data,
+		interpolator *span, u32 start, u32 end, s32 y, u32 attr)
+{
+	bool wbuffering = span->wbuffering;
+	bool perspective = span->precision != 0;
+	__m128i precision = _mm_cvtsi32_si128(span->precision);
+	__m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i one = _mm256_set1_epi32(1);
+	/* the offsets in words of the fields of 8 pixels in a row */
+	__m256i pixel_idx = _mm256_mullo_epi32(
+			lane, _mm256_set1_epi32(sizeof(re_pixel) / 4));
+
+	for (u32 x = start; x < end; x += 8) {
+		u32 n = std::min(end - x, (u32)8);
+		__m256i xs = _mm256_add_epi32(_mm256_set1_epi32(x), lane);
+		__m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(n), lane);
+		alignas(32) s32 z[8]{};
+		alignas(32) s32 attrs[5][8];
+
+		__m256i pfactor{}, pfactor_r{};
+		if (perspective || wbuffering) {
+			pfactor = get_perspective_factors_avx2(span, xs, n);
+			pfactor_r = _mm256_sub_epi32(
+					_mm256_sll_epi32(one, precision),
+					pfactor);
+		}
+
+		if (wbuffering) {
+			_mm256_store_si256((__m256i *)z,
+					interp_attr_perspective_avx2(span, 6,
+							pfactor, pfactor_r));
+		} else {
+			for (u32 j = 0; j < n; j++) {
+				s32 px = x + j;
+				bool next = px == span->next_z_x;
+				span->x = px;
+				if (next) {
+					interp_update_attr_linear(span, 6);
+				} else {
+					interp_set_attr_linear(span, 6);
+				}
+				span->next_z_x = px + 1;
+				z[j] = span->attrs[6].y;
+			}
+		}
+
+		for (u32 k = 0; k < 5; k++) {
+			__m256i v;
+			if (perspective) {
+				v = interp_attr_perspective_avx2(
+						span, k, pfactor, pfactor_r);
+			} else {
+				v = interp_attr_linear_avx2(span, k, xs);
+			}
+			_mm256_store_si256((__m256i *)attrs[k], v);
+		}
+
+		__m256i zv = _mm256_load_si256((__m256i *)z);
+		__m256i z_dest = _mm256_mask_i32gather_epi32(
+				_mm256_setzero_si256(),
+				&re->pixels[y][x].depth[0], pixel_idx, valid,
+				4);
+		__m256i attr_dest = _mm256_mask_i32gather_epi32(
+				_mm256_setzero_si256(),
+				(const int *)&re->pixels[y][x].attr[0],
+				pixel_idx, valid, 4);
+		__m256i pass = depth_test_avx2(
+				zv, z_dest, attr_dest, attr, wbuffering);
+		__m256i edge = _mm256_cmpeq_epi32(
+				_mm256_and_si256(attr_dest, one), one);
+		u32 pass_mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+				_mm256_and_si256(pass, valid)));
+		u32 edge_mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+				_mm256_and_si256(edge, valid)));
+
+		/* pixels that fail can still be drawn behind an edge */
+		for (u32 todo = pass_mask | edge_mask; todo;
+				todo &= todo - 1) {
+			u32 j = std::countr_zero(todo);
+			u32 px = x + j;
+			bool layer = 0;
+
+			if (!(pass_mask & BIT(j))) {
+				if (!depth_test(re, z[j], px, y, 1, attr,
+						    wbuffering))
+					continue;
+				layer = 1;
+			}
+
+			for (u32 k = 0; k < 5; k++) {
+				span->attrs[k].y = attrs[k][j];
+			}
+			draw_polygon_pixel(re, r_data, span, px, y, z[j],
+					layer, attr);
+		}
+	}
+}
+#endif
+
 static void
 render_normal_polygon_pixel(rendering_engine *re, poly_render_data& r_data,
 		interpolator *span, u32 x, s32 y, u32 attr)
@@ -775,7 +1297,7 @@ render_normal_polygon_pixel(rendering_engine *re, poly_render_data& r_data,
 	interp_update_or_set_z_attrs(span, x, 0, 0);
 	s32 z = span->attrs[6].y;
 	if (!depth_test(re, z, x, y, layer, attr, p->p->wbuffering)) {
-		if (layer == 1 || !(re->attr_buf[0][y][x] & 1))
+		if (layer == 1 || !(re->pixels[y][x].attr[0] & 1))
 			return;
 
 		layer = 1;
@@ -788,7 +1310,18 @@ render_normal_polygon_pixel(rendering_engine *re, poly_render_data& r_data,
 	}
 
 	interp_update_attrs(span, x, 0, 5);
-	color4 px_color = get_pixel_color(re, p->p, span->attrs[0].y >> 3,
+	draw_polygon_pixel(re, r_data, span, x, y, z, layer, attr);
+}
+
+/* shades a pixel that passed the depth test and draws it to the layer */
+static void
+draw_polygon_pixel(rendering_engine *re, poly_render_data& r_data,
+		interpolator *span, u32 x, s32 y, s32 z, bool layer, u32 attr)
+{
+	re_polygon *p = r_data.p;
+	bool shadow = p->shadow;
+
+	color4 px_color = get_pixel_color(re, p, span->attrs[0].y >> 3,
 			span->attrs[1].y >> 3, span->attrs[2].y >> 3,
 			r_data.alpha, span->attrs[3].y, span->attrs[4].y);
 	if (px_color.a <= r_data.alpha_test_ref)
@@ -802,9 +1335,9 @@ render_normal_polygon_pixel(rendering_engine *re, poly_render_data& r_data,
 		}
 
 		if (layer == 0) {
-			re->color_buf[1][y][x] = re->color_buf[0][y][x];
-			re->depth_buf[1][y][x] = re->depth_buf[0][y][x];
-			re->attr_buf[1][y][x] = re->attr_buf[0][y][x];
+			re->pixels[y][x].color[1] = re->pixels[y][x].color[0];
+			re->pixels[y][x].depth[1] = re->pixels[y][x].depth[0];
+			re->pixels[y][x].attr[1] = re->pixels[y][x].attr[0];
 		}
 
 		draw_opaque_pixel(re, r_data, px_color, x, y, z, layer, attr);
@@ -822,8 +1355,8 @@ static bool
 depth_test(rendering_engine *re, s32 z, u32 x, u32 y, bool layer, u32 attr,
 		bool wbuffering)
 {
-	s32 z_dest = re->depth_buf[layer][y][x];
-	u32 attr_dest = re->attr_buf[layer][y][x];
+	s32 z_dest = re->pixels[y][x].depth[layer];
+	u32 attr_dest = re->pixels[y][x].attr[layer];
 
 	if (attr & BIT(14)) {
 		s32 margin = wbuffering ? 0xFF : 0x200;
@@ -840,9 +1373,10 @@ depth_test(rendering_engine *re, s32 z, u32 x, u32 y, bool layer, u32 attr,
 }
 
 static color4
-get_pixel_color(rendering_engine *re, polygon *p, u8 rv, u8 gv, u8 bv, u8 av,
-		s32 s, s32 t)
+get_pixel_color(rendering_engine *re, re_polygon *rp, u8 rv, u8 gv, u8 bv,
+		u8 av, s32 s, s32 t)
 {
+	polygon *p = rp->p;
 	u32 tx_format = p->tx_param >> 26 & 7;
 	u32 blend_mode = p->attr >> 4 & 3;
 
@@ -869,7 +1403,7 @@ get_pixel_color(rendering_engine *re, polygon *p, u8 rv, u8 gv, u8 bv, u8 av,
 		b = bv;
 		a = av;
 	} else {
-		auto [rt, gt, bt, at] = get_texture_color(re, p, s, t);
+		auto [rt, gt, bt, at] = get_texture_color(rp, s, t);
 
 		if (blend_mode & 1) {
 			switch (at) {
@@ -909,206 +1443,19 @@ get_pixel_color(rendering_engine *re, polygon *p, u8 rv, u8 gv, u8 bv, u8 av,
 }
 
 static color4
-get_texture_color(rendering_engine *re, polygon *p, s32 s, s32 t)
+get_texture_color(re_polygon *p, s32 s, s32 t)
 {
-	u8 r{}, g{}, b{}, a{};
-	nds_ctx *nds = re->gpu->nds;
-	u32 tx_format = p->tx_param >> 26 & 7;
-	u32 base_offset = (p->tx_param & 0xFFFF) << 3;
-	bool color_0_transparent = p->tx_param & BIT(29);
-	bool s_clamp = !(p->tx_param & BIT(16));
-	bool t_clamp = !(p->tx_param & BIT(17));
-	bool s_flip = p->tx_param & BIT(18);
-	bool t_flip = p->tx_param & BIT(19);
-	s32 s_size = 8 << (p->tx_param >> 20 & 7) << 4;
-	s32 t_size = 8 << (p->tx_param >> 23 & 7) << 4;
+	u32 tx_param = p->p->tx_param;
+	bool s_clamp = !(tx_param & BIT(16));
+	bool t_clamp = !(tx_param & BIT(17));
+	bool s_flip = tx_param & BIT(18);
+	bool t_flip = tx_param & BIT(19);
+	s32 s_size = 8 << (tx_param >> 20 & 7) << 4;
+	s32 t_size = 8 << (tx_param >> 23 & 7) << 4;
 	s = clamp_or_repeat_texcoords(s, s_size, s_clamp, s_flip);
 	t = clamp_or_repeat_texcoords(t, t_size, t_clamp, t_flip);
-	s_size >>= 4;
-	t_size >>= 4;
-
-	switch (tx_format) {
-	case 2:
-	{
-		u32 offset = base_offset;
-		offset += (t >> 4) * (s_size >> 2);
-		offset += (s >> 4) >> 2;
-		u8 color_num = vram_read_texture<u8>(nds, offset);
-		color_num = color_num >> ((s >> 4 & 3) << 1) & 3;
-		if (color_num != 0 || !color_0_transparent) {
-			u32 palette_offset =
-					(p->pltt_base << 3) + (color_num << 1);
-			u16 color = vram_read_texture_palette<u16>(
-					nds, palette_offset);
-			unpack_bgr555_3d(color, &r, &g, &b);
-			a = 31;
-		}
-		break;
-	}
-	case 3:
-	{
-		u32 offset = base_offset;
-		offset += (t >> 4) * (s_size >> 1);
-		offset += (s >> 4) >> 1;
-		u8 color_num = vram_read_texture<u8>(nds, offset);
-		color_num = color_num >> ((s >> 4 & 1) << 2) & 0xF;
-		if (color_num != 0 || !color_0_transparent) {
-			u32 palette_offset =
-					(p->pltt_base << 4) + (color_num << 1);
-			u16 color = vram_read_texture_palette<u16>(
-					nds, palette_offset);
-			unpack_bgr555_3d(color, &r, &g, &b);
-			a = 31;
-		}
-		break;
-	}
-	case 4:
-	{
-		u32 offset = base_offset + (t >> 4) * s_size + (s >> 4);
-		u8 color_num = vram_read_texture<u8>(nds, offset);
-		if (color_num != 0 || !color_0_transparent) {
-			u32 palette_offset =
-					(p->pltt_base << 4) + (color_num << 1);
-			u16 color = vram_read_texture_palette<u16>(
-					nds, palette_offset);
-			unpack_bgr555_3d(color, &r, &g, &b);
-			a = 31;
-		}
-		break;
-	}
-	case 1:
-	{
-		u32 offset = base_offset + (t >> 4) * s_size + (s >> 4);
-		u8 data = vram_read_texture<u8>(nds, offset);
-		u8 color_num = data & 0x1F;
-		u8 alpha = data >> 5;
-		u32 palette_offset = (p->pltt_base << 4) + (color_num << 1);
-		u16 color = vram_read_texture_palette<u16>(
-				nds, palette_offset);
-		unpack_bgr555_3d(color, &r, &g, &b);
-		a = (alpha << 2) + (alpha >> 1);
-		break;
-	}
-	case 6:
-	{
-		u32 offset = base_offset + (t >> 4) * s_size + (s >> 4);
-		u8 data = vram_read_texture<u8>(nds, offset);
-		u8 color_num = data & 7;
-		u32 palette_offset = (p->pltt_base << 4) + (color_num << 1);
-		u16 color = vram_read_texture_palette<u16>(
-				nds, palette_offset);
-		unpack_bgr555_3d(color, &r, &g, &b);
-		a = data >> 3;
-		break;
-	}
-	case 7:
-	{
-		u32 offset = base_offset;
-		offset += (t >> 4) * s_size << 1;
-		offset += (s >> 4) << 1;
-		u16 color = vram_read_texture<u16>(nds, offset);
-		unpack_abgr1555_3d(color, &r, &g, &b, &a);
-		break;
-	}
-	case 5:
-	{
-		u32 offset = base_offset;
-		offset += (t >> 4 & ~3) * (s_size >> 2);
-		offset += (s >> 4 & ~3);
-		u32 data = vram_read_texture<u32>(nds, offset);
-		u32 color_num = data >> ((t >> 4 & 3) << 3) >>
-		                ((s >> 4 & 3) << 1);
-		color_num &= 3;
-		u32 index_offset = 0x20000 + ((offset & 0x1FFFF) >> 1);
-		if (offset >= 0x40000) {
-			index_offset += 0x10000;
-		}
-		u16 index_data = vram_read_texture<u32>(nds, index_offset);
-		u32 palette_base = (p->pltt_base << 4) +
-		                   ((index_data & 0x3FFF) << 2);
-		u32 palette_mode = index_data >> 14;
-
-		switch (color_num) {
-		case 0:
-		{
-			u16 color = vram_read_texture_palette<u16>(
-					nds, palette_base);
-			unpack_bgr555_3d(color, &r, &g, &b);
-			a = 31;
-			break;
-		}
-		case 1:
-		{
-			u16 color = vram_read_texture_palette<u16>(
-					nds, palette_base + 2);
-			unpack_bgr555_3d(color, &r, &g, &b);
-			a = 31;
-			break;
-		}
-		case 2:
-		{
-			switch (palette_mode) {
-			case 0:
-			case 2:
-			{
-				u16 color = vram_read_texture_palette<u16>(
-						nds, palette_base + 4);
-				unpack_bgr555_3d(color, &r, &g, &b);
-				a = 31;
-				break;
-			}
-			case 1:
-			case 3:
-			{
-				u16 color0 = vram_read_texture_palette<u16>(
-						nds, palette_base);
-				u16 color1 = vram_read_texture_palette<u16>(
-						nds, palette_base + 2);
-				if (palette_mode == 1) {
-					blend_bgr555_11_3d(color0, color1, &r,
-							&g, &b);
-				} else {
-					blend_bgr555_53_3d(color0, color1, &r,
-							&g, &b);
-				}
-				a = 31;
-			}
-			}
-			break;
-		}
-		case 3:
-		{
-			switch (palette_mode) {
-			case 0:
-			case 1:
-				a = 0;
-				break;
-			case 2:
-			{
-				u16 color = vram_read_texture_palette<u16>(
-						nds, palette_base + 6);
-				unpack_bgr555_3d(color, &r, &g, &b);
-				a = 31;
-				break;
-			}
-			case 3:
-
-			{
-				u16 color0 = vram_read_texture_palette<u16>(
-						nds, palette_base);
-				u16 color1 = vram_read_texture_palette<u16>(
-						nds, palette_base + 2);
-				blend_bgr555_53_3d(color1, color0, &r, &g, &b);
-				a = 31;
-			}
-			}
-		}
-		}
-		break;
-	}
-	}
 
-	return { r, g, b, a };
+	return p->texture->texels[(t >> 4) * (s_size >> 4) + (s >> 4)];
 }
 
 static s32
@@ -1133,11 +1480,11 @@ static void
 draw_opaque_pixel(rendering_engine *re, poly_render_data&, color4 color, u32 x,
 		u32 y, s32 z, bool layer, u32 attr)
 {
-	re->color_buf[layer][y][x] = color;
-	re->depth_buf[layer][y][x] = z;
-	u32 attr_dest = re->attr_buf[layer][y][x];
+	re->pixels[y][x].color[layer] = color;
+	re->pixels[y][x].depth[layer] = z;
+	u32 attr_dest = re->pixels[y][x].attr[layer];
 	attr = (attr_dest & 0x3F0000) | (attr & ~0x3F0000) | BIT(1);
-	re->attr_buf[layer][y][x] = attr;
+	re->pixels[y][x].attr[layer] = attr;
 }
 
 static void
@@ -1145,7 +1492,7 @@ draw_translucent_pixel(rendering_engine *re, poly_render_data& r_data,
 		color4 color, u32 x, u32 y, s32 z, bool layer, bool shadow,
 		u32 attr)
 {
-	u32 attr_dest = re->attr_buf[layer][y][x];
+	u32 attr_dest = re->pixels[y][x].attr[layer];
 	if (!(attr_dest & BIT(1))) {
 		if (attr >> 24 == attr_dest << 8 >> 24)
 			return;
@@ -1154,7 +1501,7 @@ draw_translucent_pixel(rendering_engine *re, poly_render_data& r_data,
 			return;
 	}
 
-	color4& color_dest = re->color_buf[layer][y][x];
+	color4& color_dest = re->pixels[y][x].color[layer];
 	if (color_dest.a == 0) {
 		color_dest = color;
 	} else if (!r_data.alpha_blending) {
@@ -1172,20 +1519,20 @@ draw_translucent_pixel(rendering_engine *re, poly_render_data& r_data,
 	}
 
 	if (attr & BIT(11)) {
-		re->depth_buf[layer][y][x] = z;
+		re->pixels[y][x].depth[layer] = z;
 	}
 
 	attr = (attr_dest & 0x3F000000) | (attr >> 8 & 0x3F0000) |
 	       (attr & 0xFFFF);
 	attr = (attr & ~BIT(15)) | (attr & attr_dest & BIT(15));
-	re->attr_buf[layer][y][x] = attr;
+	re->pixels[y][x].attr[layer] = attr;
 }
 
 static void
-apply_effects_scanline(rendering_engine *re, s32 y)
+apply_effects_scanline(rendering_engine *re, const re_band *b, s32 y)
 {
 	if (re->r.disp3dcnt & BIT(5)) {
-		apply_edge_marking(re, y);
+		apply_edge_marking(re, b, y);
 	}
 
 	if (re->r.disp3dcnt & BIT(7)) {
@@ -1198,20 +1545,35 @@ apply_effects_scanline(rendering_engine *re, s32 y)
 }
 
 static void
-apply_edge_marking(rendering_engine *re, s32 y)
+save_band_edges(rendering_engine *re, re_band *b)
+{
+	s32 lines[2] = { b->y0, b->y1 - 1 };
+
+	for (int i = 0; i < 2; i++) {
+		auto& pixels = re->pixels[lines[i]];
+		for (u32 x = 0; x < 256; x++) {
+			b->edge_ids[i][x] = pixels[x].attr[0] & 0x3F000000;
+			b->edge_depths[i][x] = pixels[x].depth[0];
+		}
+	}
+}
+
+static void
+apply_edge_marking(rendering_engine *re, const re_band *b, s32 y)
 {
 	for (u32 x = 0; x < 256; x++) {
-		u32 attr = re->attr_buf[0][y][x];
+		u32 attr = re->pixels[y][x].attr[0];
 
 		if (!(attr & BIT(1)) || !(attr & BIT(0)))
 			continue;
 
 		u32 adj_ids[4];
 		s32 adj_depths[4];
-		get_surrounding_id_depth(re, y, x, adj_ids, adj_depths);
+		get_surrounding_id_depth(
+				re, b, y, x, adj_ids, adj_depths);
 
 		u32 id = attr & 0x3F000000;
-		s32 depth = re->depth_buf[0][y][x];
+		s32 depth = re->pixels[y][x].depth[0];
 
 		bool mark = false;
 		for (u32 i = 0; i < 4; i++) {
@@ -1225,16 +1587,20 @@ apply_edge_marking(rendering_engine *re, s32 y)
 
 		u16 color = re->r._edge_color[id >> 24 >> 3];
 		auto [r, g, b, _] = unpack_bgr555_3d(color);
-		re->color_buf[0][y][x].r = r;
-		re->color_buf[0][y][x].g = g;
-		re->color_buf[0][y][x].b = b;
-		re->attr_buf[0][y][x] = (attr & ~0x1F00) | (u32)0x10 << 8;
+		re->pixels[y][x].color[0].r = r;
+		re->pixels[y][x].color[0].g = g;
+		re->pixels[y][x].color[0].b = b;
+		re->pixels[y][x].attr[0] = (attr & ~0x1F00) | (u32)0x10 << 8;
 	}
 }
 
+/*
+ * The lines of the bands next to b are read from their saved edges, since
+ * their own edge marking may be writing the pixels.
+ */
 static void
-get_surrounding_id_depth(rendering_engine *re, s32 y, s32 x, u32 *id_out,
-		s32 *depth_out)
+get_surrounding_id_depth(rendering_engine *re, const re_band *b, s32 y,
+		s32 x, u32 *id_out, s32 *depth_out)
 {
 	s32 offsets[4][2] = { { 0, -1 }, { -1, 0 }, { 1, 0 }, { 0, 1 } };
 
@@ -1245,9 +1611,15 @@ get_surrounding_id_depth(rendering_engine *re, s32 y, s32 x, u32 *id_out,
 		if (x2 < 0 || x2 >= 256 || y2 < 0 || y2 >= 192) {
 			id_out[i] = re->outside_opaque_id_attr;
 			depth_out[i] = re->outside_depth;
+		} else if (y2 < b->y0) {
+			id_out[i] = b[-1].edge_ids[1][x2];
+			depth_out[i] = b[-1].edge_depths[1][x2];
+		} else if (y2 >= b->y1) {
+			id_out[i] = b[1].edge_ids[0][x2];
+			depth_out[i] = b[1].edge_depths[0][x2];
 		} else {
-			id_out[i] = re->attr_buf[0][y2][x2] & 0x3F000000;
-			depth_out[i] = re->depth_buf[0][y2][x2];
+			id_out[i] = re->pixels[y2][x2].attr[0] & 0x3F000000;
+			depth_out[i] = re->pixels[y2][x2].depth[0];
 		}
 	}
 }
@@ -1265,17 +1637,17 @@ apply_fog(rendering_engine *re, s32 y)
 
 	for (s32 x = 0; x < 256; x++) {
 		for (int layer = 0; layer < 2; layer++) {
-			if (!(re->attr_buf[layer][y][x] & BIT(15)))
+			if (!(re->pixels[y][x].attr[layer] & BIT(15)))
 				continue;
 
-			u32 z = re->depth_buf[layer][y][x] >> 9;
+			u32 z = re->pixels[y][x].depth[layer] >> 9;
 			u8 t = calculate_fog_density(re->r.fog_table.data(),
 					fog_offset, fog_step, z);
 			if (t >= 127) {
 				t = 128;
 			}
 
-			auto& dst = re->color_buf[layer][y][x];
+			auto& dst = re->pixels[y][x].color[layer];
 			dst.a = (af * t + dst.a * (128 - t)) >> 7;
 			if (!alpha_only) {
 				dst.r = (rf * t + dst.r * (128 - t)) >> 7;
@@ -1312,13 +1684,13 @@ static void
 apply_antialiasing(rendering_engine *re, s32 y)
 {
 	for (s32 x = 0; x < 256; x++) {
-		u32 attr = re->attr_buf[0][y][x];
+		u32 attr = re->pixels[y][x].attr[0];
 
 		if (!(attr & BIT(1)) || !(attr & BIT(0)))
 			continue;
 
-		auto& c0 = re->color_buf[0][y][x];
-		auto& c1 = re->color_buf[1][y][x];
+		auto& c0 = re->pixels[y][x].color[0];
+		auto& c1 = re->pixels[y][x].color[1];
 		u32 t = attr >> 8 & 0x1F;
 
 		c0.a = ((t + 1) * c0.a + (31 - t) * c1.a) >> 5;
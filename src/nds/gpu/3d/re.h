@@ -1,15 +1,64 @@
 #ifndef TWICE_GPU3D_RE_H
 #define TWICE_GPU3D_RE_H
 
+#include <atomic>
+#include <vector>
+
+#include "common/thread_pool.h"
 #include "common/types.h"
 #include "libtwice/nds/defs.h"
 #include "nds/gpu/3d/gpu3d_types.h"
+#include "nds/gpu/3d/texture_cache.h"
 #include "nds/gpu/color.h"
 
 namespace twice {
 
 struct gpu_3d_engine;
 
+enum : int {
+	MAX_RENDER_THREADS = 16,
+};
+
+/* a range of scanlines rasterized by one thread */
+struct re_band {
+	s32 y0{};
+	s32 y1{};
+	/* the polygons that the band walks the edges of */
+	re_polygon *polys{};
+	std::vector<re_polygon> poly_state;
+	bool last_poly_is_shadow_mask{};
+	/*
+	 * The ids and depths of the first and last line of the band as
+	 * rasterized. Edge marking of the bands next to this one reads them
+	 * instead of the pixels, which edge marking of this band writes.
+	 */
+	std::array<u32, 256> edge_ids[2]{};
+	std::array<s32, 256> edge_depths[2]{};
+	std::atomic<bool> rasterized{};
+};
+
+/*
+ * The two layers of a pixel of the framebuffer. Drawing a pixel reads and
+ * writes most of these, so they are kept in the same half of a cache line.
+ */
+struct alignas(32) re_pixel {
+	color4 color[2];
+	s32 depth[2]{};
+	/*
+	 * attributes
+	 * 0		edge
+	 * 1		opaque
+	 * 7		backface
+	 * 8-12		antialising coverage
+	 * 11		translucent set new depth
+	 * 14		depth test equal mode
+	 * 15		fog
+	 * 16-21	translucent poly id
+	 * 24-29	opaque poly id
+	 */
+	u32 attr[2]{};
+};
+
 struct rendering_engine {
 	struct registers {
 		u16 disp3dcnt{};
@@ -32,31 +81,39 @@ struct rendering_engine {
 	u32 outside_opaque_id_attr{};
 	s32 outside_depth{};
 
-	std::array<std::array<color4, 256>, 192> color_buf[2]{};
-	std::array<std::array<s32, 256>, 192> depth_buf[2]{};
-	/*
-	 * attributes
-	 * 0		edge
-	 * 1		opaque
-	 * 7		backface
-	 * 8-12		antialising coverage
-	 * 11		translucent set new depth
-	 * 14		depth test equal mode
-	 * 15		fog
-	 * 16-21	translucent poly id
-	 * 24-29	opaque poly id
-	 */
-	std::array<std::array<u32, 256>, 192> attr_buf[2]{};
+	std::array<std::array<re_pixel, 256>, 192> pixels{};
 	std::array<std::array<u8, 256>, 192> stencil_buf{};
+	/* bumped for each frame rendered into pixels */
+	u64 frame_id{};
 
 	bool enabled{};
 	vertex_ram *vtx_ram{};
 	polygon_ram *poly_ram{};
 	std::array<re_polygon, 2048> polys{};
+	/*
+	 * The indices into polys of the polygons that cover each scanline,
+	 * in drawing order. Line y uses the entries from line_start[y] up to
+	 * line_start[y + 1].
+	 */
+	std::array<u32, 193> line_start{};
+	std::vector<u16> line_polys;
+	texture_cache tex_cache;
 	gpu_3d_engine *gpu{};
+
+	int num_bands{};
+	re_band bands[MAX_RENDER_THREADS];
+	thread_pool pool;
+
+	/*
+	 * Renders frames in the background when async rendering is on.
+	 * Declared after pool, so it is joined before pool is destroyed.
+	 */
+	thread_pool render_thread;
+	bool render_pending{};
 };
 
 void re_render_frame(rendering_engine *re);
+void re_wait_for_frame(rendering_engine *re);
 
 } // namespace twice
 
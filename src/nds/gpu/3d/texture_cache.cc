@@ -0,0 +1,322 @@
+#include "nds/gpu/3d/texture_cache.h"
+
+#include "nds/mem/vram.h"
+#include "nds/nds.h"
+
+#include <algorithm>
+
+namespace twice {
+
+struct texel_reader {
+	nds_ctx *nds;
+	texture_cache_entry *e;
+};
+
+static void decode_texture(texel_reader *rd, u32 tx_param, u32 pltt_base);
+static color4 decode_texel(
+		texel_reader *rd, u32 tx_param, u32 pltt_base, u32 s, u32 t);
+static void drop_entry(texture_cache *tc,
+		std::unordered_map<u64, texture_cache_entry>::iterator it);
+
+void
+texture_cache_begin_frame(texture_cache *tc, nds_ctx *nds)
+{
+	auto& vram = nds->vram;
+	tc->frame++;
+
+	if (vram.texture_dirty.none() && vram.texture_palette_dirty.none())
+		return;
+
+	for (auto it = tc->entries.begin(); it != tc->entries.end();) {
+		auto& e = it->second;
+		if ((e.texture_pages & vram.texture_dirty).any() ||
+				(e.palette_pages & vram.texture_palette_dirty)
+						.any()) {
+			drop_entry(tc, it++);
+		} else {
+			++it;
+		}
+	}
+
+	vram.texture_dirty.reset();
+	vram.texture_palette_dirty.reset();
+}
+
+texture_cache_entry *
+texture_cache_get(
+		texture_cache *tc, nds_ctx *nds, u32 tx_param, u32 pltt_base)
+{
+	/* the wrap, flip and texcoord transform bits do not matter */
+	tx_param &= 0x3FF0FFFF;
+	if ((tx_param >> 26 & 7) == 7) {
+		pltt_base = 0;
+	}
+
+	u64 key = (u64)tx_param << 32 | pltt_base;
+	auto [it, inserted] = tc->entries.try_emplace(key);
+	texture_cache_entry *e = &it->second;
+	e->last_used = tc->frame;
+
+	if (inserted) {
+		texel_reader rd{ nds, e };
+		decode_texture(&rd, tx_param, pltt_base);
+		tc->size += e->texels.size() * sizeof(color4);
+	}
+
+	return e;
+}
+
+/*
+ * Drops the least recently used entries until the cache fits its budget.
+ * Entries used by the current frame are kept.
+ */
+void
+texture_cache_end_frame(texture_cache *tc)
+{
+	if (tc->size <= TEXTURE_CACHE_BUDGET)
+		return;
+
+	std::vector<std::pair<u64, u64>> by_age;
+	for (auto& [key, e] : tc->entries) {
+		if (e.last_used != tc->frame) {
+			by_age.emplace_back(e.last_used, key);
+		}
+	}
+	std::sort(by_age.begin(), by_age.end());
+
+	for (auto [last_used, key] : by_age) {
+		if (tc->size <= TEXTURE_CACHE_BUDGET)
+			break;
+
+		drop_entry(tc, tc->entries.find(key));
+	}
+}
+
+static void
+drop_entry(texture_cache *tc,
+		std::unordered_map<u64, texture_cache_entry>::iterator it)
+{
+	tc->size -= it->second.texels.size() * sizeof(color4);
+	tc->entries.erase(it);
+}
+
+static void
+decode_texture(texel_reader *rd, u32 tx_param, u32 pltt_base)
+{
+	u32 s_size = 8 << (tx_param >> 20 & 7);
+	u32 t_size = 8 << (tx_param >> 23 & 7);
+	auto& texels = rd->e->texels;
+
+	texels.resize(s_size * t_size);
+	for (u32 t = 0; t < t_size; t++) {
+		for (u32 s = 0; s < s_size; s++) {
+			texels[t * s_size + s] = decode_texel(
+					rd, tx_param, pltt_base, s, t);
+		}
+	}
+}
+
+template <typename T>
+static T
+read_texture(texel_reader *rd, u32 offset)
+{
+	offset &= VRAM_TEXTURE_MASK;
+	rd->e->texture_pages.set(offset >> VRAM_TEXTURE_PAGE_SHIFT);
+	return vram_read_texture<T>(rd->nds, offset);
+}
+
+template <typename T>
+static T
+read_palette(texel_reader *rd, u32 offset)
+{
+	offset &= VRAM_TEXTURE_PALETTE_MASK;
+	rd->e->palette_pages.set(offset >> VRAM_TEXTURE_PALETTE_PAGE_SHIFT);
+	return vram_read_texture_palette<T>(rd->nds, offset);
+}
+
+static color4
+decode_texel(texel_reader *rd, u32 tx_param, u32 pltt_base, u32 s, u32 t)
+{
+	u8 r{}, g{}, b{}, a{};
+	u32 tx_format = tx_param >> 26 & 7;
+	u32 base_offset = (tx_param & 0xFFFF) << 3;
+	bool color_0_transparent = tx_param & BIT(29);
+	u32 s_size = 8 << (tx_param >> 20 & 7);
+
+	switch (tx_format) {
+	case 2:
+	{
+		u32 offset = base_offset;
+		offset += t * (s_size >> 2);
+		offset += s >> 2;
+		u8 color_num = read_texture<u8>(rd, offset);
+		color_num = color_num >> ((s & 3) << 1) & 3;
+		if (color_num != 0 || !color_0_transparent) {
+			u32 palette_offset =
+					(pltt_base << 3) + (color_num << 1);
+			u16 color = read_palette<u16>(rd, palette_offset);
+			unpack_bgr555_3d(color, &r, &g, &b);
+			a = 31;
+		}
+		break;
+	}
+	case 3:
+	{
+		u32 offset = base_offset;
+		offset += t * (s_size >> 1);
+		offset += s >> 1;
+		u8 color_num = read_texture<u8>(rd, offset);
+		color_num = color_num >> ((s & 1) << 2) & 0xF;
+		if (color_num != 0 || !color_0_transparent) {
+			u32 palette_offset =
+					(pltt_base << 4) + (color_num << 1);
+			u16 color = read_palette<u16>(rd, palette_offset);
+			unpack_bgr555_3d(color, &r, &g, &b);
+			a = 31;
+		}
+		break;
+	}
+	case 4:
+	{
+		u32 offset = base_offset + t * s_size + s;
+		u8 color_num = read_texture<u8>(rd, offset);
+		if (color_num != 0 || !color_0_transparent) {
+			u32 palette_offset =
+					(pltt_base << 4) + (color_num << 1);
+			u16 color = read_palette<u16>(rd, palette_offset);
+			unpack_bgr555_3d(color, &r, &g, &b);
+			a = 31;
+		}
+		break;
+	}
+	case 1:
+	{
+		u32 offset = base_offset + t * s_size + s;
+		u8 data = read_texture<u8>(rd, offset);
+		u8 color_num = data & 0x1F;
+		u8 alpha = data >> 5;
+		u32 palette_offset = (pltt_base << 4) + (color_num << 1);
+		u16 color = read_palette<u16>(rd, palette_offset);
+		unpack_bgr555_3d(color, &r, &g, &b);
+		a = (alpha << 2) + (alpha >> 1);
+		break;
+	}
+	case 6:
+	{
+		u32 offset = base_offset + t * s_size + s;
+		u8 data = read_texture<u8>(rd, offset);
+		u8 color_num = data & 7;
+		u32 palette_offset = (pltt_base << 4) + (color_num << 1);
+		u16 color = read_palette<u16>(rd, palette_offset);
+		unpack_bgr555_3d(color, &r, &g, &b);
+		a = data >> 3;
+		break;
+	}
+	case 7:
+	{
+		u32 offset = base_offset;
+		offset += t * s_size << 1;
+		offset += s << 1;
+		u16 color = read_texture<u16>(rd, offset);
+		unpack_abgr1555_3d(color, &r, &g, &b, &a);
+		break;
+	}
+	case 5:
+	{
+		u32 offset = base_offset;
+		offset += (t & ~3) * (s_size >> 2);
+		offset += s & ~3;
+		u32 data = read_texture<u32>(rd, offset);
+		u32 color_num = data >> ((t & 3) << 3) >> ((s & 3) << 1);
+		color_num &= 3;
+		u32 index_offset = 0x20000 + ((offset & 0x1FFFF) >> 1);
+		if (offset >= 0x40000) {
+			index_offset += 0x10000;
+		}
+		u16 index_data = read_texture<u32>(rd, index_offset);
+		u32 palette_base = (pltt_base << 4) +
+		                   ((index_data & 0x3FFF) << 2);
+		u32 palette_mode = index_data >> 14;
+
+		switch (color_num) {
+		case 0:
+		{
+			u16 color = read_palette<u16>(rd, palette_base);
+			unpack_bgr555_3d(color, &r, &g, &b);
+			a = 31;
+			break;
+		}
+		case 1:
+		{
+			u16 color = read_palette<u16>(rd, palette_base + 2);
+			unpack_bgr555_3d(color, &r, &g, &b);
+			a = 31;
+			break;
+		}
+		case 2:
+		{
+			switch (palette_mode) {
+			case 0:
+			case 2:
+			{
+				u16 color = read_palette<u16>(
+						rd, palette_base + 4);
+				unpack_bgr555_3d(color, &r, &g, &b);
+				a = 31;
+				break;
+			}
+			case 1:
+			case 3:
+			{
+				u16 color0 = read_palette<u16>(
+						rd, palette_base);
+				u16 color1 = read_palette<u16>(
+						rd, palette_base + 2);
+				if (palette_mode == 1) {
+					blend_bgr555_11_3d(color0, color1, &r,
+							&g, &b);
+				} else {
+					blend_bgr555_53_3d(color0, color1, &r,
+							&g, &b);
+				}
+				a = 31;
+			}
+			}
+			break;
+		}
+		case 3:
+		{
+			switch (palette_mode) {
+			case 0:
+			case 1:
+				a = 0;
+				break;
+			case 2:
+			{
+				u16 color = read_palette<u16>(
+						rd, palette_base + 6);
+				unpack_bgr555_3d(color, &r, &g, &b);
+				a = 31;
+				break;
+			}
+			case 3:
+
+			{
+				u16 color0 = read_palette<u16>(
+						rd, palette_base);
+				u16 color1 = read_palette<u16>(
+						rd, palette_base + 2);
+				blend_bgr555_53_3d(color1, color0, &r, &g, &b);
+				a = 31;
+			}
+			}
+		}
+		}
+		break;
+	}
+	}
+
+	return { r, g, b, a };
+}
+
+} // namespace twice
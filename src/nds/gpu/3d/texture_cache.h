@@ -0,0 +1,52 @@
+#ifndef TWICE_GPU3D_TEXTURE_CACHE_H
+#define TWICE_GPU3D_TEXTURE_CACHE_H
+
+#include <bitset>
+#include <unordered_map>
+#include <vector>
+
+#include "common/types.h"
+#include "nds/gpu/color.h"
+#include "nds/gpu/vram.h"
+
+namespace twice {
+
+struct nds_ctx;
+
+enum : u32 {
+	/* decoded texels kept around before the least recently used go */
+	TEXTURE_CACHE_BUDGET = 32_MiB,
+};
+
+/* a texture decoded to 6 bit color and 5 bit alpha texels */
+struct texture_cache_entry {
+	std::vector<color4> texels;
+	/* the pages the texels were decoded from */
+	std::bitset<VRAM_TEXTURE_NUM_PAGES> texture_pages;
+	std::bitset<VRAM_TEXTURE_PALETTE_NUM_PAGES> palette_pages;
+	u64 last_used{};
+};
+
+/*
+ * Decoded textures keyed by the bits of TEXIMAGE_PARAM that affect
+ * decoding and the palette base. Entries are dropped when a page they were
+ * decoded from changes, which the vram code reports through texture_dirty
+ * and texture_palette_dirty.
+ *
+ * Entries are only added and dropped between texture_cache_begin_frame
+ * and texture_cache_end_frame, while no thread samples from them.
+ */
+struct texture_cache {
+	std::unordered_map<u64, texture_cache_entry> entries;
+	size_t size{};
+	u64 frame{};
+};
+
+void texture_cache_begin_frame(texture_cache *tc, nds_ctx *nds);
+texture_cache_entry *texture_cache_get(
+		texture_cache *tc, nds_ctx *nds, u32 tx_param, u32 pltt_base);
+void texture_cache_end_frame(texture_cache *tc);
+
+} // namespace twice
+
+#endif
@@ -5,6 +5,22 @@
 
 namespace twice {
 
+/*
+ * Waits for the 2D lines drawn from the old mappings, and makes the 2D
+ * engines drop what they cached from them and draw every line again.
+ */
+static void
+prepare_remap(nds_ctx *nds)
+{
+	gpu2d_wait_for_lines(nds);
+	nds->vram.dirty_2d[0].set();
+	nds->vram.dirty_2d[1].set();
+	for (auto& memo : nds->gpu2d_memo) {
+		memo.vram_gen[0]++;
+		memo.vram_gen[1]++;
+	}
+}
+
 static u8 *
 get_vram_ptr(nds_ctx *nds, int bank, int page)
 {
@@ -379,6 +395,8 @@ vramcnt_ab_write(nds_ctx *nds, u8 value)
 		return;
 	}
 
+	prepare_remap(nds);
+
 	u8 *base = vram.bank_to_base_ptr[bank];
 
 	if (vram.bank_mapped[bank]) {
@@ -440,6 +458,8 @@ vramcnt_cd_write(nds_ctx *nds, u8 value)
 		return;
 	}
 
+	prepare_remap(nds);
+
 	u8 *base = vram.bank_to_base_ptr[bank];
 
 	if (vram.bank_mapped[bank]) {
@@ -519,6 +539,8 @@ vramcnt_e_write(nds_ctx *nds, u8 value)
 		return;
 	}
 
+	prepare_remap(nds);
+
 	u8 *base = vram.bank_to_base_ptr[VRAM_E];
 
 	if (vram.bank_mapped[VRAM_E]) {
@@ -586,6 +608,8 @@ vramcnt_fg_write(nds_ctx *nds, u8 value)
 		return;
 	}
 
+	prepare_remap(nds);
+
 	u8 *base = vram.bank_to_base_ptr[bank];
 
 	if (vram.bank_mapped[bank]) {
@@ -665,6 +689,8 @@ vramcnt_h_write(nds_ctx *nds, u8 value)
 		return;
 	}
 
+	prepare_remap(nds);
+
 	u8 *base = vram.bank_to_base_ptr[VRAM_H];
 
 	if (vram.bank_mapped[VRAM_H]) {
@@ -721,6 +747,8 @@ vramcnt_i_write(nds_ctx *nds, u8 value)
 		return;
 	}
 
+	prepare_remap(nds);
+
 	u8 *base = vram.bank_to_base_ptr[VRAM_I];
 
 	if (vram.bank_mapped[VRAM_I]) {
@@ -815,30 +843,48 @@ vram_read_texture_slow(nds_ctx *nds, u32 offset)
 	return vram_read_banks<T>(nds, offset, mask);
 }
 
+/*
+ * Copies a slot of texture or texture palette memory to the fast array,
+ * page by page, and marks the pages whose contents changed.
+ */
+template <size_t N>
 static void
-setup_fast_texture_array(nds_ctx *nds)
+copy_changed_pages(u8 *dest, const u8 *src, u32 offset, u32 len,
+		u32 page_shift, std::bitset<N>& dirty)
 {
-	auto& vram = nds->vram;
-	u8 *dest = vram.texture_fast;
+	u32 page_size = (u32)1 << page_shift;
 
-	for (u32 i = 0; i < 4; i++, dest += 0x20000) {
-		u8 *p = vram.texture_pt[i];
-		if (p) {
-			std::memcpy(dest, p, 0x20000);
-			continue;
+	for (u32 i = offset; i < offset + len; i += page_size) {
+		if (std::memcmp(dest + i, src + i - offset, page_size)) {
+			std::memcpy(dest + i, src + i - offset, page_size);
+			dirty.set(i >> page_shift);
 		}
+	}
+}
 
+static void
+setup_fast_texture_array(nds_ctx *nds)
+{
+	auto& vram = nds->vram;
+	std::vector<u8> buf;
+
+	for (u32 i = 0; i < 4; i++) {
+		const u8 *src = vram.texture_pt[i];
 		u16 mask = vram.texture_bank[i];
-		if (mask == 0) {
-			std::fill(dest, dest + 0x20000, 0);
-			continue;
-		}
 
-		for (u32 j = 0; j < 0x20000; j += 8) {
-			u64 val = vram_read_texture_slow<u64>(
-					nds, i * 0x20000 + j);
-			writearr<u64>(dest, j, val);
+		if (!src) {
+			buf.assign(0x20000, 0);
+			src = buf.data();
+			for (u32 j = 0; mask != 0 && j < 0x20000; j += 8) {
+				u64 val = vram_read_texture_slow<u64>(
+						nds, i * 0x20000 + j);
+				writearr<u64>(buf.data(), j, val);
+			}
 		}
+
+		copy_changed_pages(vram.texture_fast, src, i * 0x20000,
+				0x20000, VRAM_TEXTURE_PAGE_SHIFT,
+				vram.texture_dirty);
 	}
 }
 
@@ -855,26 +901,25 @@ static void
 setup_fast_texture_palette_array(nds_ctx *nds)
 {
 	auto& vram = nds->vram;
-	u8 *dest = vram.texture_palette_fast;
-
-	for (u32 i = 0; i < 6; i++, dest += 0x4000) {
-		u8 *p = vram.texture_palette_pt[i];
-		if (p) {
-			std::memcpy(dest, p, 0x4000);
-			continue;
-		}
+	std::vector<u8> buf;
 
+	for (u32 i = 0; i < 6; i++) {
+		const u8 *src = vram.texture_palette_pt[i];
 		u16 mask = vram.texture_palette_bank[i];
-		if (mask == 0) {
-			std::fill(dest, dest + 0x4000, 0);
-			continue;
-		}
 
-		for (u32 j = 0; j < 0x4000; j += 8) {
-			u64 val = vram_read_texture_palette_slow<u64>(
-					nds, i * 0x4000 + j);
-			writearr<u64>(dest, j, val);
+		if (!src) {
+			buf.assign(0x4000, 0);
+			src = buf.data();
+			for (u32 j = 0; mask != 0 && j < 0x4000; j += 8) {
+				u64 val = vram_read_texture_palette_slow<u64>(
+						nds, i * 0x4000 + j);
+				writearr<u64>(buf.data(), j, val);
+			}
 		}
+
+		copy_changed_pages(vram.texture_palette_fast, src, i * 0x4000,
+				0x4000, VRAM_TEXTURE_PALETTE_PAGE_SHIFT,
+				vram.texture_palette_dirty);
 	}
 }
 
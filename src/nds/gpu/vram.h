@@ -1,6 +1,8 @@
 #ifndef TWICE_GPU_VRAM_H
 #define TWICE_GPU_VRAM_H
 
+#include <bitset>
+
 #include "common/types.h"
 #include "common/util.h"
 
@@ -47,6 +49,19 @@ enum : u32 {
 	VRAM_TEXTURE_MASK = 512_KiB - 1,
 	VRAM_TEXTURE_PALETTE_SIZE = 128_KiB,
 	VRAM_TEXTURE_PALETTE_MASK = 128_KiB - 1,
+	VRAM_TEXTURE_PAGE_SHIFT = 12,
+	VRAM_TEXTURE_PALETTE_PAGE_SHIFT = 10,
+	VRAM_TEXTURE_NUM_PAGES = VRAM_TEXTURE_SIZE >> VRAM_TEXTURE_PAGE_SHIFT,
+	VRAM_TEXTURE_PALETTE_NUM_PAGES = VRAM_TEXTURE_PALETTE_SIZE >>
+	                                 VRAM_TEXTURE_PALETTE_PAGE_SHIFT,
+};
+
+enum : u32 {
+	VRAM_TOTAL_SIZE = VRAM_A_SIZE + VRAM_B_SIZE + VRAM_C_SIZE +
+	                  VRAM_D_SIZE + VRAM_E_SIZE + VRAM_F_SIZE +
+	                  VRAM_G_SIZE + VRAM_H_SIZE + VRAM_I_SIZE,
+	VRAM_2D_PAGE_SHIFT = 10,
+	VRAM_2D_NUM_PAGES = VRAM_TOTAL_SIZE >> VRAM_2D_PAGE_SHIFT,
 };
 
 struct gpu_vram {
@@ -93,6 +108,18 @@ struct gpu_vram {
 	u8 texture_palette_fast[VRAM_TEXTURE_PALETTE_SIZE]{};
 	bool texture_changed{};
 	bool texture_palette_changed{};
+	/*
+	 * The pages of texture_fast and texture_palette_fast whose contents
+	 * changed since the 3D engine last cleared the bits.
+	 */
+	std::bitset<VRAM_TEXTURE_NUM_PAGES> texture_dirty;
+	std::bitset<VRAM_TEXTURE_PALETTE_NUM_PAGES> texture_palette_dirty;
+	/*
+	 * The pages of the banks written through the 2D engine mappings
+	 * since each engine last cleared its bits, counted from the start of
+	 * vram_a. All bits are set when the mappings change.
+	 */
+	std::bitset<VRAM_2D_NUM_PAGES> dirty_2d[2];
 
 	u8 vramcnt[VRAM_NUM_BANKS]{};
 };
@@ -159,6 +186,26 @@ vram_bank_write(gpu_vram *vram, u32 offset, T value, int bank)
 	}
 }
 
+inline void
+vram_mark_dirty_2d(gpu_vram *vram, const u8 *p)
+{
+	uintptr_t offset = (uintptr_t)p - (uintptr_t)vram->vram_a;
+	vram->dirty_2d[0].set(offset >> VRAM_2D_PAGE_SHIFT);
+	vram->dirty_2d[1].set(offset >> VRAM_2D_PAGE_SHIFT);
+}
+
+inline void
+vram_mark_banks_dirty_2d(gpu_vram *vram, u32 offset, u16 banks)
+{
+	for (int i = 0; i < VRAM_NUM_BANKS; i++) {
+		if (banks & BIT(i)) {
+			u32 size = (vram->bank_to_page_mask[i] + 1) * 16_KiB;
+			u8 *base = vram->bank_to_base_ptr[i];
+			vram_mark_dirty_2d(vram, base + (offset & (size - 1)));
+		}
+	}
+}
+
 void setup_fast_texture_vram(nds_ctx *nds);
 
 } // namespace twice
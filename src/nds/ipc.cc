@@ -6,6 +6,8 @@ namespace twice {
 u32
 ipc_fifo_recv(nds_ctx *nds, int cpuid)
 {
+	nds->sc.ipc_activity = true;
+
 	auto& src = nds->ipcfifo[cpuid ^ 1];
 	auto& dest = nds->ipcfifo[cpuid];
 
@@ -40,6 +42,8 @@ ipc_fifo_recv(nds_ctx *nds, int cpuid)
 void
 ipc_fifo_send(nds_ctx *nds, int cpuid, u32 value)
 {
+	nds->sc.ipc_activity = true;
+
 	auto& src = nds->ipcfifo[cpuid];
 	auto& dest = nds->ipcfifo[cpuid ^ 1];
 
@@ -72,6 +76,8 @@ ipc_fifo_send(nds_ctx *nds, int cpuid, u32 value)
 void
 ipc_fifo_cnt_write(struct nds_ctx *nds, int cpuid, u16 value)
 {
+	nds->sc.ipc_activity = true;
+
 	auto& src = nds->ipcfifo[cpuid];
 	auto& dest = nds->ipcfifo[cpuid ^ 1];
 
@@ -108,6 +114,8 @@ ipc_fifo_cnt_write(struct nds_ctx *nds, int cpuid, u16 value)
 void
 ipcsync_write(nds_ctx *nds, int cpuid, u16 value)
 {
+	nds->sc.ipc_activity = true;
+
 	nds->ipcsync[cpuid ^ 1] &= ~0xF;
 	nds->ipcsync[cpuid ^ 1] |= value >> 8 & 0xF;
 	nds->ipcsync[cpuid] &= ~0x4F00;
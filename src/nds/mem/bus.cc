@@ -34,6 +34,8 @@ bus9_write(nds_ctx *nds, u32 addr, T value)
 	u8 *p = nds->bus9_write_pt[addr >> BUS9_PAGE_SHIFT];
 	if (p) {
 		writearr<T>(p, addr & BUS9_PAGE_MASK, value);
+		track_page_write<BUS9_PAGE_SHIFT>(
+				&nds->tracker, nds->bus9_tracked_pt, addr);
 		return;
 	}
 
@@ -59,6 +61,8 @@ bus7_write(nds_ctx *nds, u32 addr, T value)
 	u8 *p = nds->bus7_write_pt[addr >> BUS7_PAGE_SHIFT];
 	if (p) {
 		writearr<T>(p, addr & BUS7_PAGE_MASK, value);
+		track_page_write<BUS7_PAGE_SHIFT>(
+				&nds->tracker, nds->bus7_tracked_pt, addr);
 		return;
 	}
 
@@ -87,6 +91,10 @@ bus9_read_slow(nds_ctx *nds, u32 addr)
 			return readarr<T>(nds->palette, addr & PALETTE_MASK);
 		}
 	case 0x6:
+		/* display capture writes to VRAM while the lines are drawn */
+		if (nds->gpu2d[0].display_capture) {
+			gpu2d_wait_for_lines(nds);
+		}
 		return vram_read<T>(nds, addr);
 	case 0x7:
 		if (gpu_disabled) {
@@ -132,17 +140,24 @@ bus9_write_slow(nds_ctx *nds, u32 addr, T value)
 		break;
 	case 0x5:
 		if (sizeof(T) != 1 && !gpu_disabled) {
+			gpu2d_wait_for_lines(nds);
 			writearr<T>(nds->palette, addr & PALETTE_MASK, value);
+			nds->gpu2d_memo[addr >> 10 & 1]
+					.palette_gen[addr >> 9 & 1]++;
 		}
 		break;
 	case 0x6:
 		if (sizeof(T) != 1) {
+			gpu2d_wait_for_lines(nds);
 			vram_write<T>(nds, addr, value);
 		}
 		break;
 	case 0x7:
 		if (sizeof(T) != 1 && !gpu_disabled) {
+			gpu2d_wait_for_lines(nds);
 			writearr<T>(nds->oam, addr & OAM_MASK, value);
+			nds->gpu2d_sprites[addr >> 10 & 1].dirty = true;
+			nds->gpu2d_memo[addr >> 10 & 1].oam_gen++;
 		}
 		break;
 	case 0x2:
@@ -299,6 +314,9 @@ update_bus9_page_tables(nds_ctx *nds, u64 start, u64 end)
 			pt_r[page] = nullptr;
 			pt_w[page] = nullptr;
 		}
+
+		nds->bus9_tracked_pt[page] =
+				get_tracked_page(&nds->tracker, pt_w[page]);
 	}
 
 	update_arm9_page_tables(nds->arm9.get(), start, end);
@@ -398,7 +416,13 @@ update_bus7_page_tables(nds_ctx *nds, u64 start, u64 end)
 			pt_r[page] = nullptr;
 			pt_w[page] = nullptr;
 		}
+
+		nds->bus7_tracked_pt[page] =
+				get_tracked_page(&nds->tracker, pt_w[page]);
 	}
+
+	fastmem_map_pages(nds, 1, start, end);
+	invalidate_all_blocks(nds, 1);
 }
 
 void
@@ -451,6 +475,8 @@ update_bus7_timing_tables(nds_ctx *nds, u64 start, u64 end)
 		nds->arm7_data_timings[page] = cpu_data_timing;
 		nds->arm7_code_timings[page] = data_timing;
 	}
+
+	invalidate_all_blocks(nds, 1);
 }
 
 static bool
@@ -0,0 +1,434 @@
+#include "nds/mem/fastmem.h"
+#include "nds/arm/arm7.h"
+#include "nds/arm/arm9.h"
+#include "nds/nds.h"
+
+#include "common/logger.h"
+#include "libtwice/exception.h"
+
+#ifdef TWICE_HAVE_FASTMEM
+
+#include <mutex>
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+namespace twice {
+
+struct fastmem_fixup {
+	s32 insn;
+	s32 fixup;
+};
+
+extern "C" {
+extern const fastmem_fixup __start_twice_fastmem[] __attribute__((weak));
+extern const fastmem_fixup __stop_twice_fastmem[] __attribute__((weak));
+}
+
+enum {
+	NUM_BACKINGS = 5,
+};
+
+/* memories that live in the memfd and can be aliased */
+struct backing {
+	u8 *p{};
+	u64 size{};
+	u64 offset{};
+};
+
+struct mapping {
+	u64 addr;
+	u64 size;
+	s64 offset;
+	int prot;
+};
+
+static std::once_flag handler_once;
+static struct sigaction old_action;
+
+static void get_backings(nds_ctx *nds, backing *b);
+static bool copy_to_memfd(int fd, const backing& x);
+static bool restore_backings(int fd, const backing *b, int count);
+static void disable_region(nds_ctx *nds, int cpuid);
+static int get_page_prot(nds_ctx *nds, const backing *b, int cpuid,
+		u64 addr, s64 *offset);
+static bool map_run(nds_ctx *nds, u8 *base, const mapping& m);
+static void update_region_flags(
+		nds_ctx *nds, const backing *b, int cpuid, u64 start, u64 end);
+static void install_fault_handler();
+static void handle_fault(int sig, siginfo_t *info, void *ucontext);
+
+bool
+fastmem_init(nds_ctx *nds)
+{
+	if (sysconf(_SC_PAGESIZE) != BUS9_PAGE_SIZE) {
+		LOG("fastmem: unsupported host page size\n");
+		return false;
+	}
+
+	backing b[NUM_BACKINGS];
+	get_backings(nds, b);
+	u64 size = b[NUM_BACKINGS - 1].offset + b[NUM_BACKINGS - 1].size;
+
+	int fd = memfd_create("twice-fastmem", MFD_CLOEXEC);
+	if (fd < 0) {
+		LOG("fastmem: memfd_create failed\n");
+		return false;
+	}
+
+	if (ftruncate(fd, size)) {
+		LOG("fastmem: ftruncate failed\n");
+		close(fd);
+		return false;
+	}
+
+	u8 *regions[2];
+	for (int i = 0; i < 2; i++) {
+		void *p = mmap(nullptr, 4_GiB, PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+				-1, 0);
+		if (p == MAP_FAILED) {
+			LOG("fastmem: could not reserve the address space\n");
+			if (i == 1) {
+				munmap(regions[0], 4_GiB);
+			}
+			close(fd);
+			return false;
+		}
+		regions[i] = (u8 *)p;
+	}
+
+	/* move the memories into the memfd, keeping their addresses */
+	int copied = 0;
+	bool aliased = true;
+	for (; aliased && copied < NUM_BACKINGS; copied++) {
+		auto& x = b[copied];
+		if (!copy_to_memfd(fd, x)) {
+			aliased = false;
+			break;
+		}
+
+		/* on failure, the old pages may be gone as well */
+		void *p = mmap(x.p, x.size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, fd, x.offset);
+		aliased = p != MAP_FAILED;
+	}
+
+	if (!aliased) {
+		LOG("fastmem: could not alias memory\n");
+		bool restored = restore_backings(fd, b, copied);
+		munmap(regions[0], 4_GiB);
+		munmap(regions[1], 4_GiB);
+		close(fd);
+		if (!restored) {
+			throw twice_error("fastmem: could not restore memory");
+		}
+		return false;
+	}
+
+	std::call_once(handler_once, install_fault_handler);
+
+	nds->fastmem_fd = fd;
+	nds->arm9->fastmem.base = regions[0];
+	nds->arm7->fastmem.base = regions[1];
+	fastmem_map_pages(nds, 0, 0, 4_GiB);
+	fastmem_map_pages(nds, 1, 0, 4_GiB);
+	arm_update_memory_ops(nds, 0);
+	arm_update_memory_ops(nds, 1);
+
+	return nds->arm9->fastmem.base || nds->arm7->fastmem.base;
+}
+
+void
+fastmem_destroy(nds_ctx *nds)
+{
+	if (nds->fastmem_fd < 0) {
+		return;
+	}
+
+	disable_region(nds, 0);
+	disable_region(nds, 1);
+
+	/* give the memories back to the allocator as ordinary pages */
+	backing b[NUM_BACKINGS];
+	get_backings(nds, b);
+	for (auto& x : b) {
+		mmap(x.p, x.size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+	}
+
+	close(nds->fastmem_fd);
+	nds->fastmem_fd = -1;
+}
+
+void
+fastmem_map_pages(nds_ctx *nds, int cpuid, u64 start, u64 end)
+{
+	u8 *base = nds->cpu[cpuid]->fastmem.base;
+	if (!base) {
+		return;
+	}
+
+	backing b[NUM_BACKINGS];
+	get_backings(nds, b);
+	u64 page_size = cpuid == 0 ? BUS9_PAGE_SIZE : BUS7_PAGE_SIZE;
+
+	/* coalesce pages that map to consecutive memfd offsets */
+	mapping run{};
+	bool ok = true;
+	for (u64 addr = start; ok && addr < end; addr += page_size) {
+		s64 offset;
+		int prot = get_page_prot(nds, b, cpuid, addr, &offset);
+
+		bool extends = run.size && run.prot == prot &&
+		               (prot == PROT_NONE ||
+		                run.offset + (s64)run.size == offset);
+		if (extends) {
+			run.size += page_size;
+			continue;
+		}
+
+		if (run.size) {
+			ok = map_run(nds, base, run);
+		}
+		run = { addr, page_size, offset, prot };
+	}
+
+	if (ok && run.size) {
+		ok = map_run(nds, base, run);
+	}
+
+	if (!ok) {
+		/* the region no longer matches the page tables */
+		LOG("fastmem: mmap failed, using the page tables\n");
+		disable_region(nds, cpuid);
+		return;
+	}
+
+	update_region_flags(nds, b, cpuid, start, end);
+}
+
+static void
+get_backings(nds_ctx *nds, backing *b)
+{
+	b[0] = { nds->main_ram, MAIN_RAM_SIZE };
+	b[1] = { nds->shared_wram, SHARED_WRAM_SIZE };
+	b[2] = { nds->arm7_wram, ARM7_WRAM_SIZE };
+	b[3] = { nds->arm9->itcm, arm9_cpu::ITCM_SIZE };
+	b[4] = { nds->arm9->dtcm, arm9_cpu::DTCM_SIZE };
+
+	u64 offset = 0;
+	for (int i = 0; i < NUM_BACKINGS; i++) {
+		b[i].offset = offset;
+		offset += b[i].size;
+	}
+}
+
+static bool
+copy_to_memfd(int fd, const backing& x)
+{
+	for (u64 done = 0; done < x.size;) {
+		ssize_t n = pwrite(fd, x.p + done, x.size - done,
+				x.offset + done);
+		if (n <= 0) {
+			return false;
+		}
+		done += n;
+	}
+
+	return true;
+}
+
+/*
+ * Gives memories that were moved into the memfd their own pages again,
+ * with the contents they have in the memfd.
+ */
+static bool
+restore_backings(int fd, const backing *b, int count)
+{
+	bool ok = true;
+
+	for (int i = 0; i < count; i++) {
+		const auto& x = b[i];
+		void *p = mmap(x.p, x.size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+		if (p == MAP_FAILED) {
+			ok = false;
+			continue;
+		}
+
+		for (u64 done = 0; done < x.size;) {
+			ssize_t n = pread(fd, x.p + done, x.size - done,
+					x.offset + done);
+			if (n <= 0) {
+				ok = false;
+				break;
+			}
+			done += n;
+		}
+	}
+
+	return ok;
+}
+
+static void
+disable_region(nds_ctx *nds, int cpuid)
+{
+	auto& fm = nds->cpu[cpuid]->fastmem;
+	if (fm.base) {
+		munmap(fm.base, 4_GiB);
+	}
+	fm = {};
+	arm_update_memory_ops(nds, cpuid);
+}
+
+static int
+get_page_prot(nds_ctx *nds, const backing *b, int cpuid, u64 addr,
+		s64 *offset)
+{
+	u8 *r, *w;
+	u64 page_size;
+
+	if (cpuid == 0) {
+		u32 page = addr >> BUS9_PAGE_SHIFT;
+		r = nds->arm9->pages[arm9_cpu::LOAD][page];
+		w = nds->arm9->pages[arm9_cpu::STORE][page];
+		page_size = BUS9_PAGE_SIZE;
+	} else {
+		u32 page = addr >> BUS7_PAGE_SHIFT;
+		r = nds->bus7_read_pt[page];
+		w = nds->bus7_write_pt[page];
+		page_size = BUS7_PAGE_SIZE;
+	}
+
+	*offset = -1;
+
+	/* pages where loads and stores go to different memories fault */
+	if (!r || (w && w != r)) {
+		return PROT_NONE;
+	}
+
+	for (int i = 0; i < NUM_BACKINGS; i++) {
+		uintptr_t x = (uintptr_t)r - (uintptr_t)b[i].p;
+		if (x < b[i].size && x + page_size <= b[i].size) {
+			*offset = b[i].offset + x;
+			return w ? PROT_READ | PROT_WRITE : PROT_READ;
+		}
+	}
+
+	return PROT_NONE;
+}
+
+static bool
+map_run(nds_ctx *nds, u8 *base, const mapping& m)
+{
+	void *p;
+
+	if (m.prot == PROT_NONE) {
+		p = mmap(base + m.addr, m.size, PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+						MAP_FIXED,
+				-1, 0);
+	} else {
+		p = mmap(base + m.addr, m.size, m.prot,
+				MAP_SHARED | MAP_FIXED, nds->fastmem_fd,
+				m.offset);
+	}
+
+	return p != MAP_FAILED;
+}
+
+static void
+update_region_flags(
+		nds_ctx *nds, const backing *b, int cpuid, u64 start, u64 end)
+{
+	auto& fm = nds->cpu[cpuid]->fastmem;
+	u64 page_size = cpuid == 0 ? BUS9_PAGE_SIZE : BUS7_PAGE_SIZE;
+
+	for (u64 region = start >> 24; region < (end + 16_MiB - 1) >> 24;
+			region++) {
+		u8 flags = 0;
+
+		for (u64 addr = region << 24; addr < (region + 1) << 24;
+				addr += page_size) {
+			s64 offset;
+			int prot = get_page_prot(nds, b, cpuid, addr, &offset);
+			if (prot & PROT_READ) {
+				flags |= FASTMEM_READ;
+			}
+			if (prot & PROT_WRITE) {
+				flags |= FASTMEM_WRITE;
+			}
+		}
+
+		fm.regions[region] = flags;
+	}
+}
+
+static void
+install_fault_handler()
+{
+	struct sigaction sa {};
+	sa.sa_sigaction = handle_fault;
+	sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, &old_action);
+}
+
+static void
+handle_fault(int sig, siginfo_t *info, void *ucontext)
+{
+	auto *uc = (ucontext_t *)ucontext;
+#if defined(__x86_64__)
+	auto& pc = uc->uc_mcontext.gregs[REG_RIP];
+#else
+	auto& pc = uc->uc_mcontext.pc;
+#endif
+
+	for (auto *e = __start_twice_fastmem; e < __stop_twice_fastmem; e++) {
+		if ((uintptr_t)&e->insn + e->insn == (uintptr_t)pc) {
+			pc = (uintptr_t)&e->fixup + e->fixup;
+			return;
+		}
+	}
+
+	/* not a fastmem access, so pass it on to the previous handler */
+	if (old_action.sa_flags & SA_SIGINFO) {
+		old_action.sa_sigaction(sig, info, ucontext);
+	} else if (old_action.sa_handler == SIG_DFL ||
+			old_action.sa_handler == SIG_IGN) {
+		/* the access faults again and takes the default action */
+		sigaction(SIGSEGV, &old_action, nullptr);
+	} else {
+		old_action.sa_handler(sig);
+	}
+}
+
+} // namespace twice
+
+#else
+
+namespace twice {
+
+bool
+fastmem_init(nds_ctx *)
+{
+	LOG("fastmem: not supported on this platform\n");
+	return false;
+}
+
+void
+fastmem_destroy(nds_ctx *)
+{
+}
+
+void
+fastmem_map_pages(nds_ctx *, int, u64, u64)
+{
+}
+
+} // namespace twice
+
+#endif
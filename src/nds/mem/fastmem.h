@@ -0,0 +1,208 @@
+#ifndef TWICE_MEM_FASTMEM_H
+#define TWICE_MEM_FASTMEM_H
+
+#include "common/types.h"
+#include "common/util.h"
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define TWICE_HAVE_FASTMEM 1
+#endif
+
+namespace twice {
+
+struct nds_ctx;
+
+enum : u8 {
+	FASTMEM_READ = BIT(0),
+	FASTMEM_WRITE = BIT(1),
+};
+
+/*
+ * A 4 GiB host region per cpu, in which a guest address is the offset of
+ * the host memory it maps to. The memories in the page tables are aliased
+ * into the region, and every other page faults. A faulting access is
+ * redirected to the page table path.
+ *
+ * Faults are slow, so accesses to 16 MiB regions without any mapped pages,
+ * like IO, skip the fastmem path entirely.
+ */
+struct fastmem_region {
+	u8 *base{};
+	/* FASTMEM_READ / FASTMEM_WRITE for every 16 MiB region */
+	u8 regions[256]{};
+};
+
+bool fastmem_init(nds_ctx *nds);
+void fastmem_destroy(nds_ctx *nds);
+void fastmem_map_pages(nds_ctx *nds, int cpuid, u64 start, u64 end);
+
+#ifdef TWICE_HAVE_FASTMEM
+
+/*
+ * Records the faulting instruction at local label 1 and the label to
+ * continue at in the fixup table searched by the fault handler.
+ */
+#define TWICE_FASTMEM_FIXUP(fault)                                            \
+	".pushsection twice_fastmem, \"a\"\n\t"                               \
+	".balign 4\n\t"                                                       \
+	".long 1b - .\n\t"                                                    \
+	".long %l[" fault "] - .\n\t"                                         \
+	".popsection\n\t"
+
+template <typename T>
+bool
+fastmem_read(const fastmem_region *fm, u32 addr, T *result)
+{
+	if (!(fm->regions[addr >> 24] & FASTMEM_READ)) {
+		return false;
+	}
+
+	T value;
+	u8 *base = fm->base;
+	u64 offset = addr;
+
+#if defined(__x86_64__)
+	if constexpr (sizeof(T) == 1) {
+		asm goto("1: movzbl (%[base], %[offset]), %k[value]\n\t"
+			 TWICE_FASTMEM_FIXUP("fault")
+			 : [value] "=r"(value)
+			 : [base] "r"(base), [offset] "r"(offset)
+			 : "memory"
+			 : fault);
+	} else if constexpr (sizeof(T) == 2) {
+		asm goto("1: movzwl (%[base], %[offset]), %k[value]\n\t"
+			 TWICE_FASTMEM_FIXUP("fault")
+			 : [value] "=r"(value)
+			 : [base] "r"(base), [offset] "r"(offset)
+			 : "memory"
+			 : fault);
+	} else {
+		asm goto("1: movl (%[base], %[offset]), %k[value]\n\t"
+			 TWICE_FASTMEM_FIXUP("fault")
+			 : [value] "=r"(value)
+			 : [base] "r"(base), [offset] "r"(offset)
+			 : "memory"
+			 : fault);
+	}
+#else
+	if constexpr (sizeof(T) == 1) {
+		asm goto("1: ldrb %w[value], [%[base], %[offset]]\n\t"
+			 TWICE_FASTMEM_FIXUP("fault")
+			 : [value] "=r"(value)
+			 : [base] "r"(base), [offset] "r"(offset)
+			 : "memory"
+			 : fault);
+	} else if constexpr (sizeof(T) == 2) {
+		asm goto("1: ldrh %w[value], [%[base], %[offset]]\n\t"
+			 TWICE_FASTMEM_FIXUP("fault")
+			 : [value] "=r"(value)
+			 : [base] "r"(base), [offset] "r"(offset)
+			 : "memory"
+			 : fault);
+	} else {
+		asm goto("1: ldr %w[value], [%[base], %[offset]]\n\t"
+			 TWICE_FASTMEM_FIXUP("fault")
+			 : [value] "=r"(value)
+			 : [base] "r"(base), [offset] "r"(offset)
+			 : "memory"
+			 : fault);
+	}
+#endif
+
+	*result = value;
+	return true;
+fault:
+	return false;
+}
+
+template <typename T>
+bool
+fastmem_write(const fastmem_region *fm, u32 addr, T value)
+{
+	if (!(fm->regions[addr >> 24] & FASTMEM_WRITE)) {
+		return false;
+	}
+
+	u8 *base = fm->base;
+	u64 offset = addr;
+
+#if defined(__x86_64__)
+	if constexpr (sizeof(T) == 1) {
+		asm goto("1: movb %b[value], (%[base], %[offset])\n\t"
+			 TWICE_FASTMEM_FIXUP("fault")
+			 :
+			 : [value] "r"(value), [base] "r"(base),
+			   [offset] "r"(offset)
+			 : "memory"
+			 : fault);
+	} else if constexpr (sizeof(T) == 2) {
+		asm goto("1: movw %w[value], (%[base], %[offset])\n\t"
+			 TWICE_FASTMEM_FIXUP("fault")
+			 :
+			 : [value] "r"(value), [base] "r"(base),
+			   [offset] "r"(offset)
+			 : "memory"
+			 : fault);
+	} else {
+		asm goto("1: movl %k[value], (%[base], %[offset])\n\t"
+			 TWICE_FASTMEM_FIXUP("fault")
+			 :
+			 : [value] "r"(value), [base] "r"(base),
+			   [offset] "r"(offset)
+			 : "memory"
+			 : fault);
+	}
+#else
+	if constexpr (sizeof(T) == 1) {
+		asm goto("1: strb %w[value], [%[base], %[offset]]\n\t"
+			 TWICE_FASTMEM_FIXUP("fault")
+			 :
+			 : [value] "r"(value), [base] "r"(base),
+			   [offset] "r"(offset)
+			 : "memory"
+			 : fault);
+	} else if constexpr (sizeof(T) == 2) {
+		asm goto("1: strh %w[value], [%[base], %[offset]]\n\t"
+			 TWICE_FASTMEM_FIXUP("fault")
+			 :
+			 : [value] "r"(value), [base] "r"(base),
+			   [offset] "r"(offset)
+			 : "memory"
+			 : fault);
+	} else {
+		asm goto("1: str %w[value], [%[base], %[offset]]\n\t"
+			 TWICE_FASTMEM_FIXUP("fault")
+			 :
+			 : [value] "r"(value), [base] "r"(base),
+			   [offset] "r"(offset)
+			 : "memory"
+			 : fault);
+	}
+#endif
+
+	return true;
+fault:
+	return false;
+}
+
+#else
+
+template <typename T>
+bool
+fastmem_read(const fastmem_region *, u32, T *)
+{
+	return false;
+}
+
+template <typename T>
+bool
+fastmem_write(const fastmem_region *, u32, T)
+{
+	return false;
+}
+
+#endif
+
+} // namespace twice
+
+#endif
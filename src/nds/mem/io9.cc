@@ -13,6 +13,7 @@ wramcnt_write(nds_ctx *nds, u8 value)
 	bool changed = (nds->wramcnt != value);
 
 	nds->wramcnt = value;
+	nds->sc.ipc_activity = true;
 
 	switch (value & 3) {
 	case 0:
@@ -0,0 +1,138 @@
+#include "nds/mem/page_tracker.h"
+#include "nds/arm/arm9.h"
+#include "nds/arm/block_cache.h"
+#include "nds/nds.h"
+
+namespace twice {
+
+static void update_active_flags(page_tracker *t);
+
+void
+page_tracker_init(nds_ctx *nds)
+{
+	auto& t = nds->tracker;
+	t.nds = nds;
+
+	struct {
+		u8 *base;
+		u32 size;
+	} regions[NUM_TRACKED_REGIONS] = {
+		{ nds->main_ram, MAIN_RAM_SIZE },
+		{ nds->shared_wram, SHARED_WRAM_SIZE },
+		{ nds->arm7_wram, ARM7_WRAM_SIZE },
+		{ nds->arm9->itcm, arm9_cpu::ITCM_SIZE },
+		{ nds->arm9->dtcm, arm9_cpu::DTCM_SIZE },
+	};
+
+	u32 first_page = 0;
+	for (u32 i = 0; i < NUM_TRACKED_REGIONS; i++) {
+		t.regions[i] = { regions[i].base, regions[i].size, first_page };
+		first_page += regions[i].size >> TRACKED_PAGE_SHIFT;
+	}
+}
+
+void
+on_tracked_page_write(page_tracker *t, int page, u32 offset)
+{
+	u8 flags = t->flags[page];
+
+	if (flags & (PAGE_ARM9_CODE | PAGE_ARM7_CODE)) {
+		invalidate_code_page(t, page);
+	}
+
+	if (flags & PAGE_TRACK_DIRTY) {
+		t->dirty[page >> 6] |= BIT(page & 63);
+		t->flags[page] &= ~PAGE_TRACK_DIRTY;
+	}
+
+	if ((flags & PAGE_WATCHED) && t->watch) {
+		u8 *p = get_tracked_page_ptr(t, page) + offset;
+		t->watch(t->watch_data, page, p);
+	}
+}
+
+void
+start_dirty_tracking(page_tracker *t)
+{
+	for (auto& x : t->dirty) {
+		x = 0;
+	}
+
+	for (u32 i = 0; i < NUM_TRACKED_PAGES; i++) {
+		t->flags[i] |= PAGE_TRACK_DIRTY;
+	}
+	t->tracking_dirty = true;
+	t->active |= PAGE_TRACK_DIRTY;
+}
+
+void
+stop_dirty_tracking(page_tracker *t)
+{
+	for (u32 i = 0; i < NUM_TRACKED_PAGES; i++) {
+		t->flags[i] &= ~PAGE_TRACK_DIRTY;
+	}
+	t->tracking_dirty = false;
+	update_active_flags(t);
+}
+
+bool
+is_page_dirty(const page_tracker *t, int page)
+{
+	return t->dirty[page >> 6] & BIT(page & 63);
+}
+
+void
+clear_page_dirty(page_tracker *t, int page)
+{
+	t->dirty[page >> 6] &= ~BIT(page & 63);
+
+	/* rearm the page, so that the next write sets the bit again */
+	if (t->tracking_dirty) {
+		t->flags[page] |= PAGE_TRACK_DIRTY;
+		t->active |= PAGE_TRACK_DIRTY;
+	}
+}
+
+u8 *
+get_tracked_page_ptr(const page_tracker *t, int page)
+{
+	for (auto& r : t->regions) {
+		u32 offset = (page - r.first_page) << TRACKED_PAGE_SHIFT;
+		if ((u32)page >= r.first_page && offset < r.size) {
+			return r.base + offset;
+		}
+	}
+
+	return nullptr;
+}
+
+void
+set_page_watch(page_tracker *t, int page, bool watched)
+{
+	if (watched) {
+		t->flags[page] |= PAGE_WATCHED;
+	} else {
+		t->flags[page] &= ~PAGE_WATCHED;
+	}
+
+	update_active_flags(t);
+}
+
+void
+set_watch_callback(page_tracker *t, page_tracker::watch_cb cb, void *data)
+{
+	t->watch = cb;
+	t->watch_data = data;
+}
+
+static void
+update_active_flags(page_tracker *t)
+{
+	u8 active = 0;
+	for (u32 i = 0; i < NUM_TRACKED_PAGES; i++) {
+		active |= t->flags[i];
+	}
+	t->active = active;
+}
+
+} // namespace twice
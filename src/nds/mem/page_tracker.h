@@ -0,0 +1,114 @@
+#ifndef TWICE_MEM_PAGE_TRACKER_H
+#define TWICE_MEM_PAGE_TRACKER_H
+
+#include "common/types.h"
+#include "common/util.h"
+
+namespace twice {
+
+struct nds_ctx;
+
+enum : u32 {
+	TRACKED_PAGE_SHIFT = 12,
+	TRACKED_PAGE_SIZE = (u32)1 << TRACKED_PAGE_SHIFT,
+	TRACKED_PAGE_MASK = TRACKED_PAGE_SIZE - 1,
+
+	/* main ram, shared wram, arm7 wram, itcm, dtcm */
+	NUM_TRACKED_REGIONS = 5,
+	NUM_TRACKED_PAGES = (4_MiB + 32_KiB + 64_KiB + 32_KiB + 16_KiB) >>
+	                    TRACKED_PAGE_SHIFT,
+};
+
+enum : u8 {
+	/* cpu n has decoded blocks in the page */
+	PAGE_ARM9_CODE = BIT(0),
+	PAGE_ARM7_CODE = BIT(1),
+	/* the next write sets the dirty bit of the page */
+	PAGE_TRACK_DIRTY = BIT(2),
+	/* every write calls the watch callback */
+	PAGE_WATCHED = BIT(3),
+};
+
+/*
+ * Tracks writes to the memories that the cpus access through the page
+ * tables. While no page has a flag set, stores only test active. Otherwise
+ * they look up the tracked page of the bus page they write to, which the
+ * page tables keep next to the host pointers, and only pages with flags
+ * set take the slow path.
+ *
+ * Pages are indexed by host memory, so mirrors of the same memory share
+ * the same page.
+ */
+struct page_tracker {
+	typedef void (*watch_cb)(void *data, int page, const u8 *p);
+
+	struct region {
+		u8 *base{};
+		u32 size{};
+		u32 first_page{};
+	} regions[NUM_TRACKED_REGIONS];
+
+	u8 flags[NUM_TRACKED_PAGES]{};
+	u64 dirty[NUM_TRACKED_PAGES / 64 + 1]{};
+	bool tracking_dirty{};
+
+	/* the flags that are set in any page */
+	u8 active{};
+
+	watch_cb watch{};
+	void *watch_data{};
+
+	nds_ctx *nds{};
+};
+
+void page_tracker_init(nds_ctx *nds);
+void on_tracked_page_write(page_tracker *t, int page, u32 offset);
+void start_dirty_tracking(page_tracker *t);
+void stop_dirty_tracking(page_tracker *t);
+bool is_page_dirty(const page_tracker *t, int page);
+void clear_page_dirty(page_tracker *t, int page);
+u8 *get_tracked_page_ptr(const page_tracker *t, int page);
+void set_page_watch(page_tracker *t, int page, bool watched);
+void set_watch_callback(page_tracker *t, page_tracker::watch_cb cb,
+		void *data);
+
+/* only for remapping and decoding, stores use the page tables instead */
+inline int
+get_tracked_page(const page_tracker *t, const u8 *p)
+{
+	for (auto& r : t->regions) {
+		uintptr_t offset = (uintptr_t)p - (uintptr_t)r.base;
+		if (offset < r.size) {
+			return r.first_page + (offset >> TRACKED_PAGE_SHIFT);
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * tracked_pt holds the tracked page at the start of each bus page, or -1.
+ * Bus pages map contiguous host memory, so a bus page larger than a
+ * tracked page covers the tracked pages that follow.
+ */
+template <u32 BusPageShift>
+inline void
+track_page_write(page_tracker *t, const s16 *tracked_pt, u32 addr)
+{
+	if (!t->active)
+		return;
+
+	int page = tracked_pt[addr >> BusPageShift];
+	if (page < 0)
+		return;
+
+	u32 offset = addr & (((u32)1 << BusPageShift) - 1);
+	page += offset >> TRACKED_PAGE_SHIFT;
+	if (t->flags[page]) {
+		on_tracked_page_write(t, page, offset & TRACKED_PAGE_MASK);
+	}
+}
+
+} // namespace twice
+
+#endif
@@ -51,13 +51,17 @@ template <typename T>
 void
 vram_write_abg(nds_ctx *nds, u32 offset, T value)
 {
+	nds->gpu2d_memo[0].vram_gen[0]++;
+
 	u32 index = offset >> 14 & 31;
 	u8 *p = nds->vram.abg_pt[index];
 	if (p) {
 		writearr<T>(p, offset & 0x3FFF, value);
+		vram_mark_dirty_2d(&nds->vram, p + (offset & 0x3FFF));
 	} else {
 		u16 mask = nds->vram.abg_bank[index];
 		vram_write_banks<T>(nds, offset, value, mask);
+		vram_mark_banks_dirty_2d(&nds->vram, offset, mask);
 	}
 }
 
@@ -79,13 +83,17 @@ template <typename T>
 void
 vram_write_bbg(nds_ctx *nds, u32 offset, T value)
 {
+	nds->gpu2d_memo[1].vram_gen[0]++;
+
 	u32 index = offset >> 14 & 7;
 	u8 *p = nds->vram.bbg_pt[index];
 	if (p) {
 		writearr<T>(p, offset & 0x3FFF, value);
+		vram_mark_dirty_2d(&nds->vram, p + (offset & 0x3FFF));
 	} else {
 		u16 mask = nds->vram.bbg_bank[index >> 1];
 		vram_write_banks<T>(nds, offset, value, mask);
+		vram_mark_banks_dirty_2d(&nds->vram, offset, mask);
 	}
 }
 
@@ -107,13 +115,17 @@ template <typename T>
 void
 vram_write_aobj(nds_ctx *nds, u32 offset, T value)
 {
+	nds->gpu2d_memo[0].vram_gen[1]++;
+
 	u32 index = offset >> 14 & 15;
 	u8 *p = nds->vram.aobj_pt[index];
 	if (p) {
 		writearr<T>(p, offset & 0x3FFF, value);
+		vram_mark_dirty_2d(&nds->vram, p + (offset & 0x3FFF));
 	} else {
 		u16 mask = nds->vram.aobj_bank[index];
 		vram_write_banks<T>(nds, offset, value, mask);
+		vram_mark_banks_dirty_2d(&nds->vram, offset, mask);
 	}
 }
 
@@ -135,13 +147,17 @@ template <typename T>
 void
 vram_write_bobj(nds_ctx *nds, u32 offset, T value)
 {
+	nds->gpu2d_memo[1].vram_gen[1]++;
+
 	u32 index = offset >> 14 & 7;
 	u8 *p = nds->vram.bobj_pt[index];
 	if (p) {
 		writearr<T>(p, offset & 0x3FFF, value);
+		vram_mark_dirty_2d(&nds->vram, p + (offset & 0x3FFF));
 	} else {
 		u16 mask = nds->vram.bobj_bank;
 		vram_write_banks<T>(nds, offset, value, mask);
+		vram_mark_banks_dirty_2d(&nds->vram, offset, mask);
 	}
 }
 
@@ -20,7 +20,11 @@ static void check_lyc(nds_ctx *nds, int cpuid);
 static void nds_on_vblank(nds_ctx *nds);
 static void schedule_32k_tick_event(nds_ctx *nds, timestamp late);
 
-nds_ctx::~nds_ctx() = default;
+nds_ctx::~nds_ctx()
+{
+	fastmem_destroy(this);
+	jit_destroy(this);
+}
 
 std::unique_ptr<nds_ctx>
 create_nds_ctx(file_view arm9_bios, file_view arm7_bios, file_view firmware,
@@ -47,6 +51,10 @@ create_nds_ctx(file_view arm9_bios, file_view arm7_bios, file_view firmware,
 	nds->cpu[1] = nds->arm7.get();
 	arm_init(nds, 0);
 	arm_init(nds, 1);
+	page_tracker_init(nds);
+	if (config->use_fastmem && !fastmem_init(nds)) {
+		LOG("fastmem is not available, using the page tables\n");
+	}
 	gpu2d_init(nds);
 	gpu3d_init(nds);
 	firmware_init(nds);
@@ -166,6 +174,7 @@ void
 nds_dump_prof(nds_ctx *nds)
 {
 	nds->prof.report();
+	dump_idle_loop_stats(nds);
 }
 
 void
@@ -252,6 +261,13 @@ nds_setup_run(nds_ctx *nds, u64 target, unsigned long term_sigs, s16 *mic_buf,
 	nds->arm7->cycles_executed = 0;
 	nds->dma[0].cycles_executed = 0;
 	nds->dma[1].cycles_executed = 0;
+	nds->sc.timeslices = 0;
+	nds->gpu3d.frames_swapped = 0;
+	nds->gpu3d.frames_reused = 0;
+	for (auto& memo : nds->gpu2d_memo) {
+		memo.lines = 0;
+		memo.lines_reused = 0;
+	}
 	nds->exec_out = out;
 	schedule_event(nds, scheduler::EXECUTION_TARGET_REACHED, target);
 }
@@ -268,8 +284,12 @@ run_loop(nds_ctx *nds)
 			nds->arm_cycles[0] = nds->arm_target_cycles[0];
 		} else if (nds->dma[0].active) {
 			run_dma9(nds);
+			nds->arm7->idling = false;
 		} else {
 			nds->arm9->run();
+			if (!nds->arm9->idling) {
+				nds->arm7->idling = false;
+			}
 		}
 
 		run_cpu_events(nds, 0);
@@ -281,8 +301,12 @@ run_loop(nds_ctx *nds)
 				nds->arm_cycles[1] = nds->arm_target_cycles[1];
 			} else if (nds->dma[1].active) {
 				run_dma7(nds);
+				nds->arm9->idling = false;
 			} else {
 				nds->arm7->run();
+				if (!nds->arm7->idling) {
+					nds->arm9->idling = false;
+				}
 			}
 
 			run_cpu_events(nds, 1);
@@ -305,6 +329,14 @@ run_loop(nds_ctx *nds)
 			nds->dma[0].cycles_executed / 1120380.0,
 			nds->dma[1].cycles_executed / 560190.0,
 		};
+		nds->exec_out->timeslices = nds->sc.timeslices;
+		nds->exec_out->frames_3d = nds->gpu3d.frames_swapped;
+		nds->exec_out->frames_3d_reused = nds->gpu3d.frames_reused;
+		nds->exec_out->lines_2d = nds->gpu2d_memo[0].lines +
+		                          nds->gpu2d_memo[1].lines;
+		nds->exec_out->lines_2d_reused =
+				nds->gpu2d_memo[0].lines_reused +
+				nds->gpu2d_memo[1].lines_reused;
 	}
 }
 
@@ -6,15 +6,18 @@
 #include "libtwice/nds/game_db.h"
 #include "libtwice/nds/machine.h"
 
+#include "nds/arm/block_cache.h"
 #include "nds/cart/cart.h"
 #include "nds/cart/dldi.h"
 #include "nds/dma.h"
 #include "nds/firmware.h"
 #include "nds/gpu/2d/gpu2d.h"
+#include "nds/gpu/2d/tile_cache.h"
 #include "nds/gpu/3d/gpu3d.h"
 #include "nds/gpu/vram.h"
 #include "nds/ipc.h"
 #include "nds/mem/bus.h"
+#include "nds/mem/page_tracker.h"
 #include "nds/powerman.h"
 #include "nds/rtc.h"
 #include "nds/scheduler.h"
@@ -80,6 +83,10 @@ struct nds_ctx {
 	gpu_vram vram;
 	gpu_2d_engine gpu2d[2];
 	gpu_3d_engine gpu3d;
+	gpu_2d_render_queue gpu2d_queue;
+	tile_cache gpu2d_tiles[2];
+	gpu_2d_sprite_bins gpu2d_sprites[2];
+	gpu_2d_line_memo gpu2d_memo[2];
 
 	scheduler sc;
 	timestamp arm_target_cycles[2]{};
@@ -104,11 +111,12 @@ struct nds_ctx {
 	/*
 	 * Memory
 	 */
-	u8 main_ram[MAIN_RAM_SIZE]{};
-	u8 shared_wram[SHARED_WRAM_SIZE]{};
+	/* page aligned so that fastmem can alias them */
+	alignas(4_KiB) u8 main_ram[MAIN_RAM_SIZE]{};
+	alignas(4_KiB) u8 shared_wram[SHARED_WRAM_SIZE]{};
 	u8 palette[PALETTE_SIZE]{};
 	u8 oam[OAM_SIZE]{};
-	u8 arm7_wram[ARM7_WRAM_SIZE]{};
+	alignas(4_KiB) u8 arm7_wram[ARM7_WRAM_SIZE]{};
 
 	u8 *shared_wram_p[2]{};
 	u32 shared_wram_mask[2]{};
@@ -128,6 +136,11 @@ struct nds_ctx {
 	u8 *bus9_write_pt[BUS9_PAGE_TABLE_SIZE]{};
 	u8 *bus7_read_pt[BUS7_PAGE_TABLE_SIZE]{};
 	u8 *bus7_write_pt[BUS7_PAGE_TABLE_SIZE]{};
+	/* the tracked pages of the write page tables */
+	s16 bus9_tracked_pt[BUS9_PAGE_TABLE_SIZE]{};
+	s16 bus7_tracked_pt[BUS7_PAGE_TABLE_SIZE]{};
+	page_tracker tracker;
+	int fastmem_fd{ -1 };
 
 	/* NSEQ32 / SEQ32 / NSEQ16 / SEQ16 */
 	std::array<u8, 4> arm9_code_timings[BUS_TIMING_TABLE_SIZE]{};
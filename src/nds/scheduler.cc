@@ -16,8 +16,10 @@ struct event_state {
 	bool enabled{};
 };
 
-static void run_events(
-		nds_ctx *nds, u32 start, u32 length, timestamp curr_time);
+static void set_expiry(scheduler& sc, int id, timestamp t);
+static void update_next_expiry(scheduler& sc);
+static void run_events(nds_ctx *nds, int group, timestamp curr_time);
+static void update_timeslice(nds_ctx *nds);
 
 static event_state initial_state[scheduler::NUM_EVENTS] = {
 	{ .cb = event_hblank_start },
@@ -50,8 +52,46 @@ scheduler_init(nds_ctx *nds)
 		sc.callbacks[i] = initial_state[i].cb;
 		sc.data[i] = initial_state[i].data;
 		sc.expiry[i] = initial_state[i].expiry;
-		sc.enabled[i] = initial_state[i].enabled;
+		if (initial_state[i].enabled) {
+			sc.enabled |= BIT(i);
+		}
+	}
+	sc.num_events = scheduler::NUM_EVENTS;
+
+	for (u32 i = 0; i < scheduler::NUM_EVENTS; i++) {
+		if (i < scheduler::ARM9_EVENTS) {
+			sc.group_events[scheduler::GROUP_SYSTEM] |= BIT(i);
+		} else if (i < scheduler::ARM7_EVENTS) {
+			sc.group_events[scheduler::GROUP_ARM9] |= BIT(i);
+		} else {
+			sc.group_events[scheduler::GROUP_ARM7] |= BIT(i);
+		}
+	}
+
+	sc.next_expiry_dirty = true;
+}
+
+int
+register_event(nds_ctx *nds, int group, scheduler::event_cb cb,
+		intptr_t data)
+{
+	auto& sc = nds->sc;
+
+	if (sc.num_events == scheduler::MAX_EVENTS) {
+		throw twice_error("too many scheduler events");
 	}
+
+	/*
+	 * events in a group run in order of id, so registered events run
+	 * after the fixed ones
+	 */
+	int id = sc.num_events++;
+	sc.callbacks[id] = cb;
+	sc.data[id] = data;
+	sc.expiry[id] = 0;
+	sc.group_events[group] |= BIT(id);
+
+	return id;
 }
 
 timestamp
@@ -59,25 +99,31 @@ get_next_event_time(nds_ctx *nds)
 {
 	auto& sc = nds->sc;
 
+	update_timeslice(nds);
+
 	timestamp curr = nds->arm_cycles[0];
-	timestamp limit = curr + 64;
-	timestamp target = -1;
+	timestamp limit = curr + sc.timeslice;
 
-	for (int i = 0; i < scheduler::NUM_EVENTS; i++) {
-		if (sc.enabled[i]) {
-			target = std::min(target, sc.expiry[i]);
-		}
+	if (sc.next_expiry_dirty) {
+		update_next_expiry(sc);
 	}
+	timestamp target = sc.next_expiry;
 
+	/*
+	 * a cpu spinning in an idle loop cannot make progress until an
+	 * event fires, so it is as good as halted
+	 */
 	bool fast_skip = !nds->dma[0].active && !nds->dma[1].active &&
-	                 nds->cpu[0]->halted && nds->cpu[1]->halted;
+	                 (nds->cpu[0]->halted || nds->cpu[0]->idling) &&
+	                 (nds->cpu[1]->halted || nds->cpu[1]->idling);
 	if (!fast_skip) {
 		target = std::min(target, limit);
 	}
 
 	if (target <= curr) {
-		for (int i = 0; i < scheduler::NUM_EVENTS; i++) {
-			if (sc.enabled[i] && sc.expiry[i] == target) {
+		for (u64 mask = sc.enabled; mask; mask &= mask - 1) {
+			int i = std::countr_zero(mask);
+			if (sc.expiry[i] == target) {
 				LOG("%d\n", i);
 			}
 		}
@@ -90,45 +136,43 @@ get_next_event_time(nds_ctx *nds)
 void
 schedule_event(nds_ctx *nds, int id, timestamp t)
 {
-	auto& sc = nds->sc;
-	sc.expiry[id] = t;
-	sc.enabled[id] = true;
+	set_expiry(nds->sc, id, t);
 }
 
 void
 reschedule_event_after(nds_ctx *nds, int id, timestamp dt)
 {
 	auto& sc = nds->sc;
-	sc.expiry[id] += dt;
-	sc.enabled[id] = true;
+	set_expiry(sc, id, sc.expiry[id] + dt);
 }
 
 void
 schedule_event_after(nds_ctx *nds, int cpuid, int id, timestamp dt)
 {
-	auto& sc = nds->sc;
 	timestamp t = (nds->arm_cycles[cpuid] << cpuid) + dt;
 
 	if (t < nds->arm_target_cycles[cpuid] << cpuid) {
 		nds->arm_target_cycles[cpuid] = t >> cpuid;
 	}
 
-	sc.enabled[id] = true;
-	sc.expiry[id] = t;
+	set_expiry(nds->sc, id, t);
 }
 
 void
 cancel_event(nds_ctx *nds, int id)
 {
 	auto& sc = nds->sc;
-	sc.enabled[id] = false;
+
+	if ((sc.enabled & BIT(id)) && sc.expiry[id] == sc.next_expiry) {
+		sc.next_expiry_dirty = true;
+	}
+	sc.enabled &= ~BIT(id);
 }
 
 void
 run_system_events(nds_ctx *nds)
 {
-	run_events(nds, scheduler::SYSTEM_EVENTS, scheduler::ARM9_EVENTS,
-			nds->arm_cycles[0]);
+	run_events(nds, scheduler::GROUP_SYSTEM, nds->arm_cycles[0]);
 	nds->arm9->check_halted();
 	nds->arm7->check_halted();
 }
@@ -137,10 +181,9 @@ void
 run_cpu_events(nds_ctx *nds, int cpuid)
 {
 	if (cpuid == 0) {
-		run_events(nds, scheduler::ARM9_EVENTS, scheduler::ARM7_EVENTS,
-				nds->arm_cycles[0]);
+		run_events(nds, scheduler::GROUP_ARM9, nds->arm_cycles[0]);
 	} else {
-		run_events(nds, scheduler::ARM7_EVENTS, scheduler::NUM_EVENTS,
+		run_events(nds, scheduler::GROUP_ARM7,
 				nds->arm_cycles[1] << 1);
 		nds->arm7->check_halted();
 	}
@@ -155,19 +198,83 @@ get_timer_update_event_id(int cpuid, int timer_id)
 }
 
 static void
-run_events(nds_ctx *nds, u32 start, u32 end, timestamp curr_time)
+update_timeslice(nds_ctx *nds)
+{
+	auto& sc = nds->sc;
+
+	switch (nds->config->timeslice_policy) {
+	case nds_timeslice_policy::FIXED:
+		sc.timeslice = MIN_TIMESLICE;
+		break;
+	case nds_timeslice_policy::ADAPTIVE:
+		if (sc.ipc_activity) {
+			sc.timeslice = MIN_TIMESLICE;
+		} else {
+			sc.timeslice = std::min<u32>(
+					sc.timeslice * 2, MAX_TIMESLICE);
+		}
+		break;
+	case nds_timeslice_policy::MAX:
+		sc.timeslice = MAX_TIMESLICE;
+	}
+
+	sc.ipc_activity = false;
+	sc.timeslices++;
+}
+
+static void
+set_expiry(scheduler& sc, int id, timestamp t)
+{
+	if (t <= sc.next_expiry) {
+		sc.next_expiry = t;
+	} else if ((sc.enabled & BIT(id)) &&
+			sc.expiry[id] == sc.next_expiry) {
+		/* the earliest event moved later */
+		sc.next_expiry_dirty = true;
+	}
+
+	sc.expiry[id] = t;
+	sc.enabled |= BIT(id);
+}
+
+static void
+update_next_expiry(scheduler& sc)
+{
+	timestamp t = -1;
+
+	for (u64 mask = sc.enabled; mask; mask &= mask - 1) {
+		t = std::min(t, sc.expiry[std::countr_zero(mask)]);
+	}
+
+	sc.next_expiry = t;
+	sc.next_expiry_dirty = false;
+}
+
+static void
+run_events(nds_ctx *nds, int group, timestamp curr_time)
 {
 	auto& sc = nds->sc;
+	u64 events = sc.group_events[group];
 
-	for (u32 i = start; i < end; i++) {
-		if (!sc.enabled[i])
-			continue;
+	/*
+	 * a callback may enable or cancel other events, so the enabled
+	 * events after the current one are looked up again each time
+	 */
+	for (u64 mask = sc.enabled & events; mask;) {
+		int i = std::countr_zero(mask);
 
 		if (curr_time >= sc.expiry[i]) {
 			timestamp late = curr_time - sc.expiry[i];
-			sc.enabled[i] = false;
+			sc.enabled &= ~BIT(i);
+			sc.next_expiry_dirty = true;
 			sc.callbacks[i](nds, sc.data[i], late);
+
+			/* the event may change what the cpus are polling */
+			nds->cpu[0]->idling = false;
+			nds->cpu[1]->idling = false;
 		}
+
+		mask = sc.enabled & events & ~MASK(i + 1);
 	}
 }
 
@@ -7,6 +7,11 @@ namespace twice {
 
 struct nds_ctx;
 
+enum : u32 {
+	MIN_TIMESLICE = 64,
+	MAX_TIMESLICE = 1024,
+};
+
 struct scheduler {
 	typedef void (*event_cb)(nds_ctx *nds, intptr_t data, timestamp late);
 
@@ -38,15 +43,41 @@ struct scheduler {
 		ARM7_SPI_TRANSFER,
 
 		NUM_EVENTS,
+
+		/* room for events added with register_event */
+		MAX_EVENTS = 64,
 	};
 
-	event_cb callbacks[NUM_EVENTS]{};
-	intptr_t data[NUM_EVENTS]{};
-	timestamp expiry[NUM_EVENTS]{};
-	bool enabled[NUM_EVENTS]{};
+	enum {
+		GROUP_SYSTEM,
+		GROUP_ARM9,
+		GROUP_ARM7,
+		NUM_GROUPS,
+	};
+
+	event_cb callbacks[MAX_EVENTS]{};
+	intptr_t data[MAX_EVENTS]{};
+	timestamp expiry[MAX_EVENTS]{};
+	u32 num_events{};
+
+	/* bit n is set if event n is enabled */
+	u64 enabled{};
+	u64 group_events[NUM_GROUPS]{};
+
+	/* earliest expiry of the enabled events, recomputed when dirty */
+	timestamp next_expiry{ (timestamp)-1 };
+	bool next_expiry_dirty{};
+
+	/* in arm9 cycles */
+	u32 timeslice{ MIN_TIMESLICE };
+	/* set if the cpus might have communicated since the last slice */
+	bool ipc_activity{};
+	u64 timeslices{};
 };
 
 void scheduler_init(nds_ctx *nds);
+int register_event(nds_ctx *nds, int group, scheduler::event_cb cb,
+		intptr_t data);
 timestamp get_next_event_time(nds_ctx *nds);
 void schedule_event(nds_ctx *nds, int id, timestamp t);
 void reschedule_event_after(nds_ctx *nds, int id, timestamp dt);
@@ -0,0 +1,85 @@
+#include "bench.h"
+
+#include "nds/arm/arm7.h"
+#include "nds/arm/arm9.h"
+#include "nds/mem/io.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace twice {
+
+static u8 arm9_bios[ARM9_BIOS_SIZE];
+static u8 arm7_bios[ARM7_BIOS_SIZE];
+
+std::unique_ptr<nds_ctx>
+bench_create_nds_ctx(nds_config *config)
+{
+	auto ctx = std::make_unique<nds_ctx>();
+	nds_ctx *nds = ctx.get();
+	nds->config = config;
+	nds->arm9_bios = arm9_bios;
+	nds->arm7_bios = arm7_bios;
+	nds->arm9 = std::make_unique<arm9_cpu>();
+	nds->arm7 = std::make_unique<arm7_cpu>();
+	nds->cpu[0] = nds->arm9.get();
+	nds->cpu[1] = nds->arm7.get();
+	arm_init(nds, 0);
+	arm_init(nds, 1);
+	page_tracker_init(nds);
+	if (config->use_fastmem && !fastmem_init(nds)) {
+		std::fprintf(stderr, "fastmem is not available\n");
+	}
+	gpu2d_init(nds);
+	gpu3d_init(nds);
+	dma_controller_init(nds, 0);
+	dma_controller_init(nds, 1);
+	scheduler_init(nds);
+	bus_tables_init(nds);
+
+	wramcnt_write(nds, 0x3);
+	powcnt1_write(nds, 0x1);
+	exmem_write(nds, 0, 0x6000);
+	exmem_write(nds, 1, 0x6000);
+	schedule_event(nds, scheduler::HBLANK_START, 3072);
+	schedule_event(nds, scheduler::HBLANK_END, 4260);
+
+	return ctx;
+}
+
+double
+bench_now()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch())
+			.count();
+}
+
+void
+bench_report(const char *name, std::vector<double> times, double div,
+		double mul, const char *unit)
+{
+	if (times.empty()) {
+		return;
+	}
+
+	std::sort(times.begin(), times.end());
+	double scale = mul / div;
+	std::printf("%-32s min %9.3f  median %9.3f  max %9.3f %s\n", name,
+			times.front() * scale, times[times.size() / 2] * scale,
+			times.back() * scale, unit);
+}
+
+u32
+bench_hash(const void *p, size_t size, u32 h)
+{
+	auto *bytes = (const u8 *)p;
+	for (size_t i = 0; i < size; i++) {
+		h = (h ^ bytes[i]) * 16777619;
+	}
+
+	return h;
+}
+
+} // namespace twice
@@ -0,0 +1,44 @@
+#ifndef TWICE_BENCH_H
+#define TWICE_BENCH_H
+
+#include "nds/nds.h"
+
+#include <memory>
+#include <vector>
+
+namespace twice {
+
+struct bench_options {
+	int runs{ 10 };
+};
+
+/*
+ * An nds_ctx with the bios, firmware and cartridge left out, which is
+ * enough to run code from main ram or to draw from vram.
+ */
+std::unique_ptr<nds_ctx> bench_create_nds_ctx(nds_config *config);
+
+double bench_now();
+
+/*
+ * Prints the minimum, median and maximum of the times of the runs, in
+ * seconds, each divided by div and multiplied by mul.
+ */
+void bench_report(const char *name, std::vector<double> times, double div,
+		double mul, const char *unit);
+
+u32 bench_hash(const void *p, size_t size, u32 h = 2166136261);
+
+int bench_cpu(const bench_options& opts);
+int bench_geometry(const bench_options& opts);
+int bench_render3d(const bench_options& opts);
+int bench_scheduler(const bench_options& opts);
+int check_compositor(const bench_options& opts);
+int check_geometry(const bench_options& opts);
+int check_jit(const bench_options& opts);
+int check_spans(const bench_options& opts);
+int check_tracker(const bench_options& opts);
+
+} // namespace twice
+
+#endif
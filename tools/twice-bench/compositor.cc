@@ -0,0 +1,162 @@
+#include "bench.h"
+
+#include "common/cpu.h"
+#include "nds/mem/bus.h"
+#include "nds/mem/io.h"
+
+#include <cstdio>
+#include <random>
+
+namespace twice {
+
+enum : int {
+	CHECK_FRAMES = 64,
+};
+
+/*
+ * Maps vram for both 2d engines, and fills vram, palettes, oam and the
+ * 3d layer with the same random data on every machine.
+ */
+static void
+fill_2d_memory(nds_ctx *nds)
+{
+	powcnt1_write(nds, 0x820F);
+	vramcnt_a_write(nds, 0x81);
+	vramcnt_b_write(nds, 0x89);
+	vramcnt_c_write(nds, 0x84);
+	vramcnt_d_write(nds, 0x80);
+	vramcnt_e_write(nds, 0x82);
+	vramcnt_h_write(nds, 0x82);
+	vramcnt_i_write(nds, 0x82);
+
+	std::mt19937 rng(5);
+	for (u32 i = 0; i < 0x80000; i += 4) {
+		bus9_write<u32>(nds, 0x6000000 + i, rng());
+	}
+	for (u32 i = 0; i < 0x20000; i += 4) {
+		bus9_write<u32>(nds, 0x6200000 + i, rng());
+	}
+	for (u32 i = 0; i < 0x800; i += 4) {
+		bus9_write<u32>(nds, 0x5000000 + i, rng());
+		bus9_write<u32>(nds, 0x7000000 + i, rng());
+	}
+
+	for (auto& line : nds->gpu3d.re.pixels) {
+		for (auto& px : line) {
+			u8 alpha = rng() % 4 == 0 ? 0 : rng() % 32;
+			px.color[0] = color4(rng() % 64, rng() % 64, rng() % 64,
+					alpha);
+		}
+	}
+}
+
+/*
+ * Writes a few random 2d registers of either engine, and sometimes to
+ * palettes, vram and oam, before a line is drawn.
+ */
+static void
+write_random_registers(nds_ctx *nds, std::mt19937& rng)
+{
+	int n = rng() % 4;
+	for (int k = 0; k < n; k++) {
+		u32 engine = rng() & 1 ? 0x1000 : 0;
+		u32 reg = rng() % 0x58 & ~1;
+		u32 v = rng();
+		if (reg == 0 && rng() % 2) {
+			/* display capture, on engine a only */
+			if (!engine) {
+				bus9_write<u32>(nds, 0x4000064, v | BIT(31));
+			}
+			continue;
+		}
+		if (reg == 0) {
+			/* graphics display, with all layers on */
+			v = (v & 0xFFFF9F08) | 0x10000 | rng() % 6 | 0x1F00;
+		} else if (reg == 2) {
+			v = (v & 0xFFFC) | 1;
+		}
+		bus9_write<u16>(nds, 0x4000000 + engine + reg, v);
+	}
+
+	if (rng() % 8 == 0) {
+		bus9_write<u16>(nds, 0x5000000 + (rng() & 0x7FE), rng());
+	}
+	if (rng() % 8 == 0) {
+		bus9_write<u16>(nds, 0x6000000 + (rng() & 0x7FFFE), rng());
+	}
+	if (rng() % 8 == 0) {
+		bus9_write<u16>(nds, 0x7000000 + (rng() & 0x7FE), rng());
+	}
+	if (rng() % 4 == 0) {
+		/* master brightness */
+		bus9_write<u16>(nds, 0x400006C + (rng() & 1) * 0x1000,
+				rng() & 0xC01F);
+	}
+	if (rng() % 4 == 0) {
+		/* blending */
+		bus9_write<u16>(nds, 0x4000050 + (rng() & 1) * 0x1000, rng());
+	}
+}
+
+/* draws a frame, and returns a hash of it and of the capture banks */
+static u32
+run_random_frame(nds_ctx *nds, u32 seed)
+{
+	std::mt19937 rng(seed);
+
+	for (u32 y = 0; y < 263; y++) {
+		nds->vcount = y;
+		write_random_registers(nds, rng);
+		gpu_on_scanline_start(nds);
+	}
+
+	u32 h = bench_hash(nds->fb, sizeof nds->fb);
+	h = bench_hash(nds->vram.vram_a, sizeof nds->vram.vram_a, h);
+	return bench_hash(nds->vram.vram_b, sizeof nds->vram.vram_b, h);
+}
+
+int
+check_compositor(const bench_options&)
+{
+#ifdef TWICE_HAVE_AVX2
+	if (!cpu_has_avx2()) {
+		std::printf("avx2 is not available, skipped\n");
+		return 0;
+	}
+
+	nds_config config;
+	std::unique_ptr<nds_ctx> ctx[2];
+	for (auto& nds : ctx) {
+		nds = bench_create_nds_ctx(&config);
+		fill_2d_memory(nds.get());
+	}
+
+	/*
+	 * Runs the same frames on two machines, without and with avx2. Each
+	 * machine keeps its mode, so that a line reused from an earlier
+	 * frame was drawn in the same mode.
+	 */
+	int failures = 0;
+	for (u32 i = 0; i < CHECK_FRAMES; i++) {
+		u32 h[2];
+		for (int avx2 = 0; avx2 < 2; avx2++) {
+			set_use_avx2(avx2);
+			h[avx2] = run_random_frame(ctx[avx2].get(), i);
+		}
+		if (h[0] != h[1]) {
+			std::printf("  frame %u: scalar %08X, avx2 %08X\n", i,
+					h[0], h[1]);
+			failures++;
+		}
+	}
+	set_use_avx2(true);
+
+	std::printf("%s\n", failures ? "FAILED" : "ok");
+	return failures != 0;
+#else
+	std::printf("avx2 is not available, skipped\n");
+	return 0;
+#endif
+}
+
+} // namespace twice
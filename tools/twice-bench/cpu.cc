@@ -0,0 +1,139 @@
+#include "bench.h"
+
+#include "nds/arm/arm7.h"
+#include "nds/arm/arm9.h"
+
+#include <cstdio>
+
+namespace twice {
+
+/*
+ *	mov r1, #0x2000000
+ *	add r1, r1, #0x10000
+ *	mov r3, #0x100
+ * 1:	ldr r4, [r1], #4
+ *	add r5, r5, r4
+ *	eor r6, r6, r5, lsl #1
+ *	str r6, [r1, #-4]
+ *	subs r3, r3, #1
+ *	bne 1b
+ *	b 0b
+ */
+static const u32 loop_code[] = {
+	0xE3A01402,
+	0xE2811801,
+	0xE3A03C01,
+	0xE4914004,
+	0xE0855004,
+	0xE0266085,
+	0xE5016004,
+	0xE2533001,
+	0x1AFFFFF9,
+	0xEAFFFFF5,
+};
+
+enum : u64 {
+	LOOP_CYCLES = 20000000,
+};
+
+struct cpu_mode {
+	const char *name;
+	void (*setup)(nds_config *config);
+};
+
+static const cpu_mode cpu_modes[] = {
+	{ "interpreter", [](nds_config *) {} },
+	{ "cached interpreter",
+			[](nds_config *cfg) {
+				cfg->use_cached_interpreter = true;
+			} },
+	{ "interpreter, fastmem",
+			[](nds_config *cfg) { cfg->use_fastmem = true; } },
+	{ "cached interpreter, fastmem",
+			[](nds_config *cfg) {
+				cfg->use_cached_interpreter = true;
+				cfg->use_fastmem = true;
+			} },
+	{ "jit", [](nds_config *cfg) { cfg->use_jit = true; } },
+};
+
+static double
+run_loop(const cpu_mode& mode, int cpuid, u32 *result)
+{
+	nds_config cfg{};
+	mode.setup(&cfg);
+	auto ctx = bench_create_nds_ctx(&cfg);
+	nds_ctx *nds = ctx.get();
+
+	for (u32 i = 0; i < std::size(loop_code); i++) {
+		writearr<u32>(nds->main_ram, i * 4, loop_code[i]);
+	}
+
+	nds->cpu[cpuid]->cpsr = 0x1F;
+	if (cpuid == 0) {
+		nds->arm9->arm_jump(0x2000000);
+	} else {
+		nds->arm7->arm_jump(0x2000000);
+	}
+	nds->arm_target_cycles[cpuid] = nds->arm_cycles[cpuid] + LOOP_CYCLES;
+
+	double start = bench_now();
+	if (cpuid == 0) {
+		nds->arm9->run();
+	} else {
+		nds->arm7->run();
+	}
+	double time = bench_now() - start;
+
+	*result = bench_hash(nds->cpu[cpuid]->gpr, sizeof nds->cpu[cpuid]->gpr,
+			bench_hash(nds->main_ram, MAIN_RAM_SIZE));
+	return time;
+}
+
+/*
+ * Runs a load, alu and store loop from main ram on each cpu with each
+ * way of executing code. The registers and main ram must end up the same
+ * for all of them.
+ */
+int
+bench_cpu(const bench_options& opts)
+{
+	constexpr size_t num_modes = std::size(cpu_modes);
+	std::vector<double> times[2][num_modes];
+	bool mismatch = false;
+
+	for (int i = 0; i < opts.runs; i++) {
+		for (int cpuid = 0; cpuid < 2; cpuid++) {
+			u32 expected = 0;
+			for (size_t m = 0; m < num_modes; m++) {
+				u32 result;
+				times[cpuid][m].push_back(run_loop(
+						cpu_modes[m], cpuid, &result));
+				if (m == 0) {
+					expected = result;
+				} else if (result != expected) {
+					mismatch = true;
+				}
+			}
+		}
+	}
+
+	for (int cpuid = 0; cpuid < 2; cpuid++) {
+		for (size_t m = 0; m < num_modes; m++) {
+			char name[64];
+			std::snprintf(name, sizeof name, "arm%d %s",
+					cpuid ? 7 : 9, cpu_modes[m].name);
+			bench_report(name, times[cpuid][m], LOOP_CYCLES, 1e9,
+					"ns/cycle");
+		}
+	}
+
+	if (mismatch) {
+		std::printf("the results of the modes differ\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+} // namespace twice
@@ -0,0 +1,313 @@
+#include "bench.h"
+
+#include "common/cpu.h"
+#include "nds/gpu/3d/gpu3d.h"
+#include "nds/mem/io.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+namespace twice {
+
+enum : int {
+	PASS_VERTICES = 4096,
+	CHECK_FRAMES = 32,
+	CHECK_COMMANDS = 4000,
+};
+
+/* the number of parameters of the geometry commands, or -1 if unused */
+static const s8 num_params[0x80] = {
+	0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	1, 0, 1, 1, 1, 0, 16, 12, 16, 12, 9, 3, 3, -1, -1, -1,
+	1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1,
+	1, 1, 1, 1, 32, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	1, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	3, 2, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+/*
+ * Returns parameter i of a command. Matrices stay close to the identity,
+ * so that products of many of them keep some precision.
+ */
+static u32
+make_param(std::mt19937& rng, u8 cmd, int i)
+{
+	switch (cmd) {
+	case 0x10:
+		return rng() % 4;
+	case 0x16:
+	case 0x17:
+	case 0x18:
+	case 0x19:
+	case 0x1A:
+		if (i % 5 == 0) {
+			return 0x1000 + (s32)(rng() % 0x400) - 0x200;
+		}
+		return (s32)(rng() % 0x800) - 0x400;
+	case 0x1B:
+		return 0x1000 + (s32)(rng() % 0x800) - 0x400;
+	case 0x1C:
+		return (s32)(rng() % 0x4000) - 0x2000;
+	case 0x29:
+		/* opaque, both sides, random lights */
+		return rng() | 0x1F00C0;
+	case 0x40:
+		return rng() % 4;
+	default:
+		return rng();
+	}
+}
+
+struct ge_command {
+	u8 cmd;
+	u32 params[32];
+};
+
+static void
+add_command(std::vector<ge_command>& cmds, std::mt19937& rng, u8 cmd)
+{
+	ge_command c{ cmd, {} };
+	for (int i = 0; i < num_params[cmd]; i++) {
+		c.params[i] = make_param(rng, cmd, i);
+	}
+	cmds.push_back(c);
+}
+
+static void
+make_matrix_pass(std::vector<ge_command>& cmds, std::mt19937& rng)
+{
+	static const u8 ops[] = { 0x18, 0x19, 0x1A, 0x1B, 0x1C };
+
+	cmds.push_back({ 0x10, { 2 } });
+	cmds.push_back({ 0x15, {} });
+	for (int i = 0; i < PASS_VERTICES; i++) {
+		add_command(cmds, rng, ops[rng() % std::size(ops)]);
+		if (i % 64 == 63) {
+			add_command(cmds, rng, 0x16);
+		}
+	}
+}
+
+static void
+make_vertex_pass(std::vector<ge_command>& cmds, std::mt19937& rng)
+{
+	cmds.push_back({ 0x10, { 2 } });
+	add_command(cmds, rng, 0x19);
+	cmds.push_back({ 0x29, { 0x1F00C0 } });
+	cmds.push_back({ 0x40, { 0 } });
+	for (int i = 0; i < PASS_VERTICES; i++) {
+		add_command(cmds, rng, 0x23);
+	}
+}
+
+static void
+make_lit_vertex_pass(std::vector<ge_command>& cmds, std::mt19937& rng)
+{
+	cmds.push_back({ 0x10, { 2 } });
+	add_command(cmds, rng, 0x19);
+	for (u32 i = 0; i < 4; i++) {
+		u32 vec = rng() & 0x3FFFFFFF;
+		u32 color = rng() & 0x7FFF;
+		cmds.push_back({ 0x32, { i << 30 | vec } });
+		cmds.push_back({ 0x33, { i << 30 | color } });
+	}
+	add_command(cmds, rng, 0x30);
+	add_command(cmds, rng, 0x31);
+	cmds.push_back({ 0x29, { 0x1F00CF } });
+	cmds.push_back({ 0x40, { 0 } });
+	for (int i = 0; i < PASS_VERTICES; i++) {
+		add_command(cmds, rng, 0x21);
+		add_command(cmds, rng, 0x23);
+	}
+}
+
+static const struct {
+	const char *name;
+	void (*make_pass)(std::vector<ge_command>&, std::mt19937&);
+} workloads[] = {
+	{ "matrix commands", make_matrix_pass },
+	{ "vertices", make_vertex_pass },
+	{ "vertices with 4 lights", make_lit_vertex_pass },
+};
+
+static double
+run_pass(geometry_engine *ge, const std::vector<ge_command>& cmds)
+{
+	ge->vtx_ram->count = 0;
+	ge->poly_ram->count = 0;
+
+	double start = bench_now();
+	for (const auto& c : cmds) {
+		std::memcpy(ge->cmd_params, c.params, sizeof c.params);
+		ge_execute_command(ge, c.cmd);
+	}
+
+	return bench_now() - start;
+}
+
+int
+bench_geometry(const bench_options& opts)
+{
+	constexpr size_t NUM_WORKLOADS = std::size(workloads);
+	nds_config config;
+	auto nds = bench_create_nds_ctx(&config);
+	auto *ge = &nds->gpu3d.ge;
+	powcnt1_write(nds.get(), 0x20F);
+
+	std::vector<ge_command> passes[NUM_WORKLOADS];
+	std::vector<double> times[NUM_WORKLOADS];
+	for (size_t i = 0; i < NUM_WORKLOADS; i++) {
+		std::mt19937 rng(i);
+		workloads[i].make_pass(passes[i], rng);
+	}
+
+	for (int run = 0; run < opts.runs; run++) {
+		for (size_t i = 0; i < NUM_WORKLOADS; i++) {
+			times[i].push_back(run_pass(ge, passes[i]));
+		}
+	}
+
+	for (size_t i = 0; i < NUM_WORKLOADS; i++) {
+		bench_report(workloads[i].name, times[i], passes[i].size(),
+				1e9, "ns/cmd");
+	}
+
+	return 0;
+}
+
+/* hashes the vertex and polygon rams, with vertices as indices */
+static u32
+hash_geometry(gpu_3d_engine *gpu, u32 h)
+{
+	const vertex *vtxs = gpu->vtx_ram[0].vtxs.data();
+
+	for (int b = 0; b < 2; b++) {
+		auto *vr = &gpu->vtx_ram[b];
+		auto *pr = &gpu->poly_ram[b];
+
+		h = bench_hash(&vr->count, sizeof vr->count, h);
+		for (u32 i = 0; i < vr->count; i++) {
+			auto& v = vr->vtxs[i];
+			h = bench_hash(&v.pos, sizeof v.pos, h);
+			h = bench_hash(&v.attr, sizeof v.attr, h);
+			h = bench_hash(&v.sx, sizeof v.sx, h);
+			h = bench_hash(&v.sy, sizeof v.sy, h);
+		}
+
+		h = bench_hash(&pr->count, sizeof pr->count, h);
+		for (u32 i = 0; i < pr->count; i++) {
+			auto& p = pr->polys[i];
+			for (u32 k = 0; k < p.num_vtxs; k++) {
+				s64 idx = p.vtxs[k] - vtxs;
+				h = bench_hash(&idx, sizeof idx, h);
+			}
+			h = bench_hash(&p.w, sizeof p.w, h);
+			h = bench_hash(&p.z, sizeof p.z, h);
+			h = bench_hash(&p.attr, sizeof p.attr, h);
+			h = bench_hash(&p.tx_param, sizeof p.tx_param, h);
+		}
+	}
+
+	return h;
+}
+
+/*
+ * Writes random commands to the geometry fifo, as single and as packed
+ * commands, then swaps the buffers. Returns a hash of the test results,
+ * the clip matrix and the swapped geometry.
+ */
+static u32
+run_random_frame(nds_ctx *nds, u32 seed)
+{
+	static const u8 cmd_pool[] = {
+		0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
+		0x1A, 0x1B, 0x1C, 0x20, 0x21, 0x21, 0x21, 0x22, 0x23, 0x23,
+		0x23, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x2B,
+		0x30, 0x31, 0x32, 0x33, 0x34, 0x40, 0x41, 0x60, 0x70, 0x71,
+		0x72,
+	};
+	auto *gpu = &nds->gpu3d;
+	std::mt19937 rng(seed);
+	u32 h = 2166136261;
+
+	for (int i = 0; i < CHECK_COMMANDS; i++) {
+		u8 cmd = cmd_pool[rng() % std::size(cmd_pool)];
+
+		if (rng() % 2) {
+			int n = std::max<int>(1, num_params[cmd]);
+			for (int j = 0; j < n; j++) {
+				gpu_3d_write32(gpu, 0x400 + 4 * cmd,
+						make_param(rng, cmd, j));
+			}
+		} else {
+			gpu_3d_write32(gpu, 0x400, cmd);
+			for (int j = 0; j < num_params[cmd]; j++) {
+				gpu_3d_write32(gpu, 0x400,
+						make_param(rng, cmd, j));
+			}
+		}
+
+		if (cmd >= 0x70) {
+			for (u16 offset = 0x620; offset < 0x640; offset += 4) {
+				u32 v = gpu_3d_read32(gpu, offset);
+				h = bench_hash(&v, sizeof v, h);
+			}
+		}
+	}
+
+	for (u16 offset = 0x640; offset < 0x6A4; offset += 4) {
+		u32 v = gpu_3d_read32(gpu, offset);
+		h = bench_hash(&v, sizeof v, h);
+	}
+
+	gpu_3d_write32(gpu, 0x540, 0);
+	gpu3d_on_vblank(gpu);
+
+	return hash_geometry(gpu, h);
+}
+
+int
+check_geometry(const bench_options&)
+{
+#ifdef TWICE_HAVE_AVX2
+	if (!cpu_has_avx2()) {
+		std::printf("avx2 is not available, skipped\n");
+		return 0;
+	}
+
+	nds_config config;
+	std::unique_ptr<nds_ctx> ctx[2];
+	for (auto& nds : ctx) {
+		nds = bench_create_nds_ctx(&config);
+		powcnt1_write(nds.get(), 0x20F);
+	}
+
+	/* runs the same frames on two machines, without and with avx2 */
+	int failures = 0;
+	for (u32 i = 0; i < CHECK_FRAMES; i++) {
+		u32 h[2];
+		for (int avx2 = 0; avx2 < 2; avx2++) {
+			set_use_avx2(avx2);
+			h[avx2] = run_random_frame(ctx[avx2].get(), i);
+		}
+		if (h[0] != h[1]) {
+			std::printf("  frame %u: scalar %08X, avx2 %08X\n", i,
+					h[0], h[1]);
+			failures++;
+		}
+	}
+	set_use_avx2(true);
+
+	std::printf("%s\n", failures ? "FAILED" : "ok");
+	return failures != 0;
+#else
+	std::printf("avx2 is not available, skipped\n");
+	return 0;
+#endif
+}
+
+} // namespace twice
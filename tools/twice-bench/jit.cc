@@ -0,0 +1,764 @@
+#include "bench.h"
+
+#include "libtwice/exception.h"
+#include "nds/arm/arm7.h"
+#include "nds/arm/arm9.h"
+#include "nds/arm/jit/jit.h"
+#include "nds/mem/bus.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+
+namespace twice {
+
+enum : u32 {
+	/* filled with branches to themselves, the tested code goes in it */
+	CODE_BASE = 0x2000000,
+	CODE_SIZE = 16_KiB,
+	TEST_ADDR = 0x2000100,
+	/* where the pointer registers point to */
+	DATA_BASE = 0x2010000,
+	DATA_SIZE = 64_KiB,
+
+	RANDOM_CASES = 1500,
+	MAX_CASE_INSTS = 8,
+	CASE_CYCLES = 256,
+
+	ARM_SELF_BRANCH = 0xEAFFFFFE,
+	THUMB_SELF_BRANCH = 0xE7FE,
+};
+
+/*
+ * The registers that random instructions may write. The others hold
+ * pointers into the data area, or small offsets, for the whole case, so
+ * that loads and stores stay in main ram.
+ */
+static const u8 arm_dest_regs[] = { 0, 1, 2, 3, 4, 5, 14 };
+static const u8 arm_ptr_regs[] = { 8, 9, 10, 11, 12, 13 };
+static const u8 arm_offset_regs[] = { 6, 7 };
+static const u8 thumb_ptr_regs[] = { 4, 5 };
+static const u8 thumb_offset_regs[] = { 6, 7 };
+static const u8 thumb_hi_dest_regs[] = { 0, 1, 2, 3, 8, 9, 10, 11, 12, 14 };
+
+/* the interpreter is machine 0, the jit machine 1 */
+struct jit_machines {
+	nds_config config[2];
+	std::unique_ptr<nds_ctx> nds[2];
+};
+
+struct cpu_result {
+	u32 gpr[16];
+	u32 cpsr;
+	u32 mode;
+	timestamp cycles;
+	std::string error;
+};
+
+struct test_case {
+	const char *name;
+	int cpuid;
+	bool thumb;
+	u32 addr;
+	std::vector<u32> code;
+	u32 gpr[15];
+	u32 flags;
+	u32 cycles;
+};
+
+static int failures;
+
+template <size_t N>
+static u32
+pick(std::mt19937& rng, const u8 (&regs)[N])
+{
+	return regs[rng() % N];
+}
+
+static u32
+random_reg(std::mt19937& rng)
+{
+	return rng() % 15;
+}
+
+/* a register list for ldm and stm, never empty */
+static u32
+random_reg_list(std::mt19937& rng, u32 allowed)
+{
+	u32 list = 0;
+	while (!list) {
+		list = rng() & allowed;
+	}
+
+	return list;
+}
+
+static u32
+make_arm_alu(std::mt19937& rng)
+{
+	u32 op = rng() % 16;
+	u32 opcode = op << 21 | pick(rng, arm_dest_regs) << 12;
+
+	/* the ops with a carry in or out get most of the cases */
+	if (rng() % 2) {
+		static const u8 carry_ops[] = { 2, 3, 4, 5, 6, 7, 10, 11 };
+		opcode = (opcode & ~(0xF << 21)) | pick(rng, carry_ops) << 21;
+		opcode |= BIT(20);
+	} else if (rng() % 2 || op >> 2 == 2) {
+		opcode |= BIT(20);
+	}
+
+	/* pc can be an operand, except with a shift by a register */
+	if (rng() % 2) {
+		/* a rotated immediate */
+		opcode |= BIT(25) | (rng() % 16) << 16 | (rng() & 0xFFF);
+	} else if (rng() % 4) {
+		/* a register shifted by an immediate */
+		opcode |= (rng() % 16) << 16 | (rng() & 0xFE0) | rng() % 16;
+	} else {
+		/* a register shifted by a register */
+		opcode |= random_reg(rng) << 16 | random_reg(rng) << 8 |
+		          (rng() & 0x60) | BIT(4) | random_reg(rng);
+	}
+
+	return opcode;
+}
+
+static u32
+make_arm_multiply(std::mt19937& rng)
+{
+	if (rng() % 2) {
+		/* mul and mla */
+		return (rng() & 0x300000) | pick(rng, arm_dest_regs) << 16 |
+		       random_reg(rng) << 12 | random_reg(rng) << 8 | 0x90 |
+		       random_reg(rng);
+	}
+
+	/* umull, umlal, smull and smlal to two different registers */
+	u32 hi = pick(rng, arm_dest_regs);
+	u32 lo = hi;
+	while (lo == hi) {
+		lo = pick(rng, arm_dest_regs);
+	}
+
+	return 0x800000 | (rng() & 0x700000) | hi << 16 | lo << 12 |
+	       random_reg(rng) << 8 | 0x90 | random_reg(rng);
+}
+
+static u32
+make_arm_transfer(std::mt19937& rng)
+{
+	bool load = rng() % 2;
+	u32 rn = pick(rng, arm_ptr_regs);
+	u32 rd = load ? pick(rng, arm_dest_regs) : rng() % 16;
+	/* p, u, b and w */
+	u32 opcode = 0x4000000 | (rng() & 0x1E00000) | load << 20 | rn << 16 |
+	             rd << 12;
+
+	if (rng() % 2) {
+		opcode |= rng() & 0xFFF;
+	} else {
+		/* a small register offset, shifted left */
+		opcode |= BIT(25) | (rng() % 4) << 7 |
+		          pick(rng, arm_offset_regs);
+	}
+
+	return opcode;
+}
+
+static u32
+make_arm_halfword_transfer(std::mt19937& rng)
+{
+	bool load = rng() % 2;
+	u32 sh = 1 + rng() % 3;
+	u32 rn = pick(rng, arm_ptr_regs);
+	u32 rd = load ? pick(rng, arm_dest_regs) : random_reg(rng);
+
+	/* ldrd and strd use an even register and the next one */
+	if (!load && sh != 1) {
+		rd = 2 * (rng() % 3);
+	}
+
+	/* p, u, i and w */
+	u32 opcode = (rng() & 0x1E00000) | load << 20 | rn << 16 | rd << 12 |
+	             BIT(7) | sh << 5 | BIT(4);
+	if (opcode & BIT(22)) {
+		opcode |= (rng() & 0xF00) | (rng() & 0xF);
+	} else {
+		opcode |= pick(rng, arm_offset_regs);
+	}
+
+	return opcode;
+}
+
+static u32
+make_arm_block_transfer(std::mt19937& rng)
+{
+	bool load = rng() % 2;
+	u32 allowed = 0x403F;
+	if (!load) {
+		allowed = 0xFFFF;
+	}
+
+	/* p, u and w */
+	return 0x8000000 | (rng() & 0x1A00000) | load << 20 |
+	       pick(rng, arm_ptr_regs) << 16 | random_reg_list(rng, allowed);
+}
+
+/* branches stay in the code area, which is all branches to themselves */
+static u32
+make_arm_branch(std::mt19937& rng)
+{
+	return 0xA000000 | (rng() & BIT(24)) | ((rng() % 64 - 32) & 0xFFFFFF);
+}
+
+static u32
+make_arm_misc(std::mt19937& rng, bool arm9)
+{
+	u32 rd = pick(rng, arm_dest_regs);
+	u32 rm = random_reg(rng);
+	u32 rn = random_reg(rng);
+
+	switch (rng() % (arm9 ? 5 : 2)) {
+	case 0:
+		/* mrs */
+		return 0x10F0000 | rd << 12;
+	case 1:
+		/* swp and swpb */
+		return 0x1000090 | (rng() & BIT(22)) |
+		       pick(rng, arm_ptr_regs) << 16 | rd << 12 | rm;
+	case 2:
+		/* clz */
+		return 0x16F0F10 | rd << 12 | rm;
+	case 3:
+		/* qadd, qsub, qdadd and qdsub */
+		return 0x1000050 | (rng() % 4) << 21 | rn << 16 | rd << 12 |
+		       rm;
+	default:
+		/* smulxy */
+		return 0x1600080 | rd << 16 | random_reg(rng) << 8 |
+		       (rng() & 0x60) | rm;
+	}
+}
+
+static u32
+make_arm_inst(std::mt19937& rng, bool arm9)
+{
+	u32 cond = rng() % 3 ? 0xE : rng() % 15;
+	u32 opcode;
+
+	switch (rng() % 16) {
+	case 0:
+	case 1:
+	case 2:
+	case 3:
+	case 4:
+	case 5:
+		opcode = make_arm_alu(rng);
+		break;
+	case 6:
+		opcode = make_arm_multiply(rng);
+		break;
+	case 7:
+	case 8:
+	case 9:
+		opcode = make_arm_transfer(rng);
+		break;
+	case 10:
+	case 11:
+		opcode = make_arm_halfword_transfer(rng);
+		break;
+	case 12:
+		opcode = make_arm_block_transfer(rng);
+		break;
+	case 13:
+	case 14:
+		opcode = make_arm_branch(rng);
+		break;
+	default:
+		opcode = make_arm_misc(rng, arm9);
+	}
+
+	return cond << 28 | opcode;
+}
+
+static u32
+thumb_dest(std::mt19937& rng)
+{
+	return rng() % 4;
+}
+
+static u32
+make_thumb_load_store(std::mt19937& rng)
+{
+	u32 rb = pick(rng, thumb_ptr_regs);
+
+	switch (rng() % 4) {
+	case 0:
+	{
+		/* register offset, the loads are ops 3 to 7 */
+		u32 op = rng() % 8;
+		u32 rd = op >= 3 ? thumb_dest(rng) : rng() % 8;
+		return 0x5000 | op << 9 | pick(rng, thumb_offset_regs) << 6 |
+		       rb << 3 | rd;
+	}
+	case 1:
+	{
+		/* immediate offset, word, byte and halfword */
+		static const u16 ops[] = { 0x6000, 0x7000, 0x8000 };
+		bool load = rng() % 2;
+		u32 rd = load ? thumb_dest(rng) : rng() % 8;
+		return ops[rng() % 3] | load << 11 | (rng() & 0x7C0) |
+		       rb << 3 | rd;
+	}
+	case 2:
+	{
+		/* sp relative */
+		bool load = rng() % 2;
+		u32 rd = load ? thumb_dest(rng) : rng() % 8;
+		return 0x9000 | load << 11 | rd << 8 | (rng() & 0xFF);
+	}
+	default:
+		/* pc relative */
+		return 0x4800 | thumb_dest(rng) << 8 | (rng() & 0xFF);
+	}
+}
+
+static u32
+make_thumb_inst(std::mt19937& rng, std::vector<u32>& code)
+{
+	switch (rng() % 16) {
+	case 0:
+		/* shifts by an immediate */
+		return (rng() % 3) << 11 | (rng() & 0x7F8) | thumb_dest(rng);
+	case 1:
+		/* add and sub with three operands */
+		return 0x1800 | (rng() & 0x7F8) | thumb_dest(rng);
+	case 2:
+		/* mov, cmp, add and sub with an immediate */
+		return 0x2000 | (rng() & 0x18FF) | thumb_dest(rng) << 8;
+	case 3:
+	case 4:
+	case 5:
+		/* the alu ops, with adc and sbc twice as often */
+		if (rng() % 4 == 0) {
+			return 0x4000 | (rng() % 2 ? 0x140 : 0x180) |
+			       (rng() & 0x38) | thumb_dest(rng);
+		}
+		return 0x4000 | (rng() & 0x3F8) | thumb_dest(rng);
+	case 6:
+	{
+		/* high register add, cmp and mov */
+		u32 op = rng() % 3;
+		u32 rd = op == 1 ? rng() % 16 : pick(rng, thumb_hi_dest_regs);
+		u32 rm = rng() % 16;
+		return 0x4400 | op << 8 | (rd & 8) << 4 | rm << 3 | (rd & 7);
+	}
+	case 7:
+	case 8:
+	case 9:
+		return make_thumb_load_store(rng);
+	case 10:
+		/* add to pc or sp */
+		return 0xA000 | (rng() & 0x8FF) | thumb_dest(rng) << 8;
+	case 11:
+		/* adjust sp, push and pop */
+		switch (rng() % 3) {
+		case 0:
+			return 0xB000 | (rng() & 0xFF);
+		case 1:
+			return 0xB400 | random_reg_list(rng, 0x1FF);
+		default:
+			return 0xBC00 | random_reg_list(rng, 0xF);
+		}
+	case 12:
+	{
+		/* ldmia and stmia */
+		bool load = rng() % 2;
+		u32 list = random_reg_list(rng, load ? 0xF : 0xFF);
+		return 0xC000 | load << 11 | pick(rng, thumb_ptr_regs) << 8 |
+		       list;
+	}
+	case 13:
+		/* conditional branches */
+		return 0xD000 | (rng() % 14) << 8 | ((rng() % 32 - 16) & 0xFF);
+	case 14:
+		return 0xE000 | ((rng() % 64 - 32) & 0x7FF);
+	default:
+		/* a bl pair */
+		code.push_back(0xF000);
+		return 0xF800 | rng() % 32;
+	}
+}
+
+/* the cycles in the result are the ones taken by this run */
+static void
+run_cpu(nds_ctx *nds, int cpuid, u32 cycles, cpu_result *r)
+{
+	timestamp start = nds->arm_cycles[cpuid];
+	nds->arm_target_cycles[cpuid] = start + cycles;
+
+	try {
+		if (cpuid == 0) {
+			nds->arm9->run();
+		} else {
+			nds->arm7->run();
+		}
+	} catch (const twice_exception& e) {
+		r->error = e.what();
+	}
+
+	arm_cpu *cpu = nds->cpu[cpuid];
+	std::memcpy(r->gpr, cpu->gpr, sizeof r->gpr);
+	r->cpsr = arm_get_cpsr(cpu);
+	r->mode = cpu->mode;
+	r->cycles += nds->arm_cycles[cpuid] - start;
+}
+
+static void
+start_case(nds_ctx *nds, const test_case& t)
+{
+	arm_cpu *cpu = nds->cpu[t.cpuid];
+
+	/* the code is written behind the back of the page tracker */
+	invalidate_all_blocks(nds, t.cpuid);
+
+	for (u32 i = 0; i < CODE_SIZE; i += 4) {
+		u32 v = t.thumb ? THUMB_SELF_BRANCH * 0x10001 : ARM_SELF_BRANCH;
+		writearr<u32>(nds->main_ram, i, v);
+	}
+	u32 offset = t.addr - CODE_BASE;
+	for (u32 opcode : t.code) {
+		if (t.thumb) {
+			writearr<u16>(nds->main_ram, offset, opcode);
+			offset += 2;
+		} else {
+			writearr<u32>(nds->main_ram, offset, opcode);
+			offset += 4;
+		}
+	}
+
+	std::mt19937 rng(t.addr ^ t.code[0]);
+	for (u32 i = 0; i < DATA_SIZE; i += 4) {
+		writearr<u32>(nds->main_ram, DATA_BASE - CODE_BASE + i, rng());
+	}
+
+	arm_switch_mode(cpu, arm_cpu::MODE_SYS);
+	std::memcpy(cpu->gpr, t.gpr, sizeof t.gpr);
+	cpu->cpsr = t.flags | (t.thumb ? 0x20 : 0) | 0x1F;
+	arm_set_flags(cpu, t.flags);
+	cpu->interrupt = false;
+
+	if (t.cpuid == 0) {
+		t.thumb ? nds->arm9->thumb_jump(t.addr)
+		        : nds->arm9->arm_jump(t.addr);
+	} else {
+		t.thumb ? nds->arm7->thumb_jump(t.addr)
+		        : nds->arm7->arm_jump(t.addr);
+	}
+}
+
+static void
+print_case(const test_case& t)
+{
+	std::printf("  %s, arm%d %s:", t.name, t.cpuid ? 7 : 9,
+			t.thumb ? "thumb" : "arm");
+	for (u32 opcode : t.code) {
+		std::printf(t.thumb ? " %04X" : " %08X", opcode);
+	}
+	std::printf("\n");
+}
+
+static bool
+compare_results(const cpu_result& a, const cpu_result& b)
+{
+	bool same = true;
+
+	for (int i = 0; i < 16; i++) {
+		if (a.gpr[i] != b.gpr[i]) {
+			std::printf("    r%d: %08X, jit %08X\n", i, a.gpr[i],
+					b.gpr[i]);
+			same = false;
+		}
+	}
+	if (a.cpsr != b.cpsr || a.mode != b.mode) {
+		std::printf("    cpsr: %08X, jit %08X\n", a.cpsr, b.cpsr);
+		same = false;
+	}
+	if (a.cycles != b.cycles) {
+		std::printf("    cycles: %llu, jit %llu\n",
+				(unsigned long long)a.cycles,
+				(unsigned long long)b.cycles);
+		same = false;
+	}
+	if (a.error != b.error) {
+		std::printf("    error: \"%s\", jit \"%s\"\n", a.error.c_str(),
+				b.error.c_str());
+		same = false;
+	}
+
+	return same;
+}
+
+/*
+ * Runs a case on both machines and compares the registers, flags, cycles,
+ * errors and main ram. after runs between the two halves of the case.
+ */
+static bool
+run_case(jit_machines& m, const test_case& t,
+		void (*after)(nds_ctx *nds, int cpuid) = nullptr)
+{
+	cpu_result r[2]{};
+
+	for (int i = 0; i < 2; i++) {
+		nds_ctx *nds = m.nds[i].get();
+		start_case(nds, t);
+		run_cpu(nds, t.cpuid, t.cycles, &r[i]);
+		if (after) {
+			after(nds, t.cpuid);
+			r[i].error.clear();
+			run_cpu(nds, t.cpuid, t.cycles, &r[i]);
+		}
+	}
+
+	nds_ctx *a = m.nds[0].get();
+	nds_ctx *b = m.nds[1].get();
+	bool same_ram = std::memcmp(a->main_ram, b->main_ram,
+	                            MAIN_RAM_SIZE) == 0;
+	if (compare_results(r[0], r[1]) && same_ram) {
+		return true;
+	}
+
+	if (!same_ram) {
+		std::printf("    main ram differs\n");
+		std::memcpy(b->main_ram, a->main_ram, MAIN_RAM_SIZE);
+	}
+	print_case(t);
+	failures++;
+	return false;
+}
+
+static void
+make_random_state(std::mt19937& rng, test_case *t)
+{
+	for (u32 i = 0; i < 15; i++) {
+		switch (rng() % 4) {
+		case 0:
+			t->gpr[i] = DATA_BASE + rng() % DATA_SIZE;
+			break;
+		case 1:
+			t->gpr[i] = rng() % 64;
+			break;
+		default:
+			t->gpr[i] = rng();
+		}
+	}
+
+	auto set_ptr = [&](u32 r) {
+		/* misaligned on purpose, and with room for offsets */
+		t->gpr[r] = DATA_BASE + 0x1000 + rng() % (DATA_SIZE - 0x2000);
+	};
+	if (t->thumb) {
+		for (u32 r : thumb_ptr_regs) set_ptr(r);
+		for (u32 r : thumb_offset_regs) t->gpr[r] = rng() % 0x100;
+		set_ptr(13);
+	} else {
+		for (u32 r : arm_ptr_regs) set_ptr(r);
+		for (u32 r : arm_offset_regs) t->gpr[r] = rng() % 0x100;
+	}
+
+	t->flags = rng() & 0xF0000000;
+}
+
+static void
+check_random_cases(jit_machines& m, int cpuid, bool thumb)
+{
+	int case_failures = 0;
+
+	for (u32 i = 0; i < RANDOM_CASES && case_failures < 8; i++) {
+		std::mt19937 rng(i << 2 | cpuid << 1 | thumb);
+		test_case t{ "random", cpuid, thumb, TEST_ADDR, {}, {}, 0,
+			CASE_CYCLES };
+
+		u32 n = 1 + rng() % MAX_CASE_INSTS;
+		while (t.code.size() < n) {
+			u32 opcode = thumb ? make_thumb_inst(rng, t.code)
+			                   : make_arm_inst(rng, cpuid == 0);
+			t.code.push_back(opcode);
+		}
+		make_random_state(rng, &t);
+
+		if (!run_case(m, t)) {
+			case_failures++;
+		}
+	}
+}
+
+/*
+ * The carry and overflow out of the arithmetic ops, for operands around
+ * the points where they change, and both carries in.
+ */
+static void
+check_carry_flags(jit_machines& m, int cpuid)
+{
+	static const u32 values[] = { 0, 1, 2, 0x7FFFFFFE, 0x7FFFFFFF,
+		0x80000000, 0x80000001, 0xFFFFFFFE, 0xFFFFFFFF };
+	/* sub, rsb, add, adc, sbc, rsc, cmp and cmn */
+	static const u8 arm_ops[] = { 2, 3, 4, 5, 6, 7, 10, 11 };
+	/* sub and add to r0, then adc, sbc, cmp and cmn on r1, and neg */
+	static const u16 thumb_ops[] = { 0x1A88, 0x1888, 0x4151, 0x4191,
+		0x4291, 0x42D1, 0x4250 };
+
+	for (u32 a : values) {
+		for (u32 b : values) {
+			for (u32 flags : { 0u, 0x20000000u, 0xF0000000u }) {
+				test_case t{ "carry flags", cpuid, false,
+					TEST_ADDR, {}, {}, flags, 16 };
+				t.gpr[1] = a;
+				t.gpr[2] = b;
+
+				for (u32 op : arm_ops) {
+					t.thumb = false;
+					t.code = { 0xE0100002 | op << 21 };
+					run_case(m, t);
+				}
+				for (u32 op : thumb_ops) {
+					t.thumb = true;
+					t.code = { op };
+					run_case(m, t);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Errors from the interpreter, and from the loads and stores, must leave
+ * the jit with the registers written back and come out of run.
+ */
+static void
+check_exceptions(jit_machines& m, int cpuid)
+{
+	test_case t{ "exceptions", cpuid, false, TEST_ADDR, {}, {}, 0, 64 };
+	for (u32 i = 0; i < 15; i++) {
+		t.gpr[i] = i;
+	}
+
+	/* adds, then bkpt, which the interpreter does not implement */
+	t.code = { 0xE2800001, 0xE2800001, 0xE1200070 };
+	run_case(m, t);
+	t.thumb = true;
+	t.code = { 0x3001, 0x3001, 0xBE00 };
+	run_case(m, t);
+
+	if (cpuid == 0) {
+		/* an invalid vramcnt c, which the store path throws on */
+		t.thumb = false;
+		t.gpr[1] = 0x87;
+		t.gpr[8] = 0x4000242;
+		t.code = { 0xE2800001, 0xE5C81000 };
+		run_case(m, t);
+		t.thumb = true;
+		t.gpr[4] = 0x4000242;
+		t.code = { 0x3001, 0x7021 };
+		run_case(m, t);
+	}
+
+	/* and the machine keeps working after them */
+	t.thumb = false;
+	t.code = { 0xE2800001, 0xE2800001 };
+	run_case(m, t);
+}
+
+/*
+ * A branch at 0x2000000 to 0x2001000, and one back. The jit links the
+ * blocks after they run once. Rewriting the second block must unlink it,
+ * so that the first block runs the new code.
+ */
+static void
+rewrite_second_block(nds_ctx *nds, int cpuid)
+{
+	/* add r2, r2, #2, instead of #1 */
+	if (cpuid == 0) {
+		bus9_write<u32>(nds, 0x2001000, 0xE2822002);
+	} else {
+		bus7_write<u32>(nds, 0x2001000, 0xE2822002);
+	}
+}
+
+template <typename CPUT>
+static bool
+is_block_linked(CPUT *cpu, u32 addr)
+{
+	auto *block = lookup_block(cpu->blocks, addr, false);
+	return block && !block->jit_links.empty();
+}
+
+static void
+check_links(jit_machines& m, int cpuid)
+{
+	test_case t{ "links", cpuid, false, CODE_BASE, {}, {}, 0, 2000 };
+
+	/* add r1, r1, #1; b 0x2001000 */
+	t.code = { 0xE2811001, 0xEA0003FD };
+	t.code.resize(0x1000 / 4, ARM_SELF_BRANCH);
+	/* add r2, r2, #1; b 0x2000000 */
+	t.code.push_back(0xE2822001);
+	t.code.push_back(0xEAFFFBFD);
+
+	auto *nds = m.nds[1].get();
+	start_case(nds, t);
+	cpu_result r{};
+	run_cpu(nds, cpuid, t.cycles, &r);
+	bool linked = cpuid == 0 ? is_block_linked(nds->arm9.get(), 0x2001000)
+	                         : is_block_linked(nds->arm7.get(), 0x2001000);
+	if (!linked) {
+		std::printf("  links, arm%d: the blocks were not linked\n",
+				cpuid ? 7 : 9);
+		failures++;
+	}
+
+	run_case(m, t, rewrite_second_block);
+
+	/*
+	 * A store to an instruction further on in its own block, which the
+	 * interpreter has not fetched yet.
+	 */
+	t.name = "self-modifying code";
+	t.cycles = 200;
+	t.gpr[1] = 0xE3A03005;
+	t.gpr[8] = 0x2000010;
+	t.code = { 0xE5881000, 0xE2800001, 0xE2800001, 0xE2800001,
+		0xE3A03001 };
+	run_case(m, t);
+}
+
+int
+check_jit(const bench_options&)
+{
+#ifdef TWICE_HAVE_JIT
+	jit_machines m;
+	m.config[1].use_jit = true;
+	for (int i = 0; i < 2; i++) {
+		m.nds[i] = bench_create_nds_ctx(&m.config[i]);
+	}
+
+	failures = 0;
+	for (int cpuid = 0; cpuid < 2; cpuid++) {
+		check_carry_flags(m, cpuid);
+		check_exceptions(m, cpuid);
+		check_links(m, cpuid);
+		check_random_cases(m, cpuid, false);
+		check_random_cases(m, cpuid, true);
+	}
+
+	std::printf("%s\n", failures ? "FAILED" : "ok");
+	return failures != 0;
+#else
+	std::printf("the jit is not available, skipped\n");
+	return 0;
+#endif
+}
+
+} // namespace twice
@@ -0,0 +1,127 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#  include <sched.h>
+#endif
+
+using namespace twice;
+
+struct bench_entry {
+	const char *name;
+	const char *description;
+	int (*fn)(const bench_options& opts);
+};
+
+static const bench_entry benches[] = {
+	{ "cpu", "run a load/alu/store loop on both cpus", bench_cpu },
+	{ "geometry", "run matrix, vertex and lighting commands",
+			bench_geometry },
+	{ "render3d", "rasterize synthetic 3d scenes", bench_render3d },
+	{ "scheduler", "dispatch events with both cpus idle",
+			bench_scheduler },
+};
+
+/* checks are not timed, and return nonzero on failure */
+static const bench_entry checks[] = {
+	{ "compositor-avx2", "compare the avx2 and scalar 2d compositor",
+			check_compositor },
+	{ "geometry-avx2", "compare the avx2 and scalar geometry math",
+			check_geometry },
+	{ "jit", "compare the jit with the interpreter", check_jit },
+	{ "spans", "compare the avx2 and scalar 3d spans", check_spans },
+	{ "tracker", "check dirty tracking and page watches",
+			check_tracker },
+};
+
+static void
+print_usage()
+{
+	std::printf("usage: twice-bench [-r runs] [-c core] <name>...\n\n");
+	std::printf("  -r <runs>   number of timed runs (default 10)\n");
+	std::printf("  -c <core>   run pinned to a cpu core\n\n");
+	for (const auto& b : benches) {
+		std::printf("  %-16s%s\n", b.name, b.description);
+	}
+	std::printf("\nchecks:\n");
+	for (const auto& b : checks) {
+		std::printf("  %-16s%s\n", b.name, b.description);
+	}
+}
+
+static bool
+pin_to_core(int core)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	return sched_setaffinity(0, sizeof set, &set) == 0;
+#else
+	(void)core;
+	return false;
+#endif
+}
+
+int
+main(int argc, char **argv)
+{
+	bench_options opts;
+	int first = 1;
+
+	for (; first + 1 < argc && argv[first][0] == '-'; first += 2) {
+		const char *arg = argv[first + 1];
+		if (std::strcmp(argv[first], "-r") == 0) {
+			opts.runs = std::max(1, std::atoi(arg));
+		} else if (std::strcmp(argv[first], "-c") == 0) {
+			if (!pin_to_core(std::atoi(arg))) {
+				std::fprintf(stderr, "cannot pin to %s\n", arg);
+				return 1;
+			}
+		} else {
+			break;
+		}
+	}
+
+	if (first >= argc) {
+		print_usage();
+		return 1;
+	}
+
+	int ret = 0;
+	for (int i = first; i < argc; i++) {
+		const bench_entry *bench = nullptr;
+		bool check = false;
+		for (const auto& b : benches) {
+			if (std::strcmp(argv[i], b.name) == 0) {
+				bench = &b;
+			}
+		}
+		for (const auto& b : checks) {
+			if (std::strcmp(argv[i], b.name) == 0) {
+				bench = &b;
+				check = true;
+			}
+		}
+		if (!bench) {
+			std::fprintf(stderr, "unknown benchmark: %s\n",
+					argv[i]);
+			print_usage();
+			return 1;
+		}
+
+		if (check) {
+			std::printf("%s\n", bench->name);
+		} else {
+			std::printf("%s (%d runs)\n", bench->name,
+					opts.runs);
+		}
+		ret |= bench->fn(opts);
+	}
+
+	return ret;
+}
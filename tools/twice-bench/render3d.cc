@@ -0,0 +1,269 @@
+#include "bench.h"
+
+#include "common/cpu.h"
+#include "nds/gpu/3d/re.h"
+#include "nds/mem/io.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+namespace twice {
+
+enum : int {
+	SCENE_FRAMES = 8,
+	CHECK_FRAMES = 64,
+};
+
+struct scene_params {
+	const char *name;
+	u32 num_polys;
+	s32 min_radius;
+	s32 max_radius;
+	bool textured;
+};
+
+static const scene_params scenes[] = {
+	{ "2048 small polygons", 2048, 2, 14, false },
+	{ "2048 small textured polygons", 2048, 2, 14, true },
+	{ "300 mixed polygons", 300, 4, 160, true },
+	{ "empty frames", 0, 0, 1, false },
+};
+
+static void
+fill_vram(nds_ctx *nds)
+{
+	powcnt1_write(nds, 0x20F);
+
+	/* textures in vram a to d and palettes in vram e */
+	vramcnt_a_write(nds, 0x83);
+	vramcnt_b_write(nds, 0x8B);
+	vramcnt_c_write(nds, 0x93);
+	vramcnt_d_write(nds, 0x9B);
+	vramcnt_e_write(nds, 0x83);
+
+	std::mt19937 rng(1234);
+	for (auto& x : nds->vram.vram_a) x = rng();
+	for (auto& x : nds->vram.vram_b) x = rng();
+	for (auto& x : nds->vram.vram_c) x = rng();
+	for (auto& x : nds->vram.vram_d) x = rng();
+	for (auto& x : nds->vram.vram_e) x = rng();
+	nds->vram.texture_changed = true;
+	nds->vram.texture_palette_changed = true;
+}
+
+/*
+ * Fills the polygon and vertex ram of the rendering engine with random
+ * regular polygons, with random attributes, modes and textures.
+ */
+static void
+make_scene(nds_ctx *nds, const scene_params& s, u32 seed)
+{
+	auto& re = nds->gpu3d.re;
+	auto *vr = re.vtx_ram;
+	auto *pr = re.poly_ram;
+	std::mt19937 rng(seed);
+	u32 nv = 0;
+
+	re.enabled = true;
+	pr->count = 0;
+	for (u32 i = 0; i < s.num_polys; i++) {
+		u32 n = s.max_radius > 16 && rng() % 8 == 0 ? 3 + rng() % 8
+		                                             : 3;
+		if (nv + n > vr->vtxs.size()) {
+			break;
+		}
+
+		s32 cx = rng() % 256;
+		s32 cy = rng() % 192;
+		s32 r = s.min_radius + rng() % (s.max_radius - s.min_radius);
+		double a0 = (rng() % 1000) / 1000.0 * 6.28;
+		double dir = rng() & 1 ? 6.28 : -6.28;
+
+		polygon& p = pr->polys[pr->count++];
+		p = {};
+		for (u32 k = 0; k < n; k++) {
+			vertex& v = vr->vtxs[nv++];
+			v = {};
+			double a = a0 + dir * k / n;
+			v.sx = std::clamp<s32>(cx + r * std::cos(a), 0, 255);
+			v.sy = std::clamp<s32>(cy + r * std::sin(a), 0, 191);
+			for (auto& x : v.attr) {
+				x = rng() % 0x400;
+			}
+			v.attr[3] = (s32)(rng() % 0x4000) - 0x2000;
+			v.attr[4] = (s32)(rng() % 0x4000) - 0x2000;
+			p.vtxs[k] = &v;
+			p.w[k] = rng() % 4 == 0 && k ? p.w[0]
+			                             : 1 + rng() % 0xFFFF;
+			p.z[k] = rng() % 0x1000000;
+		}
+		p.num_vtxs = n;
+		p.backface = rng() & 1;
+		p.wbuffering = rng() % 4 == 0;
+
+		u32 alpha = rng() % 3 == 0 ? rng() % 32 : 31;
+		u32 mode = rng() % 4;
+		u32 id = rng() % 8 == 0 ? 0 : rng() % 64;
+		p.attr = id << 24 | alpha << 16 | mode << 4 | (rng() & 0xC800);
+		p.translucent = alpha != 31 && alpha != 0;
+
+		/* 32 textures of 16 to 128 texels a side */
+		std::mt19937 tr(rng() % 32);
+		u32 format = 1 + tr() % 7;
+		p.tx_param = (tr() & 0xC00FFFF) | (2 + tr() % 3) << 20 |
+		             (2 + tr() % 3) << 23 | format << 26 |
+		             (tr() & 1) << 29 | (rng() & 0xF) << 16;
+		p.pltt_base = tr() & 0x1FFF;
+	}
+	vr->count = nv;
+
+	re.manual_sort = rng() & 1;
+	re.r.disp3dcnt = (rng() & 0x4FFE) | s.textured;
+	re.r.clear_color = rng();
+	re.r.clear_depth = rng() & 0x7FFF;
+	re.r.clrimage_offset = rng();
+	for (auto& x : re.r._toon_table) x = rng();
+	for (auto& x : re.r._edge_color) x = rng();
+	for (auto& x : re.r.fog_table) x = rng() & 0x7F;
+	re.r.fog_color = rng();
+	re.r.fog_offset = rng() & 0x7FFF;
+	re.r.alpha_test_ref = rng() & 0x1F;
+}
+
+/*
+ * Hashes the colors, depths and attributes of both layers, each as one
+ * 256x192 array, then the stencil buffer.
+ */
+static u32
+hash_frame(const rendering_engine& re, u32 h)
+{
+	for (int l = 0; l < 2; l++) {
+		for (const auto& line : re.pixels) {
+			for (const auto& px : line) {
+				h = bench_hash(&px.color[l], 4, h);
+			}
+		}
+		for (const auto& line : re.pixels) {
+			for (const auto& px : line) {
+				h = bench_hash(&px.depth[l], 4, h);
+			}
+		}
+		for (const auto& line : re.pixels) {
+			for (const auto& px : line) {
+				h = bench_hash(&px.attr[l], 4, h);
+			}
+		}
+	}
+
+	return bench_hash(&re.stencil_buf, sizeof re.stencil_buf, h);
+}
+
+/*
+ * Renders the frames of a scene, and returns the time taken. The hash of
+ * all frames goes to hash.
+ */
+static double
+render_scene(nds_ctx *nds, const scene_params& s, u32 *hash)
+{
+	auto& re = nds->gpu3d.re;
+	double t = 0;
+	u32 h = 2166136261;
+
+	for (int i = 0; i < SCENE_FRAMES; i++) {
+		make_scene(nds, s, i);
+		double start = bench_now();
+		re_render_frame(&re);
+		re_wait_for_frame(&re);
+		t += bench_now() - start;
+		h = hash_frame(re, h);
+	}
+
+	*hash = h;
+	return t;
+}
+
+int
+bench_render3d(const bench_options& opts)
+{
+	constexpr size_t NUM_SCENES = std::size(scenes);
+	nds_config config;
+	auto nds = bench_create_nds_ctx(&config);
+	fill_vram(nds.get());
+
+	std::vector<double> times[NUM_SCENES];
+	u32 hashes[NUM_SCENES]{};
+	int ret = 0;
+
+	for (int run = 0; run < opts.runs; run++) {
+		for (size_t i = 0; i < NUM_SCENES; i++) {
+			u32 h;
+			times[i].push_back(render_scene(nds.get(), scenes[i],
+					&h));
+			if (run != 0 && h != hashes[i]) {
+				std::printf("%s: the frames differ between "
+				            "runs\n",
+						scenes[i].name);
+				ret = 1;
+			}
+			hashes[i] = h;
+		}
+	}
+
+	for (size_t i = 0; i < NUM_SCENES; i++) {
+		bench_report(scenes[i].name, times[i], SCENE_FRAMES, 1e3,
+				"ms/frame");
+	}
+	for (size_t i = 0; i < NUM_SCENES; i++) {
+		std::printf("%-32s hash %08X\n", scenes[i].name, hashes[i]);
+	}
+
+	return ret;
+}
+
+int
+check_spans(const bench_options&)
+{
+#ifdef TWICE_HAVE_AVX2
+	if (!cpu_has_avx2()) {
+		std::printf("avx2 is not available, skipped\n");
+		return 0;
+	}
+
+	nds_config config;
+	auto nds = bench_create_nds_ctx(&config);
+	auto& re = nds->gpu3d.re;
+	fill_vram(nds.get());
+
+	/* renders every frame with the avx2 and the scalar spans */
+	int failures = 0;
+	for (const auto& s : scenes) {
+		for (u32 i = 0; i < CHECK_FRAMES; i++) {
+			u32 h[2];
+			for (int avx2 = 0; avx2 < 2; avx2++) {
+				set_use_avx2(avx2);
+				make_scene(nds.get(), s, i);
+				re_render_frame(&re);
+				re_wait_for_frame(&re);
+				h[avx2] = hash_frame(re, 2166136261);
+			}
+			if (h[0] != h[1]) {
+				std::printf("  %s, frame %u: scalar %08X, "
+				            "avx2 %08X\n",
+						s.name, i, h[0], h[1]);
+				failures++;
+			}
+		}
+	}
+	set_use_avx2(true);
+
+	std::printf("%s\n", failures ? "FAILED" : "ok");
+	return failures != 0;
+#else
+	std::printf("avx2 is not available, skipped\n");
+	return 0;
+#endif
+}
+
+} // namespace twice
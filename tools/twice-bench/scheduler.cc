@@ -0,0 +1,66 @@
+#include "bench.h"
+
+#include <cstdio>
+
+namespace twice {
+
+enum : u32 {
+	SCHEDULER_FRAMES = 60,
+	ARM9_CYCLES_PER_FRAME = 560190,
+};
+
+static double
+run_slices(u64 *slices)
+{
+	nds_config cfg{};
+	auto ctx = bench_create_nds_ctx(&cfg);
+	nds_ctx *nds = ctx.get();
+
+	/* a few timers that never expire, like a typical game */
+	for (int cpuid = 0; cpuid < 2; cpuid++) {
+		for (int timer = 0; timer < 2; timer++) {
+			int id = get_timer_update_event_id(cpuid, timer);
+			schedule_event(nds, id, (timestamp)1 << 40);
+		}
+	}
+
+	timestamp end = (timestamp)SCHEDULER_FRAMES * ARM9_CYCLES_PER_FRAME;
+	*slices = 0;
+
+	double start = bench_now();
+	while (nds->arm_cycles[0] < end) {
+		timestamp t = get_next_event_time(nds);
+		nds->arm_cycles[0] = nds->arm_target_cycles[0] = t;
+		nds->arm_cycles[1] = nds->arm_target_cycles[1] = t >> 1;
+		run_system_events(nds);
+		run_cpu_events(nds, 0);
+		run_cpu_events(nds, 1);
+		(*slices)++;
+	}
+
+	return bench_now() - start;
+}
+
+/*
+ * Runs the slice loop of the scheduler with both cpus idle, so only event
+ * dispatch is timed: the hblank events fire and four timers are enabled.
+ */
+int
+bench_scheduler(const bench_options& opts)
+{
+	std::vector<double> times;
+	u64 slices = 0;
+
+	for (int i = 0; i < opts.runs; i++) {
+		times.push_back(run_slices(&slices));
+	}
+
+	std::printf("%lu slices per run\n", (unsigned long)slices);
+	bench_report("dispatch per frame", times, SCHEDULER_FRAMES, 1e6,
+			"us");
+	bench_report("dispatch per slice", times, slices, 1e9, "ns");
+
+	return 0;
+}
+
+} // namespace twice
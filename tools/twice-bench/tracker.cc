@@ -0,0 +1,155 @@
+#include "bench.h"
+
+#include "nds/arm/arm7.h"
+#include "nds/arm/arm9.h"
+#include "nds/mem/bus.h"
+
+#include <cstdio>
+
+namespace twice {
+
+struct watch_log {
+	int calls{};
+	int page{ -1 };
+	const u8 *p{};
+	u32 value{};
+};
+
+static int failures;
+
+static void
+expect(bool cond, const char *mode, const char *what)
+{
+	if (!cond) {
+		std::printf("  %s: %s\n", mode, what);
+		failures++;
+	}
+}
+
+static void
+on_watch(void *data, int page, const u8 *p)
+{
+	auto *log = (watch_log *)data;
+	log->calls++;
+	log->page = page;
+	log->p = p;
+	log->value = readarr<u32>(p, 0);
+}
+
+static void
+check_dirty_tracking(nds_ctx *nds, const char *mode)
+{
+	auto *t = &nds->tracker;
+	auto *arm9 = nds->arm9.get();
+	auto *arm7 = nds->arm7.get();
+
+	expect(!t->active, mode, "a page is tracked after init");
+
+	start_dirty_tracking(t);
+	arm9->store32n(0x2000010, 1);
+	expect(is_page_dirty(t, 0), mode, "arm9 store not tracked");
+	expect(!is_page_dirty(t, 1), mode, "untouched page is dirty");
+
+	/* mirrors share the page */
+	clear_page_dirty(t, 0);
+	arm9->store8n(0x2400020, 2);
+	expect(is_page_dirty(t, 0), mode, "store to a mirror not tracked");
+
+	/* the arm7 bus pages cover four tracked pages */
+	arm7->store16n(0x2006002, 3);
+	expect(is_page_dirty(t, 6), mode, "arm7 store not tracked");
+	expect(!is_page_dirty(t, 4), mode, "arm7 store marked the wrong page");
+
+	bus9_write<u32>(nds, 0x2008000, 4);
+	expect(is_page_dirty(t, 8), mode, "bus store not tracked");
+
+	u32 values[4] = { 5, 6, 7, 8 };
+	arm7->store_multiple(0x2013FF8, 4, values);
+	expect(is_page_dirty(t, 0x13) && is_page_dirty(t, 0x14), mode,
+			"arm7 store multiple not tracked");
+
+	int wram_page = get_tracked_page(t, nds->arm7_wram + 0xF000);
+	arm7->store32n(0x380F000, 9);
+	expect(is_page_dirty(t, wram_page), mode,
+			"arm7 wram store not tracked");
+
+	/* 16 KiB of dtcm at 0x800000 */
+	cp15_write(arm9, 0x910, 0x0080000A);
+	cp15_write(arm9, 0x100, arm9->ctrl_reg | BIT(16));
+	int dtcm_page = get_tracked_page(t, arm9->dtcm + 0x1000);
+	arm9->store32n(0x801000, 10);
+	expect(is_page_dirty(t, dtcm_page), mode, "dtcm store not tracked");
+	expect(readarr<u32>(arm9->dtcm, 0x1000) == 10, mode,
+			"dtcm store went elsewhere");
+
+	/* a cleared page is rearmed, the others stay dirty */
+	clear_page_dirty(t, 0);
+	expect(!is_page_dirty(t, 0), mode, "page still dirty after clear");
+	expect(is_page_dirty(t, 8), mode, "clear changed another page");
+	arm9->store32n(0x2000100, 11);
+	expect(is_page_dirty(t, 0), mode, "cleared page not rearmed");
+
+	stop_dirty_tracking(t);
+	expect(!t->active, mode, "a page is tracked after stopping");
+	clear_page_dirty(t, 0);
+	arm9->store32n(0x2000100, 12);
+	expect(!is_page_dirty(t, 0), mode, "page dirtied after stopping");
+}
+
+static void
+check_page_watch(nds_ctx *nds, const char *mode)
+{
+	auto *t = &nds->tracker;
+	watch_log log;
+
+	/* a watch without a callback is ignored */
+	set_page_watch(t, 10, true);
+	nds->arm9->store32n(0x200A004, 1);
+
+	set_watch_callback(t, on_watch, &log);
+	nds->arm9->store32n(0x200A008, 0x12345678);
+	expect(log.calls == 1, mode, "watched store not reported");
+	expect(log.page == 10, mode, "wrong watched page");
+	expect(log.p == nds->main_ram + 0xA008, mode, "wrong watched pointer");
+	expect(log.value == 0x12345678, mode, "watch ran before the store");
+
+	nds->arm9->store32n(0x200B000, 2);
+	nds->arm7->store32n(0x2009FFC, 3);
+	expect(log.calls == 1, mode, "store to another page reported");
+
+	nds->arm7->store16n(0x200A000, 4);
+	expect(log.calls == 2 && log.p == nds->main_ram + 0xA000, mode,
+			"arm7 watched store not reported");
+
+	set_page_watch(t, 10, false);
+	nds->arm9->store32n(0x200A00C, 5);
+	expect(log.calls == 2, mode, "store reported after unwatching");
+	expect(!t->active, mode, "a page is tracked after unwatching");
+	set_watch_callback(t, nullptr, nullptr);
+}
+
+int
+check_tracker(const bench_options&)
+{
+	struct {
+		const char *name;
+		bool fastmem;
+	} modes[] = {
+		{ "page tables", false },
+		{ "fastmem", true },
+	};
+
+	failures = 0;
+	for (auto& mode : modes) {
+		nds_config config;
+		config.use_fastmem = mode.fastmem;
+		auto nds = bench_create_nds_ctx(&config);
+		check_dirty_tracking(nds.get(), mode.name);
+		check_page_watch(nds.get(), mode.name);
+	}
+
+	std::printf("%s\n", failures ? "FAILED" : "ok");
+	return failures != 0;
+}
+
+} // namespace twice